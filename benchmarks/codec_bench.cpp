@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/codec.h>
+
+#include <benchmark/benchmark.h>
+
+namespace
+{
+
+using namespace usbip;
+
+auto make_cmd_submit(seqnum_t seqnum, INT32 length)
+{
+        usbip_header hdr{};
+
+        auto &b = hdr.base;
+        b.command = USBIP_CMD_SUBMIT;
+        b.seqnum = seqnum;
+        b.devid = 0x10002;
+        b.direction = USBIP_DIR_IN;
+        b.ep = 3;
+
+        auto &r = hdr.u.cmd_submit;
+        r.transfer_buffer_length = length;
+        r.number_of_packets = number_of_packets_non_isoch;
+        r.interval = 4;
+
+        return hdr;
+}
+
+/*
+ * CMD_SUBMIT is built in host byte order and swapped as a whole.
+ */
+void swap_header(benchmark::State &state)
+{
+        seqnum_t num = 0;
+
+        for (auto _: state) {
+                auto hdr = make_cmd_submit(make_seqnum(++num, true), 512);
+                byteswap_header(hdr, swap_dir::host2net);
+                benchmark::DoNotOptimize(hdr);
+        }
+}
+BENCHMARK(swap_header);
+
+/*
+ * The per-endpoint template in network byte order is copied and patched, @see make_cmd_submit_template.
+ */
+void patch_template(benchmark::State &state)
+{
+        auto tmpl = make_cmd_submit(0, 0);
+        byteswap_header(tmpl, swap_dir::host2net);
+        benchmark::DoNotOptimize(tmpl);
+
+        seqnum_t num = 0;
+
+        for (auto _: state) {
+                auto hdr = tmpl;
+                hdr.base.seqnum = bswap(make_seqnum(++num, true));
+                hdr.u.cmd_submit.transfer_buffer_length = INT32(bswap(UINT32(512)));
+                benchmark::DoNotOptimize(hdr);
+        }
+}
+BENCHMARK(patch_template);
+
+void validate_ret_submit(benchmark::State &state)
+{
+        usbip_header ret{};
+        ret.base.command = USBIP_RET_SUBMIT;
+        ret.base.seqnum = make_seqnum(1, true);
+        ret.u.ret_submit.actual_length = 512;
+        ret.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+        byteswap_header(ret, swap_dir::host2net);
+
+        for (auto _: state) {
+                auto hdr = ret;
+                benchmark::DoNotOptimize(hdr);
+                byteswap_header(hdr, swap_dir::net2host);
+                benchmark::DoNotOptimize(validate_ret_header(hdr));
+        }
+}
+BENCHMARK(validate_ret_submit);
+
+} // namespace
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/frame_clock.h>
+#include <usbip/histogram.h>
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr INT64 FREQ = 10'000'000; // QueryPerformanceFrequency
+constexpr INT64 USEC = FREQ/1'000'000;
+
+/*
+ * Jitter harness: the server's frame counter, isoch URBs of 8 packets back to back and RET_SUBMIT-s
+ * delayed by the simulated network. The error of the clock is measured when each URB is completed,
+ * the results are reported as counters, the time is the cost of sync() and frame().
+ *
+ * @param range(0) mean one-way delay, microseconds
+ * @param range(1) standard deviation of the delay, microseconds
+ */
+void jitter(benchmark::State &state)
+{
+        const UINT32 frames = 8;
+        const UINT32 server_offset = 123'456;
+
+        std::mt19937 gen(1);
+        std::normal_distribution<double> delay(double(state.range(0)), double(state.range(1)));
+
+        frame_clock c;
+        c.init(FREQ);
+
+        latency_histogram err{}; // absolute error, frames
+        INT64 done = 0; // the server completed the transfer, microseconds
+        INT64 cnt = 0;
+
+        for (auto _: state) {
+                done += frames*1000;
+
+                auto d = delay(gen);
+                auto received = done + (d > 0 ? INT64(d) : 0); // microseconds
+                auto rtt = 2*(received - done);
+
+                c.sync(UINT32(done/1000) - frames + server_offset, frames, (received - rtt)*USEC, received*USEC);
+
+                if (++cnt > 100) { // the clock has converged
+                        auto server = done*USEC; // at this moment the server's frame is exactly known
+                        auto e = INT32(c.frame(server) - UINT32(done/1000 + server_offset));
+                        record(err, UINT64(e < 0 ? -e : e));
+                }
+        }
+
+        state.counters["err_p50"] = double(get_percentile(err, 50)); // frames
+        state.counters["err_p99"] = double(get_percentile(err, 99));
+        state.counters["jitter_us"] = c.jitter_us();
+        state.counters["lead"] = c.lead();
+        state.counters["resyncs"] = c.resyncs();
+}
+BENCHMARK(jitter)->Args({500, 0})->Args({500, 100})->Args({2000, 500})->Args({10000, 3000});
+
+} // namespace
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/histogram.h>
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Latencies in 100 ns units, log-normal around 1 ms.
+ */
+auto make_values()
+{
+        std::mt19937 gen(1);
+        std::lognormal_distribution<double> d(9.2, 1);
+
+        std::vector<UINT64> v(4096);
+        for (auto &i: v) {
+                i = UINT64(d(gen));
+        }
+
+        return v;
+}
+
+void record_latency(benchmark::State &state)
+{
+        auto values = make_values();
+        latency_histogram h{};
+
+        for (auto _: state) {
+                for (auto v: values) {
+                        record(h, v);
+                }
+                benchmark::DoNotOptimize(h);
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()*values.size()));
+}
+BENCHMARK(record_latency);
+
+void percentile(benchmark::State &state)
+{
+        latency_histogram h{};
+        for (auto v: make_values()) {
+                record(h, v);
+        }
+
+        for (auto _: state) {
+                benchmark::DoNotOptimize(get_percentile(h, 99));
+        }
+}
+BENCHMARK(percentile);
+
+} // namespace
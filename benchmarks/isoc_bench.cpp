@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/isoc.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct packet // USBD_ISO_PACKET_DESCRIPTOR
+{
+        UINT32 Offset;
+        UINT32 Length;
+        UINT32 Status;
+};
+
+constexpr UINT32 PACKET_SIZE = 3*1024; // high-bandwidth high speed endpoint
+
+auto make_packets(UINT32 cnt)
+{
+        std::vector<packet> v(cnt);
+        for (UINT32 i = 0; i < cnt; ++i) {
+                v[i].Offset = i*PACKET_SIZE;
+        }
+        return v;
+}
+
+void set_packets_processed(benchmark::State &state, UINT32 cnt)
+{
+        state.SetItemsProcessed(int64_t(state.iterations()*cnt));
+}
+
+/*
+ * Descriptors are built and swapped in one pass, @see repack.
+ * @param range(0) number of packets
+ */
+void pack_fused(benchmark::State &state)
+{
+        auto cnt = UINT32(state.range(0));
+        auto src = make_packets(cnt);
+        std::vector<usbip_iso_packet_descriptor> d(cnt);
+
+        for (auto _: state) {
+                benchmark::DoNotOptimize(isoc::pack(d.data(), src.data(), cnt, cnt*PACKET_SIZE));
+                benchmark::ClobberMemory();
+        }
+
+        set_packets_processed(state, cnt);
+}
+BENCHMARK(pack_fused)->Arg(8)->Arg(64)->Arg(USBIP_MAX_ISO_PACKETS);
+
+/*
+ * The algorithm before isoc::pack, descriptors are built in host byte order and swapped by the second pass.
+ */
+void pack_then_byteswap(benchmark::State &state)
+{
+        auto cnt = UINT32(state.range(0));
+        auto src = make_packets(cnt);
+        std::vector<usbip_iso_packet_descriptor> d(cnt);
+        auto buf_len = cnt*PACKET_SIZE;
+
+        for (auto _: state) {
+                for (UINT32 i = 0; i < cnt; ++i) {
+                        auto offset = src[i].Offset;
+                        auto next_offset = i + 1 < cnt ? src[i + 1].Offset : buf_len;
+
+                        if (!(next_offset >= offset && next_offset <= buf_len)) {
+                                state.SkipWithError("invalid offset");
+                                return;
+                        }
+
+                        d[i] = { .offset = offset, .length = next_offset - offset, .actual_length = 0, .status = 0 };
+                }
+
+                byteswap(d.data(), cnt);
+                benchmark::ClobberMemory();
+        }
+
+        set_packets_processed(state, cnt);
+}
+BENCHMARK(pack_then_byteswap)->Arg(8)->Arg(64)->Arg(USBIP_MAX_ISO_PACKETS);
+
+/*
+ * RET_SUBMIT of IN transfer: compacted data at the beginning of the buffer, descriptors in network byte order.
+ */
+struct ret_submit
+{
+        std::vector<usbip_iso_packet_descriptor> d;
+        std::string data;
+        UINT32 actual_length{};
+};
+
+auto make_ret_submit(UINT32 cnt, int short_percent)
+{
+        std::mt19937 gen(short_percent);
+        ret_submit r;
+
+        for (UINT32 i = 0; i < cnt; ++i) {
+                auto len = int(gen() % 100) < short_percent ? UINT32(gen() % PACKET_SIZE) : PACKET_SIZE;
+                r.d.push_back({ .offset = i*PACKET_SIZE, .length = PACKET_SIZE, .actual_length = len, .status = 0 });
+                r.actual_length += len;
+        }
+
+        byteswap(r.d.data(), cnt);
+        r.data.assign(r.actual_length, 'x');
+
+        return r;
+}
+
+/*
+ * The algorithm of fill_isoc_data before isoc::expander.
+ */
+class per_packet
+{
+public:
+        explicit per_packet(void *buffer) : m_buf(static_cast<char*>(buffer)) {}
+
+        void add(UINT32 src, UINT32 dst, UINT32 len)
+        {
+                if (src != dst) {
+                        memmove(m_buf + dst, m_buf + src, len);
+                }
+        }
+
+        void flush() {}
+private:
+        char *m_buf;
+};
+
+/*
+ * The copy of the compacted data into the transfer buffer is a part of each iteration.
+ * @param range(0) percent of short packets
+ */
+template<typename Expander>
+void expand(benchmark::State &state)
+{
+        const UINT32 cnt = USBIP_MAX_ISO_PACKETS/4;
+        auto r = make_ret_submit(cnt, int(state.range(0)));
+        std::string buf(cnt*PACKET_SIZE, '\0');
+
+        for (auto _: state) {
+                memcpy(buf.data(), r.data.data(), r.actual_length);
+
+                Expander exp(buf.data());
+                auto length = r.actual_length;
+
+                for (auto i = cnt; i--; ) {
+                        auto d = isoc::to_host(r.d[i]);
+                        if (!d.actual_length) {
+                                continue;
+                        }
+                        if (isoc::get_unpack_error(d, d.offset, length, UINT32(buf.size())) != isoc::unpack_error::none) {
+                                state.SkipWithError("unpack error");
+                                return;
+                        }
+                        exp.add(length, d.offset, d.actual_length);
+                }
+
+                exp.flush();
+                benchmark::ClobberMemory();
+        }
+
+        set_packets_processed(state, cnt);
+}
+BENCHMARK_TEMPLATE(expand, isoc::expander)->Arg(0)->Arg(1)->Arg(10)->Arg(50)->Arg(100);
+BENCHMARK_TEMPLATE(expand, per_packet)->Arg(0)->Arg(1)->Arg(10)->Arg(50)->Arg(100);
+
+} // namespace
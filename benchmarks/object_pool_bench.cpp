@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/object_pool.h>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+/*
+ * object_pool as wsk_context.cpp uses it. Each thread is a device that takes and returns objects in bursts,
+ * as URBs are sent and completed. The global lookaside list is modelled by a pool that is shared by all threads.
+ * The free list is guarded by std::mutex instead of SLIST_HEADER, the difference is the sharing
+ * of a cache line between CPUs, not the kind of lock.
+ */
+namespace
+{
+
+using namespace usbip;
+
+constexpr auto CACHE_LINE = 64; // SYSTEM_CACHE_ALIGNMENT_SIZE
+constexpr size_t BURST = 32; // URBs in flight
+
+enum : UINT32 { POOL_MAX_CAPACITY = 64 }; // wsk_context.cpp
+
+struct pool;
+
+struct alignas(CACHE_LINE) object
+{
+        object *next; // pool::free
+        pool *owner;
+        char hdr[48]; // usbip_header
+};
+
+struct alignas(CACHE_LINE) pool
+{
+        std::mutex mtx; // for free
+        object *free{};
+        std::atomic<long> refs{1};
+        std::atomic<long> fallbacks{};
+        pool_slab<object> *slabs{};
+        UINT32 capacity{};
+};
+
+struct traits
+{
+        using pool_type = pool;
+        using object_type = object;
+
+        static object* pop_free(pool &p)
+        {
+                std::lock_guard lck(p.mtx);
+                auto obj = p.free;
+                if (obj) {
+                        p.free = obj->next;
+                }
+                return obj;
+        }
+
+        static void push_free(pool &p, object &obj)
+        {
+                std::lock_guard lck(p.mtx);
+                obj.next = p.free;
+                p.free = &obj;
+        }
+
+        static void add_ref(pool &p) { p.refs.fetch_add(1, std::memory_order_relaxed); }
+        static bool release_ref(pool &p) { return p.refs.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+        static void add_fallback(pool &p) { p.fallbacks.fetch_add(1, std::memory_order_relaxed); }
+        static auto get_pool(const object &obj) { return obj.owner; }
+        static void free_pool(pool&) {}
+};
+
+using object_pool_t = object_pool<traits, POOL_MAX_CAPACITY>;
+using slab = object_pool_t::slab_type;
+
+pool g_shared;
+pool g_devices[64];
+
+void add_slab(pool &p, UINT32 cnt)
+{
+        cnt = object_pool_t::get_slab_count(p.capacity, cnt);
+        if (!cnt) {
+                return;
+        }
+
+        auto s = new (std::align_val_t(alignof(slab))) char[slab::get_size(cnt)]{};
+        auto &sl = *reinterpret_cast<slab*>(s);
+
+        object_pool_t::add_slab(p, sl, cnt);
+
+        for (UINT32 i = 0; i < cnt; ++i) {
+                auto &obj = sl.objects()[i];
+                obj.owner = &p;
+                object_pool_t::push_new(p, obj);
+        }
+}
+
+void free_slabs(pool &p)
+{
+        for (auto s = p.slabs; s; ) {
+                auto next = s->next;
+                operator delete[](reinterpret_cast<char*>(s), std::align_val_t(alignof(slab)));
+                s = next;
+        }
+
+        p.free = nullptr;
+        p.slabs = nullptr;
+        p.capacity = 0;
+        p.fallbacks = 0;
+}
+
+/*
+ * As alloc_wsk_context and free do, a fallback is allocated from the heap.
+ */
+void run(benchmark::State &state, pool *p)
+{
+        object *burst[BURST];
+
+        for (auto _: state) {
+                for (auto &obj: burst) {
+                        obj = p ? object_pool_t::pop(*p) : nullptr;
+                        if (!obj) {
+                                obj = new object{};
+                        }
+                        obj->hdr[0] = 1; // the header is written by the sender
+                }
+
+                for (auto obj: burst) {
+                        if (!object_pool_t::push(*obj)) {
+                                delete obj;
+                        }
+                }
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()*BURST));
+
+        if (p) {
+                state.counters["fallbacks"] = benchmark::Counter(double(p->fallbacks), benchmark::Counter::kAvgThreads);
+        }
+}
+
+/*
+ * Called once before the threads of a run are started, each device adds two slabs as endpoint_add does.
+ */
+void setup(const benchmark::State &state)
+{
+        for (int i = 0; i < 2; ++i) {
+                add_slab(g_shared, POOL_MAX_CAPACITY/2);
+        }
+
+        for (int t = 0; t < state.threads(); ++t) {
+                for (int i = 0; i < 2; ++i) {
+                        add_slab(g_devices[t], POOL_MAX_CAPACITY/2);
+                }
+        }
+}
+
+void teardown(const benchmark::State&)
+{
+        free_slabs(g_shared);
+
+        for (auto &d: g_devices) {
+                free_slabs(d);
+        }
+}
+
+/*
+ * All devices share one pool, a burst of every device is BURST, so it runs out of objects with many threads.
+ */
+void shared_pool(benchmark::State &state)
+{
+        run(state, &g_shared);
+}
+BENCHMARK(shared_pool)->Setup(setup)->Teardown(teardown)->ThreadRange(1, 16)->UseRealTime();
+
+void per_device_pool(benchmark::State &state)
+{
+        run(state, &g_devices[state.thread_index()]);
+}
+BENCHMARK(per_device_pool)->Setup(setup)->Teardown(teardown)->ThreadRange(1, 16)->UseRealTime();
+
+/*
+ * A device without a pool, every object is allocated.
+ */
+void no_pool(benchmark::State &state)
+{
+        run(state, nullptr);
+}
+BENCHMARK(no_pool)->ThreadRange(1, 16)->UseRealTime();
+
+} // namespace
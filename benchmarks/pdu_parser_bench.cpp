@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/pdu_parser.h>
+#include <usbip/codec.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * RET_SUBMIT-s of IN transfers in network byte order.
+ */
+auto make_stream(size_t bytes, INT32 payload)
+{
+        std::string s;
+
+        for (seqnum_t num = 1; s.size() < bytes; ++num) {
+                usbip_header hdr{};
+                hdr.base.command = USBIP_RET_SUBMIT;
+                hdr.base.seqnum = make_seqnum(num, true);
+                hdr.u.ret_submit.actual_length = payload;
+                hdr.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+
+                byteswap_header(hdr, swap_dir::host2net);
+                s.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+                s.append(payload, 'x');
+        }
+
+        return s;
+}
+
+/*
+ * Copies payloads to a transfer buffer as wsk_receive does.
+ */
+struct handler
+{
+        char buf[64*1024];
+        size_t pdus{};
+
+        bool on_header(usbip_header &hdr, size_t &payload_size, bool &drain)
+        {
+                byteswap_header(hdr, swap_dir::net2host);
+                if (validate_ret_header(hdr) != header_error::none) {
+                        return false;
+                }
+
+                payload_size = get_payload_size(hdr);
+                drain = payload_size > sizeof(buf);
+                return true;
+        }
+
+        bool on_payload(size_t offset, const void *data, size_t len)
+        {
+                memcpy(buf + offset, data, len);
+                return true;
+        }
+
+        bool on_pdu() { return ++pdus; }
+};
+
+/*
+ * @param range(0) size of the chunks which are received from the network
+ * @param range(1) size of the payload of each RET_SUBMIT
+ */
+void parse_stream(benchmark::State &state)
+{
+        auto chunk = size_t(state.range(0));
+        auto s = make_stream(4*1024*1024, INT32(state.range(1)));
+
+        auto h = std::make_unique<handler>();
+        size_t pdus = 0;
+
+        for (auto _: state) {
+                pdu_parser p{};
+                h->pdus = 0;
+
+                for (size_t off = 0; off < s.size(); off += chunk) {
+                        if (!p.parse(s.data() + off, std::min(chunk, s.size() - off), *h)) {
+                                state.SkipWithError("parse error");
+                                return;
+                        }
+                }
+
+                pdus += h->pdus;
+        }
+
+        state.SetBytesProcessed(int64_t(state.iterations()*s.size()));
+        state.counters["pdus"] = benchmark::Counter(double(pdus), benchmark::Counter::kIsRate);
+}
+BENCHMARK(parse_stream)->ArgsProduct({{1460, 64*1024}, {64, 512, 16*1024}});
+
+} // namespace
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/seqnum_table.h>
+
+#include <benchmark/benchmark.h>
+
+#include <list>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct request
+{
+        seqnum_t seqnum;
+};
+
+enum : UINT32 { INFLIGHT_SIZE = 4096 }; // device_ctx::INFLIGHT_SIZE
+using table = seqnum_table<request, INFLIGHT_SIZE>;
+
+/*
+ * Requests complete in random order, a completed one is replaced by a new one.
+ * @return the order of completions
+ */
+auto make_completions(size_t in_flight, size_t cnt)
+{
+        std::mt19937 gen(in_flight);
+        std::vector<size_t> v(cnt);
+
+        for (auto &i: v) {
+                i = gen() % in_flight;
+        }
+
+        return v;
+}
+
+/*
+ * RET_SUBMIT looks up the request by seqnum, removes it and the next CMD_SUBMIT inserts a new one.
+ * @param range(0) requests in flight
+ */
+void hash_table(benchmark::State &state)
+{
+        auto n = size_t(state.range(0));
+        auto order = make_completions(n, 64*1024);
+
+        std::vector<request> reqs(n);
+        auto t = std::make_unique<request*[]>(INFLIGHT_SIZE);
+        seqnum_t num = 0;
+
+        for (auto &r: reqs) {
+                r.seqnum = make_seqnum(++num, true);
+                table::insert(t.get(), &r);
+        }
+
+        for (auto _: state) {
+                for (auto i: order) {
+                        auto &r = reqs[i];
+                        auto pos = table::find(t.get(), r.seqnum);
+                        benchmark::DoNotOptimize(pos);
+                        table::erase(t.get(), pos);
+
+                        r.seqnum = make_seqnum(++num, true);
+                        table::insert(t.get(), &r);
+                }
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()*order.size()));
+}
+BENCHMARK(hash_table)->Arg(10)->Arg(100)->Arg(1000);
+
+/*
+ * The list of sent requests that the driver scanned before the inflight table.
+ */
+void list_scan(benchmark::State &state)
+{
+        auto n = size_t(state.range(0));
+        auto order = make_completions(n, 64*1024);
+
+        std::vector<request> reqs(n);
+        std::list<request*> lst;
+        seqnum_t num = 0;
+
+        for (auto &r: reqs) {
+                r.seqnum = make_seqnum(++num, true);
+                lst.push_back(&r);
+        }
+
+        for (auto _: state) {
+                for (auto i: order) {
+                        auto &r = reqs[i];
+                        auto seqnum = r.seqnum;
+                        auto it = lst.begin();
+                        for ( ; (*it)->seqnum != seqnum; ++it);
+                        lst.erase(it);
+
+                        r.seqnum = make_seqnum(++num, true);
+                        lst.push_back(&r);
+                }
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()*order.size()));
+}
+BENCHMARK(list_scan)->Arg(10)->Arg(100)->Arg(1000);
+
+} // namespace
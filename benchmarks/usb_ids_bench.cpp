@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <libusbip/src/usb_ids.h>
+#include <libusbip/src/usb_ids_table.h>
+
+#include <benchmark/benchmark.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+using namespace usbip;
+
+const std::string& get_text()
+{
+        static auto s = []
+        {
+                std::ifstream f(USBIP_USB_IDS, std::ios::binary);
+                std::ostringstream os;
+                os << f.rdbuf();
+                return std::move(os).str();
+        }();
+
+        return s;
+}
+
+/*
+ * @param range(0) the binary table if non-zero, otherwise the text of usb.ids
+ */
+std::string_view get_content(const benchmark::State &state)
+{
+        return state.range(0) ? usb_ids::get_table() : get_text();
+}
+
+/*
+ * The time of UsbIds construction at startup.
+ */
+void load(benchmark::State &state)
+{
+        auto s = get_content(state);
+
+        for (auto _: state) {
+                UsbIds ids(s);
+                benchmark::DoNotOptimize(ids);
+        }
+
+        state.SetBytesProcessed(int64_t(state.iterations()*s.size()));
+        state.SetLabel(state.range(0) ? "table" : "text");
+}
+BENCHMARK(load)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+void find_product(benchmark::State &state)
+{
+        UsbIds ids(get_content(state));
+        const std::pair<uint16_t, uint16_t> v[] { {0x1d6b, 0x0002}, {0x8086, 0x1234}, {0x046d, 0xc52b}, {0xffff, 1} };
+
+        for (auto _: state) {
+                for (auto [vid, pid]: v) {
+                        benchmark::DoNotOptimize(ids.find_product(vid, pid));
+                }
+        }
+
+        state.SetItemsProcessed(int64_t(state.iterations()*std::size(v)));
+}
+BENCHMARK(find_product)->Arg(0)->Arg(1);
+
+void find_class_subclass_proto(benchmark::State &state)
+{
+        UsbIds ids(get_content(state));
+
+        for (auto _: state) {
+                benchmark::DoNotOptimize(ids.find_class_subclass_proto(3, 1, 2));
+        }
+}
+BENCHMARK(find_class_subclass_proto)->Arg(0)->Arg(1);
+
+/*
+ * The first call builds the search index, it is not measured.
+ */
+void find_by_name(benchmark::State &state)
+{
+        UsbIds ids(get_text());
+        benchmark::DoNotOptimize(ids.find_by_name("hub"));
+
+        for (auto _: state) {
+                benchmark::DoNotOptimize(ids.find_by_name("logitech"));
+        }
+}
+BENCHMARK(find_by_name)->Unit(benchmark::kMicrosecond);
+
+} // namespace
@@ -249,6 +249,10 @@ const char *device_control_name(ULONG ioctl_code)
 	case vhci::ioctl::PLUGOUT_HARDWARE: return "vhci_plugout_hardware";
 	case vhci::ioctl::GET_IMPORTED_DEVICES: return "vhci_get_imported_devices";
 	case vhci::ioctl::DRIVER_REGISTRY_PATH: return "vhci_driver_registry_path";
+	case vhci::ioctl::GET_DEVICE_STATS: return "vhci_get_device_stats";
+	case vhci::ioctl::GET_ENDPOINT_LATENCY: return "vhci_get_endpoint_latency";
+	case vhci::ioctl::SET_CAPTURE: return "vhci_set_capture";
+	case vhci::ioctl::GET_CAPTURE: return "vhci_get_capture";
 
 	case IOCTL_USB_DIAG_IGNORE_HUBS_ON: return "USB_DIAG_IGNORE_HUBS_ON";
 	case IOCTL_USB_DIAG_IGNORE_HUBS_OFF: return "USB_DIAG_IGNORE_HUBS_OFF";
@@ -135,3 +135,73 @@ MDL *usbip::tail(_In_opt_ MDL *mdl)
         for ( ; mdl && mdl->Next; mdl = mdl->Next);
         return mdl;
 }
+
+MDL *usbip::seek(_In_opt_ MDL *mdl, _Inout_ size_t &offset)
+{
+        for ( ; mdl; mdl = mdl->Next) {
+                if (size_t sz = MmGetMdlByteCount(mdl); offset < sz) {
+                        break;
+                } else {
+                        offset -= sz;
+                }
+        }
+
+        return mdl;
+}
+
+/*
+ * Copy data into a chain of MDLs starting from the offset.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::copy(_In_opt_ MDL *dst, _In_ size_t offset, _In_ const void *src, _In_ size_t len)
+{
+        auto from = static_cast<const char*>(src);
+
+        for (auto mdl = seek(dst, offset); mdl && len; mdl = mdl->Next, offset = 0) {
+
+                auto to = (char*)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+                if (!to) {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                auto cnt = MmGetMdlByteCount(mdl) - offset;
+                if (cnt > len) {
+                        cnt = len;
+                }
+
+                RtlCopyMemory(to + offset, from, cnt);
+
+                from += cnt;
+                len -= cnt;
+        }
+
+        return len ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+}
+
+/*
+ * Copy data from a chain of MDLs starting from the offset.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+size_t usbip::copy(_Out_writes_bytes_(len) void *dst, _In_ size_t len, _In_opt_ MDL *src, _In_ size_t offset)
+{
+        auto to = static_cast<char*>(dst);
+        size_t done = 0;
+
+        for (auto mdl = seek(src, offset); mdl && done < len; mdl = mdl->Next, offset = 0) {
+
+                auto from = (char*)MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute);
+                if (!from) {
+                        break;
+                }
+
+                auto cnt = MmGetMdlByteCount(mdl) - offset;
+                if (cnt > len - done) {
+                        cnt = len - done;
+                }
+
+                RtlCopyMemory(to + done, from + offset, cnt);
+                done += cnt;
+        }
+
+        return done;
+}
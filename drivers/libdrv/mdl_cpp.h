@@ -14,6 +14,21 @@ enum class memory { nonpaged, paged, stack = paged };
 MDL *tail(_In_opt_ MDL *mdl);
 size_t size(_In_opt_ const MDL *mdl);
 
+/*
+ * @param offset in the chain, will be relative to the returned MDL
+ * @return MDL of the chain that contains the offset or NULL
+ */
+MDL *seek(_In_opt_ MDL *mdl, _Inout_ size_t &offset);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS copy(_In_opt_ MDL *dst, _In_ size_t offset, _In_ const void *src, _In_ size_t len);
+
+/*
+ * @return number of bytes copied from the chain, it is less than len if the chain is shorter
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+size_t copy(_Out_writes_bytes_(len) void *dst, _In_ size_t len, _In_opt_ MDL *src, _In_ size_t offset);
+
 class Mdl
 {
 public:
@@ -1,32 +1,7 @@
 #include "usbd_helper.h"
+#include <usbip\codec.h>
 
-/*
- * Linux error codes.
- * See: include/uapi/asm-generic/errno-base.h, include/uapi/asm-generic/errno.h
- */
-enum {
-	ENOENT_LNX = 2,
-	ENXIO_LNX = 6,
-	ENOMEM_LNX = 12,
-	EBUSY_LNX = 16,
-	EXDEV_LNX = 18,
-	ENODEV_LNX = 19,
-	EINVAL_LNX = 22,
-	ENOSPC_LNX = 28,
-	EPIPE_LNX = 32,
-	ETIME_LNX = 62,
-	ENOSR_LNX = 63,
-	ECOMM_LNX = 70,
-	EPROTO_LNX = 71,
-	EOVERFLOW_LNX = 75,
-	EILSEQ_LNX = 84,
-	ECONNRESET_LNX = 104,
-	ESHUTDOWN_LNX = 108,
-	ETIMEDOUT_LNX = 110,
-	EHOSTUNREACH_LNX = 113,
-	EINPROGRESS_LNX = 115,
-	EREMOTEIO_LNX = 121,
-};
+using namespace usbip;
 
 /*
  * Status can be from usb_submit_urb or urb->status, we cannot know its origin.
@@ -142,14 +117,6 @@ int to_linux_status(USBD_STATUS status)
 	return -err;
 }
 
-/*
-* <linux/usb.h>, urb->transfer_flags
-*/
-enum {
-	URB_SHORT_NOT_OK = 0x0001, // report short reads as errors
-	URB_ISO_ASAP = 0x0002      // iso-only; use the first unexpired slot in the schedule
-};
-
  /*
  TransferFlags
  Specifies zero, one, or a combination of the following flags: 
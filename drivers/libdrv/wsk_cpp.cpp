@@ -73,7 +73,7 @@ public:
         auto operator ->() const { return m_irp; }
 
         _IRQL_requires_max_(APC_LEVEL)
-        PAGED NTSTATUS wait_for_completion(_Inout_ NTSTATUS &status);
+        PAGED NTSTATUS wait_for_completion(_Inout_ NTSTATUS &status, _In_opt_ LARGE_INTEGER *timeout = nullptr);
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
         void reset();
@@ -140,14 +140,28 @@ NTSTATUS irp_cls::completion(_In_ DEVICE_OBJECT*, _In_ IRP *irp, _In_ void *cont
         return StopCompletion;
 }
 
+/*
+ * If timeout expires, the IRP is cancelled and STATUS_IO_TIMEOUT is returned.
+ * IRP must be completed anyway before it can be reused.
+ */
 _IRQL_requires_max_(APC_LEVEL)
-PAGED NTSTATUS irp_cls::wait_for_completion(_Inout_ NTSTATUS &status)
+PAGED NTSTATUS irp_cls::wait_for_completion(_Inout_ NTSTATUS &status, _In_opt_ LARGE_INTEGER *timeout)
 {
         PAGED_CODE();
         NT_ASSERT(*this);
 
-        if (status == STATUS_PENDING) {
+        if (status != STATUS_PENDING) {
+                return status;
+        }
+
+        if (KeWaitForSingleObject(&m_event, Executive, KernelMode, false, timeout) == STATUS_TIMEOUT) {
+                IoCancelIrp(m_irp);
                 NT_VERIFY(!KeWaitForSingleObject(&m_event, Executive, KernelMode, false, nullptr));
+
+                if (status = m_irp->IoStatus.Status; status == STATUS_CANCELLED) {
+                        status = STATUS_IO_TIMEOUT;
+                }
+        } else {
                 status = m_irp->IoStatus.Status;
         }
 
@@ -311,7 +325,9 @@ PAGED auto getsockopt(_In_ SOCKET *sock, int level, int optname, void *optval, s
 }
 
 _IRQL_requires_max_(APC_LEVEL)
-PAGED auto transfer(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _Out_ SIZE_T &actual, _In_ bool send)
+PAGED auto transfer(
+        _In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _Out_ SIZE_T &actual, _In_ bool send,
+        _In_opt_ LARGE_INTEGER *timeout = nullptr)
 {
         PAGED_CODE();
         NT_ASSERT(sock);
@@ -333,7 +349,7 @@ PAGED auto transfer(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _
         irp->reset();
 
         auto st = sock->invoke(cnt, func, sock->Self, buffer, flags, irp->get());
-        irp->wait_for_completion(st);
+        irp->wait_for_completion(st, timeout);
 
         actual = NT_SUCCESS(st) ? (*irp)->IoStatus.Information : 0;
         return st;
@@ -397,7 +413,9 @@ PAGED NTSTATUS wsk::send(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG fla
 }
 
 _IRQL_requires_max_(APC_LEVEL)
-PAGED NTSTATUS wsk::receive(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _Out_opt_ SIZE_T *actual)
+PAGED NTSTATUS wsk::receive(
+        _In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _Out_opt_ SIZE_T *actual,
+        _In_opt_ LARGE_INTEGER *timeout)
 {
         PAGED_CODE();
 
@@ -406,7 +424,7 @@ PAGED NTSTATUS wsk::receive(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG
         }
 
         SIZE_T received = 0;
-        auto st = transfer(sock, buffer, flags, received, false);
+        auto st = transfer(sock, buffer, flags, received, false, timeout);
 
         if (actual) {
                 *actual = received;
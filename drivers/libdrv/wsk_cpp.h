@@ -70,8 +70,13 @@ PAGED NTSTATUS getremoteaddr(_In_ SOCKET *sock, _Out_ SOCKADDR *RemoteAddress);
 _IRQL_requires_max_(APC_LEVEL)
 PAGED NTSTATUS send(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags = 0);
 
+/*
+ * @param timeout see KeWaitForSingleObject, STATUS_IO_TIMEOUT is returned if it expires
+ */
 _IRQL_requires_max_(APC_LEVEL)
-PAGED NTSTATUS receive(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags = 0, _Out_opt_ SIZE_T *actual = nullptr);
+PAGED NTSTATUS receive(
+        _In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags = 0, _Out_opt_ SIZE_T *actual = nullptr,
+        _In_opt_ LARGE_INTEGER *timeout = nullptr);
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS send(_In_ SOCKET *sock, _In_ WSK_BUF *buffer, _In_ ULONG flags, _In_ IRP *irp);
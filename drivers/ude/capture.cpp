@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "capture.h"
+#include "trace.h"
+#include "capture.tmh"
+
+#include "driver.h"
+#include <libdrv\mdl_cpp.h>
+
+namespace
+{
+
+using namespace usbip;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto read(_In_ volatile LONG64 &v)
+{
+        return InterlockedOr64(&v, 0);
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::enable_capture(_Inout_ device_ctx &dev, _In_ bool enable)
+{
+        PAGED_CODE();
+
+        if (enable && !dev.capture) {
+                auto r = (capture_ring*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, sizeof(capture_ring), pooltag);
+                if (!r) {
+                        Trace(TRACE_LEVEL_ERROR, "Can't allocate capture ring, %Iu bytes", sizeof(*r));
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID*>(&dev.capture), r, nullptr)) {
+                        ExFreePoolWithTag(r, pooltag); // concurrent call has set it
+                }
+        }
+
+        static_assert(sizeof(dev.capturing) == sizeof(CHAR));
+        InterlockedExchange8(PCHAR(&dev.capturing), enable);
+
+        TraceDbg("dev %04x, %!BOOLEAN!", ptr04x(get_handle(&dev)), enable);
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::free_capture(_Inout_ device_ctx &dev)
+{
+        dev.capturing = false;
+
+        if (auto &r = dev.capture) {
+                ExFreePoolWithTag(r, pooltag);
+                r = nullptr;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+capture_ptr usbip::capture_begin(
+        _Inout_ device_ctx &dev, _In_ capture_dir dir, _In_ const usbip_header &hdr, _In_ size_t length, 
+        _In_ LONGLONG timestamp)
+{
+        if (!dev.capturing) {
+                return {};
+        }
+
+        auto &r = *dev.capture;
+        auto idx = InterlockedIncrement64(&r.head) - 1;
+
+        auto &s = r.slots[idx & (r.SIZE - 1)];
+        InterlockedExchange64(&s.seq, 0);
+
+        auto &rec = s.rec;
+        rec.timestamp = timestamp;
+        rec.length = static_cast<UINT32>(length);
+        rec.captured = 0;
+        rec.dir = dir;
+        rec.reserved = 0;
+        rec.hdr = hdr;
+
+        return { .slot = &s, .seq = idx + 1 };
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_payload(_Inout_ capture_ptr &ptr, _In_ size_t offset, _In_ const void *data, _In_ size_t len)
+{
+        if (!ptr) {
+                return;
+        }
+
+        auto &rec = ptr.slot->rec;
+        if (offset != rec.captured || offset >= CAPTURE_PAYLOAD) {
+                return;
+        }
+
+        if (auto avail = CAPTURE_PAYLOAD - offset; len > avail) {
+                len = avail;
+        }
+
+        RtlCopyMemory(rec.payload + offset, data, len);
+        rec.captured += static_cast<UINT16>(len);
+}
+
+/*
+ * If the ring wraps while a record is being written, the slot can be reused by another writer.
+ * The record is committed only if the slot was not taken, the reader drops it anyway
+ * because of unexpected seq.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_end(_Inout_ capture_ptr &ptr)
+{
+        if (ptr) {
+                InterlockedCompareExchange64(&ptr.slot->seq, ptr.seq, 0);
+                ptr = {};
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::capture_send(
+        _Inout_ device_ctx &dev, _In_ const usbip_header &hdr, _In_ size_t length, _In_ MDL *pdu, 
+        _In_ LONGLONG timestamp)
+{
+        auto ptr = capture_begin(dev, CAPTURE_OUT, hdr, length, timestamp);
+        if (!ptr) {
+                return;
+        }
+
+        if (auto payload = length - sizeof(hdr)) {
+                auto &rec = ptr.slot->rec;
+                auto len = payload < CAPTURE_PAYLOAD ? payload : CAPTURE_PAYLOAD;
+                rec.captured = static_cast<UINT16>(copy(rec.payload, len, pdu, sizeof(hdr)));
+        }
+
+        capture_end(ptr);
+}
+
+/*
+ * A record that is being written stops reading, it will be read next time.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::read_capture(
+        _Inout_ device_ctx &dev, _Out_writes_to_(max_cnt, cnt) capture_record *dst, _In_ ULONG max_cnt, 
+        _Out_ ULONG &cnt, _Out_ UINT64 &lost)
+{
+        cnt = 0;
+        lost = 0;
+
+        auto r = dev.capture;
+        if (!r) {
+                return STATUS_SUCCESS; // capture was never enabled
+        }
+
+        if (InterlockedCompareExchange(&r->reading, true, false)) {
+                return STATUS_DEVICE_BUSY;
+        }
+
+        auto head = read(r->head);
+        auto &tail = r->tail;
+
+        if (head - tail > r->SIZE) {
+                r->lost += head - tail - r->SIZE;
+                tail = head - r->SIZE;
+        }
+
+        for ( ; tail < head && cnt < max_cnt; ++tail) {
+
+                auto &s = r->slots[tail & (r->SIZE - 1)];
+                auto seq = read(s.seq);
+
+                if (!seq || seq <= tail) { // is being written
+                        break;
+                } else if (seq != tail + 1) { // overwritten
+                        ++r->lost;
+                        continue;
+                }
+
+                dst[cnt] = s.rec;
+
+                if (read(s.seq) == seq) {
+                        ++cnt;
+                } else { // overwritten while it was copied
+                        ++r->lost;
+                }
+        }
+
+        lost = r->lost;
+        InterlockedExchange(&r->reading, false);
+
+        return STATUS_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+#include <usbip\capture.h>
+
+namespace usbip
+{
+
+struct capture_slot
+{
+        volatile LONG64 seq; // index of the record plus one if it is complete, zero while it is being written
+        capture_record rec;
+};
+
+/*
+ * Lock-free ring of captured PDUs, multiple writers and a single reader.
+ * Writers never wait, the oldest records are overwritten if the reader is late.
+ */
+struct capture_ring
+{
+        enum : ULONG { SIZE = 2048 }; // must be a power of two
+
+        alignas(SYSTEM_CACHE_ALIGNMENT_SIZE) volatile LONG64 head; // index of the next record to write
+
+        alignas(SYSTEM_CACHE_ALIGNMENT_SIZE) LONG64 tail; // index of the next record to read
+        UINT64 lost; // overwritten before they were read
+        volatile LONG reading; // a reader is active
+
+        capture_slot slots[SIZE];
+};
+
+/*
+ * A record that is being written.
+ */
+struct capture_ptr
+{
+        capture_slot *slot;
+        LONG64 seq;
+
+        explicit operator bool() const { return slot; }
+        auto operator !() const { return !slot; }
+};
+
+/*
+ * The ring is allocated on the first call and lives until the device is destroyed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS enable_capture(_Inout_ device_ctx &dev, _In_ bool enable);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_capture(_Inout_ device_ctx &dev);
+
+/*
+ * @param hdr in network byte order
+ * @param length of PDU, header and payload
+ * @return null if capture is disabled
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+capture_ptr capture_begin(
+        _Inout_ device_ctx &dev, _In_ capture_dir dir, _In_ const usbip_header &hdr, _In_ size_t length, 
+        _In_ LONGLONG timestamp);
+
+/*
+ * Appends a part of the payload if it follows the captured data.
+ * @param offset relative to the start of the payload
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_payload(_Inout_ capture_ptr &ptr, _In_ size_t offset, _In_ const void *data, _In_ size_t len);
+
+/*
+ * Makes the record visible to the reader, does nothing if ptr is null.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_end(_Inout_ capture_ptr &ptr);
+
+/*
+ * @param pdu chain of MDLs that starts with usbip_header
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void capture_send(
+        _Inout_ device_ctx &dev, _In_ const usbip_header &hdr, _In_ size_t length, _In_ MDL *pdu, 
+        _In_ LONGLONG timestamp);
+
+/*
+ * @param lost records that were overwritten before they were read
+ * @return number of records copied or error
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS read_capture(
+        _Inout_ device_ctx &dev, _Out_writes_to_(max_cnt, cnt) capture_record *dst, _In_ ULONG max_cnt, 
+        _Out_ ULONG &cnt, _Out_ UINT64 &lost);
+
+} // namespace usbip
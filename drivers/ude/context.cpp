@@ -13,21 +13,19 @@
 
  /*
   * First bit is reserved for direction of transfer (USBIP_DIR_OUT|USBIP_DIR_IN).
-  * @see is_valid_seqnum
+  * @see make_seqnum
   */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 seqnum_t usbip::next_seqnum(_Inout_ device_ctx &dev, _In_ bool dir_in)
 {
-	static_assert(!USBIP_DIR_OUT);
-	static_assert(USBIP_DIR_IN);
-
 	auto &seqnum = dev.seqnum;
 	static_assert(sizeof(seqnum) == sizeof(LONG));
 
 	while (true) {
-		if (seqnum_t num = InterlockedIncrement(reinterpret_cast<LONG*>(&seqnum)) << 1) {
-			return num |= seqnum_t(dir_in);
+		if (auto num = make_seqnum(InterlockedIncrement(reinterpret_cast<LONG*>(&seqnum)), dir_in);
+		    is_valid_seqnum(num)) {
+			return num;
 		}
 	}
 }
@@ -9,6 +9,10 @@
 #include <libdrv\wdf_cpp.h>
 
 #include <usbip\proto.h>
+#include <usbip\codec.h>
+#include <usbip\stats.h>
+#include <usbip\frame_clock.h>
+#include <usbip\isoc.h>
 
 #include <wdfusb.h>
 #include <UdeCx.h>
@@ -62,7 +66,11 @@ inline auto get_handle(_In_ vhci_ctx *ctx)
 }
 
 struct wsk_context;
+struct wsk_context_pool;
 struct device_ctx;
+struct request_ctx;
+struct capture_ring;
+struct request_part;
 
 /*
  * Context extention for device_ctx. 
@@ -91,6 +99,37 @@ struct device_ctx_ext
         vhci::imported_device_properties dev; // for ioctl::get_imported_devices
 };
 
+/*
+ * Descriptors returned by GET_DESCRIPTOR, the key is (type, index, langid, length).
+ * @see descriptor_cache.h
+ */
+struct descriptor_cache
+{
+        struct entry
+        {
+                UCHAR type;
+                UCHAR index;
+                USHORT langid;
+                USHORT length; // wLength of the request
+                USHORT size; // of data, can be less than length
+                void *data; // NonPagedPoolNx, null if entry is free
+        };
+
+        enum { SIZE = 32 };
+        entry entries[SIZE];
+        ULONG next; // entry to replace if there are no free ones
+        ULONG generation; // incremented by clear_descriptor_cache
+
+        WDFSPINLOCK lock; // for all members
+        UINT64 hits;
+        UINT64 misses;
+};
+
+/*
+ * Counters of a CPU occupy separate cache lines.
+ */
+struct alignas(SYSTEM_CACHE_ALIGNMENT_SIZE) cpu_stats_counters : stats_counters {};
+
 /*
  * Context space for UDECXUSBDEVICE - emulated USB device.
  */
@@ -107,13 +146,38 @@ struct device_ctx
         UDECXUSBENDPOINT ep0; // default control pipe
         WDFSPINLOCK endpoint_list_lock; // for endpoint_ctx::entry
 
-        WDFSPINLOCK send_lock; // for WskSend on sock()
+        WDFSPINLOCK send_lock; // for send_pending, sending, sent_*
+
+        // send aggregator, PDUs that are submitted while a batch is in flight are sent by the next batch
+        LIST_ENTRY send_pending; // head for wsk_context::entry
+        WDFWORKITEM send_batch;
+        bool sending; // a batch is in flight
+        LONGLONG batch_sending; // performance counter before WskSend of the batch in flight
+        latency_histogram send_latency; // from WskSend to its completion
+        ULONG batch_max_bytes;
+        ULONG batch_max_pdus;
+        UINT64 sent_batches; // batching factor is sent_pdus/sent_batches
+        UINT64 sent_pdus;
 
         LIST_ENTRY egress_requests; // that are waiting for WskSend completion handler, head for request_ctx::entry
-        WDFSPINLOCK egress_requests_lock;
+        WDFSPINLOCK egress_requests_lock; // also for inflight and endpoint_ctx::pending
+
+        enum : ULONG { INFLIGHT_SIZE = 4096 }; // must be a power of two
+        request_part **inflight; // of requests from egress_requests and endpoint_ctx::pending, @see usbip\seqnum_table.h
+
+        descriptor_cache descriptors;
 
-        WDFQUEUE queue; // requests that are waiting for USBIP_RET_SUBMIT from a server
-        KEVENT queue_purged;
+        cpu_stats_counters *stats; // NonPagedPoolNxCacheAligned, per-CPU, @see counters.h
+        ULONG stats_cpus; // number of elements in stats
+
+        capture_ring *capture; // NonPagedPoolNxCacheAligned, @see capture.h
+        volatile bool capturing;
+
+        wsk_context_pool *wsk_pool; // preallocated wsk_context-s, @see add_wsk_contexts
+
+        frame_clock frames; // of the server, updated by RET_SUBMIT of isoch transfers
+
+        KEVENT detached; // set by detach() after all requests are completed, @see wait_detach
 
         int port; // vhci_ctx.devices[port - 1]
         seqnum_t seqnum; // @see next_seqnum
@@ -123,9 +187,9 @@ struct device_ctx
 
         // for WSK receive
         WDFWORKITEM recv_hdr;
-        using received_fn = NTSTATUS (wsk_context&);
+        using received_fn = NTSTATUS (wsk_context&, size_t received);
         received_fn *received;
-        size_t receive_size;
+        size_t receive_size; // zero if any number of bytes can be received
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(device_ctx, get_device_ctx)
 
@@ -135,12 +199,6 @@ inline auto get_handle(_In_ device_ctx *ctx)
         return static_cast<UDECXUSBDEVICE>(WdfObjectContextGetObject(ctx));
 }
 
-WDF_DECLARE_CONTEXT_TYPE(UDECXUSBDEVICE); // WdfObjectGet_UDECXUSBDEVICE
-inline auto& get_device(_In_ WDFQUEUE queue) // for device_ctx.queue
-{
-        return *WdfObjectGet_UDECXUSBDEVICE(queue);
-}
-
 /*
  * Context space for UDECXUSBENDPOINT.
  */
@@ -149,6 +207,7 @@ struct endpoint_ctx
         UDECXUSBDEVICE device; // parent
         WDFQUEUE queue; // child
         USB_ENDPOINT_DESCRIPTOR_AUDIO descriptor;
+        usbip_header cmd_submit; // template in network byte order, @see set_cmd_submit_usbip_header
 
         CCHAR priority_boost; 
         static_assert(!IO_NO_INCREMENT);
@@ -158,26 +217,75 @@ struct endpoint_ctx
 
         USBD_PIPE_HANDLE PipeHandle;
         LIST_ENTRY entry; // list head if default control pipe, protected by device_ctx::endpoint_list_lock
+
+        // requests that are waiting for USBIP_RET_SUBMIT from a server, marked cancelable,
+        // head for request_ctx::entry, protected by device_ctx::egress_requests_lock
+        LIST_ENTRY pending;
+
+        stats_counters stats; // updated atomically, @see counters.h
+        latency_histogram latency[vhci::LATENCY_STAGES]; // updated atomically, @see latency.h
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(endpoint_ctx, get_endpoint_ctx)
 
 WDF_DECLARE_CONTEXT_TYPE(UDECXUSBENDPOINT); // WdfObjectGet_UDECXUSBENDPOINT
-inline auto& get_endpoint(_In_ WDFQUEUE queue) // use get_device() for device_ctx.queue
+inline auto& get_endpoint(_In_ WDFQUEUE queue)
 {
         return *WdfObjectGet_UDECXUSBENDPOINT(queue);
 }
 
+/*
+ * CMD_SUBMIT of a request, isoch URB that has more than USBIP_MAX_ISO_PACKETS has several ones.
+ * @see isoc::part
+ */
+struct request_part
+{
+        seqnum_t seqnum;
+        ULONG index; // in request_ctx::parts
+};
+
 /*
  * Context space for WDFREQUEST.
  */
 struct request_ctx
 {
-        LIST_ENTRY entry; // head is device_ctx::egress_requests
+        LIST_ENTRY entry; // head is device_ctx::egress_requests or endpoint_ctx::pending
         UDECXUSBENDPOINT endpoint;
-        seqnum_t seqnum;
+
+        request_part parts[isoc::MAX_PARTS]; // are in device_ctx::inflight while RET_SUBMIT is not received
+        ULONG outstanding; // bitmask of the parts whose RET_SUBMIT is not received yet
+        ULONG part; // whose RET_SUBMIT is being received
+
+        auto seqnum() const { return parts[0].seqnum; }
+
+        bool cancelable; // marked, @see move_egress_request_to_queue
+        bool sent; // removed from egress_requests by WskSend completion, @see requeue_request
+        bool receiving; // RET_SUBMIT of a part, other ones are in flight, @see requeue_request
+        bool purged; // while CMD_SUBMIT was being sent or RET_SUBMIT of a part was being received
+        ULONG descriptors_generation; // of descriptor_cache when CMD_SUBMIT was made
+
+        // performance counter at the stages of URB lifecycle, zero if a stage was not reached
+        LONGLONG submitted; // device::internal_control is called
+        LONGLONG sending; // before WskSend
+        LONGLONG received; // RET_SUBMIT header is parsed
+        LONGLONG landed; // payload of RET_SUBMIT is received
+
+        isoc::merge_state isoc; // of RET_SUBMIT-s of the parts
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(request_ctx, get_request_ctx)
 
+inline auto& get_request(_In_ request_part &p)
+{
+        return *CONTAINING_RECORD(&p - p.index, request_ctx, parts);
+}
+
+/*
+ * RET_SUBMIT of the part is not received yet.
+ */
+inline bool is_outstanding(_In_ const request_ctx &req, _In_ ULONG part)
+{
+        return req.outstanding & (1UL << part);
+}
+
 inline auto get_handle(_In_ request_ctx *ctx)
 {
         NT_ASSERT(ctx);
@@ -196,10 +304,6 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 seqnum_t next_seqnum(_Inout_ device_ctx &dev, _In_ bool dir_in);
 
-constexpr auto extract_num(seqnum_t seqnum) { return seqnum >> 1; }
-constexpr auto extract_dir(seqnum_t seqnum) { return usbip_dir(seqnum & 1); }
-constexpr bool is_valid_seqnum(seqnum_t seqnum) { return extract_num(seqnum); }
-
 constexpr UINT32 make_devid(UINT16 busnum, UINT16 devnum)
 {
         return (busnum << 16) | devnum;
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+
+namespace usbip
+{
+
+using counter_t = UINT64 stats_counters::*;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void add(_Inout_ UINT64 &counter, _In_ UINT64 value)
+{
+        InterlockedAdd64(reinterpret_cast<LONG64*>(&counter), static_cast<LONG64>(value));
+}
+
+/*
+ * Lock-free, each CPU has its own counters. They are updated atomically anyway,
+ * because a thread running below DISPATCH_LEVEL can be moved to another CPU.
+ *
+ * @param endp counters of the endpoint are also updated if it is not null
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void count(_Inout_ device_ctx &dev, _Inout_opt_ endpoint_ctx *endp, _In_ counter_t counter, _In_ UINT64 value = 1)
+{
+        if (auto cpu = KeGetCurrentProcessorNumberEx(nullptr); cpu < dev.stats_cpus) {
+                add(dev.stats[cpu].*counter, value);
+        }
+
+        if (endp) {
+                add(endp->stats.*counter, value);
+        }
+}
+
+/*
+ * @return sum of the counters of all CPUs
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto get_stats(_In_ const device_ctx &dev)
+{
+        stats_counters r{};
+
+        for (ULONG i = 0; i < dev.stats_cpus; ++i) {
+                r += dev.stats[i];
+        }
+
+        return r;
+}
+
+} // namespace usbip
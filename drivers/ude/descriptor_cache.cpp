@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "descriptor_cache.h"
+#include "trace.h"
+#include "descriptor_cache.tmh"
+
+#include "driver.h"
+
+#include <libdrv\ch9.h>
+#include <libdrv\ch11.h>
+
+namespace
+{
+
+using namespace usbip;
+using entry = descriptor_cache::entry;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto make_key(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        return entry {
+                .type = pkt.wValue.HiByte,
+                .index = pkt.wValue.LowByte,
+                .langid = pkt.wIndex.W,
+                .length = pkt.wLength,
+        };
+}
+
+constexpr auto matches(_In_ const entry &a, _In_ const entry &b)
+{
+        return a.data && a.type == b.type && a.index == b.index && a.langid == b.langid && a.length == b.length;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto find(_In_ descriptor_cache &c, _In_ const entry &key)
+{
+        for (auto &e: c.entries) {
+                if (matches(e, key)) {
+                        return &e;
+                }
+        }
+
+        return static_cast<entry*>(nullptr);
+}
+
+/*
+ * @return data of the replaced entry that must be freed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void *insert(_Inout_ descriptor_cache &c, _In_ const entry &e)
+{
+        auto victim = find(c, e);
+
+        if (!victim) {
+                for (auto &i: c.entries) {
+                        if (!i.data) {
+                                victim = &i;
+                                break;
+                        }
+                }
+        }
+
+        if (!victim) {
+                victim = c.entries + c.next;
+                c.next = (c.next + 1) % ARRAYSIZE(c.entries);
+        }
+
+        auto data = victim->data;
+        *victim = e;
+        return data;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::is_cacheable_descriptor(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        if (!(pkt.bmRequestType.B == (USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE) &&
+              pkt.bRequest == USB_REQUEST_GET_DESCRIPTOR && pkt.wLength)) {
+                return false;
+        }
+
+        switch (pkt.wValue.HiByte) {
+        case USB_DEVICE_DESCRIPTOR_TYPE:
+        case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+        case USB_STRING_DESCRIPTOR_TYPE:
+        case USB_BOS_DESCRIPTOR_TYPE:
+                return true;
+        }
+
+        return false;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::invalidates_descriptors(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        switch (pkt.bRequest) {
+        case USB_REQUEST_SET_CONFIGURATION:
+        case USB_REQUEST_SET_DESCRIPTOR:
+                return pkt.bmRequestType.B == (USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_DEVICE);
+        case USB_REQUEST_SET_FEATURE:
+                return pkt.bmRequestType.B == USB_RT_PORT && pkt.wValue.W == USB_PORT_FEAT_RESET;
+        }
+
+        return false;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::get_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _Out_writes_bytes_(len) void *buf, _In_ ULONG len)
+{
+        NT_ASSERT(is_cacheable_descriptor(pkt));
+
+        auto &c = dev.descriptors;
+        auto key = make_key(pkt);
+
+        ULONG size = 0;
+        {
+                wdf::Lock lck(c.lock);
+
+                if (auto e = find(c, key); e && e->size <= len) {
+                        size = e->size;
+                        RtlCopyMemory(buf, e->data, size);
+                        ++c.hits;
+                } else {
+                        ++c.misses;
+                }
+        }
+
+        if (size) {
+                TraceUrb("dev %04x, %!usb_descriptor_type!, index %d, langid %#x, length %d -> %lu bytes from cache",
+                          ptr04x(get_handle(&dev)), key.type, key.index, key.langid, key.length, size);
+        }
+
+        return size;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::get_descriptor_cache_generation(_In_ const device_ctx &dev)
+{
+        auto &c = dev.descriptors;
+
+        wdf::Lock lck(c.lock);
+        return c.generation;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::put_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_reads_bytes_(len) const void *data, _In_ ULONG len, _In_ ULONG generation)
+{
+        if (!(is_cacheable_descriptor(pkt) && len && len <= pkt.wLength)) {
+                return;
+        }
+
+        auto e = make_key(pkt);
+        e.size = static_cast<USHORT>(len);
+
+        e.data = ExAllocatePoolUninitialized(NonPagedPoolNx, len, pooltag);
+        if (!e.data) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu bytes", len);
+                return;
+        }
+
+        RtlCopyMemory(e.data, data, len);
+
+        void *old{};
+        bool stale{};
+        {
+                auto &c = dev.descriptors;
+                wdf::Lock lck(c.lock);
+
+                stale = generation != c.generation; // the cache was cleared after the request was sent
+                old = stale ? e.data : insert(c, e);
+        }
+
+        if (stale) {
+                TraceDbg("dev %04x, %!usb_descriptor_type!, index %d, generation %lu is stale, dropped",
+                          ptr04x(get_handle(&dev)), e.type, e.index, generation);
+        }
+
+        if (old) {
+                ExFreePoolWithTag(old, pooltag);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::clear_descriptor_cache(_Inout_ device_ctx &dev)
+{
+        auto &c = dev.descriptors;
+
+        void *data[ARRAYSIZE(c.entries)];
+        ULONG cnt = 0;
+        {
+                wdf::Lock lck(c.lock);
+
+                for (auto &e: c.entries) {
+                        if (e.data) {
+                                data[cnt++] = e.data;
+                                e.data = nullptr;
+                        }
+                }
+
+                c.next = 0;
+                ++c.generation;
+        }
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                ExFreePoolWithTag(data[i], pooltag);
+        }
+
+        if (cnt) {
+                TraceDbg("dev %04x, %lu descriptor(s) removed", ptr04x(get_handle(&dev)), cnt);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::free_descriptor_cache(_Inout_ device_ctx &dev)
+{
+        for (auto &e: dev.descriptors.entries) {
+                if (auto &data = e.data) {
+                        ExFreePoolWithTag(data, pooltag);
+                        data = nullptr;
+                }
+        }
+}
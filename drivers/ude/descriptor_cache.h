@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+
+namespace usbip
+{
+
+/*
+ * Standard GET_DESCRIPTOR for device, configuration, string and BOS descriptors.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool is_cacheable_descriptor(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt);
+
+/*
+ * @return true if the request can change descriptors of the device, the cache must be cleared
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool invalidates_descriptors(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt);
+
+/*
+ * @return number of bytes copied to buf, zero if the descriptor is not cached
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG get_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _Out_writes_bytes_(len) void *buf, _In_ ULONG len);
+
+/*
+ * @return the value to pass to put_cached_descriptor for a reply to GET_DESCRIPTOR that is being requested
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG get_descriptor_cache_generation(_In_ const device_ctx &dev);
+
+/*
+ * The descriptor is dropped if the cache was cleared since generation was obtained,
+ * the reply can precede SET_CONFIGURATION or reset that was issued after the request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void put_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_reads_bytes_(len) const void *data, _In_ ULONG len, _In_ ULONG generation);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void clear_descriptor_cache(_Inout_ device_ctx &dev);
+
+/*
+ * Does not acquire descriptor_cache::lock, it can be already destroyed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_descriptor_cache(_Inout_ device_ctx &dev);
+
+} // namespace usbip
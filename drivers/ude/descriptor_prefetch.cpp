@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "descriptor_prefetch.h"
+#include "trace.h"
+#include "descriptor_prefetch.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "proto.h"
+#include "network.h"
+#include "descriptor_cache.h"
+
+#include <libdrv\ch9.h>
+#include <libdrv\pdu.h>
+#include <libdrv\usbd_helper.h>
+#include <libdrv\wait_timeout.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum {
+        MAX_REQUESTS = 16, // in one round trip
+        MAX_CONFIGS = 8, // bNumConfigurations is usually one
+        RECV_TIMEOUT = 5, // seconds, a server that does not reply must not block the attach
+};
+
+enum : USHORT {
+        LANGID_EN_US = 0x0409,
+        STRING_LENGTH = 255, // MAXIMUM_USB_STRING_LENGTH, Windows requests strings with such wLength
+};
+
+struct request
+{
+        USB_DEFAULT_PIPE_SETUP_PACKET pkt;
+        seqnum_t seqnum;
+        bool replied;
+};
+
+/*
+ * Allocated in PagedPool, too big for the stack.
+ */
+struct prefetch_state
+{
+        device_ctx *dev;
+        endpoint_ctx ep0; // only descriptor and cmd_submit are used
+
+        request req[MAX_REQUESTS];
+        usbip_header hdr[MAX_REQUESTS]; // network byte order, sent by a single call
+        ULONG cnt;
+
+        // from the replies
+        USB_DEVICE_DESCRIPTOR dd;
+        USHORT config_len[MAX_CONFIGS]; // wTotalLength
+        USHORT bos_len; // wTotalLength
+        USHORT langid; // the first one from string descriptor zero
+
+        ULONG rounds;
+        ULONG requests; // GET_DESCRIPTOR
+        ULONG fetched; // descriptors
+        ULONG generation; // of descriptor_cache when prefetch started
+        LONG64 min_rtt; // KeQueryInterruptTime units
+
+        UCHAR buf[MAXUSHORT]; // for a payload of RET_SUBMIT, wLength is USHORT
+};
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto is_enabled()
+{
+        PAGED_CODE();
+        ULONG enabled = true;
+
+        if (WDFKEY key; NT_SUCCESS(WdfDriverOpenParametersRegistryKey(WdfGetDriver(), KEY_QUERY_VALUE,
+                                                                       WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+                UNICODE_STRING value_name;
+                RtlInitUnicodeString(&value_name, descriptor_prefetch_value_name);
+
+                if (ULONG val; NT_SUCCESS(WdfRegistryQueryULong(key, &value_name, &val))) {
+                        enabled = val;
+                }
+
+                WdfRegistryClose(key);
+        }
+
+        return enabled;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void add(_Inout_ prefetch_state &st, _In_ UCHAR type, _In_ UCHAR index, _In_ USHORT langid, _In_ USHORT length)
+{
+        PAGED_CODE();
+
+        if (st.cnt == ARRAYSIZE(st.req)) {
+                TraceDbg("%!usb_descriptor_type!, index %d, langid %#x, length %d: too many requests",
+                          type, index, langid, length);
+                return;
+        }
+
+        auto &r = st.req[st.cnt++];
+        RtlZeroMemory(&r, sizeof(r));
+
+        auto &pkt = r.pkt;
+        pkt.bmRequestType.B = USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+        pkt.bRequest = USB_REQUEST_GET_DESCRIPTOR;
+        pkt.wValue.HiByte = type;
+        pkt.wValue.LowByte = index;
+        pkt.wIndex.W = langid;
+        pkt.wLength = length;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto find(_In_ prefetch_state &st, _In_ seqnum_t seqnum)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; i < st.cnt; ++i) {
+                if (auto &r = st.req[i]; r.seqnum == seqnum && !r.replied) {
+                        return &r;
+                }
+        }
+
+        return static_cast<request*>(nullptr);
+}
+
+/*
+ * Remembers the fields that the next round depends on.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_descriptor(_Inout_ prefetch_state &st, _In_ const request &r, _In_ ULONG len)
+{
+        PAGED_CODE();
+
+        auto &pkt = r.pkt;
+        put_cached_descriptor(*st.dev, pkt, st.buf, len, st.generation);
+        ++st.fetched;
+
+        switch (auto index = pkt.wValue.LowByte; pkt.wValue.HiByte) {
+        case USB_DEVICE_DESCRIPTOR_TYPE:
+                if (len == sizeof(st.dd)) {
+                        RtlCopyMemory(&st.dd, st.buf, len);
+                }
+                break;
+        case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+                if (len >= sizeof(USB_CONFIGURATION_DESCRIPTOR) && index < ARRAYSIZE(st.config_len)) {
+                        st.config_len[index] = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR*>(st.buf)->wTotalLength;
+                }
+                break;
+        case USB_BOS_DESCRIPTOR_TYPE:
+                if (len >= sizeof(USB_BOS_DESCRIPTOR)) {
+                        st.bos_len = reinterpret_cast<USB_BOS_DESCRIPTOR*>(st.buf)->wTotalLength;
+                }
+                break;
+        case USB_STRING_DESCRIPTOR_TYPE:
+                if (!index && len >= sizeof(USB_STRING_DESCRIPTOR)) {
+                        st.langid = reinterpret_cast<USB_STRING_DESCRIPTOR*>(st.buf)->bString[0];
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED USBIP_STATUS recv_ret_submit(_Inout_ prefetch_state &st)
+{
+        PAGED_CODE();
+        auto sock = st.dev->sock();
+        auto timeout = make_timeout(RECV_TIMEOUT*wdm::second, wdm::period::relative);
+
+        usbip_header hdr;
+        if (auto err = recv(sock, memory::stack, &hdr, sizeof(hdr), &timeout)) {
+                Trace(TRACE_LEVEL_ERROR, "Receive usbip_header %!STATUS!", err);
+                return USBIP_ERROR_NETWORK;
+        }
+        byteswap_header(hdr, swap_dir::net2host);
+
+        auto r = hdr.base.command == USBIP_RET_SUBMIT ? find(st, hdr.base.seqnum) : nullptr;
+        if (!r) {
+                Trace(TRACE_LEVEL_ERROR, "Unexpected command %!usbip_request_type!, seqnum %u",
+                                          hdr.base.command, hdr.base.seqnum);
+                return USBIP_ERROR_PROTOCOL;
+        }
+        r->replied = true;
+
+        auto &ret = hdr.u.ret_submit;
+        hdr.base.direction = USBIP_DIR_IN; // for get_payload_size
+
+        auto len = ULONG(ret.actual_length);
+        auto payload = get_payload_size(hdr);
+
+        if (!(len <= r->pkt.wLength && payload == len)) {
+                Trace(TRACE_LEVEL_ERROR, "seqnum %u, actual_length %lu, payload %Iu, wLength %d",
+                                          hdr.base.seqnum, len, payload, r->pkt.wLength);
+                return USBIP_ERROR_PROTOCOL;
+        }
+
+        if (auto err = len ? recv(sock, memory::paged, st.buf, len, &timeout) : STATUS_SUCCESS) {
+                Trace(TRACE_LEVEL_ERROR, "Receive payload %!STATUS!", err);
+                return USBIP_ERROR_NETWORK;
+        }
+
+        if (!ret.status && len) {
+                on_descriptor(st, *r, len);
+        } else {
+                TraceDbg("%!usb_descriptor_type!, index %d: status %d, actual_length %lu",
+                          r->pkt.wValue.HiByte, r->pkt.wValue.LowByte, ret.status, len);
+        }
+
+        return USBIP_ERROR_SUCCESS;
+}
+
+/*
+ * Sends CMD_SUBMIT for all added requests at once, then reads the replies.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED USBIP_STATUS run_round(_Inout_ prefetch_state &st)
+{
+        PAGED_CODE();
+
+        if (!st.cnt) {
+                return USBIP_ERROR_SUCCESS;
+        }
+
+        auto &dev = *st.dev;
+        const ULONG flags = USBD_DEFAULT_PIPE_TRANSFER | USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK;
+
+        for (ULONG i = 0; i < st.cnt; ++i) {
+                auto &r = st.req[i];
+                auto &hdr = st.hdr[i];
+
+                if (auto err = set_cmd_submit_usbip_header(hdr, dev, st.ep0, flags, r.pkt.wLength, setup_dir::in())) {
+                        Trace(TRACE_LEVEL_ERROR, "set_cmd_submit_usbip_header %!STATUS!", err);
+                        return USBIP_ERROR_GENERAL;
+                }
+
+                static_assert(sizeof(hdr.u.cmd_submit.setup) == sizeof(r.pkt));
+                RtlCopyMemory(hdr.u.cmd_submit.setup, &r.pkt, sizeof(r.pkt));
+
+                r.seqnum = RtlUlongByteSwap(hdr.base.seqnum);
+        }
+
+        auto start = LONG64(KeQueryInterruptTime());
+
+        if (auto err = send(dev.sock(), memory::paged, st.hdr, st.cnt*sizeof(*st.hdr))) {
+                Trace(TRACE_LEVEL_ERROR, "Send %lu CMD_SUBMIT %!STATUS!", st.cnt, err);
+                return USBIP_ERROR_NETWORK;
+        }
+
+        for (ULONG i = 0; i < st.cnt; ++i) {
+                if (auto err = recv_ret_submit(st)) {
+                        return err;
+                }
+        }
+
+        auto rtt = LONG64(KeQueryInterruptTime()) - start;
+        st.min_rtt = st.rounds++ ? min(st.min_rtt, rtt) : rtt;
+        st.requests += st.cnt;
+
+        TraceDbg("round #%lu, %lu request(s), %I64d us", st.rounds, st.cnt, rtt/10);
+
+        st.cnt = 0;
+        return USBIP_ERROR_SUCCESS;
+}
+
+/*
+ * Descriptors that do not depend on others, Windows requests them first.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void add_first_round(_Inout_ prefetch_state &st)
+{
+        PAGED_CODE();
+
+        add(st, USB_DEVICE_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_DEVICE_DESCRIPTOR));
+        add(st, USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_CONFIGURATION_DESCRIPTOR));
+        add(st, USB_STRING_DESCRIPTOR_TYPE, 0, 0, STRING_LENGTH);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void add_second_round(_Inout_ prefetch_state &st)
+{
+        PAGED_CODE();
+        auto &dd = st.dd;
+
+        if (auto len = st.config_len[0]; len > sizeof(USB_CONFIGURATION_DESCRIPTOR)) {
+                add(st, USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, 0, len);
+        }
+
+        for (UCHAR i = 1; i < min(dd.bNumConfigurations, UCHAR(MAX_CONFIGS)); ++i) {
+                add(st, USB_CONFIGURATION_DESCRIPTOR_TYPE, i, 0, sizeof(USB_CONFIGURATION_DESCRIPTOR));
+        }
+
+        if (dd.bLength && dd.bcdUSB >= 0x0201) { // BOS descriptor was introduced in USB 2.1
+                add(st, USB_BOS_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_BOS_DESCRIPTOR));
+        }
+
+        if (!st.langid) {
+                return;
+        }
+
+        UCHAR const strings[] { dd.iManufacturer, dd.iProduct, dd.iSerialNumber };
+
+        for (auto index: strings) {
+                if (index) {
+                        add(st, USB_STRING_DESCRIPTOR_TYPE, index, st.langid, STRING_LENGTH);
+                }
+        }
+
+        if (st.langid != LANGID_EN_US) { // Windows also requests strings in US English
+                for (auto index: strings) {
+                        if (index) {
+                                add(st, USB_STRING_DESCRIPTOR_TYPE, index, LANGID_EN_US, STRING_LENGTH);
+                        }
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void add_third_round(_Inout_ prefetch_state &st)
+{
+        PAGED_CODE();
+
+        for (UCHAR i = 1; i < min(st.dd.bNumConfigurations, UCHAR(MAX_CONFIGS)); ++i) {
+                if (auto len = st.config_len[i]; len > sizeof(USB_CONFIGURATION_DESCRIPTOR)) {
+                        add(st, USB_CONFIGURATION_DESCRIPTOR_TYPE, i, 0, len);
+                }
+        }
+
+        if (st.bos_len > sizeof(USB_BOS_DESCRIPTOR)) {
+                add(st, USB_BOS_DESCRIPTOR_TYPE, 0, 0, st.bos_len);
+        }
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED USBIP_STATUS usbip::prefetch_descriptors(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (!is_enabled()) {
+                return USBIP_ERROR_SUCCESS;
+        }
+
+        unique_ptr buf(PagedPool, sizeof(prefetch_state));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate prefetch_state, descriptors are not prefetched");
+                return USBIP_ERROR_SUCCESS; // optional
+        }
+
+        auto &st = *buf.get<prefetch_state>();
+        RtlZeroMemory(&st, offsetof(prefetch_state, buf));
+
+        st.dev = &dev;
+        st.generation = get_descriptor_cache_generation(dev);
+        static_cast<USB_ENDPOINT_DESCRIPTOR&>(st.ep0.descriptor) = EP0;
+        make_cmd_submit_template(st.ep0.cmd_submit, dev, EP0);
+
+        auto start = LONG64(KeQueryInterruptTime());
+
+        using add_fn = void (prefetch_state&);
+        add_fn* const rounds[] { add_first_round, add_second_round, add_third_round };
+
+        for (auto add_requests: rounds) {
+                add_requests(st);
+                if (auto err = run_round(st)) {
+                        clear_descriptor_cache(dev);
+                        return err;
+                }
+        }
+
+        auto elapsed = LONG64(KeQueryInterruptTime()) - start;
+        auto saved = LONG64(st.requests - st.rounds)*st.min_rtt; // a round trip per request if they are not pipelined
+
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %lu of %lu descriptor(s) in %lu round trip(s), %I64d ms, "
+                                       "about %I64d ms saved", ptr04x(get_handle(&dev)), st.fetched, st.requests,
+                                       st.rounds, elapsed/10'000, saved/10'000);
+
+        return USBIP_ERROR_SUCCESS;
+}
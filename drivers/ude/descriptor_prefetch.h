@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <resources\messages.h>
+
+namespace usbip
+{
+
+struct device_ctx;
+
+/*
+ * Reads device, configuration, BOS and string descriptors of the imported device into descriptor_cache.
+ * Must be called after OP_REP_IMPORT and before UdecxUsbDevicePlugIn, while nobody else uses the socket.
+ * Independent GET_DESCRIPTOR requests are sent together and their replies are read afterwards,
+ * so enumeration does not pay a round trip for each descriptor.
+ *
+ * Errors of GET_DESCRIPTOR are ignored, such descriptor is not cached.
+ * A reply is awaited for a limited time, late replies are drained by the receive loop as unknown seqnums.
+ * @return error if the connection is broken, a reply timed out or it is malformed;
+ *         the caller can go on without the cache, the receive loop will detect a broken connection
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED USBIP_STATUS prefetch_descriptors(_Inout_ device_ctx &dev);
+
+} // namespace usbip
@@ -8,12 +8,16 @@
 
 #include "driver.h"
 #include "device_queue.h"
+#include "descriptor_cache.h"
 #include "endpoint_list.h"
 #include "network.h"
+#include "proto.h"
 #include "device_ioctl.h"
 #include "wsk_receive.h"
 #include "ioctl.h"
 #include "vhci.h"
+#include "capture.h"
+#include "wsk_context.h"
 
 #include <libdrv\dbgcommon.h>
 #include <libdrv\wait_timeout.h>
@@ -45,6 +49,22 @@ PAGED auto to_udex_speed(_In_ usb_device_speed speed)
         }
 }
 
+/*
+ * Number of wsk_context-s that are preallocated for the endpoint.
+ * A context is used from the submission of a PDU to the completion of its WskSend.
+ */
+constexpr ULONG get_wsk_contexts(_In_ const USB_ENDPOINT_DESCRIPTOR &epd)
+{
+        switch (usb_endpoint_type(epd)) {
+        case UsbdPipeTypeIsochronous:
+                return 8;
+        case UsbdPipeTypeBulk:
+                return 4;
+        default:
+                return 2;
+        }
+}
+
 _Function_class_(EVT_WDF_DEVICE_CONTEXT_DESTROY)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -58,8 +78,28 @@ PAGED void NTAPI device_destroy(_In_ WDFOBJECT Object)
         Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %!USTR!:%!USTR!/%!USTR!", 
                 ptr04x(device), &ext->node_name, &ext->service_name, &ext->busid);
 
+        if (auto &f = get_device_ctx(device)->frames; f.synced()) {
+                TraceDbg("dev %04x, frame clock: jitter %lu us, lead %lu frame(s), resyncs %lu", 
+                          ptr04x(device), f.jitter_us(), f.lead(), f.resyncs());
+        }
+
         free(ext);
         ext = nullptr;
+
+        if (auto &inflight = get_device_ctx(device)->inflight) {
+                ExFreePoolWithTag(inflight, pooltag);
+                inflight = nullptr;
+        }
+
+        free_capture(*get_device_ctx(device));
+        close_wsk_context_pool(get_device_ctx(device)->wsk_pool);
+
+        if (auto &stats = get_device_ctx(device)->stats) {
+                ExFreePoolWithTag(stats, pooltag);
+                stats = nullptr;
+        }
+
+        free_descriptor_cache(*get_device_ctx(device));
 }
 
 _Function_class_(EVT_WDF_DEVICE_CONTEXT_CLEANUP)
@@ -145,17 +185,9 @@ _IRQL_requires_same_
 void endpoint_purge(_In_ UDECXUSBENDPOINT endpoint)
 {
         auto &endp = *get_endpoint_ctx(endpoint);
-        auto &dev = *get_device_ctx(endp.device);
-
         TraceDbg("dev %04x, endp %04x, queue %04x", ptr04x(endp.device), ptr04x(endpoint), ptr04x(endp.queue));
 
-        while (auto request = device::dequeue_request(dev, endpoint)) { // older
-                device::send_cmd_unlink_and_cancel(endp.device, request);
-        }
-
-        while (auto request = device::remove_egress_request(dev, endpoint)) { // newer
-                device::send_cmd_unlink_and_cancel(endp.device, request);
-        }
+        device::send_cmd_unlink_and_cancel_all(endpoint);
 
         auto purge_complete = [] ([[maybe_unused]] auto queue, auto ctx) // EVT_WDF_IO_QUEUE_STATE
         { 
@@ -256,7 +288,7 @@ NTSTATUS function_suspend_and_wake(
  * it can be called concurrently from UDECX_USB_ENDPOINT_CALLBACKS.EvtUsbEndpointPurge.
  * If set SynchronizationScopeDevice for UDECXUSBENDPOINT, UdecxUsbEndpointCreate 
  * will return STATUS_WDF_SYNCHRONIZATION_SCOPE_INVALID. For these reasons,
- * explicit WDFSPINLOCK device_ctx.send_lock is used to serialize WskSend calls.
+ * explicit WDFSPINLOCK device_ctx.send_lock is used to serialize WskSend calls, @see device_ctx.send_pending.
  * 
  * Using power-managed queues for I/O requests that require the device to be in its working state, 
  * and using queues that are not power-managed for all other requests.
@@ -343,6 +375,7 @@ PAGED NTSTATUS endpoint_add(_In_ UDECXUSBDEVICE device, _In_ UDECX_USB_ENDPOINT_
 
         endp.device = device;
         InitializeListHead(&endp.entry);
+        InitializeListHead(&endp.pending);
 
         if (auto len = data->EndpointDescriptorBufferLength) {
                 NT_ASSERT(epd.bLength == len);
@@ -355,6 +388,12 @@ PAGED NTSTATUS endpoint_add(_In_ UDECXUSBDEVICE device, _In_ UDECX_USB_ENDPOINT_
                 dev.ep0 = endpoint;
         }
 
+        make_cmd_submit_template(endp.cmd_submit, dev, endp.descriptor);
+
+        if (auto err = add_wsk_contexts(dev.wsk_pool, get_wsk_contexts(endp.descriptor))) {
+                Trace(TRACE_LEVEL_ERROR, "add_wsk_contexts %!STATUS!", err); // the global lookaside list will be used
+        }
+
         if (auto err = create_endpoint_queue(endp.queue, endpoint)) {
                 return err;
         }
@@ -540,6 +579,7 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
                 &dev.send_lock,
                 &dev.endpoint_list_lock,
                 &dev.egress_requests_lock,
+                &dev.descriptors.lock,
         };
 
         for (auto i: v) {
@@ -556,12 +596,32 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
                 return err;
         }
 
-        if (auto err = device::create_queue(device)) {
+        if (auto err = device::init_send_batch(device)) {
                 return err;
         }
 
+        dev.inflight = (request_part**)ExAllocatePoolZero(NonPagedPoolNx, 
+                                        dev.INFLIGHT_SIZE*sizeof(*dev.inflight), pooltag);
+        if (!dev.inflight) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate table of in-flight requests");
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        dev.stats_cpus = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        dev.stats = (cpu_stats_counters*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, 
+                                        dev.stats_cpus*sizeof(*dev.stats), pooltag);
+        if (!dev.stats) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate counters for %lu CPU(s)", dev.stats_cpus);
+                dev.stats_cpus = 0;
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
         InitializeListHead(&dev.egress_requests);
-        KeInitializeEvent(&dev.queue_purged, NotificationEvent, false);
+        KeInitializeEvent(&dev.detached, NotificationEvent, false);
+
+        LARGE_INTEGER freq;
+        KeQueryPerformanceCounter(&freq);
+        dev.frames.init(freq.QuadPart);
 
         return STATUS_SUCCESS;
 }
@@ -572,6 +632,90 @@ inline auto set_unplugged(_Inout_ device_ctx &dev)
         return InterlockedExchange8(PCHAR(&dev.unplugged), true);
 }
 
+/*
+ * Cancel requests that are waiting for RET_SUBMIT, they are completed after endpoint_list_lock is released.
+ * move_egress_request_to_queue does not add requests to endpoint_ctx::pending after device_ctx::unplugged is set.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void cancel_pending_requests(_Inout_ device_ctx &dev)
+{
+        if (!dev.ep0) {
+                return;
+        }
+
+        LIST_ENTRY requests; // head for request_ctx::entry
+        InitializeListHead(&requests);
+
+        auto f = [] (const endpoint_ctx &cendp, void *context)
+        {
+                auto &endp = const_cast<endpoint_ctx&>(cendp); // pending is protected by egress_requests_lock
+                auto head = static_cast<LIST_ENTRY*>(context);
+
+                while (auto request = device::dequeue_request(endp)) {
+                        auto &req = *get_request_ctx(request);
+                        InsertTailList(head, &req.entry); // request_ctx::entry is reused
+                }
+        };
+
+        for_each_endpoint(dev, f, &requests);
+
+        while (!IsListEmpty(&requests)) {
+                auto entry = RemoveHeadList(&requests);
+                InitializeListHead(entry);
+
+                auto req = CONTAINING_RECORD(entry, request_ctx, entry);
+                complete(get_handle(req), STATUS_CANCELLED);
+        }
+}
+
+/*
+ * @return referenced queue of the endpoint with the given index or WDF_NO_HANDLE
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_endpoint_queue(_Inout_ device_ctx &dev, _In_ ULONG index)
+{
+        struct context_t
+        {
+                ULONG index;
+                WDFQUEUE queue;
+        } ctx{ index };
+
+        auto f = [] (const endpoint_ctx &endp, void *context)
+        {
+                auto &ctx = *static_cast<context_t*>(context);
+
+                if (!ctx.queue && !ctx.index--) {
+                        ctx.queue = endp.queue;
+                        WdfObjectReference(ctx.queue);
+                }
+        };
+
+        if (dev.ep0) {
+                for_each_endpoint(dev, f, &ctx);
+        }
+
+        return ctx.queue;
+}
+
+/*
+ * Wait for the completion of the requests that the driver still owns. These are requests whose CMD_SUBMIT 
+ * is being sent, requests that are being canceled by canceled_pending, etc.
+ * An endpoint can be added or removed concurrently, in such case its queue can be skipped or purged twice.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void purge_endpoint_queues(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; auto queue = get_endpoint_queue(dev, i); ++i) {
+                WdfIoQueuePurgeSynchronously(queue);
+                WdfObjectDereference(queue);
+        }
+}
+
 /*
  * Call UdecxUsbDevicePlugOutAndDelete if UdecxUsbDevicePlugIn was successful.
  * After UdecxUsbDevicePlugOutAndDelete the client driver can no longer use UDECXUSBDEVICE.
@@ -595,16 +739,27 @@ PAGED void detach(_In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete)
         PAGED_CODE();
 
         auto &dev = *get_device_ctx(device);
-        WdfIoQueuePurgeSynchronously(dev.queue);
 
         if (close_socket(dev.sock())) {
                 Trace(TRACE_LEVEL_INFORMATION, "dev %04x, connection closed", ptr04x(device));
         }
 
-        while (auto request = remove_egress_request(dev, device::request_search())) {
-                complete(request, STATUS_CANCELLED);
+        device::cancel_egress_requests(device, WDF_NO_HANDLE); // as send_cmd_unlink_and_cancel_all does
+        cancel_pending_requests(dev);
+        purge_endpoint_queues(dev);
+
+        if (auto n = dev.sent_batches) {
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %I64u PDU(s) sent by %I64u batch(es), %I64u.%02I64u PDU(s) per batch",
+                        ptr04x(device), dev.sent_pdus, n, dev.sent_pdus/n, dev.sent_pdus*100/n % 100);
+        }
+
+        if (auto &c = dev.descriptors; c.hits || c.misses) {
+                Trace(TRACE_LEVEL_INFORMATION, "dev %04x, descriptor cache: %I64u hit(s), %I64u miss(es)",
+                        ptr04x(device), c.hits, c.misses);
         }
 
+        clear_descriptor_cache(dev);
+
         if (auto port = vhci::reclaim_roothub_port(device)) {
                 Trace(TRACE_LEVEL_INFORMATION, "port %d released", port);
         }
@@ -619,7 +774,7 @@ PAGED void detach(_In_ UDECXUSBDEVICE device, _In_ bool plugout_and_delete)
                 }
         }
 
-        NT_VERIFY(!KeSetEvent(&dev.queue_purged, IO_NO_INCREMENT, false)); // once
+        NT_VERIFY(!KeSetEvent(&dev.detached, IO_NO_INCREMENT, false)); // once
 }
 
 _IRQL_requires_same_
@@ -661,14 +816,14 @@ PAGED auto wait_detach(_In_ UDECXUSBDEVICE device, _In_opt_ LARGE_INTEGER *timeo
         auto &dev = *get_device_ctx(device);
         NT_ASSERT(dev.unplugged);
 
-        auto st = KeWaitForSingleObject(&dev.queue_purged, Executive, KernelMode, false, timeout);
+        auto st = KeWaitForSingleObject(&dev.detached, Executive, KernelMode, false, timeout);
 
         switch (st) {
         case STATUS_SUCCESS:
                 TraceDbg("dev %04x, completed", ptr04x(device));
                 break;
         case STATUS_TIMEOUT: // a bug in the driver
-                TraceDbg("dev %04x, timeout (purged WDFREQUEST is not completed?)", ptr04x(device));
+                TraceDbg("dev %04x, timeout (WDFREQUEST is not completed?)", ptr04x(device));
                 static_assert(NT_SUCCESS(STATUS_TIMEOUT));
                 st = STATUS_OPERATION_IN_PROGRESS;
                 break;
@@ -10,13 +10,18 @@
 #include "wsk_context.h"
 #include "device.h"
 #include "device_queue.h"
+#include "descriptor_cache.h"
 #include "proto.h"
 #include "network.h"
 #include "ioctl.h"
 #include "wsk_receive.h"
+#include "counters.h"
+#include "latency.h"
+#include "capture.h"
 
 #include "filter_request.h"
 #include <ude_filter\request.h>
+#include <usbip\isoc.h>
 
 #include <libdrv\irp.h>
 #include <libdrv\pdu.h>
@@ -43,48 +48,161 @@ void move_request_to_queue(_Inout_ device_ctx &dev, _In_ WDFREQUEST request)
         case STATUS_NOT_FOUND: // WskReceive completion handler has already removed it
         case STATUS_SUCCESS:
                 return;
-        case STATUS_WDF_BUSY: // destination queue is not accepting new requests
-                TraceDbg("req %04x, queue is purged", ptr04x(request));
-                st = STATUS_CANCELLED;
-                break;
+        case STATUS_CANCELLED: // purged while CMD_SUBMIT was being sent, already canceled or unplugged
+                device::send_cmd_unlink_and_cancel(get_handle(&dev), request); // CMD_UNLINK goes by the next batch
+                return;
         default:
-                Trace(TRACE_LEVEL_ERROR, "req %04x, WdfRequestForwardToIoQueue %!STATUS!", ptr04x(request), st);
+                Trace(TRACE_LEVEL_ERROR, "req %04x, WdfRequestMarkCancelableEx %!STATUS!", ptr04x(request), st);
         }
 
         complete(request, st);
 }
 
 /*
- * wsk_irp->Tail.Overlay.DriverContext[] are zeroed.
- *
  * The completion handler for WskReceive is executed by a high priority thread
- * and is usually called before this handler.
- * @see wsk_receive.cpp, find_request
+ * and is usually called before this function.
+ * @see device_queue.cpp, remove_inflight_request
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS send_complete(
-        _In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_Inexpressible_("varies")) void *Context)
+void sent(_In_ wsk_context &ctx, _In_ NTSTATUS status)
 {
-        wsk_context_ptr ctx(static_cast<wsk_context*>(Context), true);
-
-        auto request = ctx->request; // can be WDF_NO_HANDLE or already completed
-        auto &dev = *ctx->dev;
-
-        auto &wsk = wsk_irp->IoStatus;
-        TraceWSK("req %04x -> wsk irp %04x, %!STATUS!, Information %Iu", 
-                  ptr04x(request), ptr04x(wsk_irp), wsk.Status, wsk.Information);
+        auto request = ctx.request; // can be WDF_NO_HANDLE or already completed by RET_SUBMIT
+        auto &dev = *ctx.dev;
 
         if (!request) {
                 // nothing to do
-        } else if (NT_SUCCESS(wsk.Status)) { // request has sent
+        } else if (NT_SUCCESS(status)) { // request has sent
                 move_request_to_queue(dev, request);
         } else if (auto victim = device::remove_egress_request(dev, request)) {
                 NT_ASSERT(victim == request);
-                complete(victim, wsk.Status);
+                complete(victim, status);
         } else {
-                Trace(TRACE_LEVEL_ERROR, "req %04x not found among egress", ptr04x(request));
+                TraceDbg("req %04x not found among egress or its part is being received", ptr04x(request));
         }
+}
+
+/*
+ * Unlink MDL chains of the batch and free its contexts.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void complete_batch(_In_ wsk_context *head, _In_ NTSTATUS status)
+{
+        for (auto ctx = head; ctx; ) {
+                auto next = ctx->next;
+
+                if (next) {
+                        auto m = ctx->mdl_hdr.get();
+                        for ( ; m->Next != next->mdl_hdr.get(); m = m->Next);
+                        m->Next = nullptr;
+                }
+
+                if (NT_ERROR(status) && status != STATUS_CANCELLED) {
+                        count(*ctx->dev, nullptr, &stats_counters::send_failures);
+                }
+
+                if (!(next && next->request && next->request == ctx->request)) { // the last part, @see make_batch
+                        sent(*ctx, status);
+                }
+                free(ctx, true);
+
+                ctx = next;
+        }
+}
+
+/*
+ * CMD_SUBMIT-s of the parts of a request are not split between batches, sent() is called after the last one.
+ * @return head of the batch or nullptr if there is nothing to send
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+wsk_context *make_batch(_Inout_ device_ctx &dev, _Out_ ULONG &cnt, _Out_ size_t &len)
+{
+        wsk_context *head{};
+        cnt = 0;
+        len = 0;
+
+        wdf::Lock lck(dev.send_lock);
+
+        for (wsk_context *prev{}; !IsListEmpty(&dev.send_pending); ++cnt) {
+
+                auto ctx = CONTAINING_RECORD(dev.send_pending.Flink, wsk_context, entry);
+
+                if (cnt && (cnt == dev.batch_max_pdus || len + ctx->send_size > dev.batch_max_bytes) &&
+                    !(ctx->request && ctx->request == prev->request)) {
+                        break;
+                }
+
+                RemoveEntryList(&ctx->entry);
+                ctx->next = nullptr;
+                len += ctx->send_size;
+
+                if (prev) {
+                        prev->next = ctx;
+                        tail(prev->mdl_hdr)->Next = ctx->mdl_hdr.get();
+                } else {
+                        head = ctx;
+                }
+
+                prev = ctx;
+        }
+
+        if (head) {
+                ++dev.sent_batches;
+                dev.sent_pdus += cnt;
+        } else {
+                dev.sending = false;
+        }
+
+        return head;
+}
+
+/*
+ * Fail PDUs that were not sent because the device is unplugged.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void cancel_pending(_Inout_ device_ctx &dev)
+{
+        ULONG cnt;
+        size_t len;
+
+        while (auto head = make_batch(dev, cnt, len)) {
+                TraceDbg("dev %04x, cancel %lu PDU(s), %Iu bytes", ptr04x(get_handle(&dev)), cnt, len);
+                complete_batch(head, STATUS_CANCELLED);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void sched_send_batch(_Inout_ device_ctx &dev)
+{
+        if (dev.unplugged) {
+                cancel_pending(dev);
+        } else {
+                WdfWorkItemEnqueue(dev.send_batch);
+        }
+}
+
+/*
+ * wsk_irp->Tail.Overlay.DriverContext[] are zeroed.
+ * A WSK application should not call new WSK functions in the context of the IoCompletion routine,
+ * next batch is sent by the work item.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS send_complete(
+        _In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_Inexpressible_("varies")) void *Context)
+{
+        auto head = static_cast<wsk_context*>(Context);
+        auto &dev = *head->dev;
+
+        auto &wsk = wsk_irp->IoStatus;
+        TraceWSK("wsk irp %04x, %!STATUS!, Information %Iu", ptr04x(wsk_irp), wsk.Status, wsk.Information);
+
+        record(dev.send_latency, dev.batch_sending, get_timestamp()); // next batch is not sent yet
+        complete_batch(head, wsk.Status);
 
         if (wsk.Status == STATUS_FILE_FORCED_CLOSED && !dev.unplugged) {
                 auto hdev = get_handle(&dev);
@@ -92,34 +210,111 @@ NTSTATUS send_complete(
                 device::async_plugout_and_delete(hdev);
         }
 
+        bool pending;
+        {
+                wdf::Lock lck(dev.send_lock);
+                pending = !IsListEmpty(&dev.send_pending);
+                dev.sending = pending;
+        }
+
+        if (pending) {
+                sched_send_batch(dev);
+        }
+
         return StopCompletion;
 }
 
+/*
+ * MDL chains of PDUs are linked together and sent by a single WskSend.
+ * Only one batch can be in flight, this preserves the order of PDUs.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_ const URB *transfer_buffer)
+void send_batch(_Inout_ device_ctx &dev)
+{
+        ULONG cnt;
+        size_t len;
+
+        auto head = make_batch(dev, cnt, len);
+        if (!head) {
+                return;
+        }
+
+        dev.batch_sending = get_timestamp();
+
+        for (auto ctx = head; ctx; ctx = ctx->next) {
+                if (ctx->request) { // is not completed until sent() is called for it, @see cancel_egress_requests
+                        get_request_ctx(ctx->request)->sending = dev.batch_sending;
+                }
+                capture_send(dev, ctx->hdr, ctx->send_size, ctx->mdl_hdr.get(), dev.batch_sending);
+        }
+
+        WSK_BUF buf{ .Mdl = head->mdl_hdr.get(), .Length = len };
+        NT_ASSERT(buf.Length == size(buf.Mdl));
+
+        auto wsk_irp = head->wsk_irp; // do not access head or wsk_irp after send
+        IoSetCompletionRoutine(wsk_irp, send_complete, head, true, true, true);
+
+        switch (auto st = send(dev.sock(), &buf, WSK_FLAG_NODELAY, wsk_irp)) {
+        case STATUS_PENDING:
+        case STATUS_SUCCESS:
+                TraceWSK("wsk irp %04x, %lu PDU(s), %Iu bytes, %!STATUS!", ptr04x(wsk_irp), cnt, buf.Length, st);
+                break;
+        default:
+                Trace(TRACE_LEVEL_ERROR, "wsk irp %04x, %!STATUS!", ptr04x(wsk_irp), st);
+                if (st == STATUS_NOT_SUPPORTED) { // WskSend does not complete IRP for this status only
+                        libdrv::CompleteRequest(wsk_irp, dev.unplugged ? STATUS_CANCELLED : st);
+                }
+        }
+}
+
+_Function_class_(EVT_WDF_WORKITEM)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI send_next_batch(_In_ WDFWORKITEM WorkItem)
+{
+        auto device = static_cast<UDECXUSBDEVICE>(WdfWorkItemGetParentObject(WorkItem));
+        auto &dev = *get_device_ctx(device);
+
+        if (dev.unplugged) {
+                cancel_pending(dev);
+        } else {
+                send_batch(dev);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto prepare_wsk_buf(
+        _Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_ const URB *transfer_buffer, _In_ ULONG offset)
 {
         NT_ASSERT(!ctx.mdl_buf);
 
-        if (transfer_buffer && is_transfer_dir_out(ctx.hdr)) { // TransferFlags can have wrong direction
-                if (auto err = make_transfer_buffer_mdl(ctx.mdl_buf, URB_BUF_LEN, IoReadAccess, *transfer_buffer)) {
+        auto &hdr = ctx.hdr; // in network byte order
+        size_t payload = 0;
+
+        if (transfer_buffer && hdr.base.direction == RtlUlongByteSwap(USBIP_DIR_OUT)) { // TransferFlags can have wrong direction
+                auto len = ctx.is_isoc ? RtlUlongByteSwap(hdr.u.cmd_submit.transfer_buffer_length) : URB_BUF_LEN; // of the part
+
+                if (auto err = make_transfer_buffer_mdl(ctx.mdl_buf, len, IoReadAccess, *transfer_buffer, offset)) {
                         Trace(TRACE_LEVEL_ERROR, "make_transfer_buffer_mdl %!STATUS!", err);
                         return err;
                 }
+                payload = RtlUlongByteSwap(hdr.u.cmd_submit.transfer_buffer_length);
         }
 
         ctx.mdl_hdr.next(ctx.mdl_buf); // always replace tie from previous call
 
         if (ctx.is_isoc) {
-                NT_ASSERT(ctx.mdl_isoc);
-                byteswap(ctx.isoc, number_of_packets(ctx));
+                NT_ASSERT(ctx.mdl_isoc); // already in network byte order, @see repack
                 auto t = tail(ctx.mdl_hdr); // ctx.mdl_buf can be a chain
                 t->Next = ctx.mdl_isoc.get();
+                payload += number_of_packets(ctx)*sizeof(*ctx.isoc);
         }
 
         buf.Mdl = ctx.mdl_hdr.get();
         buf.Offset = 0;
-        buf.Length = get_total_size(ctx.hdr);
+        buf.Length = sizeof(hdr) + payload; // get_total_size() requires host byte order
 
         NT_ASSERT(verify(buf, ctx.is_isoc));
         return STATUS_SUCCESS;
@@ -128,33 +323,117 @@ auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_
 /*
  * WskSend reads data directly from URB transfer buffer. A request must not be added to Cancel-Safe IRP Queue
  * until the completion handler is called, otherwise it could be cancelled while the buffer is being copied.
+ * @param seqnum of CMD_SUBMIT of each part, @see request_ctx::parts
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void add_egress_request(
-        _Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ UDECXUSBENDPOINT endpoint, _In_ seqnum_t seqnum)
+auto add_egress_request(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ UDECXUSBENDPOINT endpoint, 
+        _In_reads_(cnt) const seqnum_t *seqnum, _In_ ULONG cnt = 1)
 {
         auto &req = *get_request_ctx(request);
         InitializeListHead(&req.entry);
+        req.cancelable = false;
+        req.sent = false;
+        req.receiving = false;
+        req.purged = false;
 
         NT_ASSERT(endpoint);
         req.endpoint = endpoint;
 
-        req.seqnum = seqnum;
-        NT_ASSERT(is_valid_seqnum(req.seqnum));
+        NT_ASSERT(cnt && cnt <= ARRAYSIZE(req.parts));
+        for (ULONG i = 0; i < cnt; ++i) {
+                auto &p = req.parts[i];
+                p.seqnum = seqnum[i];
+                p.index = i;
+                NT_ASSERT(is_valid_seqnum(p.seqnum));
+        }
+
+        req.outstanding = (1UL << cnt) - 1;
+        req.part = 0;
+
+        if (!req.submitted) { // UDE callbacks do not pass through internal_control
+                req.submitted = get_timestamp();
+        }
+        req.sending = req.received = req.landed = 0;
+
+        return device::add_egress_request(dev, req);
+}
+
+/*
+ * @param hdr in network byte order
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto dbg_usbip_hdr_net(_Out_ char *buf, _In_ size_t len, _In_ const usbip_header &hdr, _In_ bool setup_packet)
+{
+        auto h = hdr;
+        byteswap_header(h, swap_dir::net2host);
+        return dbg_usbip_hdr(buf, len, &h, setup_packet);
+}
+
+/*
+ * PDUs are appended to the send queue at once, they will be sent immediately if there is no batch in flight.
+ * @param pdus head for wsk_context::entry, the list is empty after the call
+ * @param defer the batch is sent by the work item, WskSend must not be called from an IoCompletion routine
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void enqueue(_Inout_ device_ctx &dev, _Inout_ LIST_ENTRY &pdus, _In_ bool defer)
+{
+        if (IsListEmpty(&pdus)) {
+                return;
+        }
+
+        bool sending;
+        {
+                wdf::Lock lck(dev.send_lock); // EvtUsbEndpointPurge, EvtIoInternalDeviceControl on other queues
+
+                auto first = pdus.Flink;
+                RemoveEntryList(&pdus); // a list without the head
+                InitializeListHead(&pdus);
+                AppendTailList(&dev.send_pending, first);
+
+                sending = dev.sending;
+                dev.sending = true;
+        }
+
+        if (sending) {
+                // will be sent by the next batch
+        } else if (defer) {
+                sched_send_batch(dev);
+        } else {
+                send_batch(dev);
+        }
+}
+
+/*
+ * @param request can be WDF_NO_HANDLE
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void count_submitted(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ UDECXUSBENDPOINT endpoint, 
+        _In_reads_(cnt) const wsk_context_ptr *ctx, _In_ ULONG cnt)
+{
+        if (!request) {
+                return;
+        }
 
-        device::add_egress_request(dev, req);
+        auto endp = get_endpoint_ctx(endpoint);
+        count(dev, endp, &stats_counters::submitted);
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (auto &c = *ctx[i]; c.mdl_buf) { // see prepare_wsk_buf
+                        auto len = RtlUlongByteSwap(c.hdr.u.cmd_submit.transfer_buffer_length);
+                        count(dev, endp, &stats_counters::bytes_out, len);
+                }
+        }
 }
 
 /*
- * switch (wdf::Lock lck(...); auto st = send(...))
- * is not used due to unspecified evaluation order of init-statement and condition.
- * switch (init-statement; condition) {} can be treated as:
- * {
- *      auto c = condition;
- *      init-statement;
- *      switch (c) {}
- * }
+ * PDU is added to the send queue, it will be sent immediately if there is no batch in flight.
+ * ctx->hdr must be in network byte order, @see set_cmd_submit_usbip_header.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -164,46 +443,58 @@ auto send(_In_opt_ UDECXUSBENDPOINT endpoint, _In_ wsk_context_ptr &ctx, _Inout_
         auto request = ctx->request; // can be WDF_NO_HANDLE, do not access after send
 
         WSK_BUF buf{};
-        if (auto err = prepare_wsk_buf(buf, *ctx, transfer_buffer)) {
+        if (auto err = prepare_wsk_buf(buf, *ctx, transfer_buffer, 0)) {
                 return err;
         } else {
                 char str[DBG_USBIP_HDR_BUFSZ];
                 TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x -> %Iu%s",
-                        ptr04x(request), buf.Length, dbg_usbip_hdr(str, sizeof(str), &ctx->hdr, log_setup));
+                        ptr04x(request), buf.Length, dbg_usbip_hdr_net(str, sizeof(str), ctx->hdr, log_setup));
         }
 
-        if (request) {
-                add_egress_request(dev, request, endpoint, ctx->hdr.base.seqnum);
+        if (seqnum_t seqnum = RtlUlongByteSwap(ctx->hdr.base.seqnum); !request) {
+                //
+        } else if (auto err = add_egress_request(dev, request, endpoint, &seqnum)) {
+                return err;
         }
 
-        byteswap_header(ctx->hdr, swap_dir::host2net);
+        count_submitted(dev, request, endpoint, &ctx, 1);
+        ctx->send_size = buf.Length;
 
-        auto wsk_irp = ctx->wsk_irp; // do not access ctx or wsk_irp after send
-        IoSetCompletionRoutine(wsk_irp, send_complete, ctx.release(), true, true, true);
+        LIST_ENTRY pdus;
+        InitializeListHead(&pdus);
+        InsertTailList(&pdus, &ctx.release()->entry); // do not access ctx after that
 
-        NTSTATUS st;
-        {
-                wdf::Lock lck(dev.send_lock); // EvtUsbEndpointPurge, EvtIoInternalDeviceControl on other queues
-                st = send(dev.sock(), &buf, WSK_FLAG_NODELAY, wsk_irp);
+        enqueue(dev, pdus, false);
+        return STATUS_PENDING;
+}
+
+using urb_function_t = NTSTATUS (device_ctx&, UDECXUSBENDPOINT, endpoint_ctx&, WDFREQUEST, URB&);
+
+/*
+ * @return true if the descriptor was copied to the transfer buffer, no round trip to the server is required
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto read_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request, _Inout_ URB &urb, 
+        _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        UCHAR *buf{};
+        ULONG len{};
+
+        if (NT_ERROR(UdecxUrbRetrieveBuffer(request, &buf, &len))) {
+                return false;
         }
 
-        switch (st) {
-        case STATUS_PENDING:
-        case STATUS_SUCCESS:
-                TraceWSK("req %04x -> wsk irp %04x, %Iu bytes, %!STATUS!", ptr04x(request), ptr04x(wsk_irp), buf.Length, st);
-                break;
-        default:
-                Trace(TRACE_LEVEL_ERROR, "req %04x -> wsk irp %04x, %!STATUS!", ptr04x(request), ptr04x(wsk_irp), st);
-                if (st == STATUS_NOT_SUPPORTED) { // WskSend does not complete IRP for this status only
-                        libdrv::CompleteRequest(wsk_irp, dev.unplugged ? STATUS_CANCELLED : st);
-                }
+        if (auto n = get_cached_descriptor(dev, pkt, buf, min(len, ULONG(pkt.wLength)))) {
+                urb.UrbHeader.Status = USBD_STATUS_SUCCESS;
+                UdecxUrbSetBytesCompleted(request, n);
+                return true;
         }
 
-        return STATUS_PENDING;
+        return false;
 }
 
-using urb_function_t = NTSTATUS (device_ctx&, UDECXUSBENDPOINT, endpoint_ctx&, WDFREQUEST, URB&);
-
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
 auto control_transfer(
@@ -247,6 +538,15 @@ auto control_transfer(
                 return STATUS_INVALID_PARAMETER;
         }
 
+        if (invalidates_descriptors(pkt)) {
+                clear_descriptor_cache(dev);
+        } else if (buf_len && is_cacheable_descriptor(pkt)) {
+                if (read_cached_descriptor(dev, request, urb, pkt)) {
+                        return STATUS_SUCCESS; // the caller completes the request
+                }
+                get_request_ctx(request)->descriptors_generation = get_descriptor_cache_generation(dev);
+        }
+
         wsk_context_ptr ctx(&dev, request);
         if (!ctx) {
                 return STATUS_INSUFFICIENT_RESOURCES;
@@ -254,7 +554,7 @@ auto control_transfer(
         
         setup_dir dir_out = is_transfer_dir_out(urb.UrbControlTransfer); // default control pipe is bidirectional
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, buf_len, dir_out)) {
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp, r.TransferFlags, buf_len, dir_out)) {
                 return err;
         }
 
@@ -293,7 +593,7 @@ auto bulk_or_interrupt_transfer(
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, r.TransferBufferLength)) {
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp, r.TransferFlags, r.TransferBufferLength)) {
                 return err;
         }
 
@@ -302,36 +602,95 @@ auto bulk_or_interrupt_transfer(
 
 /*
  * USBD_ISO_PACKET_DESCRIPTOR.Length is not used (zero) for USB_DIR_OUT transfer.
+ * Descriptors are built in network byte order, prepare_wsk_buf does not swap them.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto repack(_In_ usbip_iso_packet_descriptor *d, _In_ const _URB_ISOCH_TRANSFER &r)
+auto repack(_In_ usbip_iso_packet_descriptor *d, _In_ const _URB_ISOCH_TRANSFER &r, _In_ const isoc::part &p)
 {
-        ULONG length = 0;
+        auto src = r.IsoPacket + p.first;
+        auto end = p.offset + p.length;
 
-        for (ULONG i = 0; i < r.NumberOfPackets; ++d) {
+        if (auto i = isoc::pack(d, src, p.cnt, end, p.offset); i != p.cnt) {
+                auto offset = src[i].Offset;
+                auto next_offset = i + 1 < p.cnt ? src[i + 1].Offset : end;
 
-                auto offset = r.IsoPacket[i].Offset;
-                auto next_offset = ++i < r.NumberOfPackets ? r.IsoPacket[i].Offset : r.TransferBufferLength;
+                Trace(TRACE_LEVEL_ERROR, "[%lu] next_offset(%lu) >= offset(%lu) && next_offset <= end(%lu)",
+                        p.first + i, next_offset, offset, end);
+
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        NT_ASSERT(p.first || !p.cnt || !r.IsoPacket[0].Offset); // SUM(length) == TransferBufferLength
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Builds CMD_SUBMIT of each part, explicit start frames of the parts are consecutive.
+ * @param start_frame of the first part, ignored if flags have USBD_START_ISO_TRANSFER_ASAP
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto make_isoch_parts(
+        _Out_writes_(cnt) wsk_context_ptr *ctx, _In_reads_(cnt) const isoc::part *parts, _In_ ULONG cnt,
+        _In_ device_ctx &dev, _In_ endpoint_ctx &endp, _In_ WDFREQUEST request, _In_ const URB &urb, 
+        _In_ ULONG flags, _In_ UINT32 start_frame)
+{
+        auto &r = urb.UrbIsochronousTransfer;
+        auto high_speed = dev.speed() >= USB_SPEED_HIGH;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                auto &p = parts[i];
+
+                auto &c = ctx[i] = wsk_context_ptr(&dev, request, p.cnt);
+                if (!c) {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                if (auto err = set_cmd_submit_usbip_header(c->hdr, dev, endp, flags, p.length)) {
+                        return err;
+                }
+
+                if (auto err = repack(c->isoc, r, p)) {
+                        return err;
+                }
 
-                if (next_offset >= offset && next_offset <= r.TransferBufferLength) {
-                        d->offset = offset;
-                        d->length = next_offset - offset;
-                        d->actual_length = 0;
-                        d->status = 0;
-                        length += d->length;
+                if (auto cmd = &c->hdr.u.cmd_submit) { // network byte order
+                        cmd->start_frame = RtlUlongByteSwap(start_frame);
+                        cmd->number_of_packets = RtlUlongByteSwap(p.cnt);
+                }
+
+                if (!(flags & USBD_START_ISO_TRANSFER_ASAP)) {
+                        start_frame = isoc::get_next_start_frame(start_frame, p, endp.descriptor.bInterval, high_speed);
+                }
+
+                if (WSK_BUF buf{}; auto err = prepare_wsk_buf(buf, *c, &urb, p.offset)) {
+                        return err;
                 } else {
-                        Trace(TRACE_LEVEL_ERROR, "[%lu] next_offset(%lu) >= offset(%lu) && next_offset <= r.TransferBufferLength(%lu)",
-                                i, next_offset, offset, r.TransferBufferLength);
-                        return STATUS_INVALID_PARAMETER;
+                        c->send_size = buf.Length;
+                }
+
+                {
+                        char str[DBG_USBIP_HDR_BUFSZ];
+                        TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x -> %Iu%s",
+                                ptr04x(request), c->send_size, dbg_usbip_hdr_net(str, sizeof(str), c->hdr, false));
+                }
+
+                if (cnt > 1) {
+                        TraceUrb("req %04x -> part %lu from the packet %lu, NumberOfPackets %lu, offset %lu, length %lu",
+                                  ptr04x(request), i, p.first, p.cnt, p.offset, p.length);
                 }
         }
 
-        NT_ASSERT(length == r.TransferBufferLength);
         return STATUS_SUCCESS;
 }
 
 /*
- * USBD_START_ISO_TRANSFER_ASAP is appended because URB_GET_CURRENT_FRAME_NUMBER is not implemented.
+ * Isoch URB that has more than USBIP_MAX_ISO_PACKETS is sent as several CMD_SUBMIT-s at once, @see isoc::part.
+ * RET_SUBMIT-s of the parts are merged in any order, the last one completes URB.
+ * The packets are not accessed by HW until RET_SUBMIT of their part is received, @see isoc::reset_packets.
+ *
+ * Explicit StartFrame is translated to the frame of the server, @see frame_clock.
+ * USBD_START_ISO_TRANSFER_ASAP is appended if the clock is not synchronized yet or StartFrame is late,
+ * all parts are ASAP then and a server schedules them back to back.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
@@ -359,32 +718,75 @@ auto isoch_transfer(
                         func);
         }
 
-        if (r.NumberOfPackets > USBIP_MAX_ISO_PACKETS) {
-                Trace(TRACE_LEVEL_ERROR, "NumberOfPackets(%lu) > USBIP_MAX_ISO_PACKETS(%d)", 
-                                          r.NumberOfPackets, USBIP_MAX_ISO_PACKETS);
+        isoc::part parts[isoc::MAX_PARTS];
+
+        auto cnt = isoc::split(parts, r.IsoPacket, r.NumberOfPackets, r.TransferBufferLength);
+        if (!cnt) {
+                Trace(TRACE_LEVEL_ERROR, "NumberOfPackets %lu: more than %lu parts or invalid offsets", 
+                                          r.NumberOfPackets, isoc::MAX_PARTS);
                 return STATUS_INVALID_PARAMETER;
         }
 
-        wsk_context_ptr ctx(&dev, request, r.NumberOfPackets);
-        if (!ctx) {
-                return STATUS_INSUFFICIENT_RESOURCES;
+        auto flags = r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP;
+        UINT32 start_frame = r.StartFrame;
+
+        if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
+                //
+        } else if (dev.frames.get_start_frame(start_frame, r.StartFrame, get_timestamp())) {
+                flags &= ~USBD_START_ISO_TRANSFER_ASAP;
+        } else {
+                TraceUrb("req %04x, StartFrame %lu is out of schedule, frame %lu, ASAP", 
+                          ptr04x(request), r.StartFrame, dev.frames.frame(get_timestamp()));
         }
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, 
-                               r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP, r.TransferBufferLength)) {
+        wsk_context_ptr ctx[isoc::MAX_PARTS];
+        if (auto err = make_isoch_parts(ctx, parts, cnt, dev, endp, request, urb, flags, start_frame)) {
                 return err;
         }
 
-        if (auto err = repack(ctx->isoc, r)) {
+        isoc::reset_packets(r.IsoPacket, r.NumberOfPackets, USBD_STATUS_ISO_NOT_ACCESSED_BY_HW);
+        r.ErrorCount = r.NumberOfPackets;
+
+        auto &req = *get_request_ctx(request);
+        req.isoc = isoc::make_merge_state(r.NumberOfPackets);
+
+        seqnum_t seqnum[isoc::MAX_PARTS];
+        for (ULONG i = 0; i < cnt; ++i) {
+                seqnum[i] = RtlUlongByteSwap(ctx[i]->hdr.base.seqnum);
+        }
+
+        if (auto err = add_egress_request(dev, request, endpoint, seqnum, cnt)) {
                 return err;
         }
 
-        if (auto cmd = &ctx->hdr.u.cmd_submit) {
-                cmd->start_frame = r.StartFrame;
-                cmd->number_of_packets = r.NumberOfPackets;
+        count_submitted(dev, request, endpoint, ctx, cnt);
+
+        LIST_ENTRY pdus; // the parts are consecutive, @see make_batch
+        InitializeListHead(&pdus);
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                InsertTailList(&pdus, &ctx[i].release()->entry);
         }
 
-        return send(endpoint, ctx, dev, false, &urb);
+        enqueue(dev, pdus, false);
+        return STATUS_PENDING;
+}
+
+/*
+ * The frame is extrapolated from start_frame of RET_SUBMIT-s, @see frame_clock.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(urb_function_t)
+auto get_current_frame_number(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT, _In_ endpoint_ctx&, _In_ WDFREQUEST request, _In_ URB &urb)
+{
+        auto &num = urb.UrbGetCurrentFrameNumber.FrameNumber;
+        num = dev.frames.frame(get_timestamp());
+
+        TraceUrb("req %04x -> FrameNumber %lu", ptr04x(request), num);
+
+        urb.UrbHeader.Status = USBD_STATUS_SUCCESS;
+        return STATUS_SUCCESS;
 }
 
 _IRQL_requires_same_
@@ -408,6 +810,9 @@ auto usb_submit_urb(
         case URB_FUNCTION_CONTROL_TRANSFER:
                 handler = control_transfer;
                 break;
+        case URB_FUNCTION_GET_CURRENT_FRAME_NUMBER:
+                handler = get_current_frame_number;
+                break;
         default:
                 Trace(TRACE_LEVEL_ERROR, "%s(%#04x), dev %04x, endp %04x", urb_function_str(func), func, 
                                           ptr04x(endp.device), ptr04x(endpoint));
@@ -433,10 +838,14 @@ auto send_ep0_out(
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
+        if (invalidates_descriptors(setup)) {
+                clear_descriptor_cache(dev);
+        }
+
         auto &ep0 = *get_endpoint_ctx(dev.ep0);
         const ULONG TransferFlags = USBD_DEFAULT_PIPE_TRANSFER | USBD_TRANSFER_DIRECTION_OUT;
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, ep0.descriptor, TransferFlags, 0, setup_dir::out())) {
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, ep0, TransferFlags, 0, setup_dir::out())) {
                 return err;
         }
 
@@ -449,6 +858,45 @@ auto send_ep0_out(
         return ::send(dev.ep0, ctx, dev, true);
 }
 
+/*
+ * Builds CMD_UNLINK for each part of the request whose RET_SUBMIT is not received.
+ * @param unlinks head for wsk_context::entry
+ * @return number of CMD_UNLINK-s
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto make_cmd_unlinks(_Inout_ LIST_ENTRY &unlinks, _Inout_ device_ctx &dev, _In_ const request_ctx &req)
+{
+        auto endp = req.endpoint ? get_endpoint_ctx(req.endpoint) : nullptr;
+        ULONG cnt = 0;
+
+        for (ULONG i = 0; i < ARRAYSIZE(req.parts); ++i) {
+                if (!is_outstanding(req, i)) {
+                        continue;
+                }
+
+                auto seqnum = req.parts[i].seqnum;
+
+                wsk_context_ptr ctx(&dev, WDFREQUEST(WDF_NO_HANDLE));
+                if (!ctx) {
+                        Trace(TRACE_LEVEL_ERROR, "seqnum %u, wsk_context_ptr error", seqnum);
+                        continue;
+                }
+
+                set_cmd_unlink_usbip_header(ctx->hdr, dev, seqnum);
+
+                if (WSK_BUF buf{}; NT_SUCCESS(prepare_wsk_buf(buf, *ctx, nullptr, 0))) {
+                        ctx->send_size = buf.Length;
+                        InsertTailList(&unlinks, &ctx.release()->entry);
+
+                        count(dev, endp, &stats_counters::unlinks);
+                        ++cnt;
+                }
+        }
+
+        return cnt;
+}
+
 } // namespace
 
 
@@ -471,23 +919,138 @@ auto send_ep0_out(
   */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void usbip::device::send_cmd_unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request)
+void usbip::device::send_cmd_unlink_and_cancel(
+        _In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request, _In_ NTSTATUS status)
 {
         auto &dev = *get_device_ctx(device);
         auto &req = *get_request_ctx(request);
 
-        TraceDbg("dev %04x, seqnum %u", ptr04x(device), req.seqnum);
+        TraceDbg("dev %04x, seqnum %u, outstanding parts %#lx, %!STATUS!", 
+                  ptr04x(device), req.seqnum(), req.outstanding, status);
 
         if (dev.unplugged) {
                 TraceDbg("Unplugged, do not send unlink");
-        } else if (auto ctx = wsk_context_ptr(&dev, WDFREQUEST(WDF_NO_HANDLE))) {
-                set_cmd_unlink_usbip_header(ctx->hdr, dev, req.seqnum);
-                ::send(WDF_NO_HANDLE, ctx, dev, false); // ignore error
         } else {
-                Trace(TRACE_LEVEL_ERROR, "dev %04x, seqnum %u, wsk_context_ptr error", ptr04x(device), req.seqnum);
+                LIST_ENTRY unlinks; // head for wsk_context::entry
+                InitializeListHead(&unlinks);
+
+                make_cmd_unlinks(unlinks, dev, req);
+                enqueue(dev, unlinks, true);
+        }
+
+        complete(request, status);
+}
+
+/*
+ * EvtUsbEndpointPurge on alternate setting change or detach of a streaming device can have
+ * hundreds of outstanding URBs. A CMD_UNLINK per WskSend and the completion of every
+ * request right after it would make the purge much slower.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::send_cmd_unlink_and_cancel_all(_In_ UDECXUSBENDPOINT endpoint)
+{
+        auto &endp = *get_endpoint_ctx(endpoint);
+        auto &dev = *get_device_ctx(endp.device);
+
+        cancel_egress_requests(endp.device, endpoint); // newer, before the queue is drained
+
+        LIST_ENTRY requests; // head for request_ctx::entry
+        InitializeListHead(&requests);
+
+        LIST_ENTRY unlinks; // head for wsk_context::entry
+        InitializeListHead(&unlinks);
+
+        ULONG cnt = 0;
+        ULONG unlink_cnt = 0;
+
+        auto add = [&] (auto request)
+        {
+                auto &req = *get_request_ctx(request); // dequeue_request removed it from inflight
+                NT_ASSERT(IsListEmpty(&req.entry)); // request_ctx::entry is reused
+
+                InsertTailList(&requests, &req.entry);
+                ++cnt;
+
+                if (!dev.unplugged) {
+                        unlink_cnt += make_cmd_unlinks(unlinks, dev, req); // a CMD_UNLINK per part in flight
+                }
+        };
+
+        while (auto request = dequeue_request(endp)) { // older
+                add(request);
+        }
+
+        TraceDbg("dev %04x, endp %04x, %lu request(s), %lu CMD_UNLINK(s)", 
+                  ptr04x(endp.device), ptr04x(endpoint), cnt, unlink_cnt);
+
+        enqueue(dev, unlinks, false);
+
+        while (!IsListEmpty(&requests)) {
+                auto entry = RemoveHeadList(&requests);
+                InitializeListHead(entry);
+
+                auto req = CONTAINING_RECORD(entry, request_ctx, entry);
+                complete(get_handle(req), STATUS_CANCELLED);
+        }
+}
+
+/*
+ * A request in egress_requests can't be completed while its CMD_SUBMIT is in send_pending or in the batch
+ * in flight, send_batch and WskSend access the context and the transfer buffer of the request.
+ * PDUs that are not sent yet are removed from send_pending, a server does not know about them,
+ * so their requests are completed without CMD_UNLINK. Other requests are marked and sent() cancels them.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::cancel_egress_requests(_In_ UDECXUSBDEVICE device, _In_opt_ UDECXUSBENDPOINT endpoint)
+{
+        auto &dev = *get_device_ctx(device);
+
+        LIST_ENTRY unsent; // head for wsk_context::entry
+        InitializeListHead(&unsent);
+        {
+                auto head = &dev.send_pending;
+                wdf::Lock lck(dev.send_lock);
+
+                for (auto entry = head->Flink; entry != head; ) {
+                        auto ctx = CONTAINING_RECORD(entry, wsk_context, entry);
+                        entry = entry->Flink;
+
+                        if (auto request = ctx->request; 
+                            request && (!endpoint || get_request_ctx(request)->endpoint == endpoint)) {
+                                RemoveEntryList(&ctx->entry);
+                                InsertTailList(&unsent, &ctx->entry);
+                        }
+                }
         }
 
-        complete(request, STATUS_CANCELLED);
+        ULONG cnt = 0;
+
+        while (!IsListEmpty(&unsent)) {
+                auto ctx = CONTAINING_RECORD(RemoveHeadList(&unsent), wsk_context, entry);
+                auto request = ctx->request;
+                free(ctx, false); // before completion of the request, ctx->mdl_buf describes its buffer
+
+                if (auto next = unsent.Flink; 
+                    next != &unsent && CONTAINING_RECORD(next, wsk_context, entry)->request == request) {
+                        continue; // the parts of the request are consecutive, it is completed after the last one
+                }
+
+                if (auto victim = remove_egress_request(dev, request)) {
+                        NT_ASSERT(victim == request);
+                        complete(victim, STATUS_CANCELLED);
+                        ++cnt;
+                } else {
+                        Trace(TRACE_LEVEL_ERROR, "req %04x not found among egress", ptr04x(request));
+                }
+        }
+
+        auto crit = endpoint ? request_search(endpoint) : request_search();
+        auto sending = purge_egress_requests(dev, crit);
+
+        TraceDbg("dev %04x, endp %04x, %lu unsent request(s) canceled, %lu are being sent", 
+                  ptr04x(device), ptr04x(endpoint), cnt, sending);
 }
 
 _IRQL_requires_same_
@@ -623,6 +1186,8 @@ void NTAPI usbip::device::internal_control(
         auto endpoint = get_endpoint(queue);
         auto &endp = *get_endpoint_ctx(endpoint);
         
+        get_request_ctx(request)->submitted = get_timestamp();
+
         if (auto dev = get_device_ctx(endp.device); dev->unplugged) {
                 UdecxUrbComplete(request, USBD_STATUS_DEVICE_GONE);
         } else if (auto st = usb_submit_urb(*dev, endpoint, endp, request); st != STATUS_PENDING) {
@@ -632,3 +1197,55 @@ void NTAPI usbip::device::internal_control(
                 UdecxUrbCompleteWithNtStatus(request, st);
         }
 }
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::device::init_send_batch(_In_ UDECXUSBDEVICE device)
+{
+        PAGED_CODE();
+        auto &dev = *get_device_ctx(device);
+
+        InitializeListHead(&dev.send_pending);
+
+        dev.batch_max_bytes = 64*1024; // defaults
+        dev.batch_max_pdus = 32;
+
+        if (WDFKEY key; NT_SUCCESS(WdfDriverOpenParametersRegistryKey(WdfGetDriver(), KEY_QUERY_VALUE, 
+                                                                       WDF_NO_OBJECT_ATTRIBUTES, &key))) {
+                struct {
+                        const wchar_t *name;
+                        ULONG &value;
+                } const v[] = {
+                        { send_batch_max_bytes_value_name, dev.batch_max_bytes },
+                        { send_batch_max_pdus_value_name, dev.batch_max_pdus },
+                };
+
+                for (auto &[name, value]: v) {
+                        UNICODE_STRING value_name;
+                        RtlInitUnicodeString(&value_name, name);
+
+                        if (ULONG val; NT_SUCCESS(WdfRegistryQueryULong(key, &value_name, &val)) && val) {
+                                value = val;
+                        }
+                }
+
+                WdfRegistryClose(key);
+        }
+
+        TraceDbg("dev %04x, batch max %lu bytes, %lu PDU(s)", ptr04x(device), dev.batch_max_bytes, dev.batch_max_pdus);
+
+        WDF_WORKITEM_CONFIG cfg;
+        WDF_WORKITEM_CONFIG_INIT(&cfg, send_next_batch);
+        cfg.AutomaticSerialization = false;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = device;
+
+        if (auto err = WdfWorkItemCreate(&cfg, &attr, &dev.send_batch)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfWorkItemCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <libdrv\codeseg.h>
 #include <libdrv/wdf_cpp.h>
 
 #include <usb.h>
@@ -13,9 +14,39 @@
 namespace usbip::device
 {
 
+/*
+ * Initialize the send aggregator of the device.
+ * @see device_ctx::send_pending
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS init_send_batch(_In_ UDECXUSBDEVICE device);
+
+/*
+ * Sends CMD_UNLINK for each part of the request that is in flight and completes the request.
+ * CMD_UNLINK-s are sent by the work item, so it can be called from an IoCompletion routine.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send_cmd_unlink_and_cancel(
+        _In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request, _In_ NTSTATUS status = STATUS_CANCELLED);
+
+/*
+ * Cancel requests whose CMD_SUBMIT is in the send queue or in the batch in flight.
+ * @param endpoint requests of all endpoints if WDF_NO_HANDLE
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void cancel_egress_requests(_In_ UDECXUSBDEVICE device, _In_opt_ UDECXUSBENDPOINT endpoint);
+
+/*
+ * Cancels all requests of the endpoint that are sent to a server.
+ * CMD_UNLINK-s are appended to the send queue at once and go out by a batch, 
+ * the requests are completed in one pass after that.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void send_cmd_unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request);
+void send_cmd_unlink_and_cancel_all(_In_ UDECXUSBENDPOINT endpoint);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -9,6 +9,8 @@
 #include "context.h"
 #include "device_ioctl.h"
 
+#include <usbip\seqnum_table.h>
+
 namespace
 {
 
@@ -22,7 +24,7 @@ auto matches(_In_ request_ctx *req, _In_ const device::request_search &crit)
         case crit.REQUEST:
                 return crit.request == get_handle(req);
         case crit.SEQNUM:
-                return crit.seqnum == req->seqnum;
+                return crit.seqnum == req->seqnum();
         case crit.ENDPOINT:
                 return crit.endpoint == req->endpoint;
         case crit.ANY:
@@ -33,17 +35,6 @@ auto matches(_In_ request_ctx *req, _In_ const device::request_search &crit)
         return false;
 }
 
-_Function_class_(EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE)
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-void NTAPI canceled_on_queue(_In_ WDFQUEUE queue, _In_ WDFREQUEST request)
-{
-        auto dev = get_device(queue);
-        TraceDbg("dev %04x, request %04x", ptr04x(dev), ptr04x(request));
-
-        device::send_cmd_unlink_and_cancel(dev, request);
-}
-
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto remove_egress_request_nolock(_Inout_ device_ctx &dev, _In_ const device::request_search &crit)
@@ -63,101 +54,157 @@ auto remove_egress_request_nolock(_Inout_ device_ctx &dev, _In_ const device::re
         return handle;
 }
 
-} // namespace
-
+using inflight = seqnum_table<request_part, device_ctx::INFLIGHT_SIZE>;
+constexpr ULONG INFLIGHT_NPOS = inflight::NPOS;
 
 /*
- * @see device.cpp, create_endpoint_queue
+ * @return index of the part or INFLIGHT_NPOS
  */
 _IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS usbip::device::create_queue(_In_ UDECXUSBDEVICE dev)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto inflight_find(_In_ const device_ctx &dev, _In_ seqnum_t seqnum)
 {
-        PAGED_CODE();
-        auto &ctx = *get_device_ctx(dev);
+        return inflight::find(dev.inflight, seqnum);
+}
 
-        WDF_IO_QUEUE_CONFIG cfg;
-        WDF_IO_QUEUE_CONFIG_INIT(&cfg, WdfIoQueueDispatchManual);
-        cfg.PowerManaged = WdfFalse;
-        cfg.EvtIoCanceledOnQueue = canceled_on_queue;
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto inflight_insert(_Inout_ device_ctx &dev, _In_ request_part &p)
+{
+        return inflight::insert(dev.inflight, &p);
+}
 
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, UDECXUSBDEVICE);
-//      attr.SynchronizationScope = WdfSynchronizationScopeQueue; // EvtIoCanceledOnQueue is used only
-        attr.ParentObject = dev;
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void inflight_erase(_Inout_ device_ctx &dev, _In_ ULONG i)
+{
+        inflight::erase(dev.inflight, i);
+}
 
-        attr.EvtCleanupCallback = [] (auto obj) 
-        { 
-                auto queue = static_cast<WDFQUEUE>(obj);
-                TraceDbg("dev %04x, queue %04x cleanup", ptr04x(get_device(queue)), ptr04x(queue)); 
-        };
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void inflight_erase(_Inout_ device_ctx &dev, _In_ const request_part &p)
+{
+        if (auto i = inflight_find(dev, p.seqnum); i != INFLIGHT_NPOS && dev.inflight[i] == &p) {
+                inflight_erase(dev, i);
+        }
+}
 
-        if (auto err = WdfIoQueueCreate(ctx.vhci, &cfg, &attr, &ctx.queue)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoQueueCreate %!STATUS!", err);
-                return err;
+/*
+ * Parts whose RET_SUBMIT was received are already removed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void inflight_erase(_Inout_ device_ctx &dev, _In_ const request_ctx &req)
+{
+        for (ULONG i = 0; i < ARRAYSIZE(req.parts); ++i) {
+                if (is_outstanding(req, i)) {
+                        inflight_erase(dev, req.parts[i]);
+                }
         }
+}
+
+/*
+ * A request from device_ctx::inflight is always in egress_requests or in endpoint_ctx::pending,
+ * RET_SUBMIT must not find a request that was removed from them.
+ * request_ctx::outstanding is kept, send_cmd_unlink_and_cancel unlinks the parts.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void unlink(_Inout_ device_ctx &dev, _Inout_ request_ctx &req)
+{
+        RemoveEntryList(&req.entry);
+        InitializeListHead(&req.entry);
+        inflight_erase(dev, req);
+}
 
-        get_device(ctx.queue) = dev;
+/*
+ * The request is removed from endpoint_ctx::pending by whoever acquires the lock first,
+ * but only this callback completes it if WdfRequestUnmarkCancelable returned STATUS_CANCELLED.
+ */
+_Function_class_(EVT_WDF_REQUEST_CANCEL)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI canceled_pending(_In_ WDFREQUEST request)
+{
+        auto &req = *get_request_ctx(request);
+        auto device = get_endpoint_ctx(req.endpoint)->device;
+        auto &dev = *get_device_ctx(device);
+        {
+                wdf::Lock lck(dev.egress_requests_lock);
+
+                if (req.cancelable) {
+                        req.cancelable = false;
+                        unlink(dev, req);
+                }
+        }
 
-        TraceDbg("dev %04x, queue %04x", ptr04x(dev), ptr04x(ctx.queue));
-        return STATUS_SUCCESS;
+        TraceDbg("dev %04x, seqnum %u", ptr04x(device), req.seqnum());
+        device::send_cmd_unlink_and_cancel(device, request); // complete() removes it from inflight
 }
 
+/*
+ * The request was removed from endpoint_ctx::pending under the lock.
+ * @return false if canceled_pending is called or will be called for the request
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-WDFREQUEST usbip::device::dequeue_request(_In_ device_ctx &dev, _In_ const request_search &crit)
+auto unmark_cancelable(_Inout_ request_ctx &req)
 {
-        NT_ASSERT(crit);
+        NT_ASSERT(req.cancelable);
+        req.cancelable = false;
 
-        if (!dev.queue) {
-                return WDF_NO_HANDLE;
-        }
+        auto st = WdfRequestUnmarkCancelable(get_handle(&req));
+        NT_ASSERT(st == STATUS_SUCCESS || st == STATUS_CANCELLED);
 
-        for (WDFREQUEST prev{}, cur; ; prev = cur) {
+        return st != STATUS_CANCELLED;
+}
 
-                auto st = WdfIoQueueFindRequest(dev.queue, prev, WDF_NO_HANDLE, nullptr, &cur);
-                if (prev) {
-                        WdfObjectDereference(prev);
-                }
+} // namespace
 
-                switch (st) {
-                case STATUS_SUCCESS:
-                        if (auto req = get_request_ctx(cur); matches(req, crit)) {
-                                st = WdfIoQueueRetrieveFoundRequest(dev.queue, cur, &prev);
-                                WdfObjectDereference(cur);
-
-                                switch (st) {
-                                case STATUS_SUCCESS:
-                                        return prev;
-                                case STATUS_NOT_FOUND: // cur was canceled and removed from queue
-                                        cur = WDF_NO_HANDLE; // restart the loop
-                                        break;
-                                default:
-                                        Trace(TRACE_LEVEL_ERROR, "WdfIoQueueRetrieveFoundRequest %!STATUS!", st);
-                                        return WDF_NO_HANDLE;
-                                }
-                        }
-                        break;
-                case STATUS_NOT_FOUND: // prev was canceled and removed from queue
-                        NT_ASSERT(!cur); // restart the loop
-                        break;
-                case STATUS_NO_MORE_ENTRIES: // not found
-                        return WDF_NO_HANDLE;
-                default:
-                        Trace(TRACE_LEVEL_ERROR, "WdfIoQueueFindRequest %!STATUS!", st);
-                        return WDF_NO_HANDLE;
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+WDFREQUEST usbip::device::dequeue_request(_Inout_ endpoint_ctx &endp)
+{
+        auto &dev = *get_device_ctx(endp.device);
+        wdf::Lock lck(dev.egress_requests_lock);
+
+        while (!IsListEmpty(&endp.pending)) {
+                auto &req = *CONTAINING_RECORD(endp.pending.Flink, request_ctx, entry);
+                unlink(dev, req);
+
+                if (req.receiving) { // is not cancelable, requeue_request completes it
+                        req.purged = true;
+                } else if (unmark_cancelable(req)) {
+                        return get_handle(&req);
                 }
         }
+
+        return WDF_NO_HANDLE;
 }
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void usbip::device::add_egress_request(_Inout_ device_ctx &dev, _Inout_ request_ctx &req)
+NTSTATUS usbip::device::add_egress_request(_Inout_ device_ctx &dev, _Inout_ request_ctx &req)
 {
         NT_ASSERT(IsListEmpty(&req.entry));
+        NT_ASSERT(is_outstanding(req, 0));
 
         wdf::Lock lck(dev.egress_requests_lock);
+
+        for (ULONG i = 0; i < ARRAYSIZE(req.parts) && is_outstanding(req, i); ++i) {
+                if (!inflight_insert(dev, req.parts[i])) {
+                        Trace(TRACE_LEVEL_ERROR, "seqnum %u, too many requests in flight", req.parts[i].seqnum);
+                        while (i) {
+                                inflight_erase(dev, req.parts[--i]);
+                        }
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+        }
+
         AppendTailList(&dev.egress_requests, &req.entry);
+        return STATUS_SUCCESS;
 }
 
 _IRQL_requires_same_
@@ -165,7 +212,40 @@ _IRQL_requires_max_(DISPATCH_LEVEL)
 WDFREQUEST usbip::device::remove_egress_request(_Inout_ device_ctx &dev, _In_ const request_search &crit)
 {
         wdf::Lock lck(dev.egress_requests_lock);
-        return remove_egress_request_nolock(dev, crit);
+
+        auto request = remove_egress_request_nolock(dev, crit);
+        if (!request) {
+                return WDF_NO_HANDLE;
+        }
+
+        auto &req = *get_request_ctx(request);
+        req.sent = true;
+
+        if (req.receiving) { // requeue_request completes it
+                req.purged = true;
+                return WDF_NO_HANDLE;
+        }
+
+        return request;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::device::purge_egress_requests(_Inout_ device_ctx &dev, _In_ const request_search &crit)
+{
+        ULONG cnt = 0;
+        auto head = &dev.egress_requests;
+
+        wdf::Lock lck(dev.egress_requests_lock);
+
+        for (auto entry = head->Flink; entry != head; entry = entry->Flink) {
+                if (auto req = CONTAINING_RECORD(entry, request_ctx, entry); matches(req, crit)) {
+                        req->purged = true;
+                        ++cnt;
+                }
+        }
+
+        return cnt;
 }
 
 _IRQL_requires_same_
@@ -174,9 +254,106 @@ NTSTATUS usbip::device::move_egress_request_to_queue(_Inout_ device_ctx &dev, _I
 {
         wdf::Lock lck(dev.egress_requests_lock);
 
-        if (auto request = remove_egress_request_nolock(dev, crit)) {
-                return WdfRequestForwardToIoQueue(request, dev.queue);
+        auto request = remove_egress_request_nolock(dev, crit);
+        if (!request) {
+                return STATUS_NOT_FOUND;
         }
 
-        return STATUS_NOT_FOUND;
+        auto &req = *get_request_ctx(request);
+        req.sent = true;
+
+        auto &pending = get_endpoint_ctx(req.endpoint)->pending;
+
+        if (req.receiving) { // requeue_request marks it cancelable
+                InsertTailList(&pending, &req.entry);
+                return STATUS_SUCCESS;
+        }
+
+        auto st = req.purged || dev.unplugged ? STATUS_CANCELLED : WdfRequestMarkCancelableEx(request, canceled_pending);
+        if (st) { // the caller completes it
+                inflight_erase(dev, req);
+                return st;
+        }
+
+        req.cancelable = true;
+        InsertTailList(&pending, &req.entry);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+WDFREQUEST usbip::device::remove_inflight_request(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
+{
+        wdf::Lock lck(dev.egress_requests_lock);
+
+        auto i = inflight_find(dev, seqnum);
+        if (i == INFLIGHT_NPOS) {
+                return WDF_NO_HANDLE; // was canceled
+        }
+
+        auto &p = *dev.inflight[i];
+        auto &req = get_request(p);
+
+        NT_ASSERT(!IsListEmpty(&req.entry));
+        NT_ASSERT(!req.receiving);
+
+        inflight_erase(dev, i);
+        req.outstanding &= ~(1UL << p.index);
+        req.part = p.index;
+
+        if (req.outstanding) { // other parts are in flight, it stays in its list, @see requeue_request
+                if (req.cancelable && !unmark_cancelable(req)) {
+                        unlink(dev, req);
+                        return WDF_NO_HANDLE; // canceled_pending will complete it
+                }
+
+                req.receiving = true;
+                return get_handle(&req);
+        }
+
+        unlink(dev, req);
+
+        if (req.cancelable && !unmark_cancelable(req)) {
+                return WDF_NO_HANDLE; // canceled_pending will complete it
+        }
+
+        return get_handle(&req);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::device::requeue_request(_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ bool ok)
+{
+        auto &req = *get_request_ctx(request);
+        wdf::Lock lck(dev.egress_requests_lock);
+
+        NT_ASSERT(req.receiving);
+        req.receiving = false;
+
+        if (!req.sent) { // sent() moves it to endpoint_ctx::pending or cancels it
+                req.purged |= !ok;
+                return STATUS_SUCCESS;
+        }
+
+        auto st = !ok || req.purged || dev.unplugged ? STATUS_CANCELLED : WdfRequestMarkCancelableEx(request, canceled_pending);
+        if (st) { // the caller completes it
+                unlink(dev, req);
+        } else {
+                req.cancelable = true;
+        }
+
+        return st;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::forget_inflight_request(_Inout_ device_ctx &dev, _In_ const request_ctx &req)
+{
+        if (!dev.inflight) {
+                return;
+        }
+
+        wdf::Lock lck(dev.egress_requests_lock);
+        inflight_erase(dev, req);
 }
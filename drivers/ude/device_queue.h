@@ -16,16 +16,13 @@
 namespace usbip
 {
         struct device_ctx;
+        struct endpoint_ctx;
         struct request_ctx;
 }
 
 namespace usbip::device
 {
 
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS create_queue(_In_ UDECXUSBDEVICE dev);
-
 struct request_search
 {
         request_search() = default;
@@ -50,22 +47,77 @@ struct request_search
 };
 
 /*
- * @param queue device_ctx.queue 
+ * Remove the oldest request of the endpoint that is waiting for RET_SUBMIT, @see endpoint_ctx::pending.
+ * The request is also removed from device_ctx::inflight and is no longer cancelable.
+ * Requests that are being canceled are skipped, canceled_pending completes them.
+ * Requests whose part is being received are skipped too, requeue_request completes them.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-WDFREQUEST dequeue_request(_In_ device_ctx &dev, _In_ const request_search &crit);
+WDFREQUEST dequeue_request(_Inout_ endpoint_ctx &endp);
 
+/*
+ * The parts of the request are also added to device_ctx::inflight.
+ * @param req request_ctx::outstanding has a bit for each part
+ * @return STATUS_INSUFFICIENT_RESOURCES if there are too many requests in flight
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void add_egress_request(_Inout_ device_ctx &dev, _Inout_ request_ctx &req);
+NTSTATUS add_egress_request(_Inout_ device_ctx &dev, _Inout_ request_ctx &req);
 
+/*
+ * @return WDF_NO_HANDLE if the request was not found or its part is being received,
+ *         requeue_request completes such request
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 WDFREQUEST remove_egress_request(_Inout_ device_ctx &dev, _In_ const request_search &crit);
 
+/*
+ * Mark requests whose CMD_SUBMIT is being sent, they can't be completed until WskSend is completed.
+ * move_egress_request_to_queue returns STATUS_CANCELLED for them instead of moving to endpoint_ctx::pending.
+ * @return number of marked requests
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG purge_egress_requests(_Inout_ device_ctx &dev, _In_ const request_search &crit);
+
+/*
+ * Move the request from egress_requests to endpoint_ctx::pending and mark it cancelable.
+ * Both lists are protected by the same lock, so RET_SUBMIT always finds the request in one of them.
+ * @return STATUS_CANCELLED if the request was purged, already canceled or the device is unplugged,
+ *         the caller must complete it
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS move_egress_request_to_queue(_Inout_ device_ctx &dev, _In_ const request_search &crit);
 
+/*
+ * Find a request by seqnum of its part in device_ctx::inflight and remove it from the list it is in, all in O(1).
+ * If other parts are in flight, the request stays in its list, but is not cancelable and
+ * request_ctx::receiving is set, requeue_request must be called after RET_SUBMIT of the part is processed.
+ * @return WDF_NO_HANDLE if the request was not found or it is being canceled
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+WDFREQUEST remove_inflight_request(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum);
+
+/*
+ * RET_SUBMIT of a part was processed, RET_SUBMIT-s of other parts are expected.
+ * If the request is in endpoint_ctx::pending, it is marked cancelable again.
+ * @param ok false if the part has failed and the request must be canceled
+ * @return STATUS_CANCELLED if the request was purged, failed, already canceled or the device is unplugged,
+ *         the caller must send CMD_UNLINK for the parts in flight and complete it
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS requeue_request(_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ bool ok);
+
+/*
+ * Must be called before completion of the request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void forget_inflight_request(_Inout_ device_ctx &dev, _In_ const request_ctx &req);
+
 } // namespace usbip::device
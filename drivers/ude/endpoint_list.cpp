@@ -80,3 +80,18 @@ auto usbip::find_endpoint(_In_ device_ctx &dev, _In_ const endpoint_search &crit
 
         return nullptr;
 }
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::for_each_endpoint(_In_ device_ctx &dev, _In_ endpoint_fn *f, _Inout_opt_ void *context)
+{
+        auto head = get_endpoint_list_head(dev);
+
+        wdf::Lock lck(dev.endpoint_list_lock);
+        f(*CONTAINING_RECORD(head, endpoint_ctx, entry), context);
+
+        for (auto entry = head->Flink; entry != head; entry = entry->Flink) {
+                auto endp = CONTAINING_RECORD(entry, endpoint_ctx, entry);
+                f(*endp, context);
+        }
+}
@@ -41,4 +41,14 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 endpoint_ctx *find_endpoint(_In_ device_ctx &dev, _In_ const endpoint_search &crit);
 
+using endpoint_fn = void (_In_ const endpoint_ctx &endp, _Inout_opt_ void *context);
+
+/*
+ * Default control pipe is visited first. 
+ * @param f is called while a spin lock is held, it must not be pageable
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void for_each_endpoint(_In_ device_ctx &dev, _In_ endpoint_fn *f, _Inout_opt_ void *context);
+
 } // namespace usbip
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "context.h"
+
+namespace usbip
+{
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto get_timestamp()
+{
+        return KeQueryPerformanceCounter(nullptr).QuadPart;
+}
+
+/*
+ * Lock-free, a histogram is updated atomically.
+ * @param from zero if the starting stage was not reached, nothing is recorded
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void record(_Inout_ latency_histogram &h, _In_ LONGLONG from, _In_ LONGLONG to)
+{
+        if (from && to >= from) {
+                auto value = static_cast<UINT64>(to - from);
+                InterlockedIncrement(reinterpret_cast<LONG*>(&h.counts[get_bucket(value)]));
+                InterlockedAdd64(reinterpret_cast<LONG64*>(&h.sum), static_cast<LONG64>(value));
+        }
+}
+
+/*
+ * URBs that were cancelled or did not receive RET_SUBMIT are not recorded.
+ * @param done timestamp of the completion
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void record_latency(_Inout_ endpoint_ctx &endp, _In_ const request_ctx &req, _In_ LONGLONG done)
+{
+        if (!req.received) {
+                return;
+        }
+
+        auto h = endp.latency;
+
+        record(h[vhci::LAT_QUEUE], req.submitted, req.sending);
+        record(h[vhci::LAT_NETWORK], req.sending, req.received);
+        record(h[vhci::LAT_PAYLOAD], req.received, req.landed);
+        record(h[vhci::LAT_COMPLETION], req.landed, done);
+        record(h[vhci::LAT_TOTAL], req.submitted, done);
+}
+
+} // namespace usbip
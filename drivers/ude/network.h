@@ -26,9 +26,14 @@ PAGED bool close_socket(_In_ SOCKET *sock);
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS send(_Inout_ SOCKET *sock, _In_ memory pool, _In_ void *data, _In_ ULONG len);
 
+/*
+ * @param timeout see wsk::receive
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS recv(_Inout_ SOCKET *sock, _In_ memory pool, _Inout_ void *data, _In_ ULONG len);
+PAGED NTSTATUS recv(
+        _Inout_ SOCKET *sock, _In_ memory pool, _Inout_ void *data, _In_ ULONG len,
+        _In_opt_ LARGE_INTEGER *timeout = nullptr);
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -38,17 +43,20 @@ enum : ULONG { URB_BUF_LEN = MAXULONG }; // set mdl_size to URB.TransferBufferLe
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS make_transfer_buffer_mdl(
-	_Inout_ Mdl &mdl, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const _URB &urb);
+	_Inout_ Mdl &mdl, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const _URB &urb,
+	_In_ ULONG offset = 0);
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 inline auto verify(_In_ const WSK_BUF &buf, _In_ bool exact)
 {
-	if (buf.Offset || !buf.Length) {
+	if (!buf.Length) {
 		return false;
 	}
 
 	auto sz = size(buf.Mdl);
-	return exact ? buf.Length == sz : buf.Length <= sz;
+	auto len = buf.Offset + buf.Length; // Offset is relative to buf.Mdl
+
+	return exact ? len == sz : len <= sz;
 }
 
 } // namespace usbip
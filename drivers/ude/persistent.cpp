@@ -7,6 +7,8 @@
 #include "persistent.tmh"
 
 #include "context.h"
+#include "driver.h"
+#include "vhci_ioctl.h"
 
 #include <libdrv\strconv.h>
 #include <libdrv\wait_timeout.h>
@@ -82,40 +84,12 @@ PAGED auto parse_string(_Out_ vhci::ioctl::plugin_hardware &r, _In_ const UNICOD
 }
 
 /*
- * Target is self. 
+ * @param failures consecutive failures to connect to a host
  */
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto make_target(_In_ WDFDEVICE vhci)
+constexpr ULONG get_delay(_In_ ULONG failures)
 {
-        PAGED_CODE();
-        wdf::ObjectDelete target;
-
-        if (WDFIOTARGET t; auto err = WdfIoTargetCreate(vhci, WDF_NO_OBJECT_ATTRIBUTES, &t)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetCreate %!STATUS!", err);
-                return target;
-        } else {
-                target.reset(t);
-        }
-
-        auto fdo = WdfDeviceWdmGetDeviceObject(vhci);
-
-        WDF_IO_TARGET_OPEN_PARAMS params;
-        WDF_IO_TARGET_OPEN_PARAMS_INIT_EXISTING_DEVICE(&params, fdo);
-
-        if (auto err = WdfIoTargetOpen(target.get<WDFIOTARGET>(), &params)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetOpen %!STATUS!", err);
-                target.reset();
-        }
-
-        return target;
-}
-
-constexpr auto get_delay(_In_ ULONG attempt, _In_ ULONG cnt)
-{
-        NT_ASSERT(cnt);
         enum { UNIT = 10, MAX_DELAY = 30*60 }; // seconds
-        return attempt > 1 ? min(UNIT*attempt/cnt, MAX_DELAY) : 0; // first two attempts without a delay
+        return failures > 1 ? min(UNIT*(failures - 1), MAX_DELAY) : 0; // first two attempts without a delay
 }
 
 _IRQL_requires_same_
@@ -154,40 +128,6 @@ constexpr auto can_retry(_In_ NTSTATUS status)
         return false;
 }
 
-/*
- * @return true - do not try to connect to this device again
- */
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto plugin_hardware(
-        _In_ const UNICODE_STRING &line, 
-        _In_ WDFIOTARGET target,
-        _Inout_ vhci::ioctl::plugin_hardware &req,
-        _Inout_ WDF_MEMORY_DESCRIPTOR &input,
-        _Inout_ WDF_MEMORY_DESCRIPTOR &output,
-        [[maybe_unused]] _In_ const ULONG outlen)
-{
-        PAGED_CODE();
-
-        if (auto err = parse_string(req, line)) {
-                Trace(TRACE_LEVEL_ERROR, "'%!USTR!' parse %!STATUS!", &line, err);
-                return true; // remove malformed string
-        }
-
-        Trace(TRACE_LEVEL_INFORMATION, "%s:%s/%s", req.host, req.service, req.busid);
-        req.port = 0;
-
-        if (ULONG_PTR BytesReturned; // send IOCTL to itself
-            auto err = WdfIoTargetSendIoctlSynchronously(target, WDF_NO_HANDLE, vhci::ioctl::PLUGIN_HARDWARE, 
-                                                         &input, &output, nullptr, &BytesReturned)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfIoTargetSendIoctlSynchronously %!STATUS!", err);
-                return !can_retry(err);
-        } else {
-                NT_ASSERT(BytesReturned == outlen);
-                return true;
-        }
-}
-
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto open_parameters_key()
@@ -271,6 +211,299 @@ PAGED ULONG get_count(_In_ WDFCOLLECTION col, _In_ WDFKEY key, _In_ bool refresh
         return min(WdfCollectionGetCount(col), ARRAYSIZE(vhci_ctx::devices));
 }
 
+enum { MAX_PARALLELISM = 16 }; // threads that attach persistent devices concurrently
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_parallelism(_In_ WDFKEY key)
+{
+        PAGED_CODE();
+
+        enum { DEFAULT = 4 };
+        ULONG val = DEFAULT;
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, persistent_attach_parallelism_value_name);
+
+        if (auto err = WdfRegistryQueryULong(key, &value_name, &val)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                val = DEFAULT;
+        }
+
+        return max(min(val, ULONG(MAX_PARALLELISM)), 1UL);
+}
+
+/*
+ * Retry and backoff are per host. If connect to a host failed, its other devices are skipped in the current round.
+ * The first worker that takes a device of a host probes it, other workers wait for the result.
+ * Thus a dead host costs one connect timeout per round rather than one per device.
+ */
+struct host_state
+{
+        char host[sizeof(vhci::imported_device_location::host)];
+        ULONG failures; // consecutive rounds with failed connect
+        LONG64 retry_time; // KeQueryInterruptTime
+
+        // the current round, written by workers
+        volatile LONG probe; // enum probe_state
+        KEVENT probed; // signaled when probe becomes PROBE_DONE
+        volatile bool failed; // can_retry(status)
+        volatile bool reached;
+};
+
+enum probe_state { PROBE_NONE, PROBE_ACTIVE, PROBE_DONE };
+
+struct attach_item
+{
+        vhci::ioctl::plugin_hardware req;
+        host_state *host; // null if the device must be skipped in the current round
+        volatile bool done; // remove from the collection
+};
+
+struct attach_state
+{
+        vhci_ctx *vhci;
+
+        host_state hosts[TOTAL_PORTS];
+        ULONG host_cnt;
+
+        attach_item items[TOTAL_PORTS]; // items[i] is for WdfCollectionGetItem(devices, i)
+        ULONG item_cnt;
+        volatile LONG next_item; // for workers
+};
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_host(_Inout_ attach_state &st, _In_ const char *host)
+{
+        PAGED_CODE();
+
+        for (ULONG i = 0; i < st.host_cnt; ++i) {
+                if (auto &h = st.hosts[i]; !_stricmp(h.host, host)) {
+                        return &h;
+                }
+        }
+
+        if (st.host_cnt == ARRAYSIZE(st.hosts)) {
+                return static_cast<host_state*>(nullptr);
+        }
+
+        auto &h = st.hosts[st.host_cnt++];
+        RtlZeroMemory(&h, sizeof(h));
+        RtlStringCbCopyA(h.host, sizeof(h.host), host);
+
+        return &h;
+}
+
+/*
+ * @return number of devices to attach in this round
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto prepare_round(
+        _Inout_ attach_state &st, _In_ WDFCOLLECTION devices, _In_ ULONG cnt, _In_ LONG64 now,
+        _Inout_ LONG64 &wakeup)
+{
+        PAGED_CODE();
+
+        NT_ASSERT(cnt <= ARRAYSIZE(st.items));
+        st.item_cnt = cnt;
+        st.next_item = 0;
+
+        ULONG ready = 0;
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                auto &item = st.items[i];
+                RtlZeroMemory(&item, sizeof(item));
+                item.req.size = sizeof(item.req);
+
+                UNICODE_STRING str{};
+                if (auto s = (WDFSTRING)WdfCollectionGetItem(devices, i)) {
+                        WdfStringGetUnicodeString(s, &str);
+                }
+
+                if (auto err = parse_string(item.req, str)) {
+                        Trace(TRACE_LEVEL_ERROR, "'%!USTR!' parse %!STATUS!", &str, err);
+                        item.done = true; // remove malformed string
+                } else if (auto host = get_host(st, item.req.host); !host) { // hosts[] is full
+                        wakeup = min(wakeup, now + wdm::second);
+                } else if (host->retry_time > now) {
+                        wakeup = min(wakeup, host->retry_time);
+                } else {
+                        item.host = host;
+                        ++ready;
+                }
+        }
+
+        for (ULONG i = 0; i < st.host_cnt; ++i) {
+                auto &h = st.hosts[i];
+                h.probe = PROBE_NONE;
+                KeInitializeEvent(&h.probed, NotificationEvent, false);
+        }
+
+        return ready;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void plugin_hardware(_In_ WDFDEVICE vhci, _Inout_ attach_item &item)
+{
+        PAGED_CODE();
+
+        auto &r = item.req;
+        auto &host = *item.host;
+
+        auto probe = InterlockedCompareExchange(&host.probe, PROBE_ACTIVE, PROBE_NONE) == PROBE_NONE;
+
+        if (!probe && host.probe == PROBE_ACTIVE) {
+                TraceDbg("%s:%s/%s, wait for the host to be probed", r.host, r.service, r.busid);
+                if (auto err = KeWaitForSingleObject(&host.probed, Executive, KernelMode, false, nullptr)) {
+                        Trace(TRACE_LEVEL_ERROR, "KeWaitForSingleObject %!STATUS!", err);
+                }
+        }
+
+        if (host.failed) {
+                TraceDbg("%s:%s/%s, skip, connect to the host failed", r.host, r.service, r.busid);
+                NT_ASSERT(!probe);
+                return;
+        }
+
+        Trace(TRACE_LEVEL_INFORMATION, "%s:%s/%s", r.host, r.service, r.busid);
+
+        if (auto err = vhci::plugin_hardware(vhci, r); err && can_retry(err)) {
+                Trace(TRACE_LEVEL_ERROR, "%s:%s/%s %!STATUS!", r.host, r.service, r.busid, err);
+                host.failed = true;
+        } else {
+                if (err) {
+                        Trace(TRACE_LEVEL_ERROR, "%s:%s/%s %!STATUS!", r.host, r.service, r.busid, err);
+                }
+                host.reached = true;
+                item.done = true; // do not try to connect to this device again
+        }
+
+        if (probe) { // failed/reached must be set before waiters are released
+                InterlockedExchange(&host.probe, PROBE_DONE);
+                KeSetEvent(&host.probed, IO_NO_INCREMENT, false);
+        }
+}
+
+/*
+ * Takes devices of the current round until they run out.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void attach_worker(_Inout_ attach_state &st)
+{
+        PAGED_CODE();
+        auto vhci = get_handle(st.vhci);
+
+        while (sleep(*st.vhci, 0)) {
+                auto i = ULONG(InterlockedIncrement(&st.next_item)) - 1;
+                if (i >= st.item_cnt) {
+                        break;
+                }
+
+                if (auto &item = st.items[i]; item.host) {
+                        plugin_hardware(vhci, item);
+                }
+        }
+}
+
+_IRQL_requires_same_
+_Function_class_(KSTART_ROUTINE)
+PAGED void attach_worker_thread(_In_ void *ctx)
+{
+        PAGED_CODE();
+        KeSetPriorityThread(KeGetCurrentThread(), LOW_PRIORITY + 1);
+
+        attach_worker(*static_cast<attach_state*>(ctx));
+}
+
+/*
+ * The calling thread is one of the workers.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void run_round(_Inout_ attach_state &st, _In_ ULONG parallelism)
+{
+        PAGED_CODE();
+
+        const auto access = THREAD_ALL_ACCESS;
+        auto fdo = WdfDeviceWdmGetDeviceObject(get_handle(st.vhci));
+
+        PVOID threads[MAX_PARALLELISM];
+        ULONG cnt = 0;
+
+        for ( ; cnt + 1 < parallelism; ++cnt) {
+                if (HANDLE handle;
+                    auto err = IoCreateSystemThread(fdo, &handle, access, nullptr, nullptr,
+                                                    nullptr, attach_worker_thread, &st)) {
+                        Trace(TRACE_LEVEL_ERROR, "IoCreateSystemThread %!STATUS!", err);
+                        break;
+                } else {
+                        NT_VERIFY(NT_SUCCESS(ObReferenceObjectByHandle(handle, access, *PsThreadType, KernelMode,
+                                                                       &threads[cnt], nullptr)));
+                        NT_VERIFY(NT_SUCCESS(ZwClose(handle)));
+                }
+        }
+
+        attach_worker(st);
+
+        for (ULONG i = 0; i < cnt; ++i) {
+                if (auto err = KeWaitForSingleObject(threads[i], Executive, KernelMode, false, nullptr)) {
+                        Trace(TRACE_LEVEL_ERROR, "KeWaitForSingleObject %!STATUS!", err);
+                }
+                ObDereferenceObject(threads[i]);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void finish_round(_Inout_ attach_state &st, _In_ WDFCOLLECTION devices, _In_ LONG64 now)
+{
+        PAGED_CODE();
+
+        for (auto i = st.item_cnt; i--; ) { // from the end because items are removed
+                if (st.items[i].done) {
+                        if (auto s = (WDFSTRING)WdfCollectionGetItem(devices, i)) {
+                                UNICODE_STRING str{};
+                                WdfStringGetUnicodeString(s, &str);
+                                TraceDbg("exclude %!USTR!", &str);
+                        }
+                        WdfCollectionRemoveItem(devices, i);
+                }
+        }
+
+        ULONG cnt = 0;
+
+        for (ULONG i = 0; i < st.host_cnt; ++i) {
+                auto &h = st.hosts[i];
+
+                if (h.failed) {
+                        auto secs = get_delay(++h.failures);
+                        h.retry_time = now + secs*wdm::second;
+                        TraceDbg("%s, failures %lu, retry in %lu sec.", h.host, h.failures, secs);
+                } else if (h.reached) {
+                        h.failures = 0;
+                }
+
+                h.failed = false;
+                h.reached = false;
+
+                if (!h.failures) {
+                        continue; // a host without failures has no state, forget it
+                } else if (cnt != i) {
+                        RtlCopyMemory(&st.hosts[cnt], &h, sizeof(h));
+                }
+
+                ++cnt;
+        }
+
+        st.host_cnt = cnt;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void plugin_persistent_devices(_In_ vhci_ctx &ctx)
@@ -287,50 +520,40 @@ PAGED void plugin_persistent_devices(_In_ vhci_ctx &ctx)
                 return;
         }
 
-        auto vhci = get_handle(&ctx);
-
-        auto target = make_target(vhci);
-        if (!target) {
+        unique_ptr buf(PagedPool, sizeof(attach_state));
+        if (!buf) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate attach_state");
                 return;
         }
 
-        vhci::ioctl::plugin_hardware req{{ .size = sizeof(req) }};
-
-        WDF_MEMORY_DESCRIPTOR input;
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&input, &req, sizeof(req));
-
-        constexpr auto outlen = offsetof(vhci::ioctl::plugin_hardware, port) + sizeof(req.port);
+        auto &st = *buf.get<attach_state>();
+        st.vhci = &ctx;
 
-        WDF_MEMORY_DESCRIPTOR output;
-        WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&output, &req, outlen);
+        auto parallelism = get_parallelism(key.get());
+        TraceDbg("parallelism %lu", parallelism);
 
-        for (ULONG attempt = 0; true; ++attempt) {
+        for (ULONG round = 0; sleep(ctx, 0); ++round) {
 
-                auto cnt = get_count(devices.get<WDFCOLLECTION>(), key.get(), attempt);
+                auto cnt = get_count(devices.get<WDFCOLLECTION>(), key.get(), round);
                 if (!cnt) {
                         break;
                 }
 
-                if (auto secs = get_delay(attempt, cnt)) {
-                        TraceDbg("attempt #%lu, %lu device(s), sleep %lu sec.", attempt, cnt, secs);
+                auto now = LONG64(KeQueryInterruptTime());
+                auto wakeup = MAXLONG64;
+
+                if (auto ready = prepare_round(st, devices.get<WDFCOLLECTION>(), cnt, now, wakeup)) {
+                        TraceDbg("round #%lu, %lu of %lu device(s)", round, ready, cnt);
+                        run_round(st, min(parallelism, ready));
+                        finish_round(st, devices.get<WDFCOLLECTION>(), LONG64(KeQueryInterruptTime()));
+                } else if (wakeup != MAXLONG64) { // all hosts are waiting for retry
+                        auto secs = ULONG((wakeup - now + wdm::second - 1)/wdm::second);
+                        TraceDbg("round #%lu, %lu device(s), sleep %lu sec.", round, cnt, secs);
                         if (!sleep(ctx, secs)) {
                                 break;
                         }
-                }
-
-                for (ULONG i = 0; i < cnt && sleep(ctx, 0); ) {
-                        UNICODE_STRING str{};
-                        if (auto s = (WDFSTRING)WdfCollectionGetItem(devices.get<WDFCOLLECTION>(), i)) {
-                                WdfStringGetUnicodeString(s, &str);
-                        }
-
-                        if (plugin_hardware(str, target.get<WDFIOTARGET>(), req, input, output, outlen)) {
-                                TraceDbg("exclude %!USTR!", &str);
-                                WdfCollectionRemoveItem(devices.get<WDFCOLLECTION>(), i);
-                                --cnt;
-                        } else {
-                                ++i;
-                        }
+                } else { // malformed strings only
+                        finish_round(st, devices.get<WDFCOLLECTION>(), now);
                 }
         }
 }
@@ -9,6 +9,7 @@
 #include "context.h"
 
 #include <libdrv\ch9.h>
+#include <libdrv\pdu.h>
 #include <libdrv\usbd_helper.h>
 
 namespace
@@ -38,18 +39,47 @@ auto fix_transfer_flags(_In_ ULONG TransferFlags, _In_ bool dir_out)
 } // namespace
 
 
+/*
+ * The fields of CMD_SUBMIT that are the same for all transfers of the endpoint, in network byte order.
+ * It is built once in endpoint_add, see endpoint_ctx::cmd_submit.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::make_cmd_submit_template(
+	_Out_ usbip_header &hdr, _In_ const device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd)
+{
+	RtlZeroMemory(&hdr, sizeof(hdr));
+
+	if (auto r = &hdr.base) {
+		r->command = USBIP_CMD_SUBMIT;
+		r->devid = dev.devid();
+		r->direction = usb_endpoint_dir_out(epd) ? USBIP_DIR_OUT : USBIP_DIR_IN;
+		r->ep = usb_endpoint_num(epd);
+	}
+
+	if (auto r = &hdr.u.cmd_submit) {
+		r->number_of_packets = number_of_packets_non_isoch;
+		r->interval = epd.bInterval;
+	}
+
+	byteswap_header(hdr, swap_dir::host2net);
+}
+
 /*
  * Direction in TransferFlags can be invalid for bulk transfer at least.
  * Always use direction from endpoint descriptor except for control pipe where setup packet has direction.
  * 
  * Default control pipe is bidirectional, direction in setup packet must be used instead of descriptor.
  * FIXME: are there exist non-default unidirectional control pipes?
+ *
+ * The header is copied from the endpoint's template, only the fields that vary are set.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS usbip::set_cmd_submit_usbip_header(
-	_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd,
+	_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ const endpoint_ctx &endp,
 	_In_ ULONG TransferFlags, _In_ ULONG TransferBufferLength, _In_ setup_dir setup_out)
 {
+	auto &epd = endp.descriptor;
+
 	if ((TransferFlags & USBD_DEFAULT_PIPE_TRANSFER) && !usb_default_control_pipe(epd)) {
 		Trace(TRACE_LEVEL_ERROR, "Inconsistency between TransferFlags(USBD_DEFAULT_PIPE_TRANSFER) and "
 			                 "bEndpointAddress(%#x)", epd.bEndpointAddress);
@@ -62,26 +92,22 @@ NTSTATUS usbip::set_cmd_submit_usbip_header(
 
 	TransferFlags = fix_transfer_flags(TransferFlags, dir_out);
 
+	hdr = endp.cmd_submit;
+
 	if (auto r = &hdr.base) {
-		r->command = USBIP_CMD_SUBMIT;
-		r->seqnum = next_seqnum(dev, !dir_out);
-		r->devid = dev.devid();
-		r->direction = dir_out ? USBIP_DIR_OUT : USBIP_DIR_IN;
-		r->ep = usb_endpoint_num(epd);
+		r->seqnum = RtlUlongByteSwap(next_seqnum(dev, !dir_out));
+		if (setup_out) {
+			r->direction = RtlUlongByteSwap(dir_out ? USBIP_DIR_OUT : USBIP_DIR_IN);
+		}
 	}
 
 	if (auto r = &hdr.u.cmd_submit) {
-		r->transfer_flags = to_linux_flags(TransferFlags, !dir_out);
-		r->transfer_buffer_length = TransferBufferLength;
-		r->start_frame = 0;
-		r->number_of_packets = number_of_packets_non_isoch;
-		r->interval = epd.bInterval;
-		RtlZeroMemory(r->setup, sizeof(r->setup));
+		r->transfer_flags = RtlUlongByteSwap(to_linux_flags(TransferFlags, !dir_out));
+		r->transfer_buffer_length = RtlUlongByteSwap(TransferBufferLength);
 	}
 
 	return STATUS_SUCCESS;
 }
-
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void usbip::set_cmd_unlink_usbip_header(
 	_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ seqnum_t seqnum_unlink)
@@ -96,4 +122,6 @@ void usbip::set_cmd_unlink_usbip_header(
 
 	NT_ASSERT(is_valid_seqnum(seqnum_unlink));
 	hdr.u.cmd_unlink.seqnum = seqnum_unlink;
+
+	byteswap_header(hdr, swap_dir::host2net);
 }
@@ -13,6 +13,7 @@ namespace usbip
 {
 
 struct device_ctx;
+struct endpoint_ctx;
 
 class setup_dir
 {
@@ -47,11 +48,21 @@ static_assert(!!setup_dir::out());
 static_assert(*setup_dir::out());
 
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void make_cmd_submit_template(
+	_Out_ usbip_header &hdr, _In_ const device_ctx &dev, _In_ const _USB_ENDPOINT_DESCRIPTOR &epd);
+
+/*
+ * @return hdr in network byte order
+ */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS set_cmd_submit_usbip_header(
-	_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ const _USB_ENDPOINT_DESCRIPTOR &epd,
+	_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ const endpoint_ctx &endp,
 	_In_ ULONG TransferFlags, _In_ ULONG TransferBufferLength = 0, _In_ setup_dir setup_dir_out = setup_dir());
 
+/*
+ * @return hdr in network byte order
+ */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void set_cmd_unlink_usbip_header(_Out_ usbip_header &hdr, _Inout_ device_ctx &dev, _In_ seqnum_t seqnum_unlink);
 
@@ -12,6 +12,10 @@
 #include "network.h"
 #include "ioctl.h"
 #include "persistent.h"
+#include "descriptor_prefetch.h"
+#include "endpoint_list.h"
+#include "counters.h"
+#include "capture.h"
 
 #include <usbip\proto_op.h>
 
@@ -346,6 +350,11 @@ PAGED auto plugin_hardware(_In_ WDFDEVICE vhci, _Inout_ vhci::ioctl::plugin_hard
         }
         ext.release(); // now dev owns it
 
+        if (auto err = prefetch_descriptors(*get_device_ctx(dev))) { // optional, the cache is empty
+                Trace(TRACE_LEVEL_WARNING, "dev %04x, prefetch descriptors error %#lx, go on without them",
+                                            ptr04x(dev), err);
+        }
+
         if (auto err = start_device(port, dev)) {
                 WdfObjectDelete(dev); // UdecxUsbDevicePlugIn failed or was not called
                 return err;
@@ -501,6 +510,234 @@ PAGED auto driver_registry_path(_In_ WDFREQUEST request)
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void fill(_Inout_ vhci::ioctl::get_device_stats &r, _In_ device_ctx &dev)
+{
+        r.device = get_stats(dev);
+        {
+                wdf::Lock lck(dev.send_lock);
+                r.sent_batches = dev.sent_batches;
+                r.sent_pdus = dev.sent_pdus;
+        }
+        {
+                auto &c = dev.descriptors;
+                wdf::Lock lck(c.lock);
+                r.descriptor_hits = c.hits;
+                r.descriptor_misses = c.misses;
+        }
+
+        r.endpoint_cnt = 0;
+
+        auto f = [] (const endpoint_ctx &endp, void *context)
+        {
+                auto &r = *static_cast<vhci::ioctl::get_device_stats*>(context);
+                if (r.endpoint_cnt == ARRAYSIZE(r.endpoints)) {
+                        return;
+                }
+
+                auto &e = r.endpoints[r.endpoint_cnt++];
+                e.bEndpointAddress = endp.descriptor.bEndpointAddress;
+                e.bmAttributes = endp.descriptor.bmAttributes;
+                e.counters = endp.stats;
+        };
+
+        for_each_endpoint(dev, f, &r);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_device_stats(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        vhci::ioctl::get_device_stats *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (length != sizeof(*r)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (r->size != sizeof(*r) || r->version != r->VERSION) {
+                Trace(TRACE_LEVEL_ERROR, "get_device_stats.size %lu != sizeof(get_device_stats) %Iu "
+                                         "|| version %lu != %d", r->size, sizeof(*r), r->version, r->VERSION);
+
+                return as_ntstatus(USBIP_ERROR_ABI);
+        }
+
+        if (!is_valid_port(r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(get_vhci(request), r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        fill(*r, *get_device_ctx(dev.get()));
+        TraceDbg("port %d, %lu endpoint(s)", r->port, r->endpoint_cnt);
+
+        WdfRequestSetInformation(request, sizeof(*r));
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Histograms are updated concurrently and are not a consistent snapshot.
+ * @return false if the endpoint is not found
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool fill(_Inout_ vhci::ioctl::get_endpoint_latency &r, _In_ device_ctx &dev)
+{
+        LARGE_INTEGER freq;
+        KeQueryPerformanceCounter(&freq);
+        r.frequency = freq.QuadPart;
+
+        r.send = dev.send_latency;
+
+        struct search
+        {
+                vhci::ioctl::get_endpoint_latency &r;
+                bool found;
+        } ctx{ r };
+
+        auto f = [] (const endpoint_ctx &endp, void *context)
+        {
+                auto &ctx = *static_cast<search*>(context);
+
+                if (!ctx.found && endp.descriptor.bEndpointAddress == ctx.r.bEndpointAddress) {
+                        static_assert(sizeof(ctx.r.stages) == sizeof(endp.latency));
+                        RtlCopyMemory(ctx.r.stages, endp.latency, sizeof(endp.latency));
+                        ctx.found = true;
+                }
+        };
+
+        for_each_endpoint(dev, f, &ctx);
+        return ctx.found;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_endpoint_latency(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        vhci::ioctl::get_endpoint_latency *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (length != sizeof(*r)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (r->size != sizeof(*r) || r->version != r->VERSION) {
+                Trace(TRACE_LEVEL_ERROR, "get_endpoint_latency.size %lu != sizeof(get_endpoint_latency) %Iu "
+                                         "|| version %lu != %d", r->size, sizeof(*r), r->version, r->VERSION);
+
+                return as_ntstatus(USBIP_ERROR_ABI);
+        }
+
+        if (!is_valid_port(r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(get_vhci(request), r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        if (!fill(*r, *get_device_ctx(dev.get()))) {
+                TraceDbg("port %d, endpoint %#04x not found", r->port, r->bEndpointAddress);
+                return STATUS_NOT_FOUND;
+        }
+
+        WdfRequestSetInformation(request, sizeof(*r));
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto set_capture(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        vhci::ioctl::set_capture *r{};
+
+        if (size_t length;
+            auto err = WdfRequestRetrieveInputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &length)) {
+                return err;
+        } else if (length != sizeof(*r)) {
+                return STATUS_INVALID_BUFFER_SIZE;
+        } else if (r->size != sizeof(*r) || r->version != r->VERSION) {
+                Trace(TRACE_LEVEL_ERROR, "set_capture.size %lu != sizeof(set_capture) %Iu "
+                                         "|| version %lu != %d", r->size, sizeof(*r), r->version, r->VERSION);
+
+                return as_ntstatus(USBIP_ERROR_ABI);
+        }
+
+        if (!is_valid_port(r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(get_vhci(request), r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        return enable_capture(*get_device_ctx(dev.get()), r->enable);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_capture(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+
+        size_t outlen;
+        vhci::ioctl::get_capture *r{};
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r) || r->version != r->VERSION) {
+                Trace(TRACE_LEVEL_ERROR, "get_capture.size %lu != sizeof(get_capture) %Iu "
+                                         "|| version %lu != %d", r->size, sizeof(*r), r->version, r->VERSION);
+
+                return as_ntstatus(USBIP_ERROR_ABI);
+        }
+
+        if (!is_valid_port(r->port)) {
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        auto dev = vhci::get_device(get_vhci(request), r->port);
+        if (!dev) {
+                return STATUS_DEVICE_NOT_CONNECTED;
+        }
+
+        LARGE_INTEGER freq;
+        r->timestamp = KeQueryPerformanceCounter(&freq).QuadPart;
+        r->frequency = freq.QuadPart;
+
+        LARGE_INTEGER now;
+        KeQuerySystemTimePrecise(&now);
+        r->system_time = now.QuadPart;
+
+        auto max_cnt = (outlen - offsetof(vhci::ioctl::get_capture, records))/sizeof(*r->records);
+        ULONG cnt;
+
+        if (auto err = read_capture(*get_device_ctx(dev.get()), r->records, ULONG(max_cnt), cnt, r->lost)) {
+                return err;
+        }
+
+        r->count = cnt;
+        TraceDbg("port %d, %lu record(s), lost %I64u", r->port, cnt, r->lost);
+
+        auto written = vhci::ioctl::get_capture_size(cnt);
+        NT_ASSERT(written <= outlen);
+        WdfRequestSetInformation(request, written);
+
+        return STATUS_SUCCESS;
+}
+
 /*
  * IRP_MJ_DEVICE_CONTROL
  * 
@@ -541,6 +778,18 @@ void device_control(
         case vhci::ioctl::DRIVER_REGISTRY_PATH:
                 st = driver_registry_path(Request);
                 break;
+        case vhci::ioctl::GET_DEVICE_STATS:
+                st = get_device_stats(Request);
+                break;
+        case vhci::ioctl::GET_ENDPOINT_LATENCY:
+                st = get_endpoint_latency(Request);
+                break;
+        case vhci::ioctl::SET_CAPTURE:
+                st = set_capture(Request);
+                break;
+        case vhci::ioctl::GET_CAPTURE:
+                st = get_capture(Request);
+                break;
         case IOCTL_USB_USER_REQUEST:
                 NT_ASSERT(!has_urb(Request));
                 if (USBUSER_REQUEST_HEADER *hdr; 
@@ -563,6 +812,19 @@ void device_control(
 } // namespace
 
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::vhci::plugin_hardware(_In_ WDFDEVICE vhci, _Inout_ ioctl::plugin_hardware &r)
+{
+        PAGED_CODE();
+
+        if (auto err = ::plugin_hardware(vhci, r)) {
+                return as_ntstatus(err);
+        }
+
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS usbip::vhci::create_default_queue(_In_ WDFDEVICE vhci)
@@ -7,6 +7,8 @@
 #include <libdrv\codeseg.h>
 #include <libdrv/wdf_cpp.h>
 
+#include <usbip\vhci.h>
+
 namespace usbip::vhci
 {
 
@@ -14,4 +16,12 @@ _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS create_default_queue(_In_ WDFDEVICE vhci);
 
+/*
+ * The same as IOCTL PLUGIN_HARDWARE, but bypasses the default queue that dispatches requests sequentially.
+ * Can be called concurrently.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS plugin_hardware(_In_ WDFDEVICE vhci, _Inout_ ioctl::plugin_hardware &r);
+
 } // namespace usbip::vhci
@@ -6,7 +6,23 @@
 #include "trace.h"
 #include "wsk_context.tmh"
 
+#include "context.h"
+
 #include <libdrv/codeseg.h>
+#include <usbip/object_pool.h>
+
+/*
+ * Preallocated contexts of a device, slabs are added by endpoint_add.
+ * The pool is freed when the device is closed and all taken contexts are returned, @see usbip\object_pool.h.
+ */
+struct usbip::wsk_context_pool
+{
+        SLIST_HEADER free; // idle contexts
+        volatile LONG refs; // the device and every context taken from free
+        volatile LONG64 fallbacks; // allocations from the global lookaside list because free was empty
+        pool_slab<wsk_context> *slabs;
+        UINT32 capacity;
+};
 
 namespace
 {
@@ -17,30 +33,69 @@ ULONG g_tag;
 bool g_initialized;
 LOOKASIDE_LIST_EX g_lookaside;
 
+enum : UINT32 { POOL_MAX_CAPACITY = 64 }; // of a device, endpoints can be added many times
+
+/*
+ * Frees resources of the context, but not its memory.
+ */
 _IRQL_requires_same_
-_Function_class_(free_function_ex)
-void free_function_ex(_In_ __drv_freesMem(Mem) void *Buffer, _Inout_ LOOKASIDE_LIST_EX*)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void destroy(_Inout_ wsk_context &ctx)
 {
-        auto ctx = static_cast<wsk_context*>(Buffer);
-        NT_ASSERT(ctx);
+        TraceWSK("%04x, isoc[%Iu]", ptr04x(&ctx), ctx.isoc_alloc_cnt);
 
-        TraceWSK("%04x, isoc[%Iu]", ptr04x(ctx), ctx->isoc_alloc_cnt);
+        ctx.mdl_hdr.reset();
+        ctx.mdl_buf.reset();
+        ctx.mdl_isoc.reset();
 
-        ctx->mdl_hdr.reset();
-        ctx->mdl_buf.reset();
-        ctx->mdl_isoc.reset();
-
-        if (auto irp = ctx->wsk_irp) {
+        if (auto irp = ctx.wsk_irp) {
                 IoFreeIrp(irp);
         }
 
-        if (auto ptr = ctx->isoc) {
+        if (auto ptr = ctx.isoc) {
                 ExFreePoolWithTag(ptr, g_tag);
         }
+}
 
+/*
+ * @param ctx zeroed memory
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS init(_Inout_ wsk_context &ctx)
+{
+        ctx.mdl_hdr = Mdl(&ctx.hdr, sizeof(ctx.hdr));
+
+        if (auto err = ctx.mdl_hdr.prepare_nonpaged()) {
+                Trace(TRACE_LEVEL_ERROR, "mdl_hdr %!STATUS!", err);
+                return err;
+        }
+
+        ctx.wsk_irp = IoAllocateIrp(1, false);
+        if (!ctx.wsk_irp) {
+                Trace(TRACE_LEVEL_ERROR, "IoAllocateIrp -> NULL");
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        TraceWSK("%04x", ptr04x(&ctx));
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_Function_class_(free_function_ex)
+void free_function_ex(_In_ __drv_freesMem(Mem) void *Buffer, _Inout_ LOOKASIDE_LIST_EX*)
+{
+        auto ctx = static_cast<wsk_context*>(Buffer);
+        NT_ASSERT(ctx);
+        NT_ASSERT(!ctx->pool);
+
+        destroy(*ctx);
         ExFreePoolWithTag(ctx, g_tag);
 }
 
+/*
+ * PoolType is ignored, wsk_context must be cache aligned.
+ */
 _IRQL_requires_same_
 _Function_class_(allocate_function_ex)
 void *allocate_function_ex(_In_ POOL_TYPE PoolType, _In_ SIZE_T NumberOfBytes, _In_ ULONG Tag, _Inout_ LOOKASIDE_LIST_EX *list)
@@ -48,46 +103,89 @@ void *allocate_function_ex(_In_ POOL_TYPE PoolType, _In_ SIZE_T NumberOfBytes, _
         NT_ASSERT(PoolType == NonPagedPoolNx);
         NT_ASSERT(Tag == g_tag);
 
-        auto ctx = (wsk_context*)ExAllocatePoolZero(PoolType, NumberOfBytes, Tag);
+        auto ctx = (wsk_context*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, NumberOfBytes, Tag);
         if (!ctx) {
                 Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", NumberOfBytes);
                 return nullptr;
         }
 
-        ctx->mdl_hdr = Mdl(&ctx->hdr, sizeof(ctx->hdr));
-
-        if (auto err = ctx->mdl_hdr.prepare_nonpaged()) {
-                Trace(TRACE_LEVEL_ERROR, "mdl_hdr %!STATUS!", err);
+        if (init(*ctx)) {
                 free_function_ex(ctx, list);
                 return nullptr;
         }
 
-        ctx->wsk_irp = IoAllocateIrp(1, false);
-        if (!ctx->wsk_irp) {
-                Trace(TRACE_LEVEL_ERROR, "IoAllocateIrp -> NULL");
-                free_function_ex(ctx, list);
-                return nullptr;
+        return ctx;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_pool(_In_ wsk_context_pool *pool)
+{
+        TraceDbg("pool %04x, capacity %lu, fallbacks %I64d", ptr04x(pool), pool->capacity, pool->fallbacks);
+
+        for (auto slab = pool->slabs; slab; ) {
+                auto next = slab->next;
+
+                for (UINT32 i = 0; i < slab->cnt; ++i) {
+                        destroy(slab->objects()[i]);
+                }
+
+                ExFreePoolWithTag(slab, g_tag);
+                slab = next;
         }
 
-        TraceWSK("%04x", ptr04x(ctx));
-        return ctx;
+        ExFreePoolWithTag(pool, g_tag);
 }
 
+struct pool_traits
+{
+        using pool_type = wsk_context_pool;
+        using object_type = wsk_context;
+
+        static wsk_context *pop_free(_Inout_ wsk_context_pool &pool)
+        {
+                auto entry = InterlockedPopEntrySList(&pool.free);
+                return entry ? CONTAINING_RECORD(entry, wsk_context, slist) : nullptr;
+        }
+
+        static void push_free(_Inout_ wsk_context_pool &pool, _Inout_ wsk_context &ctx)
+        {
+                InterlockedPushEntrySList(&pool.free, &ctx.slist);
+        }
+
+        static void add_ref(_Inout_ wsk_context_pool &pool) { InterlockedIncrement(&pool.refs); }
+        static bool release_ref(_Inout_ wsk_context_pool &pool) { return !InterlockedDecrement(&pool.refs); }
+
+        static void add_fallback(_Inout_ wsk_context_pool &pool) { InterlockedIncrement64(&pool.fallbacks); }
+        static auto get_pool(_In_ const wsk_context &ctx) { return ctx.pool; }
+
+        static void free_pool(_In_ wsk_context_pool &pool) { ::free_pool(&pool); }
+};
+
+using context_pool = object_pool<pool_traits, POOL_MAX_CAPACITY>;
+
 /*
  * If use ExFreeToLookasideListEx in case of error, next ExAllocateFromLookasideListEx will return the same pointer.
  * free_function_ex is used instead in hope that next object in the LookasideList may have required buffer.
+ * A context of the pool is returned to it, the global lookaside list will be used next time if the pool is empty.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto alloc_wsk_context(_In_ ULONG NumberOfPackets)
+auto alloc_wsk_context(_In_opt_ wsk_context_pool *pool, _In_ ULONG NumberOfPackets)
 {
-        auto ctx = (wsk_context*)ExAllocateFromLookasideListEx(&g_lookaside);
+        auto ctx = pool ? context_pool::pop(*pool) : nullptr;
+
+        if (!ctx) {
+                ctx = (wsk_context*)ExAllocateFromLookasideListEx(&g_lookaside);
+        }
 
         if (!ctx) {
                 Trace(TRACE_LEVEL_ERROR, "ExAllocateFromLookasideListEx error");
         } else if (auto err = prepare_isoc(*ctx, NumberOfPackets)) {
                 Trace(TRACE_LEVEL_ERROR, "prepare_isoc(NumberOfPackets %lu) %!STATUS!", NumberOfPackets, err);
-                free_function_ex(ctx, &g_lookaside);
+                if (!context_pool::push(*ctx)) {
+                        free_function_ex(ctx, &g_lookaside);
+                }
                 ctx = nullptr;
         }
 
@@ -127,6 +225,67 @@ void usbip::delete_wsk_context_list()
         }
 }
 
+/*
+ * Preallocates contexts for the endpoint of a device, so WSK I/O does not allocate them.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::add_wsk_contexts(_Inout_ wsk_context_pool* &pool, _In_ ULONG cnt)
+{
+        PAGED_CODE();
+
+        if (!pool) {
+                pool = (wsk_context_pool*)ExAllocatePoolZero(NonPagedPoolNx, sizeof(*pool), g_tag);
+                if (!pool) {
+                        Trace(TRACE_LEVEL_ERROR, "Can't allocate wsk_context_pool");
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                }
+                InitializeSListHead(&pool->free);
+                pool->refs = 1;
+        }
+
+        cnt = context_pool::get_slab_count(pool->capacity, cnt);
+        if (!cnt) {
+                return STATUS_SUCCESS;
+        }
+
+        auto size = context_pool::slab_type::get_size(cnt);
+
+        auto slab = (context_pool::slab_type*)ExAllocatePoolZero(NonPagedPoolNxCacheAligned, size, g_tag);
+        if (!slab) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", size);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        context_pool::add_slab(*pool, *slab, cnt);
+
+        for (UINT32 i = 0; i < cnt; ++i) {
+                auto &ctx = slab->objects()[i];
+                if (auto err = init(ctx)) {
+                        return err; // the slab is freed with the pool
+                }
+
+                ctx.pool = pool;
+                context_pool::push_new(*pool, ctx);
+        }
+
+        TraceDbg("pool %04x, capacity %lu", ptr04x(pool), pool->capacity);
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Contexts that are in use return to the pool, the last one frees it.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::close_wsk_context_pool(_Inout_ wsk_context_pool* &pool)
+{
+        if (auto p = pool) {
+                pool = nullptr;
+                context_pool::release(*p);
+        }
+}
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto usbip::alloc_wsk_context(
@@ -134,7 +293,7 @@ auto usbip::alloc_wsk_context(
 {
         NT_ASSERT(dev);
 
-        auto ctx = ::alloc_wsk_context(NumberOfPackets);
+        auto ctx = ::alloc_wsk_context(dev->wsk_pool, NumberOfPackets);
         if (ctx) {
                 ctx->dev = dev;
                 ctx->request = request;
@@ -160,7 +319,9 @@ void usbip::free(_In_opt_ wsk_context *ctx, _In_ bool reuse_irp)
                 IoReuseIrp(ctx->wsk_irp, STATUS_SUCCESS);
         }
 
-        ExFreeToLookasideListEx(&g_lookaside, ctx);
+        if (!context_pool::push(*ctx)) {
+                ExFreeToLookasideListEx(&g_lookaside, ctx);
+        }
 }
 
 _IRQL_requires_same_
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <libdrv/wdf_cpp.h>
+#include <libdrv\codeseg.h>
 
 #include <usbip\proto.h>
 #include <libdrv\mdl_cpp.h>
@@ -13,28 +14,38 @@ namespace usbip
 {
 
 struct device_ctx;
+struct wsk_context_pool;
 
-struct wsk_context
+/*
+ * The fields that are touched for every PDU are in the first two cache lines, the rest are cold.
+ * Objects are allocated from NonPagedPoolNxCacheAligned, @see wsk_context_pool.
+ */
+struct alignas(SYSTEM_CACHE_ALIGNMENT_SIZE) wsk_context
 {
-        device_ctx *dev; // UDECXUSBDEVICE can be obtained from WDFREQUEST, but it is optional
-
-        // transient data
+        SLIST_ENTRY slist; // wsk_context_pool::free
+        wsk_context_pool *pool; // owner, nullptr if the object is from the global lookaside list
 
+        device_ctx *dev; // UDECXUSBDEVICE can be obtained from WDFREQUEST, but it is optional
         WDFREQUEST request; // can be WDF_NO_HANDLE
-        Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
 
-        // preallocated data
+        IRP *wsk_irp; // preallocated
+        Mdl mdl_hdr; // preallocated, describes hdr
+
+        alignas(SYSTEM_CACHE_ALIGNMENT_SIZE) usbip_header hdr;
+        wsk_context *next; // in a batch, its MDL chain is linked to the chain of this context
+        size_t send_size; // get_total_size(hdr)
 
-        IRP *wsk_irp;
+        // cold data
 
-        Mdl mdl_hdr;
-        usbip_header hdr;
+        Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
+        LIST_ENTRY entry; // device_ctx::send_pending
 
         Mdl mdl_isoc;
         usbip_iso_packet_descriptor *isoc;
         ULONG isoc_alloc_cnt;
         bool is_isoc;
 };
+static_assert(!(FIELD_OFFSET(wsk_context, hdr) % SYSTEM_CACHE_ALIGNMENT_SIZE));
 
 
 _IRQL_requires_same_
@@ -45,6 +56,14 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void delete_wsk_context_list();
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS add_wsk_contexts(_Inout_ wsk_context_pool* &pool, _In_ ULONG cnt);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void close_wsk_context_pool(_Inout_ wsk_context_pool* &pool);
+
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -69,6 +88,8 @@ inline auto number_of_packets(_In_ const wsk_context &ctx)
 class wsk_context_ptr 
 {
 public:
+        wsk_context_ptr() = default;
+
         template<typename... Args>
         wsk_context_ptr(Args&&... args) : m_ctx(alloc_wsk_context(args...)) {}
 
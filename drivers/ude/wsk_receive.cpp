@@ -10,9 +10,14 @@
 #include "wsk_context.h"
 #include "device.h"
 #include "device_queue.h"
+#include "device_ioctl.h"
+#include "descriptor_cache.h"
 #include "network.h"
 #include "driver.h"
 #include "ioctl.h"
+#include "counters.h"
+#include "latency.h"
+#include "capture.h"
 
 #include <libdrv\usbd_helper.h>
 #include <libdrv\dbgcommon.h>
@@ -20,17 +25,44 @@
 #include <libdrv\irp.h>
 #include <libdrv\pdu.h>
 
+#include <usbip\isoc.h>
+#include <usbip\pdu_parser.h>
+
 namespace
 {
 
 using namespace usbip;
 
-using PWSK_CONTEXT = wsk_context*;
-WDF_DECLARE_CONTEXT_TYPE(PWSK_CONTEXT); // WdfObjectGet_PWSK_CONTEXT
+enum : ULONG { 
+	RECV_BUF_SIZE = 64*1024, // can hold many PDUs at once
+	DIRECT_RECV_MIN = PAGE_SIZE // receive the rest of the payload directly to URB's buffers if it is not less
+};
 
-inline auto& get_wsk_context(_In_ WDFWORKITEM wi)
+/*
+ * Context space for device_ctx::recv_hdr.
+ * A server's stream is read by chunks into the staging buffer and is split into PDUs by the parser.
+ */
+struct receive_ctx
 {
-	return *WdfObjectGet_PWSK_CONTEXT(wi);
+	wsk_context *wsk;
+	pdu_parser parser; // zeroed memory is a valid initial state
+
+	void *buf; // RECV_BUF_SIZE bytes, staging buffer
+	Mdl mdl; // describes buf
+
+	MDL *payload; // chain of MDLs for the payload of the current PDU, @see prepare_wsk_mdl
+	capture_ptr capture; // record of the current PDU
+};
+WDF_DECLARE_CONTEXT_TYPE(receive_ctx); // WdfObjectGet_receive_ctx
+
+inline auto& get_receive_ctx(_In_ WDFWORKITEM wi)
+{
+	return *WdfObjectGet_receive_ctx(wi);
+}
+
+inline auto& get_receive_ctx(_In_ const device_ctx &dev)
+{
+	return get_receive_ctx(dev.recv_hdr);
 }
 
 _Function_class_(EVT_WDF_OBJECT_CONTEXT_DESTROY)
@@ -43,10 +75,18 @@ PAGED void NTAPI workitem_destroy(_In_ WDFOBJECT Object)
 	auto wi = static_cast<WDFWORKITEM>(Object);
 	TraceDbg("%04x", ptr04x(wi));
 
-	if (auto ctx = get_wsk_context(wi)) {
+	auto &rcv = get_receive_ctx(wi);
+
+	if (auto ctx = rcv.wsk) {
 		NT_ASSERT(!ctx->request); // must be completed and zeroed
 		free(ctx, true);
 	}
+
+	rcv.mdl.reset();
+
+	if (auto buf = rcv.buf) {
+		ExFreePoolWithTag(buf, pooltag);
+	}
 }
 
 constexpr auto check(_In_ ULONG TransferBufferLength, _In_ int actual_length)
@@ -96,6 +136,8 @@ inline auto& get_ret_submit(_In_ const wsk_context &ctx)
 }
 
 /*
+ * @param src in network byte order
+ *
  * Buffer from the server has no gaps (compacted), SUM(src->actual_length) == actual_length,
  * src->offset is ignored for that reason.
  *
@@ -111,16 +153,19 @@ inline auto& get_ret_submit(_In_ const wsk_context &ctx)
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer, _In_ ULONG length, 
-	_In_ const usbip_iso_packet_descriptor *src)
+auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_ const isoc::part &p, _In_opt_ UCHAR *buffer, 
+	_In_ ULONG length, _In_ const usbip_iso_packet_descriptor *src)
 {
-	NT_ASSERT(length <= r.TransferBufferLength);
+	NT_ASSERT(length <= p.length);
 	auto dir_out = !buffer;
+	isoc::expander exp(buffer ? buffer + p.offset : nullptr); // offsets are relative to the part
 
-	for (auto i = LONG64(r.NumberOfPackets) - 1; i >= 0; --i) { // set dd.Status and dd.Length
+	for (auto i = LONG64(p.cnt) - 1; i >= 0; --i) { // set dd.Status and dd.Length
 
-		auto sd = src + i;
-		auto dd = r.IsoPacket + i;
+		auto host = isoc::to_host(src[i]); // no separate byteswap pass
+		auto sd = &host;
+		auto dd = r.IsoPacket + p.first + i;
+		auto offset = dd->Offset - p.offset;
 
 		dd->Status = sd->status ? to_windows_status_isoch(sd->status) : USBD_STATUS_SUCCESS;
 
@@ -133,41 +178,36 @@ auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer, _In_
 			continue;
 		}
 
-		if (sd->actual_length > sd->length) {
+		switch (isoc::get_unpack_error(*sd, offset, length, p.length)) {
+		case isoc::unpack_error::none:
+			break;
+		case isoc::unpack_error::actual_length:
 			Trace(TRACE_LEVEL_ERROR, "actual_length(%u) > length(%u)", sd->actual_length, sd->length);
 			return STATUS_INVALID_PARAMETER;
-		}
-
-		if (sd->offset != dd->Offset) { // buffer is compacted, but offsets are intact
-			Trace(TRACE_LEVEL_ERROR, "src.offset(%u) != dst.Offset(%lu)", sd->offset, dd->Offset);
+		case isoc::unpack_error::offset:
+			Trace(TRACE_LEVEL_ERROR, "src.offset(%u) != dst.Offset(%lu) - part.offset(%u)", 
+				                  sd->offset, dd->Offset, p.offset);
 			return STATUS_INVALID_PARAMETER;
-		}
-
-		if (length >= sd->actual_length) {
-			length -= sd->actual_length;
-		} else {
+		case isoc::unpack_error::length:
 			Trace(TRACE_LEVEL_ERROR, "length(%lu) >= actual_length(%u)", length, sd->actual_length);
 			return STATUS_INVALID_PARAMETER;
-		}
-
-		if (dd->Offset + sd->actual_length > r.TransferBufferLength) {
-			Trace(TRACE_LEVEL_ERROR, "dst.Offset(%lu) + src.actual_length(%u) > r.TransferBufferLength(%lu)",
-				dd->Offset, sd->actual_length, r.TransferBufferLength);
+		case isoc::unpack_error::buffer_length:
+			Trace(TRACE_LEVEL_ERROR, "offset(%lu) + src.actual_length(%u) > part.length(%u)",
+				offset, sd->actual_length, p.length);
 			return STATUS_INVALID_PARAMETER;
-		}
-		
-		if (dd->Offset < length) { // source buffer has no gaps
-			Trace(TRACE_LEVEL_ERROR, "dst.Offset(%lu) < length(%lu)", dd->Offset, length);
+		case isoc::unpack_error::gap:
+			Trace(TRACE_LEVEL_ERROR, "offset(%lu) < length(%lu)", offset, length);
 			return STATUS_INVALID_PARAMETER;
 		}
 
-		if (dd->Offset > length) {
-			RtlMoveMemory(buffer + dd->Offset, buffer + length, sd->actual_length);
-		}
-
+		exp.add(length, offset, sd->actual_length);
 		dd->Length = sd->actual_length;
 	}
 
+	if (!dir_out) {
+		exp.flush();
+	}
+
 	if (length && !dir_out) {
 		Trace(TRACE_LEVEL_ERROR, "SUM(actual_length) != actual_length, delta is %lu", length);
 		return STATUS_INVALID_PARAMETER; 
@@ -176,34 +216,48 @@ auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer, _In_
 	return STATUS_SUCCESS;
 }
 
+/*
+ * Isoch URB that has more than USBIP_MAX_ISO_PACKETS is sent by parts, RET_SUBMIT is for request_ctx::part.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto get_isoc_part(_Out_ isoc::part &p, _In_ WDFREQUEST request, _In_ const _URB_ISOCH_TRANSFER &r)
+{
+	auto first = isoc::get_part_first(get_request_ctx(request)->part);
+	return isoc::get_part(p, r.IsoPacket, r.NumberOfPackets, first, r.TransferBufferLength);
+}
+
 /*
  * Layout: transfer buffer(IN only), usbip_iso_packet_descriptor[].
+ * RET_SUBMIT-s of the parts can be received in any order, the last one finishes URB, @see isoc::merge.
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_submit &ret, _Inout_ URB &urb)
 {
 	auto cnt = ret.number_of_packets;
-
 	auto &r = urb.UrbIsochronousTransfer;
-	r.ErrorCount = ret.error_count;
-
-	if (cnt && cnt == ret.error_count) {
-		r.Hdr.Status = USBD_STATUS_ISOCH_REQUEST_FAILED;
-	}
 
-	if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
-		r.StartFrame = ret.start_frame;
+	isoc::part p;
+	if (!get_isoc_part(p, ctx.request, r)) { // was checked by CMD_SUBMIT
+		return STATUS_INVALID_PARAMETER;
 	}
 
-	if (cnt >= 0 && ULONG(cnt) == r.NumberOfPackets) {
-		NT_ASSERT(r.NumberOfPackets == number_of_packets(ctx));
-		byteswap(ctx.isoc, cnt);
+	if (cnt >= 0 && ULONG(cnt) == p.cnt) {
+		NT_ASSERT(p.cnt == number_of_packets(ctx)); // fill_isoc_data swaps bytes
 	} else {
-		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) != NumberOfPackets(%lu)", cnt, r.NumberOfPackets);
+		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) != %lu, NumberOfPackets %lu", cnt, p.cnt, r.NumberOfPackets);
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	auto &req = *get_request_ctx(ctx.request);
+
+	if (auto &dev = *ctx.dev; cnt && !ret.status && req.endpoint) { // start_frame of each part is valid
+		auto &endp = *get_endpoint_ctx(req.endpoint);
+		auto frames = get_isoch_frames(cnt, endp.descriptor.bInterval, dev.speed() >= USB_SPEED_HIGH);
+		dev.frames.sync(ret.start_frame, frames, req.sending, req.received);
+	}
+
 	UCHAR *buffer{};
 
 	if (is_transfer_dir_in(ctx.hdr)) { // TransferFlags can have wrong direction
@@ -215,20 +269,53 @@ auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_submit &r
 		NT_ASSERT(length == r.TransferBufferLength);
 	}
 
-	return fill_isoc_data(r, buffer, ret.actual_length, ctx.isoc);
+	if (auto err = fill_isoc_data(r, p, buffer, ret.actual_length, ctx.isoc)) {
+		return err;
+	}
+
+	isoc::merge(req.isoc, req.part, p, ret);
+	r.ErrorCount = req.isoc.error_count;
+
+	if (req.outstanding) { // RET_SUBMIT-s of other parts are expected
+		return STATUS_SUCCESS;
+	}
+
+	if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
+		r.StartFrame = req.isoc.start_frame; // of the first part
+	}
+
+	r.Hdr.Status = r.NumberOfPackets && r.ErrorCount == r.NumberOfPackets ? USBD_STATUS_ISOCH_REQUEST_FAILED : 
+		       req.isoc.status ? to_windows_status(req.isoc.status) : // of the first failed part
+		       USBD_STATUS_SUCCESS;
+
+	return STATUS_SUCCESS;
 }
 
+/*
+ * If RET_SUBMIT-s of other parts are expected, the request is not completed, @see device::requeue_request.
+ * It is canceled if the part has failed.
+ */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void complete_and_set_null(_Inout_ WDFREQUEST &request, _In_ NTSTATUS status)
 {
-	complete(request, status);
+	auto &req = *get_request_ctx(request);
+
+	if (!req.receiving) {
+		complete(request, status);
+	} else if (auto device = get_endpoint_ctx(req.endpoint)->device;
+		   auto err = device::requeue_request(*get_device_ctx(device), request, NT_SUCCESS(status))) {
+		device::send_cmd_unlink_and_cancel(device, request, NT_SUCCESS(status) ? err : status);
+	}
+
 	request = WDF_NO_HANDLE;
 }
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void post_control_transfer(_In_ const _URB_CONTROL_TRANSFER &r, _In_ void *TransferBuffer)
+void post_control_transfer(
+	_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ const _URB_CONTROL_TRANSFER &r, 
+	_In_ void *TransferBuffer)
 {
 	auto dsc = static_cast<USB_COMMON_DESCRIPTOR*>(TransferBuffer);
 	auto dsc_len = static_cast<UINT16>(r.TransferBufferLength);
@@ -242,6 +329,11 @@ void post_control_transfer(_In_ const _URB_CONTROL_TRANSFER &r, _In_ void *Trans
 		return;
 	}
 
+	if (USBD_SUCCESS(r.Hdr.Status)) {
+		auto generation = get_request_ctx(request)->descriptors_generation;
+		put_cached_descriptor(dev, get_setup_packet(r), TransferBuffer, dsc_len, generation);
+	}
+
 	TraceUrb("bLength %d, %!usb_descriptor_type!%!BIN!", 
 		  dsc->bLength, dsc->bDescriptorType, WppBinary(dsc, dsc_len));
 
@@ -265,13 +357,14 @@ void post_control_transfer(_In_ const _URB_CONTROL_TRANSFER &r, _In_ void *Trans
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-void post_process_transfer_buffer(_In_ const URB &urb, _In_ void *TransferBuffer)
+void post_process_transfer_buffer(
+	_Inout_ device_ctx &dev, _In_ WDFREQUEST request, _In_ const URB &urb, _In_ void *TransferBuffer)
 {
 	switch (urb.UrbHeader.Function) {
 	case URB_FUNCTION_CONTROL_TRANSFER_EX:
 	case URB_FUNCTION_CONTROL_TRANSFER: // structures are binary compatible, see urbtransfer.cpp
 		static_assert(sizeof(urb.UrbControlTransfer) == sizeof(urb.UrbControlTransferEx));
-		post_control_transfer(urb.UrbControlTransfer, TransferBuffer);
+		post_control_transfer(dev, request, urb.UrbControlTransfer, TransferBuffer);
 	}
 }
 
@@ -279,12 +372,12 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto ret_submit_urb(_Inout_ wsk_context &ctx, _In_ const usbip_header_ret_submit &ret, _Inout_ URB &urb)
 {
-	urb.UrbHeader.Status = ret.status ? to_windows_status(ret.status) : USBD_STATUS_SUCCESS;
-
-	if (is_isoch(urb)) {
+	if (is_isoch(urb)) { // sets UrbHeader.Status after the last part
 		return isoch_transfer(ctx, ret, urb);
 	}
 
+	urb.UrbHeader.Status = ret.status ? to_windows_status(ret.status) : USBD_STATUS_SUCCESS;
+
 	auto st = STATUS_SUCCESS;
 	
 	UCHAR *TransferBuffer{};
@@ -300,28 +393,29 @@ auto ret_submit_urb(_Inout_ wsk_context &ctx, _In_ const usbip_header_ret_submit
 	}
 
 	if (NT_SUCCESS(st) && TransferBufferLength) {
-		post_process_transfer_buffer(urb, TransferBuffer);
+		post_process_transfer_buffer(*ctx.dev, ctx.request, urb, TransferBuffer);
 	}
 
 	return st;
 }
 
-enum { RECV_NEXT_USBIP_HDR = STATUS_SUCCESS, RECV_MORE_DATA_REQUIRED = STATUS_PENDING };
-
-_Function_class_(device_ctx::received_fn)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS ret_submit(_Inout_ wsk_context &ctx)
+void ret_submit(_Inout_ wsk_context &ctx)
 {
 	auto &ret = get_ret_submit(ctx);
 	auto urb = try_get_urb(ctx.request); // IOCTL_INTERNAL_USB_SUBMIT_URB
 
+	if (ctx.hdr.base.direction == USBIP_DIR_IN && ret.actual_length > 0) {
+		auto endpoint = get_request_ctx(ctx.request)->endpoint;
+		count(*ctx.dev, endpoint ? get_endpoint_ctx(endpoint) : nullptr, &stats_counters::bytes_in, ret.actual_length);
+	}
+
 	auto st = urb ? ret_submit_urb(ctx, ret, *urb) :
 		  ret.status ? STATUS_UNSUCCESSFUL : 
 		  STATUS_SUCCESS;
 
 	complete_and_set_null(ctx.request, st);
-	return RECV_NEXT_USBIP_HDR;
 }
 
 _IRQL_requires_same_
@@ -351,7 +445,7 @@ auto make_mdl_chain(_In_ wsk_context &ctx)
  * Ensure that URB has TransferBuffer and its size is sufficient.
  * Do others checks when payload will be read.
  * 
- * recv_payload -> prepare_wsk_mdl, there is payload to receive.
+ * parser_handler::on_header -> prepare_wsk_mdl, there is payload to receive.
  * Payload layout:
  * a) DIR_IN: any type of transfer, [transfer_buffer] OR|AND [usbip_iso_packet_descriptor...]
  * b) DIR_OUT: ISOCH, <usbip_iso_packet_descriptor...>
@@ -379,6 +473,16 @@ auto prepare_wsk_mdl(_Out_ MDL* &mdl, _Inout_ wsk_context &ctx, _Inout_ URB &urb
 	auto dir_out = is_transfer_dir_out(ctx.hdr);
 	bool fail{};
 
+	ULONG offset{}; // in the transfer buffer
+
+	if (isoc::part p; ctx.is_isoc && is_isoch(urb)) {
+		if (!get_isoc_part(p, ctx.request, urb.UrbIsochronousTransfer)) {
+			return STATUS_INVALID_PARAMETER;
+		}
+		offset = p.offset;
+		TransferBufferLength = p.length; // of the part in flight
+	}
+
 	if (ctx.is_isoc) { // always has payload
 		fail = check(TransferBufferLength, ret.actual_length); // do not change buffer length
 	} else { // actual_length MUST be assigned, must not have payload for OUT
@@ -395,7 +499,7 @@ auto prepare_wsk_mdl(_Out_ MDL* &mdl, _Inout_ wsk_context &ctx, _Inout_ URB &urb
 	if (dir_out) {
 		NT_ASSERT(ctx.is_isoc);
 		NT_ASSERT(!ctx.mdl_buf);
-	} else if (auto err = make_transfer_buffer_mdl(ctx.mdl_buf, ret.actual_length, IoWriteAccess, urb)) {
+	} else if (auto err = make_transfer_buffer_mdl(ctx.mdl_buf, ret.actual_length, IoWriteAccess, urb, offset)) {
 		Trace(TRACE_LEVEL_ERROR, "make_transfer_buffer_mdl %!STATUS!", err);
 		return err;
 	}
@@ -406,26 +510,29 @@ auto prepare_wsk_mdl(_Out_ MDL* &mdl, _Inout_ wsk_context &ctx, _Inout_ URB &urb
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-inline auto alloc_drain_buffer(_Inout_ wsk_context &ctx, _In_ size_t length)
-{  
-	auto &buf = ctx.request;
-	NT_ASSERT(!buf);
-	return buf = (WDFREQUEST)ExAllocatePoolUninitialized(NonPagedPoolNx, length, pooltag); 
-}
+auto validate_header(_Inout_ usbip_header &hdr)
+{
+	byteswap_header(hdr, swap_dir::net2host);
+	auto &base = hdr.base;
 
-_Function_class_(device_ctx::received_fn)
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS free_drain_buffer(_Inout_ wsk_context &ctx)
-{  
-	auto &buf = ctx.request;
-	NT_ASSERT(buf);
+	switch (validate_ret_header(hdr)) {
+	case header_error::none:
+		return true;
+	case header_error::command:
+		Trace(TRACE_LEVEL_ERROR, "USBIP_RET_* expected, got %!usbip_request_type!", base.command);
+		break;
+	case header_error::number_of_packets:
+		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) is out of range", hdr.u.ret_submit.number_of_packets);
+		break;
+	case header_error::seqnum:
+		Trace(TRACE_LEVEL_ERROR, "Invalid seqnum %u", base.seqnum);
+		break;
+	}
 
-	ExFreePoolWithTag(buf, pooltag);
-	buf = WDF_NO_HANDLE;
+	return false;
+}
 
-	return RECV_NEXT_USBIP_HDR;
-};
+enum { RECV_NEXT_USBIP_HDR = STATUS_SUCCESS, RECV_MORE_DATA_REQUIRED = STATUS_PENDING };
 
 _Function_class_(IO_COMPLETION_ROUTINE)
 _IRQL_requires_same_
@@ -440,9 +547,9 @@ NTSTATUS receive_complete(
 	TraceWSK("req %04x, %!STATUS!, Information %Iu", ptr04x(ctx.request), ios.Status, ios.Information);
 
 	auto st = NT_ERROR(ios.Status) ? ios.Status :
-		  ios.Information == dev.receive_size ? dev.received(ctx) :
-		  ios.Information ? STATUS_RECEIVE_PARTIAL : 
-		  STATUS_CONNECTION_DISCONNECTED; // EOF
+		  !ios.Information ? STATUS_CONNECTION_DISCONNECTED : // EOF
+		  dev.receive_size && ios.Information != dev.receive_size ? STATUS_RECEIVE_PARTIAL :
+		  dev.received(ctx, ios.Information);
 
 	switch (st) {
 	case RECV_NEXT_USBIP_HDR:
@@ -454,13 +561,9 @@ NTSTATUS receive_complete(
 		return StopCompletion;
 	}
 
-	if (dev.received == free_drain_buffer) { // ctx.request is a drain buffer
-		free_drain_buffer(ctx);
-	} else if (auto &req = ctx.request) {
-		NT_ASSERT(dev.received != ret_submit); // never fails
+	if (auto &req = ctx.request) {
 		complete_and_set_null(req, st);
 	}
-	NT_ASSERT(!ctx.request);
 
 	if (!dev.unplugged) {
 		auto hdev = get_handle(&dev);
@@ -472,16 +575,17 @@ NTSTATUS receive_complete(
 }
 
 /*
+ * @param flags if WSK_FLAG_WAITALL is not set, any number of bytes can be received 
  * @param received will be called if requested number of bytes are received without error
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto receive(_In_ WSK_BUF &buf, _In_ device_ctx::received_fn received, _In_ wsk_context &ctx)
+auto receive(_In_ WSK_BUF &buf, _In_ ULONG flags, _In_ device_ctx::received_fn received, _In_ wsk_context &ctx)
 {
 	auto &dev = *ctx.dev;
 
 	NT_ASSERT(verify(buf, ctx.is_isoc));
-	dev.receive_size = buf.Length; // checked by verify()
+	dev.receive_size = flags & WSK_FLAG_WAITALL ? buf.Length : 0; // checked by verify()
 
 	NT_ASSERT(received);
 	dev.received = received;
@@ -491,7 +595,7 @@ auto receive(_In_ WSK_BUF &buf, _In_ device_ctx::received_fn received, _In_ wsk_
 
 	IoSetCompletionRoutine(irp, receive_complete, &ctx, true, true, true);
 
-	switch (auto st = receive(dev.sock(), &buf, WSK_FLAG_WAITALL, irp)) {
+	switch (auto st = receive(dev.sock(), &buf, flags, irp)) {
 	case STATUS_PENDING:
 	case STATUS_SUCCESS:
 		TraceWSK("wsk irp %04x, %Iu bytes, %!STATUS!", ptr04x(irp), buf.Length, st);
@@ -506,59 +610,36 @@ auto receive(_In_ WSK_BUF &buf, _In_ device_ctx::received_fn received, _In_ wsk_
 	return RECV_MORE_DATA_REQUIRED;
 }
 
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS drain_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
+/*
+ * Connects pdu_parser with wsk_context of the work item.
+ * @see pdu_parser
+ */
+struct parser_handler
 {
-	if (ULONG(length) != length) {
-		Trace(TRACE_LEVEL_ERROR, "Buffer size truncation: ULONG(%lu) != size_t(%Iu)", ULONG(length), length);
-		return STATUS_INVALID_PARAMETER;
-	}
-
-	if (auto addr = alloc_drain_buffer(ctx, length)) {
-		ctx.mdl_buf = Mdl(addr, ULONG(length));
-	} else {
-		Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", length);
-		return STATUS_INSUFFICIENT_RESOURCES;
-	}
+	receive_ctx &rcv;
+	NTSTATUS status = STATUS_SUCCESS; // the reason why parsing was stopped
 
-	if (auto err = ctx.mdl_buf.prepare_nonpaged()) {
-		NT_ASSERT(err != RECV_MORE_DATA_REQUIRED);
-		Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
-		free_drain_buffer(ctx);
-		return err;
-	}
-
-	WSK_BUF buf{ .Mdl = ctx.mdl_buf.get(), .Length = length };
-	return receive(buf, free_drain_buffer, ctx);
-}
+	_IRQL_requires_same_
+	_IRQL_requires_max_(DISPATCH_LEVEL)
+	bool on_header(_In_ const usbip_header &hdr, _Out_ size_t &payload_size, _Out_ bool &drain);
 
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS recv_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
-{
-	auto &urb = get_urb(ctx.request); // only IOCTL_INTERNAL_USB_SUBMIT_URB has payload
-	WSK_BUF buf{ .Length = length };
-
-	if (auto err = prepare_wsk_mdl(buf.Mdl, ctx, urb)) {
-		NT_ASSERT(err != RECV_MORE_DATA_REQUIRED);
-		Trace(TRACE_LEVEL_ERROR, "prepare_wsk_mdl %!STATUS!", err);
-		return err;
-	}
+	_IRQL_requires_same_
+	_IRQL_requires_max_(DISPATCH_LEVEL)
+	bool on_payload(_In_ size_t offset, _In_ const void *data, _In_ size_t len);
 
-	return receive(buf, ret_submit, ctx);
-}
+	_IRQL_requires_same_
+	_IRQL_requires_max_(DISPATCH_LEVEL)
+	bool on_pdu() 
+	{
+		if (auto request = rcv.wsk->request) {
+			get_request_ctx(request)->landed = get_timestamp();
+		}
 
-_IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
-auto find_request(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
-{
-	auto req = device::remove_egress_request(dev, seqnum); // most of the time it's still there
-	if (!req) {
-		req = device::dequeue_request(dev, seqnum); // could be cancelled on queue
+		capture_end(rcv.capture);
+		ret_submit(*rcv.wsk); // never fails
+		return true;
 	}
-	return req;
-}
+};
 
 /*
  * For RET_UNLINK irp was completed right after CMD_UNLINK was issued.
@@ -568,102 +649,156 @@ auto find_request(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
  * 1) if UNLINK is successful, status is -ECONNRESET
  * 2) if USBIP_CMD_UNLINK is after USBIP_RET_SUBMIT status is 0
  * See: <kernel>/Documentation/usb/usbip_protocol.rst
+ * 
+ * Payload of a PDU which does not have a request is drained through the staging buffer.
  */
-_Function_class_(device_ctx::received_fn)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS ret_command(_Inout_ wsk_context &ctx)
+bool parser_handler::on_header(_In_ const usbip_header &hdr, _Out_ size_t &payload_size, _Out_ bool &drain)
 {
-	auto &hdr = ctx.hdr;
+	auto &ctx = *rcv.wsk;
 
-	ctx.request = hdr.base.command == USBIP_RET_SUBMIT ? // request must be completed
-		      find_request(*ctx.dev, hdr.base.seqnum) : WDF_NO_HANDLE;
+	NT_ASSERT(!ctx.request); // must be completed and zeroed on every cycle
+	ctx.mdl_buf.reset();
+	rcv.payload = nullptr;
+	capture_end(rcv.capture); // the previous PDU was drained or its payload was not received
+
+	ctx.hdr = hdr;
+	if (!validate_header(ctx.hdr)) {
+		status = STATUS_INVALID_PARAMETER;
+		return false;
+	}
+
+	ctx.request = ctx.hdr.base.command == USBIP_RET_SUBMIT ? // request must be completed
+		      device::remove_inflight_request(*ctx.dev, ctx.hdr.base.seqnum) : WDF_NO_HANDLE;
+
+	if (ctx.request) {
+		get_request_ctx(ctx.request)->received = get_timestamp();
+	}
 
 	{
 		char buf[DBG_USBIP_HDR_BUFSZ];
 		TraceEvents(TRACE_LEVEL_VERBOSE, FLAG_USBIP, "req %04x <- %Iu%s",
-			ptr04x(ctx.request), get_total_size(hdr), dbg_usbip_hdr(buf, sizeof(buf), &hdr, false));
+			ptr04x(ctx.request), get_total_size(ctx.hdr), dbg_usbip_hdr(buf, sizeof(buf), &ctx.hdr, false));
 	}
 
-	if (auto sz = get_payload_size(hdr); sz && !ctx.dev->unplugged) {
-		auto f = ctx.request ? recv_payload : drain_payload;
-		return f(ctx, sz);
-	} else if (!ctx.request) {
+	payload_size = get_payload_size(ctx.hdr);
+	drain = !ctx.request;
+
+	rcv.capture = capture_begin(*ctx.dev, CAPTURE_IN, hdr, sizeof(hdr) + payload_size, 
+				    ctx.request ? get_request_ctx(ctx.request)->received : get_timestamp());
+
+	if (drain || !payload_size) [[likely]] {
 		//
-	} else if (!sz) [[likely]] {
-		ret_submit(ctx);
-	} else {
-		TraceDbg("dev %04x is unplugged, skip payload[%Iu]", ptr04x(ctx.dev), sz);
+	} else if (ctx.dev->unplugged) {
+		TraceDbg("dev %04x is unplugged, skip payload[%Iu]", ptr04x(ctx.dev), payload_size);
 		complete_and_set_null(ctx.request, STATUS_CANCELLED);
+		drain = true;
+	} else if (auto err = prepare_wsk_mdl(rcv.payload, ctx, get_urb(ctx.request))) { // only URB has payload
+		Trace(TRACE_LEVEL_ERROR, "prepare_wsk_mdl %!STATUS!", err);
+		status = err;
+		return false;
 	}
 
-	return RECV_NEXT_USBIP_HDR;
+	if (drain && payload_size) {
+		count(*ctx.dev, nullptr, &stats_counters::drained);
+	}
+
+	if (drain) { // on_payload and on_pdu will not be called
+		capture_end(rcv.capture);
+	}
+
+	return true;
 }
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto validate_header(_Inout_ usbip_header &hdr)
+bool parser_handler::on_payload(_In_ size_t offset, _In_ const void *data, _In_ size_t len)
 {
-	byteswap_header(hdr, swap_dir::net2host);
-
-	auto &base = hdr.base;
-	auto cmd = static_cast<usbip_request_type>(base.command);
-
-	switch (cmd) {
-	case USBIP_RET_SUBMIT: {
-		auto &ret = hdr.u.ret_submit;
-		if (ret.number_of_packets == number_of_packets_non_isoch) {
-			ret.number_of_packets = 0;
-		} else if (!is_valid_number_of_packets(ret.number_of_packets)) {
-			Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d) is out of range", ret.number_of_packets);
-			return false;
-		}
-	}	break;
-	case USBIP_RET_UNLINK:
-		break;
-	default:
-		Trace(TRACE_LEVEL_ERROR, "USBIP_RET_* expected, got %!usbip_request_type!", cmd);
+	if (auto err = copy(rcv.payload, offset, data, len)) {
+		Trace(TRACE_LEVEL_ERROR, "copy(offset %Iu, len %Iu) %!STATUS!", offset, len, err);
+		status = err;
 		return false;
 	}
 
-	auto ok = is_valid_seqnum(base.seqnum);
+	capture_payload(rcv.capture, offset, data, len);
+	return true;
+}
 
-	if (ok) {
-		base.direction = extract_dir(base.seqnum); // always zero in server response
-	} else {
-		Trace(TRACE_LEVEL_ERROR, "Invalid seqnum %u", base.seqnum);
+_Function_class_(device_ctx::received_fn)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS received_payload(_Inout_ wsk_context &ctx, _In_ size_t received)
+{
+	auto &rcv = get_receive_ctx(*ctx.dev);
+	parser_handler h{ .rcv = rcv };
+
+	return rcv.parser.skip(received, h) ? RECV_NEXT_USBIP_HDR : STATUS_INVALID_PARAMETER;
+}
+
+/*
+ * The rest of a large payload is received directly into URB's buffers, 
+ * it saves copying from the staging buffer.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS recv_payload(_Inout_ receive_ctx &rcv)
+{
+	auto &ctx = *rcv.wsk;
+	auto &parser = rcv.parser;
+
+	if (ctx.dev->unplugged) { // work item will not be scheduled
+		if (auto &req = ctx.request) {
+			TraceDbg("dev %04x is unplugged, skip payload[%Iu]", ptr04x(ctx.dev), parser.remaining());
+			complete_and_set_null(req, STATUS_CANCELLED);
+		}
+		return RECV_NEXT_USBIP_HDR;
+	}
+
+	if (!(parser.state() == pdu_parser::PAYLOAD && parser.remaining() >= DIRECT_RECV_MIN)) {
+		return RECV_NEXT_USBIP_HDR;
 	}
 
-	return ok;
+	size_t offset = parser.payload_size() - parser.remaining();
+	auto mdl = seek(rcv.payload, offset);
+
+	WSK_BUF buf{ .Mdl = mdl, .Offset = offset, .Length = parser.remaining() };
+	return receive(buf, WSK_FLAG_WAITALL, received_payload, ctx);
 }
 
+_Function_class_(device_ctx::received_fn)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS received_chunk(_Inout_ wsk_context &ctx, _In_ size_t received)
+{
+	auto &rcv = get_receive_ctx(*ctx.dev);
+	parser_handler h{ .rcv = rcv };
+
+	if (rcv.parser.parse(rcv.buf, received, h)) {
+		return recv_payload(rcv);
+	}
+
+	NT_ASSERT(NT_ERROR(h.status));
+	return h.status;
+}
 
 /*
  * A WSK application should not call new WSK functions in the context of the IoCompletion routine. 
  * Doing so may result in recursive calls and exhaust the kernel mode stack. 
  * When executing at IRQL = DISPATCH_LEVEL, this can also lead to starvation of other threads.
  *
- * For this reason work queue is used here, but reading of payload does not use it and it's OK.
+ * For this reason work queue is used here, but direct reading of a large payload does not use it and it's OK.
+ * A chunk can contain any number of PDUs and a part of the next one.
  */
 _Function_class_(EVT_WDF_WORKITEM)
 _IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL) // do not define as PAGED, lambda "received" must be resident
+_IRQL_requires_max_(DISPATCH_LEVEL)
 void NTAPI receive_usbip_header(_In_ WDFWORKITEM WorkItem)
 {
-	auto &ctx = *get_wsk_context(WorkItem);
-
-	NT_ASSERT(!ctx.request); // must be completed and zeroed on every cycle
-	ctx.mdl_buf.reset();
-
-	ctx.mdl_hdr.next(nullptr);
-	WSK_BUF buf{ .Mdl = ctx.mdl_hdr.get(), .Length = sizeof(ctx.hdr) };
-
-	auto received = [] (auto &ctx) // inherits PAGED from the function, can be called on DISPATCH_LEVEL
-	{
-		return validate_header(ctx.hdr) ? ret_command(ctx) : STATUS_INVALID_PARAMETER;
-	};
+	auto &rcv = get_receive_ctx(WorkItem);
 
-	receive(buf, received, ctx);
+	WSK_BUF buf{ .Mdl = rcv.mdl.get(), .Length = rcv.mdl.size() };
+	receive(buf, 0, received_chunk, *rcv.wsk);
 }
 
 } // namespace
@@ -683,9 +818,23 @@ void usbip::complete(_In_ WDFREQUEST request, _In_ NTSTATUS status)
 
 	auto &req = *get_request_ctx(request);
 
+	if (auto endpoint = req.endpoint) {
+		auto endp = get_endpoint_ctx(endpoint);
+		auto &dev = *get_device_ctx(endp->device);
+
+		device::forget_inflight_request(dev, req);
+
+		if (status == STATUS_CANCELLED) {
+			count(dev, endp, &stats_counters::cancelled);
+		} else {
+			count(dev, endp, &stats_counters::completed);
+			record_latency(*endp, req, get_timestamp());
+		}
+	}
+
 	if (!libdrv::has_urb(irp)) {
 		if (status) {
-			TraceUrb("seqnum %u, %!STATUS!, Information %#Ix", req.seqnum, status, info);
+			TraceUrb("seqnum %u, %!STATUS!, Information %#Ix", req.seqnum(), status, info);
 		}
 		WdfRequestComplete(request, status);
 		return;
@@ -700,7 +849,7 @@ void usbip::complete(_In_ WDFREQUEST request, _In_ NTSTATUS status)
 
 	if (status || urb_st) {
 		TraceUrb("seqnum %u, USBD_%s, %!STATUS!, Information %#Ix", 
-			  req.seqnum, get_usbd_status(urb_st), status, info);
+			  req.seqnum(), get_usbd_status(urb_st), status, info);
 	}
 
 	if (auto endp = get_endpoint_ctx(req.endpoint); auto boost = endp->priority_boost) {
@@ -711,6 +860,7 @@ void usbip::complete(_In_ WDFREQUEST request, _In_ NTSTATUS status)
 	}
 }
 
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED NTSTATUS usbip::init_receive_usbip_header(_In_ device_ctx &ctx)
@@ -722,7 +872,7 @@ PAGED NTSTATUS usbip::init_receive_usbip_header(_In_ device_ctx &ctx)
 	cfg.AutomaticSerialization = false;
 
 	WDF_OBJECT_ATTRIBUTES attr; // WdfSynchronizationScopeNone is inherited from the driver object
-	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, PWSK_CONTEXT);
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, receive_ctx);
 	attr.EvtDestroyCallback = workitem_destroy;
 	attr.ParentObject = get_handle(&ctx);
 
@@ -732,11 +882,25 @@ PAGED NTSTATUS usbip::init_receive_usbip_header(_In_ device_ctx &ctx)
 	}
 
 	TraceDbg("wsk workitem %04x", ptr04x(ctx.recv_hdr));
+	auto &rcv = get_receive_ctx(ctx.recv_hdr);
 
-	if (auto ptr = alloc_wsk_context(&ctx, WDF_NO_HANDLE)) {
-		get_wsk_context(ctx.recv_hdr) = ptr;
-		return STATUS_SUCCESS;
+	rcv.wsk = alloc_wsk_context(&ctx, WDF_NO_HANDLE);
+	if (!rcv.wsk) {
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	rcv.buf = ExAllocatePoolUninitialized(NonPagedPoolNx, RECV_BUF_SIZE, pooltag);
+	if (!rcv.buf) {
+		Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu bytes", RECV_BUF_SIZE);
+		return STATUS_INSUFFICIENT_RESOURCES;
 	}
 
-	return STATUS_INSUFFICIENT_RESOURCES;
+	rcv.mdl = Mdl(rcv.buf, RECV_BUF_SIZE);
+
+	if (auto err = rcv.mdl.prepare_nonpaged()) {
+		Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
+		return err;
+	}
+
+	return STATUS_SUCCESS;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <usbip\vhci.h>
+#include <usbip\frame_clock.h>
 
 #include <libdrv\pageable.h>
 #include <libdrv\usbdsc.h>
@@ -117,7 +118,7 @@ struct vpdo_dev_t : vdev_t
 
 	UCHAR current_intf_num;
 	UCHAR current_intf_alt;
-	ULONG current_frame_number;
+	usbip::frame_clock frames; // of the server, updated by RET_SUBMIT of isoch transfers
 
 	UNICODE_STRING usb_dev_interface;
 	
@@ -130,6 +131,15 @@ struct vpdo_dev_t : vdev_t
 	received_fn *received;
 	size_t receive_size;
 
+	// payloads of PDUs without IRP are received into it in chunks, @see drain_payload
+	void *drain_buf;
+	MDL *drain_mdl;
+	size_t drain_remaining; // of the current payload
+
+	UINT64 drained; // PDUs
+	UINT64 drained_bytes;
+	ULONG drain_allocs; // of drain_buf, does not depend on the number and size of payloads
+
 	IO_CSQ irps_csq;
 	LIST_ENTRY irps;
 	KSPIN_LOCK irps_lock;
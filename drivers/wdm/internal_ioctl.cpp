@@ -650,8 +650,8 @@ NTSTATUS select_interface(vpdo_dev_t &vpdo, IRP *irp, URB &urb)
 }
 
 /*
- * Can't be implemented without server's support.
- * In any case the result will be irrelevant due to network latency.
+ * The server is not asked, the frame is extrapolated from start_frame of RET_SUBMIT-s.
+ * @see usbip::frame_clock
  *
  * See: <linux>//drivers/usb/core/usb.c, usb_get_current_frame_number.
  */
@@ -660,7 +660,7 @@ _Function_class_(urb_function_t)
 NTSTATUS get_current_frame_number(vpdo_dev_t &vpdo, IRP *irp, URB &urb)
 {
         auto &num = urb.UrbGetCurrentFrameNumber.FrameNumber;
-        num = vpdo.current_frame_number;
+        num = vpdo.frames.frame(KeQueryPerformanceCounter(nullptr).QuadPart);
 
         TraceUrb("irp %04x: FrameNumber %lu", ptr4log(irp), num);
 
@@ -745,7 +745,8 @@ NTSTATUS bulk_or_interrupt_transfer(vpdo_dev_t &vpdo, IRP *irp, URB &urb)
 }
 
 /*
- * USBD_START_ISO_TRANSFER_ASAP is appended because URB_GET_CURRENT_FRAME_NUMBER is not implemented.
+ * Explicit StartFrame is translated to the frame of the server, @see usbip::frame_clock.
+ * USBD_START_ISO_TRANSFER_ASAP is appended if the clock is not synchronized yet or StartFrame is late.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
@@ -784,8 +785,16 @@ NTSTATUS isoch_transfer(vpdo_dev_t &vpdo, IRP *irp, URB &urb)
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        if (auto err = set_cmd_submit_usbip_header(vpdo, ctx->hdr, r.PipeHandle,
-                                                   r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP, r.TransferBufferLength)) {
+        auto flags = r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP;
+        UINT32 start_frame = r.StartFrame;
+
+        if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
+                //
+        } else if (vpdo.frames.get_start_frame(start_frame, r.StartFrame, KeQueryPerformanceCounter(nullptr).QuadPart)) {
+                flags &= ~USBD_START_ISO_TRANSFER_ASAP;
+        }
+
+        if (auto err = set_cmd_submit_usbip_header(vpdo, ctx->hdr, r.PipeHandle, flags, r.TransferBufferLength)) {
                 free(ctx, false);
                 return err;
         }
@@ -795,7 +804,7 @@ NTSTATUS isoch_transfer(vpdo_dev_t &vpdo, IRP *irp, URB &urb)
                 return err;
         }
 
-        ctx->hdr.u.cmd_submit.start_frame = r.StartFrame;
+        ctx->hdr.u.cmd_submit.start_frame = start_frame;
         ctx->hdr.u.cmd_submit.number_of_packets = r.NumberOfPackets;
 
         return send(ctx, &urb, false);
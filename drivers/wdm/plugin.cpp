@@ -501,6 +501,10 @@ PAGEABLE void init(vpdo_dev_t &vpdo, const USB_DEVICE_DESCRIPTOR &d)
 
         vpdo.speed = get_usb_speed(d.bcdUSB);
 
+        LARGE_INTEGER freq;
+        KeQueryPerformanceCounter(&freq);
+        vpdo.frames.init(freq.QuadPart);
+
         vpdo.bDeviceClass = d.bDeviceClass;
         vpdo.bDeviceSubClass = d.bDeviceSubClass;
         vpdo.bDeviceProtocol = d.bDeviceProtocol;
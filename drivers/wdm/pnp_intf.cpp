@@ -40,7 +40,8 @@ void InterfaceDereference(_In_ PVOID Context)
 _IRQL_requires_max_(HIGH_LEVEL)
 inline auto get_current_frame_number(const vpdo_dev_t &vpdo)
 {
-	return vpdo.current_frame_number ? vpdo.current_frame_number : 100;
+	auto n = vpdo.frames.frame(KeQueryPerformanceCounter(nullptr).QuadPart);
+	return n ? n : 100;
 }
 
 /*
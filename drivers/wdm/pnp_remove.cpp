@@ -15,6 +15,7 @@
 #include "wmi.h"
 #include "vhub.h"
 #include "csq.h"
+#include "wsk_receive.h"
 
 namespace
 {
@@ -157,6 +158,8 @@ PAGEABLE void destroy(vpdo_dev_t &vpdo)
 		wi = nullptr;
 	}
 
+	free_drain_buffer(vpdo);
+
 	if (vpdo.actconfig) {
 		ExFreePoolWithTag(vpdo.actconfig, USBIP_VHCI_POOL_TAG);
                 vpdo.actconfig = nullptr;
@@ -370,8 +370,6 @@ NTSTATUS urb_isoch_transfer(_In_ wsk_context &ctx, _Inout_ URB &urb)
 		r.StartFrame = ret.start_frame;
 	}
 
-	ctx.vpdo->current_frame_number = ret.start_frame;
-
 	if (cnt >= 0 && ULONG(cnt) == r.NumberOfPackets) {
 		NT_ASSERT(r.NumberOfPackets == number_of_packets(ctx));
 		byteswap(ctx.isoc, cnt);
@@ -380,6 +378,12 @@ NTSTATUS urb_isoch_transfer(_In_ wsk_context &ctx, _Inout_ URB &urb)
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	if (cnt && !ret.status) { // RET_SUBMIT-s are received sequentially, CMD_SUBMIT time is unknown
+		auto &vpdo = *ctx.vpdo;
+		auto frames = usbip::get_isoch_frames(cnt, get_endpoint_interval(r.PipeHandle), vpdo.speed >= USB_SPEED_HIGH);
+		vpdo.frames.sync(ret.start_frame, frames, 0, KeQueryPerformanceCounter(nullptr).QuadPart);
+	}
+
 	char *buf{};
 
 	if (is_transfer_direction_in(ctx.hdr)) { // TransferFlags can have wrong direction
@@ -581,6 +585,9 @@ void complete(_Inout_ IRP* &irp, _In_ NTSTATUS status)
 
 enum { RECV_NEXT_USBIP_HDR = STATUS_SUCCESS, RECV_MORE_DATA_REQUIRED = STATUS_PENDING };
 
+// scratch buffer of vpdo for payloads of PDUs without IRP, @see drain_payload
+enum : ULONG { DRAIN_BUF_SIZE = 64*1024 };
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(vpdo_dev_t::received_fn)
 NTSTATUS ret_submit(_Inout_ wsk_context &ctx)
@@ -694,26 +701,36 @@ URB *get_urb(_In_ IRP *irp)
 	return nullptr;
 }
 
+/*
+ * The buffer is allocated once for the lifetime of vpdo, @see free_drain_buffer.
+ */
 _IRQL_requires_max_(DISPATCH_LEVEL)
-inline auto alloc_drain_buffer(_Inout_ wsk_context &ctx, _In_ size_t length)
-{  
-	auto &irp = ctx.irp;
-	NT_ASSERT(!irp);
-	return irp = (IRP*)ExAllocatePool2(POOL_FLAG_NON_PAGED | POOL_FLAG_UNINITIALIZED, length, USBIP_VHCI_POOL_TAG); 
-}
+auto alloc_drain_buffer(_Inout_ vpdo_dev_t &vpdo)
+{
+	if (vpdo.drain_mdl) {
+		return STATUS_SUCCESS;
+	}
 
-_IRQL_requires_max_(DISPATCH_LEVEL)
-_Function_class_(vpdo_dev_t::received_fn)
-NTSTATUS free_drain_buffer(_Inout_ wsk_context &ctx)
-{  
-	auto &irp = ctx.irp;
-	NT_ASSERT(irp);
+	auto &buf = vpdo.drain_buf;
 
-	ExFreePoolWithTag(irp, USBIP_VHCI_POOL_TAG);
-	irp = nullptr;
+	if (!buf) {
+		buf = ExAllocatePool2(POOL_FLAG_NON_PAGED | POOL_FLAG_UNINITIALIZED, DRAIN_BUF_SIZE, USBIP_VHCI_POOL_TAG);
+		if (!buf) {
+			Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu bytes", DRAIN_BUF_SIZE);
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		++vpdo.drain_allocs;
+	}
 
-	return RECV_NEXT_USBIP_HDR;
-};
+	vpdo.drain_mdl = IoAllocateMdl(buf, DRAIN_BUF_SIZE, false, false, nullptr);
+	if (!vpdo.drain_mdl) {
+		Trace(TRACE_LEVEL_ERROR, "IoAllocateMdl error");
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	MmBuildMdlForNonPagedPool(vpdo.drain_mdl);
+	return STATUS_SUCCESS;
+}
 
 _Function_class_(IO_COMPLETION_ROUTINE)
 _IRQL_requires_same_
@@ -742,9 +759,7 @@ NTSTATUS on_receive(_In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_Inex
 		return StopCompletion;
 	}
 	
-	if (vpdo->received == free_drain_buffer) { // ctx.irp is a drain buffer
-		free_drain_buffer(ctx);
-	} else if (auto &irp = ctx.irp) {
+	if (auto &irp = ctx.irp) {
 		NT_ASSERT(vpdo->received != ret_submit); // never fails
 		complete(irp, STATUS_CANCELLED);
 	}
@@ -783,32 +798,70 @@ void receive(_In_ WSK_BUF &buf, _In_ vpdo_dev_t::received_fn received, _In_ wsk_
 	TraceWSK("wsk irp %04x, %!STATUS!", ptr4log(wsk_irp), err);
 }
 
+_Function_class_(IO_WORKITEM_ROUTINE)
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+void drain_chunk(_In_ DEVICE_OBJECT*, _In_opt_ void *Context);
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(vpdo_dev_t::received_fn)
-NTSTATUS drain_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
+NTSTATUS drained_chunk(_Inout_ wsk_context &ctx)
 {
-	if (ULONG(length) != length) {
-		Trace(TRACE_LEVEL_ERROR, "Buffer size truncation: ULONG(%lu) != size_t(%Iu)", ULONG(length), length);
-		return STATUS_INVALID_PARAMETER;
-	}
+	auto &vpdo = *ctx.vpdo;
 
-	if (auto addr = alloc_drain_buffer(ctx, length)) {
-		ctx.mdl_buf = usbip::Mdl(addr, ULONG(length));
-	} else {
-		Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", length);
-		return STATUS_INSUFFICIENT_RESOURCES;
+	auto &remaining = vpdo.drain_remaining;
+	NT_ASSERT(remaining >= vpdo.receive_size);
+
+	if (remaining -= vpdo.receive_size; !remaining || vpdo.unplugged) {
+		return RECV_NEXT_USBIP_HDR;
 	}
-	
-	if (auto err = ctx.mdl_buf.prepare_nonpaged()) {
-		NT_ASSERT(err != RECV_MORE_DATA_REQUIRED);
-		Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
-		free_drain_buffer(ctx);
+
+	const auto QueueType = static_cast<WORK_QUEUE_TYPE>(CustomPriorityWorkQueue + LOW_REALTIME_PRIORITY);
+	IoQueueWorkItem(vpdo.workitem, drain_chunk, QueueType, &ctx); // see sched_receive_usbip_header
+
+	return RECV_MORE_DATA_REQUIRED;
+}
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void receive_drain_chunk(_Inout_ wsk_context &ctx)
+{
+	auto &vpdo = *ctx.vpdo;
+	auto len = vpdo.drain_remaining < DRAIN_BUF_SIZE ? vpdo.drain_remaining : DRAIN_BUF_SIZE;
+
+	WSK_BUF buf{ vpdo.drain_mdl, 0, len };
+	receive(buf, drained_chunk, ctx);
+}
+
+_Function_class_(IO_WORKITEM_ROUTINE)
+_IRQL_requires_(PASSIVE_LEVEL)
+_IRQL_requires_same_
+void drain_chunk(_In_ DEVICE_OBJECT*, _In_opt_ void *Context)
+{
+	auto &ctx = *static_cast<wsk_context*>(Context);
+	receive_drain_chunk(ctx);
+}
+
+/*
+ * The payload is received into the scratch buffer of vpdo, 
+ * so a large payload does not require allocation of the same size.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(vpdo_dev_t::received_fn)
+NTSTATUS drain_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
+{
+	auto &vpdo = *ctx.vpdo;
+
+	if (auto err = alloc_drain_buffer(vpdo)) {
 		return err;
 	}
 
-	WSK_BUF buf{ ctx.mdl_buf.get(), 0, length };
-	receive(buf, free_drain_buffer, ctx);
+	++vpdo.drained;
+	vpdo.drained_bytes += length;
 
+	vpdo.drain_remaining = length;
+	ctx.is_isoc = false; // the last chunk can be shorter than drain_mdl, see verify()
+
+	receive_drain_chunk(ctx);
 	return RECV_MORE_DATA_REQUIRED;
 }
 
@@ -926,6 +979,23 @@ void receive_usbip_header(_In_ DEVICE_OBJECT*, _In_opt_ void *Context)
 } // namespace
 
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_drain_buffer(_Inout_ vpdo_dev_t &vpdo)
+{
+	TraceDbg("vpdo %04x: drained %I64u PDU(s), %I64u byte(s), buffer allocations %lu", 
+		 ptr4log(&vpdo), vpdo.drained, vpdo.drained_bytes, vpdo.drain_allocs);
+
+	if (auto &mdl = vpdo.drain_mdl) {
+		IoFreeMdl(mdl);
+		mdl = nullptr;
+	}
+
+	if (auto &buf = vpdo.drain_buf) {
+		ExFreePoolWithTag(buf, USBIP_VHCI_POOL_TAG);
+		buf = nullptr;
+	}
+}
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS WskDisconnectEvent(_In_opt_ PVOID SocketContext, _In_ ULONG Flags)
 {
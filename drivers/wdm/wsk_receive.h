@@ -14,3 +14,6 @@ NTSTATUS WskDisconnectEvent(_In_opt_ PVOID SocketContext, _In_ ULONG Flags);
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void sched_receive_usbip_header(_In_ wsk_context *ctx);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_drain_buffer(_Inout_ vpdo_dev_t &vpdo);
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "proto.h"
+
+#ifndef _WIN32
+  using UINT64 = uint64_t;
+#endif
+
+/*
+ * Binary records of captured PDUs, they do not depend on kernel or user mode API.
+ * The driver writes them into a ring, userspace reads them and converts to pcapng.
+ */
+namespace usbip
+{
+
+enum : UINT32 { CAPTURE_PAYLOAD = 64 }; // max number of captured bytes of a payload
+
+enum capture_dir : UINT8 { CAPTURE_OUT, CAPTURE_IN }; // to a server, from a server
+
+struct capture_record
+{
+        UINT64 timestamp; // performance counter
+        UINT32 length; // of PDU, header and payload
+        UINT16 captured; // bytes of payload, CAPTURE_PAYLOAD at most
+        UINT8 dir; // capture_dir
+        UINT8 reserved;
+        usbip_header hdr; // network byte order
+        UINT8 payload[CAPTURE_PAYLOAD]; // the beginning of the payload
+};
+
+} // namespace usbip
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2022 - 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "proto.h"
+#include <stddef.h>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+/*
+ * Encoding and decoding of USB/IP PDUs that does not depend on kernel or user mode API.
+ * Drivers use it through libdrv\pdu.h and libdrv\usbd_helper.h.
+ */
+namespace usbip
+{
+
+inline UINT32 bswap(UINT32 val)
+{
+#ifdef _MSC_VER
+        return _byteswap_ulong(val);
+#else
+        return __builtin_bswap32(val);
+#endif
+}
+
+template<typename T>
+inline void bswap(T *v[], size_t cnt)
+{
+        static_assert(sizeof(T) == sizeof(UINT32));
+
+        for (size_t i = 0; i < cnt; ++i) {
+                *v[i] = T(bswap(UINT32(*v[i])));
+        }
+}
+
+enum class swap_dir { host2net, net2host };
+
+inline void byteswap(usbip_header_basic &r)
+{
+        UINT32 *v[] { &r.command, &r.seqnum, &r.devid, &r.direction, &r.ep };
+        bswap(v, sizeof(v)/sizeof(*v));
+}
+
+inline void byteswap(usbip_header_cmd_submit &r)
+{
+        r.transfer_flags = bswap(r.transfer_flags);
+
+        INT32 *v[] { &r.transfer_buffer_length, &r.start_frame, &r.number_of_packets, &r.interval };
+        bswap(v, sizeof(v)/sizeof(*v));
+}
+
+inline void byteswap(usbip_header_ret_submit &r)
+{
+        INT32 *v[] { &r.status, &r.actual_length, &r.start_frame, &r.number_of_packets, &r.error_count };
+        bswap(v, sizeof(v)/sizeof(*v));
+}
+
+inline void byteswap(usbip_header_cmd_unlink &r) { r.seqnum = bswap(r.seqnum); }
+inline void byteswap(usbip_header_ret_unlink &r) { r.status = INT32(bswap(UINT32(r.status))); }
+
+/*
+ * The command must be in host byte order to select the member of the union,
+ * that is why the base is swapped first or last.
+ */
+inline void byteswap_header(usbip_header &hdr, swap_dir dir)
+{
+        if (dir == swap_dir::net2host) {
+                byteswap(hdr.base);
+        }
+
+        switch (hdr.base.command) {
+        case USBIP_CMD_SUBMIT:
+                byteswap(hdr.u.cmd_submit);
+                break;
+        case USBIP_RET_SUBMIT:
+                byteswap(hdr.u.ret_submit);
+                break;
+        case USBIP_CMD_UNLINK:
+                byteswap(hdr.u.cmd_unlink);
+                break;
+        case USBIP_RET_UNLINK:
+                byteswap(hdr.u.ret_unlink);
+                break;
+        }
+
+        if (dir == swap_dir::host2net) {
+                byteswap(hdr.base);
+        }
+}
+
+inline void byteswap(usbip_iso_packet_descriptor *d, size_t cnt)
+{
+        for (size_t i = 0; i < cnt; ++i, ++d) {
+                UINT32 *v[] { &d->offset, &d->length, &d->actual_length, &d->status };
+                bswap(v, sizeof(v)/sizeof(*v));
+        }
+}
+
+/*
+ * The header must be in host byte order.
+ * For a server's response, set hdr.base.direction to the value from the corresponding request,
+ * otherwise the result will be incorrect.
+ * Server's responses always have zeroes in usbip_header_basic's devid, direction, ep.
+ * See: <linux>/Documentation/usb/usbip_protocol.rst, usbip_header_basic.
+ *
+ * @return number of descriptors, zero for non-isoch transfers and unknown commands
+ */
+inline size_t get_isoc_descr(usbip_iso_packet_descriptor* &isoc, usbip_header &hdr)
+{
+        auto dir_out = hdr.base.direction == USBIP_DIR_OUT;
+
+        auto buf_end = reinterpret_cast<char*>(&hdr + 1);
+        INT32 cnt = 0;
+
+        switch (hdr.base.command) {
+        case USBIP_CMD_SUBMIT:
+                buf_end += dir_out ? hdr.u.cmd_submit.transfer_buffer_length : 0;
+                cnt = hdr.u.cmd_submit.number_of_packets;
+                break;
+        case USBIP_RET_SUBMIT:
+                buf_end += dir_out ? 0 : hdr.u.ret_submit.actual_length; // harmless if direction was not corrected
+                cnt = hdr.u.ret_submit.number_of_packets;
+                break;
+        }
+
+        isoc = reinterpret_cast<usbip_iso_packet_descriptor*>(buf_end);
+        return cnt == number_of_packets_non_isoch ? 0 : size_t(cnt);
+}
+
+inline size_t get_total_size(const usbip_header &hdr)
+{
+        usbip_iso_packet_descriptor *isoc{};
+        auto cnt = get_isoc_descr(isoc, const_cast<usbip_header&>(hdr));
+
+        return reinterpret_cast<char*>(isoc + cnt) - reinterpret_cast<const char*>(&hdr);
+}
+
+inline size_t get_payload_size(const usbip_header &hdr)
+{
+        return get_total_size(hdr) - sizeof(hdr);
+}
+
+inline void byteswap_payload(usbip_header &hdr)
+{
+        usbip_iso_packet_descriptor *isoc{};
+
+        if (auto cnt = get_isoc_descr(isoc, hdr)) {
+                byteswap(isoc, cnt);
+        }
+}
+
+/*
+ * First bit of seqnum is reserved for direction of transfer (USBIP_DIR_OUT|USBIP_DIR_IN).
+ * Zero number is invalid.
+ */
+constexpr seqnum_t make_seqnum(seqnum_t num, bool dir_in) { return (num << 1) | seqnum_t(dir_in); }
+constexpr auto extract_num(seqnum_t seqnum) { return seqnum >> 1; }
+constexpr auto extract_dir(seqnum_t seqnum) { return usbip_dir(seqnum & 1); }
+constexpr bool is_valid_seqnum(seqnum_t seqnum) { return extract_num(seqnum); }
+
+static_assert(!USBIP_DIR_OUT);
+static_assert(USBIP_DIR_IN == 1);
+static_assert(extract_dir(make_seqnum(5, true)) == USBIP_DIR_IN);
+static_assert(extract_num(make_seqnum(5, false)) == 5);
+
+enum class header_error { none, command, number_of_packets, seqnum };
+
+/*
+ * Checks USBIP_RET_* header received from a server, it must be in host byte order.
+ * Sets number_of_packets to zero for non-isoch transfers and direction from seqnum,
+ * because it is always zero in server's response.
+ */
+inline auto validate_ret_header(usbip_header &hdr)
+{
+        auto &base = hdr.base;
+
+        switch (base.command) {
+        case USBIP_RET_SUBMIT:
+                if (auto &cnt = hdr.u.ret_submit.number_of_packets; cnt == number_of_packets_non_isoch) {
+                        cnt = 0;
+                } else if (!is_valid_number_of_packets(cnt)) {
+                        return header_error::number_of_packets;
+                }
+                break;
+        case USBIP_RET_UNLINK:
+                break;
+        default:
+                return header_error::command;
+        }
+
+        if (!is_valid_seqnum(base.seqnum)) {
+                return header_error::seqnum;
+        }
+
+        base.direction = extract_dir(base.seqnum);
+        return header_error::none;
+}
+
+/*
+ * Linux error codes, usbip_header_ret_submit.status is a negated one.
+ * See: include/uapi/asm-generic/errno-base.h, include/uapi/asm-generic/errno.h
+ */
+enum linux_errno {
+        ENOENT_LNX = 2,
+        ENXIO_LNX = 6,
+        ENOMEM_LNX = 12,
+        EBUSY_LNX = 16,
+        EXDEV_LNX = 18,
+        ENODEV_LNX = 19,
+        EINVAL_LNX = 22,
+        ENOSPC_LNX = 28,
+        EPIPE_LNX = 32,
+        ETIME_LNX = 62,
+        ENOSR_LNX = 63,
+        ECOMM_LNX = 70,
+        EPROTO_LNX = 71,
+        EOVERFLOW_LNX = 75,
+        EILSEQ_LNX = 84,
+        ECONNRESET_LNX = 104,
+        ESHUTDOWN_LNX = 108,
+        ETIMEDOUT_LNX = 110,
+        EHOSTUNREACH_LNX = 113,
+        EINPROGRESS_LNX = 115,
+        EREMOTEIO_LNX = 121,
+};
+
+/*
+ * <linux/usb.h>, urb->transfer_flags
+ */
+enum linux_urb_flags {
+        URB_SHORT_NOT_OK = 0x0001, // report short reads as errors
+        URB_ISO_ASAP = 0x0002      // iso-only; use the first unexpired slot in the schedule
+};
+
+} // namespace usbip
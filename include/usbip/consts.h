@@ -3,9 +3,13 @@
 namespace usbip
 {
 
-constexpr auto &tcp_port = "3240";
-constexpr auto &driver_filename = L"usbip2_ude"; // used by filter driver
-constexpr auto &persistent_devices_value_name = L"PersistentDevices";
+inline constexpr auto &tcp_port = "3240";
+inline constexpr auto &driver_filename = L"usbip2_ude"; // used by filter driver
+inline constexpr auto &persistent_devices_value_name = L"PersistentDevices";
+inline constexpr auto &persistent_attach_parallelism_value_name = L"PersistentAttachParallelism";
+inline constexpr auto &send_batch_max_bytes_value_name = L"SendBatchMaxBytes";
+inline constexpr auto &send_batch_max_pdus_value_name = L"SendBatchMaxPdus";
+inline constexpr auto &descriptor_prefetch_value_name = L"DescriptorPrefetch";
 
 enum op_status_t // op_common.status
 {
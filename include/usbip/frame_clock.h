@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _WIN32
+  #include <basetsd.h>
+#else
+  #include <stdint.h>
+  using INT32 = int32_t;
+  using UINT32 = uint32_t;
+  using INT64 = int64_t;
+  using UINT64 = uint64_t;
+#endif
+
+/*
+ * Virtual clock of USB frames (1 ms) of the server's host controller, it does not depend on kernel or user mode API.
+ *
+ * URB_FUNCTION_GET_CURRENT_FRAME_NUMBER can't be forwarded to a server, the frame number is extrapolated
+ * from a performance counter and corrected by start_frame of RET_SUBMIT for isoch transfers.
+ * Small errors are corrected gradually, so the clock does not jump back and forth with network jitter.
+ * A big error (the first RET_SUBMIT, a server was restarted, etc.) resynchronizes the clock at once.
+ *
+ * The clock lags behind the server by the network delay. Explicit StartFrame of URB is shifted
+ * by a lead that is estimated on resynchronization only, so the spacing of URBs is preserved.
+ *
+ * start_frame of RET_SUBMIT is expected in frames as xHCI reports it.
+ */
+namespace usbip
+{
+
+/*
+ * @param bInterval of isoch endpoint, the period is 2^(bInterval - 1) frames or microframes since high speed
+ * @return number of frames spanned by the packets
+ */
+constexpr UINT32 get_isoch_frames(UINT32 number_of_packets, unsigned int bInterval, bool high_speed)
+{
+        auto shift = bInterval >= 1 && bInterval <= 16 ? bInterval - 1 : 0;
+        auto n = UINT64(number_of_packets) << shift;
+
+        return UINT32(high_speed ? (n + 7)/8 : n);
+}
+
+class frame_clock
+{
+public:
+        enum : UINT32 {
+                FRAC_BITS = 8, // fixed point, fraction of a frame
+                GAIN_BITS = 4, // 1/16 of an error is corrected by each RET_SUBMIT
+                MAX_STEP = 32, // frames, bigger error resynchronizes the clock
+                MIN_LEAD = 2, // frames
+                MAX_LEAD = 256, // must be well below the length of host controller's schedule
+                MAX_AHEAD = 512, // frames, explicit StartFrame must not be farther from the current one
+        };
+
+        /*
+         * @param freq of the performance counter, counts per second
+         */
+        void init(INT64 freq)
+        {
+                *this = frame_clock{};
+                m_freq = freq > 0 ? freq : 1;
+        }
+
+        auto synced() const { return m_synced; }
+        auto lead() const { return m_lead; }
+        auto resyncs() const { return m_resyncs; }
+
+        /*
+         * Smoothed absolute error of the clock, like interarrival jitter of RFC 3550.
+         */
+        auto jitter_us() const { return UINT32((m_jitter*1000) >> FRAC_BITS); }
+
+        /*
+         * @param now performance counter
+         */
+        UINT32 frame(INT64 now) const
+        {
+                return static_cast<UINT32>((m_offset + to_fixed(now)) >> FRAC_BITS);
+        }
+
+        /*
+         * Must not be called concurrently.
+         * @param start_frame of RET_SUBMIT
+         * @param frames duration of the transfer, @see get_isoch_frames
+         * @param sent performance counter of CMD_SUBMIT, zero if unknown
+         * @param received performance counter of RET_SUBMIT
+         */
+        void sync(UINT32 start_frame, UINT32 frames, INT64 sent, INT64 received)
+        {
+                auto now = m_offset + to_fixed(received);
+                auto observed = start_frame + frames; // the transfer is complete
+
+                auto err = (INT64(INT32(observed - UINT32(now >> FRAC_BITS))) << FRAC_BITS) - (now & FRAC_MASK);
+                auto abs_err = err < 0 ? -err : err;
+
+                if (!m_synced || abs_err > (INT64(MAX_STEP) << FRAC_BITS)) {
+                        m_offset += err;
+                        m_jitter = 0;
+                        m_lead = get_lead(frames, sent, received);
+                        m_synced = true;
+                        ++m_resyncs;
+                } else {
+                        m_offset += err/(1 << GAIN_BITS);
+                        m_jitter += (abs_err - m_jitter)/(1 << GAIN_BITS);
+                }
+        }
+
+        /*
+         * @param StartFrame explicit frame of isoch URB
+         * @param server_frame StartFrame for CMD_SUBMIT
+         * @return false if StartFrame is in the past or too far, use USBD_START_ISO_TRANSFER_ASAP
+         */
+        bool get_start_frame(UINT32 &server_frame, UINT32 StartFrame, INT64 now) const
+        {
+                if (!m_synced) {
+                        return false;
+                }
+
+                if (auto ahead = INT32(StartFrame - frame(now)); ahead < 0 || ahead > INT32(MAX_AHEAD)) {
+                        return false;
+                }
+
+                server_frame = StartFrame + m_lead;
+                return true;
+        }
+
+private:
+        enum : INT64 { FRAC_MASK = (1 << FRAC_BITS) - 1 };
+
+        INT64 m_freq = 1;
+        INT64 m_offset{}; // fixed point, the frame is m_offset + to_fixed(performance counter)
+        INT64 m_jitter{}; // fixed point
+        UINT32 m_lead = MIN_LEAD;
+        UINT32 m_resyncs{};
+        bool m_synced{};
+
+        /*
+         * @return frames in fixed point
+         */
+        INT64 to_fixed(INT64 counter) const
+        {
+                constexpr INT64 k = INT64(1000) << FRAC_BITS;
+                return counter/m_freq*k + counter%m_freq*k/m_freq;
+        }
+
+        /*
+         * The clock lags by one-way delay and CMD_SUBMIT needs the same time to reach a server,
+         * so the lead is the round trip time without the duration of the transfer.
+         */
+        UINT32 get_lead(UINT32 frames, INT64 sent, INT64 received) const
+        {
+                INT64 lead = MIN_LEAD;
+
+                if (sent && received > sent) {
+                        auto rtt = to_fixed(received - sent) >> FRAC_BITS;
+                        if (rtt > frames) {
+                                lead += rtt - frames;
+                        }
+                }
+
+                return UINT32(lead < MAX_LEAD ? lead : INT64(MAX_LEAD));
+        }
+};
+
+} // namespace usbip
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _WIN32
+  #include <basetsd.h>
+#else
+  #include <stdint.h>
+  using UINT32 = uint32_t;
+  using UINT64 = uint64_t;
+#endif
+
+#include <stddef.h>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+/*
+ * Log-linear (HdrHistogram-like) histogram of latencies, it does not depend on kernel or user mode API.
+ * Values are grouped by the position of the highest set bit, each group is split into SUB_BUCKETS
+ * linear buckets. Thus the relative error of a bucket is at most 1/SUB_BUCKETS.
+ * Values below SUB_BUCKETS are exact, values above MAX_VALUE are counted in the last bucket.
+ */
+namespace usbip
+{
+
+struct latency_histogram
+{
+        enum : UINT32 {
+                SUB_BITS = 3,
+                SUB_BUCKETS = 1U << SUB_BITS,
+                MAX_BITS = 32, // ~7 minutes for 10 MHz counter
+                BUCKETS = (MAX_BITS - SUB_BITS + 1)*SUB_BUCKETS,
+        };
+
+        static constexpr UINT64 MAX_VALUE = (1ULL << MAX_BITS) - 1;
+
+        UINT32 counts[BUCKETS];
+        UINT64 sum; // of recorded values, for the mean
+};
+
+inline unsigned int get_msb(UINT64 v) // v must not be zero
+{
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return idx;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+}
+
+inline UINT32 get_bucket(UINT64 value)
+{
+        using h = latency_histogram;
+
+        if (value < h::SUB_BUCKETS) {
+                return static_cast<UINT32>(value);
+        } else if (value > h::MAX_VALUE) {
+                return h::BUCKETS - 1;
+        }
+
+        auto shift = get_msb(value) - h::SUB_BITS;
+        auto sub = (value >> shift) & (h::SUB_BUCKETS - 1);
+
+        return (shift + 1)*h::SUB_BUCKETS + static_cast<UINT32>(sub);
+}
+
+/*
+ * @return the smallest value of the bucket
+ */
+constexpr UINT64 get_bucket_lower(UINT32 bucket)
+{
+        using h = latency_histogram;
+
+        if (bucket < h::SUB_BUCKETS) {
+                return bucket;
+        }
+
+        auto shift = bucket/h::SUB_BUCKETS - 1;
+        auto sub = bucket % h::SUB_BUCKETS;
+
+        return (UINT64(h::SUB_BUCKETS) + sub) << shift;
+}
+
+/*
+ * @return the largest value of the bucket
+ */
+constexpr UINT64 get_bucket_upper(UINT32 bucket)
+{
+        return bucket + 1 < latency_histogram::BUCKETS ? get_bucket_lower(bucket + 1) - 1 : latency_histogram::MAX_VALUE;
+}
+
+static_assert(get_bucket_lower(latency_histogram::SUB_BUCKETS) == latency_histogram::SUB_BUCKETS);
+static_assert(get_bucket_upper(latency_histogram::BUCKETS - 1) == latency_histogram::MAX_VALUE);
+
+/*
+ * Not thread-safe, the driver updates a histogram atomically.
+ */
+inline void record(latency_histogram &h, UINT64 value)
+{
+        ++h.counts[get_bucket(value)];
+        h.sum += value;
+}
+
+inline UINT64 get_count(const latency_histogram &h)
+{
+        UINT64 cnt = 0;
+        for (auto n: h.counts) {
+                cnt += n;
+        }
+        return cnt;
+}
+
+/*
+ * @param percent in range [0, 100]
+ * @return upper bound of the bucket that contains the percentile, zero if the histogram is empty
+ */
+inline UINT64 get_percentile(const latency_histogram &h, double percent)
+{
+        auto total = get_count(h);
+        if (!total) {
+                return 0;
+        }
+
+        auto rank = static_cast<UINT64>(percent*total/100 + 0.5);
+        if (!rank) {
+                rank = 1;
+        }
+
+        UINT64 cnt = 0;
+
+        for (UINT32 i = 0; i < latency_histogram::BUCKETS; ++i) {
+                if (cnt += h.counts[i]; cnt >= rank) {
+                        return get_bucket_upper(i);
+                }
+        }
+
+        return latency_histogram::MAX_VALUE;
+}
+
+} // namespace usbip
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "codec.h"
+#include "frame_clock.h"
+
+#include <string.h>
+
+/*
+ * Isochronous packet descriptors that follow usbip_header are in network byte order.
+ * These functions convert them on the fly while they are built or read,
+ * so the array is traversed once instead of a separate byteswap pass.
+ * They do not depend on kernel or user mode API.
+ */
+namespace usbip::isoc
+{
+
+/*
+ * @param d network byte order
+ * @return host byte order
+ */
+inline auto to_host(const usbip_iso_packet_descriptor &d)
+{
+        return usbip_iso_packet_descriptor {
+                .offset = bswap(d.offset),
+                .length = bswap(d.length),
+                .actual_length = bswap(d.actual_length),
+                .status = bswap(d.status),
+        };
+}
+
+/*
+ * An isoch URB that has more than USBIP_MAX_ISO_PACKETS is sent as several CMD_SUBMITs at once.
+ * A part is the range of packets [first, first + cnt) and the range of the transfer buffer
+ * [offset, offset + length), offsets of the packets in CMD_SUBMIT are relative to the part.
+ * Each part has its own seqnum, RET_SUBMIT-s of the parts are merged by merge().
+ */
+struct part
+{
+        UINT32 first; // packet
+        UINT32 cnt; // of packets
+        UINT32 offset; // in the transfer buffer
+        UINT32 length;
+};
+
+constexpr auto get_part_size(UINT32 total, UINT32 first)
+{
+        auto n = first < total ? total - first : 0;
+        return n < USBIP_MAX_ISO_PACKETS ? n : UINT32(USBIP_MAX_ISO_PACKETS);
+}
+
+/*
+ * @param first packet of the part
+ * @return false if the part has invalid offsets
+ */
+template<typename Packet>
+bool get_part(part &p, const Packet *src, UINT32 total, UINT32 first, UINT32 buf_len)
+{
+        p.first = first;
+        p.cnt = get_part_size(total, first);
+
+        auto last = first + p.cnt;
+        p.offset = first < total ? src[first].Offset : 0;
+        auto end = last < total ? src[last].Offset : buf_len;
+
+        if (!(p.offset <= end && end <= buf_len)) {
+                return false;
+        }
+
+        p.length = end - p.offset;
+        return true;
+}
+
+enum : UINT32 { MAX_PARTS = 8 }; // NumberOfPackets of URB is limited by MAX_PARTS*USBIP_MAX_ISO_PACKETS
+
+constexpr UINT32 get_part_first(UINT32 idx) { return idx*USBIP_MAX_ISO_PACKETS; }
+
+/*
+ * URB without packets is sent as a single part.
+ */
+constexpr UINT32 get_part_count(UINT32 number_of_packets)
+{
+        return number_of_packets ? (number_of_packets - 1)/USBIP_MAX_ISO_PACKETS + 1 : 1;
+}
+
+/*
+ * @return number of parts, zero if there are more than MAX_PARTS or a part has invalid offsets
+ */
+template<typename Packet>
+UINT32 split(part (&parts)[MAX_PARTS], const Packet *src, UINT32 total, UINT32 buf_len)
+{
+        auto cnt = get_part_count(total);
+        if (cnt > MAX_PARTS) {
+                return 0;
+        }
+
+        for (UINT32 i = 0; i < cnt; ++i) {
+                if (!get_part(parts[i], src, total, get_part_first(i), buf_len)) {
+                        return 0;
+                }
+        }
+
+        return cnt;
+}
+
+/*
+ * Explicit start frames of the parts are consecutive, the next part starts when the previous one ends.
+ * @param prev the previous part
+ * @see get_isoch_frames
+ */
+constexpr UINT32 get_next_start_frame(UINT32 start_frame, const part &prev, unsigned int bInterval, bool high_speed)
+{
+        return start_frame + get_isoch_frames(prev.cnt, bInterval, high_speed);
+}
+
+/*
+ * Packets are marked as not transferred before the parts are submitted, merge() does not
+ * count them as errors any longer when RET_SUBMIT of their part is received.
+ * Packets of a part that was not sent or whose RET_SUBMIT was not received keep the status.
+ */
+template<typename Packet, typename Status>
+void reset_packets(Packet *src, UINT32 cnt, Status status)
+{
+        for (UINT32 i = 0; i < cnt; ++i) {
+                src[i].Length = 0;
+                src[i].Status = status;
+        }
+}
+
+/*
+ * The result of URB that is merged from RET_SUBMIT-s of its parts, they can be received in any order.
+ * error_count is consistent with the statuses of the packets at any time, @see reset_packets.
+ */
+struct merge_state
+{
+        UINT32 error_count; // ErrorCount of URB
+        INT32 status; // the first non-zero status of RET_SUBMIT in the order of the parts
+        UINT32 status_part; // index of the part that has the status
+        INT32 start_frame; // of the first part
+};
+
+constexpr auto make_merge_state(UINT32 number_of_packets)
+{
+        merge_state m{};
+        m.error_count = number_of_packets;
+        return m;
+}
+
+/*
+ * Each part must be merged once.
+ * @param idx of the part
+ * @param ret in host byte order
+ */
+inline void merge(merge_state &m, UINT32 idx, const part &p, const usbip_header_ret_submit &ret)
+{
+        auto errors = ret.error_count > 0 ? UINT32(ret.error_count) : 0;
+        if (errors > p.cnt) {
+                errors = p.cnt;
+        }
+
+        m.error_count -= p.cnt - errors;
+
+        if (!idx) {
+                m.start_frame = ret.start_frame;
+        }
+
+        if (ret.status && (!m.status || idx < m.status_part)) {
+                m.status = ret.status;
+                m.status_part = idx;
+        }
+}
+
+/*
+ * Builds descriptors for CMD_SUBMIT in network byte order.
+ * Packet is USBD_ISO_PACKET_DESCRIPTOR, only its Offset is used because Length is zero for OUT transfers.
+ * The length of a packet is the distance to the offset of the next one or to the end of the buffer.
+ *
+ * @param buf_len offset of the end of the buffer
+ * @param base offset of the buffer, it is subtracted from offsets of the packets, @see part
+ * @return index of the packet which has invalid offset or cnt if all are valid
+ */
+template<typename Packet>
+UINT32 pack(usbip_iso_packet_descriptor *d, const Packet *src, UINT32 cnt, UINT32 buf_len, UINT32 base = 0)
+{
+        for (UINT32 i = 0; i < cnt; ++i, ++d) {
+
+                auto offset = src[i].Offset;
+                auto next_offset = i + 1 < cnt ? src[i + 1].Offset : buf_len;
+
+                if (!(next_offset >= offset && next_offset <= buf_len && offset >= base)) {
+                        return i;
+                }
+
+                d->offset = bswap(offset - base);
+                d->length = bswap(next_offset - offset);
+                d->actual_length = 0;
+                d->status = 0;
+        }
+
+        return cnt;
+}
+
+enum class unpack_error { none, actual_length, offset, length, buffer_length, gap };
+
+/*
+ * Checks a packet of RET_SUBMIT for IN transfer. The buffer from a server is compacted,
+ * so packets are visited from the last to the first one and moved from the end of
+ * the compacted data to their offsets.
+ *
+ * @param d in host byte order, actual_length must not be zero
+ * @param offset of the packet in the transfer buffer of URB
+ * @param length of the remaining compacted data, it is decreased by d.actual_length
+ * @param buf_len size of the transfer buffer of URB
+ */
+template<typename Length> // ULONG or UINT32
+auto get_unpack_error(const usbip_iso_packet_descriptor &d, Length offset, Length &length, Length buf_len)
+{
+        if (d.actual_length > d.length) {
+                return unpack_error::actual_length;
+        }
+
+        if (d.offset != offset) { // buffer is compacted, but offsets are intact
+                return unpack_error::offset;
+        }
+
+        if (length >= d.actual_length) {
+                length -= d.actual_length;
+        } else {
+                return unpack_error::length;
+        }
+
+        if (offset + d.actual_length > buf_len) {
+                return unpack_error::buffer_length;
+        }
+
+        if (offset < length) { // source buffer has no gaps
+                return unpack_error::gap;
+        }
+
+        return unpack_error::none;
+}
+
+/*
+ * Moves packets of IN transfer from the compacted data to their offsets in the transfer buffer.
+ * Packets must be added from the last to the first one, after get_unpack_error succeeded for them.
+ * Adjacent packets that have the same displacement are moved by one memmove, packets that are
+ * not displaced (there are no short packets before them) are not moved at all.
+ */
+class expander
+{
+public:
+        explicit expander(void *buffer) : m_buf(static_cast<char*>(buffer)) {}
+
+        /*
+         * @param src offset of the packet in the compacted data, the remaining length after get_unpack_error
+         * @param dst offset of the packet in the transfer buffer
+         * @param len actual_length of the packet
+         */
+        void add(UINT32 src, UINT32 dst, UINT32 len)
+        {
+                if (m_len && dst - src == m_dst - m_src) { // src + len == m_src
+                        m_src = src;
+                        m_dst = dst;
+                        m_len += len;
+                } else {
+                        flush();
+                        m_src = src;
+                        m_dst = dst;
+                        m_len = len;
+                }
+        }
+
+        /*
+         * Moves the pending run of packets, must be called after all packets are added.
+         */
+        void flush()
+        {
+                if (m_len && m_dst != m_src) {
+                        memmove(m_buf + m_dst, m_buf + m_src, m_len);
+                }
+                m_len = 0;
+        }
+
+private:
+        char *m_buf;
+        UINT32 m_src{};
+        UINT32 m_dst{};
+        UINT32 m_len{}; // of the pending run of packets
+};
+
+} // namespace usbip::isoc
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _WIN32
+  #include <basetsd.h>
+#else
+  #include <stdint.h>
+  using UINT32 = uint32_t;
+#endif
+
+#include <stddef.h>
+
+namespace usbip
+{
+
+/*
+ * Header of a block of preallocated objects, the objects follow it.
+ * alignas makes the size of the header a multiple of alignment of T, so the objects are aligned too.
+ */
+template<typename T>
+struct alignas(alignof(T)) pool_slab
+{
+        pool_slab *next;
+        UINT32 cnt;
+
+        auto objects() { return reinterpret_cast<T*>(this + 1); }
+        static constexpr size_t get_size(UINT32 cnt) { return sizeof(pool_slab) + cnt*sizeof(T); }
+};
+
+/*
+ * Pool of preallocated objects of a device, it does not depend on kernel or user mode API.
+ * The pool is grown by slabs up to MaxCapacity objects, an object is taken without allocation of memory.
+ * If the pool is empty, the caller allocates an object elsewhere (fallback) and the pool counts it.
+ * Every taken object holds a reference to the pool, the owner holds one more.
+ * The last release frees the pool, so objects can be returned after the owner has closed it.
+ *
+ * Pool must have members pool_slab<object_type> *slabs and UINT32 capacity, they are not thread-safe
+ * and are modified while the pool is grown only. Traits provides the thread-safe operations:
+ *   using pool_type, using object_type
+ *   static object_type* pop_free(pool_type&); // nullptr if empty
+ *   static void push_free(pool_type&, object_type&);
+ *   static void add_ref(pool_type&);
+ *   static bool release_ref(pool_type&); // true if it was the last reference
+ *   static void add_fallback(pool_type&);
+ *   static pool_type* get_pool(const object_type&); // nullptr if the object is not from a pool
+ *   static void free_pool(pool_type&);
+ */
+template<typename Traits, UINT32 MaxCapacity>
+struct object_pool
+{
+        using pool_type = typename Traits::pool_type;
+        using object_type = typename Traits::object_type;
+        using slab_type = pool_slab<object_type>;
+
+        static_assert(MaxCapacity);
+
+        /*
+         * @param cnt objects requested for a new slab
+         * @return objects that can be added, zero if the pool is full
+         */
+        static constexpr UINT32 get_slab_count(UINT32 capacity, UINT32 cnt)
+        {
+                auto avail = capacity < MaxCapacity ? MaxCapacity - capacity : 0;
+                return cnt < avail ? cnt : avail;
+        }
+
+        /*
+         * The slab is freed with the pool, its objects are added by push_new.
+         * @param s zeroed memory of slab_type::get_size(cnt) bytes
+         */
+        static void add_slab(pool_type &pool, slab_type &s, UINT32 cnt)
+        {
+                s.cnt = cnt;
+                s.next = pool.slabs;
+                pool.slabs = &s;
+        }
+
+        /*
+         * @param obj initialized object of a slab of the pool
+         */
+        static void push_new(pool_type &pool, object_type &obj)
+        {
+                ++pool.capacity;
+                Traits::push_free(pool, obj);
+        }
+
+        /*
+         * Never allocates memory.
+         * @return nullptr if the pool is empty, the caller must use a fallback
+         */
+        static object_type* pop(pool_type &pool)
+        {
+                if (auto obj = Traits::pop_free(pool)) {
+                        Traits::add_ref(pool);
+                        return obj;
+                }
+
+                Traits::add_fallback(pool);
+                return nullptr;
+        }
+
+        /*
+         * The object is pushed before the reference is released, so the last release frees all of them.
+         * @return false if the object is not from a pool, the caller must free it
+         */
+        static bool push(object_type &obj)
+        {
+                auto pool = Traits::get_pool(obj);
+                if (pool) {
+                        Traits::push_free(*pool, obj);
+                        release(*pool);
+                }
+                return pool;
+        }
+
+        static void release(pool_type &pool)
+        {
+                if (Traits::release_ref(pool)) {
+                        Traits::free_pool(pool);
+                }
+        }
+};
+
+} // namespace usbip
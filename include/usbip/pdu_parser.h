@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "proto.h"
+#include <string.h>
+
+namespace usbip
+{
+
+/*
+ * Splits a stream of bytes received from a server into PDUs: usbip_header and optional payload.
+ * A caller feeds chunks of arbitrary size, a chunk can contain several PDUs or a part of one.
+ * It is a plain state machine that does not depend on kernel or user mode API.
+ *
+ * Handler must have the following member functions, if one of them returns false, parsing stops.
+ * 1.bool on_header(usbip_header &hdr, size_t &payload_size, bool &drain)
+ *   hdr is in network byte order, payload_size must be set, drain means the payload must be skipped.
+ * 2.bool on_payload(size_t offset, const void *data, size_t len)
+ *   a part of the payload, offset is relative to the start of the payload.
+ * 3.bool on_pdu()
+ *   the whole PDU was consumed, it is not called for drained PDUs.
+ */
+class pdu_parser
+{
+public:
+        enum state_t { HEADER, PAYLOAD, DRAIN }; // zeroed memory is a valid initial state
+
+        auto state() const { return m_state; }
+        auto payload_size() const { return m_size; }
+        auto remaining() const { return m_size - m_done; } // payload bytes
+
+        void reset() { *this = pdu_parser(); }
+
+        template<typename Handler>
+        bool parse(const void *data, size_t len, Handler &h);
+
+        /*
+         * The caller has received len bytes of the payload bypassing parse(), directly into the destination.
+         */
+        template<typename Handler>
+        bool skip(size_t len, Handler &h)
+        {
+                return m_state != HEADER && len <= remaining() && advance(len, h);
+        }
+
+private:
+        usbip_header m_hdr;
+        size_t m_hdr_len;
+
+        size_t m_size; // of the payload
+        size_t m_done; // bytes of the payload consumed
+
+        state_t m_state;
+
+        template<typename Handler>
+        bool on_header(Handler &h);
+
+        template<typename Handler>
+        bool advance(size_t len, Handler &h);
+};
+
+
+template<typename Handler>
+bool pdu_parser::parse(const void *data, size_t len, Handler &h)
+{
+        for (auto ptr = static_cast<const char*>(data); len; ) {
+
+                size_t cnt{};
+
+                if (m_state == HEADER) {
+                        cnt = sizeof(m_hdr) - m_hdr_len;
+                        if (cnt > len) {
+                                cnt = len;
+                        }
+
+                        memcpy(reinterpret_cast<char*>(&m_hdr) + m_hdr_len, ptr, cnt);
+                        m_hdr_len += cnt;
+
+                        if (m_hdr_len == sizeof(m_hdr) && !on_header(h)) {
+                                return false;
+                        }
+                } else {
+                        cnt = remaining();
+                        if (cnt > len) {
+                                cnt = len;
+                        }
+
+                        if (m_state == PAYLOAD && !h.on_payload(m_done, ptr, cnt)) {
+                                return false;
+                        }
+
+                        if (!advance(cnt, h)) {
+                                return false;
+                        }
+                }
+
+                ptr += cnt;
+                len -= cnt;
+        }
+
+        return true;
+}
+
+template<typename Handler>
+bool pdu_parser::on_header(Handler &h)
+{
+        m_hdr_len = 0;
+        m_size = 0;
+        m_done = 0;
+
+        bool drain{};
+        if (!h.on_header(m_hdr, m_size, drain)) {
+                return false;
+        }
+
+        m_state = drain ? DRAIN : PAYLOAD;
+        return m_size || advance(0, h);
+}
+
+template<typename Handler>
+bool pdu_parser::advance(size_t len, Handler &h)
+{
+        m_done += len;
+        if (m_done < m_size) {
+                return true;
+        }
+
+        auto drained = m_state == DRAIN;
+        m_state = HEADER;
+
+        return drained || h.on_pdu();
+}
+
+} // namespace usbip
@@ -1,9 +1,17 @@
 #pragma once
 
 #include "consts.h"
-#include <basetsd.h>
 
-#include <PSHPACK1.H>
+#ifdef _WIN32
+  #include <basetsd.h>
+#else
+  #include <stdint.h>
+  typedef uint8_t UINT8;
+  typedef uint16_t UINT16;
+  typedef uint32_t UINT32;
+#endif
+
+#pragma pack(push, 1)
 
 struct usbip_usb_interface 
 {
@@ -176,7 +184,7 @@ struct op_devlist_reply_extra {
 	usbip_net_pack_uint32_t(pack, &(reply)->ndev);	\
 } while (0)
 
-#include <POPPACK.H>
+#pragma pack(pop)
 
 void usbip_net_pack_uint32_t(int pack, UINT32 *num);
 void usbip_net_pack_uint16_t(int pack, UINT16 *num);
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "codec.h"
+
+namespace usbip
+{
+
+/*
+ * Hash table of in-flight requests with key seqnum, it does not depend on kernel or user mode API.
+ * Open addressing with linear probing, the storage is an array of Size pointers that is owned by a caller.
+ * seqnum is monotonic, so consecutive requests occupy consecutive slots and a lookup is O(1).
+ * Backward shift deletion is used, so the table never fills up with tombstones.
+ *
+ * T must have member seqnum_t seqnum, the caller is responsible for locking.
+ */
+template<typename T, UINT32 Size>
+struct seqnum_table
+{
+        static_assert(Size && !(Size & (Size - 1)), "must be a power of two");
+
+        enum : UINT32 { NPOS = Size };
+
+        static constexpr UINT32 slot(seqnum_t seqnum) { return extract_num(seqnum) & (Size - 1); }
+        static constexpr UINT32 next(UINT32 i) { return (i + 1) & (Size - 1); }
+
+        /*
+         * @return index of the element or NPOS
+         */
+        static UINT32 find(T* const *t, seqnum_t seqnum)
+        {
+                for (UINT32 i = slot(seqnum), cnt = 0; cnt < Size; i = next(i), ++cnt) {
+                        if (auto p = t[i]; !p) {
+                                break;
+                        } else if (p->seqnum == seqnum) {
+                                return i;
+                        }
+                }
+
+                return NPOS;
+        }
+
+        /*
+         * @return false if the table is full
+         */
+        static bool insert(T **t, T *p)
+        {
+                for (UINT32 i = slot(p->seqnum), cnt = 0; cnt < Size; i = next(i), ++cnt) {
+                        if (auto &s = t[i]; !s) {
+                                s = p;
+                                return true;
+                        }
+                }
+
+                return false;
+        }
+
+        /*
+         * An element can be moved to the freed slot if its home slot is not in the range (i, j].
+         * @param i index returned by find
+         */
+        static void erase(T **t, UINT32 i)
+        {
+                t[i] = nullptr;
+
+                for (auto j = next(i); auto p = t[j]; j = next(j)) {
+
+                        auto k = slot(p->seqnum);
+                        auto stay = i <= j ? i < k && k <= j : i < k || k <= j;
+
+                        if (!stay) {
+                                t[i] = p;
+                                t[j] = nullptr;
+                                i = j;
+                        }
+                }
+        }
+};
+
+} // namespace usbip
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _WIN32
+  #include <basetsd.h>
+#else
+  #include <stdint.h>
+  using UINT64 = uint64_t;
+#endif
+
+#include <stddef.h>
+
+/*
+ * Performance counters of an imported device, they do not depend on kernel or user mode API.
+ */
+namespace usbip
+{
+
+/*
+ * All members are UINT64 and only grow, the order must not be changed, new ones are appended.
+ */
+struct stats_counters
+{
+        UINT64 submitted; // URBs sent to a server
+        UINT64 completed; // URBs completed with any status except cancelled
+        UINT64 cancelled;
+        UINT64 bytes_in;  // transfer buffer data received from a server
+        UINT64 bytes_out; // transfer buffer data sent to a server
+        UINT64 unlinks;   // CMD_UNLINK sent
+        UINT64 drained;   // payloads of PDUs without a request that were skipped
+        UINT64 send_failures; // PDUs that were not sent because of a network error
+};
+
+constexpr auto stats_counters_cnt = sizeof(stats_counters)/sizeof(UINT64);
+static_assert(stats_counters_cnt*sizeof(UINT64) == sizeof(stats_counters));
+
+inline auto& operator +=(stats_counters &a, const stats_counters &b)
+{
+        auto dst = reinterpret_cast<UINT64*>(&a);
+        auto src = reinterpret_cast<const UINT64*>(&b);
+
+        for (size_t i = 0; i < stats_counters_cnt; ++i) {
+                dst[i] += src[i];
+        }
+
+        return a;
+}
+
+/*
+ * Counters of each CPU are read one by one and are not a consistent snapshot,
+ * so a sum can have more completions than submissions for a while.
+ */
+constexpr UINT64 get_in_flight(const stats_counters &c)
+{
+        auto done = c.completed + c.cancelled;
+        return c.submitted > done ? c.submitted - done : 0;
+}
+
+/*
+ * @param seconds between two snapshots
+ * @return per second
+ */
+constexpr double get_rate(UINT64 prev, UINT64 cur, double seconds)
+{
+        return cur > prev && seconds > 0 ? (cur - prev)/seconds : 0;
+}
+
+} // namespace usbip
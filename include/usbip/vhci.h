@@ -17,6 +17,9 @@
 
 #include "ch9.h"
 #include "consts.h"
+#include "stats.h"
+#include "histogram.h"
+#include "capture.h"
 
 /*
  * Strings encoding is UTF8. 
@@ -52,6 +55,19 @@ struct imported_device_properties
 
 struct imported_device : imported_device_location, imported_device_properties {};
 
+/*
+ * Stages of URB lifecycle, a latency histogram is kept for each of them.
+ */
+enum latency_stage
+{
+        LAT_QUEUE,      // from submission of URB to WskSend, time in send queue
+        LAT_NETWORK,    // from WskSend to RET_SUBMIT header, network and server
+        LAT_PAYLOAD,    // from RET_SUBMIT header to the end of its payload
+        LAT_COMPLETION, // from the end of the payload to completion of URB
+        LAT_TOTAL,      // from submission to completion of URB
+        LATENCY_STAGES
+};
+
 } // namespace usbip::vhci
 
 
@@ -63,6 +79,10 @@ enum class function { // 12 bit
         plugout_hardware, 
         get_imported_devices,
         driver_registry_path,
+        get_device_stats,
+        get_endpoint_latency,
+        set_capture,
+        get_capture,
 };
 
 constexpr auto make(function id)
@@ -76,6 +96,10 @@ enum {
         PLUGOUT_HARDWARE     = make(function::plugout_hardware),
         GET_IMPORTED_DEVICES = make(function::get_imported_devices),
         DRIVER_REGISTRY_PATH = make(function::driver_registry_path),
+        GET_DEVICE_STATS     = make(function::get_device_stats),
+        GET_ENDPOINT_LATENCY = make(function::get_endpoint_latency),
+        SET_CAPTURE          = make(function::set_capture),
+        GET_CAPTURE          = make(function::get_capture),
 };
 
 struct base
@@ -109,4 +133,86 @@ struct driver_registry_path : base
         WCHAR path[MAX_PATH]; // key name max size is 255
 };
 
+struct endpoint_stats
+{
+        UINT8 bEndpointAddress;
+        UINT8 bmAttributes; // transfer type
+        stats_counters counters;
+};
+
+/*
+ * Counters since the device was plugged in.
+ * A new version can only append members, the driver rejects a version it does not know.
+ */
+struct get_device_stats : base
+{
+        enum { VERSION = 1 };
+        UINT32 version; // IN
+
+        int port; // IN
+
+        stats_counters device; // sum of the counters of all endpoints, including removed ones
+
+        UINT64 sent_batches; // PDUs are sent in batches
+        UINT64 sent_pdus;
+
+        UINT64 descriptor_hits; // GET_DESCRIPTOR was served from the cache
+        UINT64 descriptor_misses;
+
+        UINT32 endpoint_cnt; // number of used elements in endpoints
+        endpoint_stats endpoints[32]; // USB device can have 31 endpoints at most
+};
+
+/*
+ * Latency histograms since the endpoint was created, values are ticks of the performance counter.
+ */
+struct get_endpoint_latency : base
+{
+        enum { VERSION = 1 };
+        UINT32 version; // IN
+
+        int port; // IN
+        UINT8 bEndpointAddress; // IN
+
+        UINT64 frequency; // ticks per second
+        latency_histogram send; // from WskSend to its completion, for all endpoints of the device
+        latency_histogram stages[LATENCY_STAGES];
+};
+
+/*
+ * Capture of PDUs is disabled by default.
+ */
+struct set_capture : base
+{
+        enum { VERSION = 1 };
+        UINT32 version;
+
+        int port;
+        bool enable;
+};
+
+/*
+ * Reads captured PDUs, the output buffer size determines the max number of records.
+ */
+struct get_capture : base
+{
+        enum { VERSION = 1 };
+        UINT32 version; // IN
+
+        int port; // IN
+
+        UINT64 frequency; // of the performance counter, ticks per second
+        UINT64 timestamp; // performance counter at system_time
+        UINT64 system_time; // 100-nanosecond intervals since January 1, 1601 (UTC)
+
+        UINT64 lost; // records that were overwritten before they were read
+        UINT32 count; // number of records
+        capture_record records[ANYSIZE_ARRAY];
+};
+
+constexpr auto get_capture_size(_In_ ULONG n)
+{
+        return offsetof(get_capture, records) + n*sizeof(*get_capture::records);
+}
+
 } // namespace usbip::vhci::ioctl
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/codec.h>
+
+#include <gtest/gtest.h>
+#include <cstring>
+
+namespace
+{
+
+using namespace usbip;
+
+auto make_cmd_submit(seqnum_t seqnum, usbip_dir dir, INT32 length, INT32 number_of_packets)
+{
+        usbip_header hdr{};
+
+        auto &b = hdr.base;
+        b.command = USBIP_CMD_SUBMIT;
+        b.seqnum = seqnum;
+        b.devid = 0x10002;
+        b.direction = dir;
+        b.ep = 3;
+
+        auto &r = hdr.u.cmd_submit;
+        r.transfer_flags = URB_SHORT_NOT_OK;
+        r.transfer_buffer_length = length;
+        r.start_frame = 0;
+        r.number_of_packets = number_of_packets;
+        r.interval = 4;
+
+        return hdr;
+}
+
+auto bytes_equal(const usbip_header &a, const usbip_header &b)
+{
+        return !memcmp(&a, &b, sizeof(a));
+}
+
+} // namespace
+
+
+TEST(codec, byteswap_is_network_order)
+{
+        auto hdr = make_cmd_submit(make_seqnum(1, true), USBIP_DIR_IN, 0x01020304, number_of_packets_non_isoch);
+        byteswap_header(hdr, swap_dir::host2net);
+
+        auto p = reinterpret_cast<const UINT8*>(&hdr.u.cmd_submit.transfer_buffer_length);
+        EXPECT_EQ(p[0], 1);
+        EXPECT_EQ(p[3], 4);
+
+        auto cmd = reinterpret_cast<const UINT8*>(&hdr.base.command);
+        EXPECT_EQ(cmd[3], USBIP_CMD_SUBMIT);
+}
+
+TEST(codec, byteswap_roundtrip_all_commands)
+{
+        for (auto cmd: {USBIP_CMD_SUBMIT, USBIP_RET_SUBMIT, USBIP_CMD_UNLINK, USBIP_RET_UNLINK}) {
+                usbip_header hdr{};
+                hdr.base.command = cmd;
+                hdr.base.seqnum = make_seqnum(7, false);
+
+                auto w = reinterpret_cast<UINT32*>(&hdr.u);
+                for (int i = 0; i < 7; ++i) {
+                        w[i] = 0x11223344u + i;
+                }
+                auto orig = hdr;
+
+                byteswap_header(hdr, swap_dir::host2net);
+                EXPECT_FALSE(bytes_equal(hdr, orig)) << cmd;
+
+                byteswap_header(hdr, swap_dir::net2host);
+                EXPECT_TRUE(bytes_equal(hdr, orig)) << cmd;
+        }
+}
+
+/*
+ * Per-endpoint template in network byte order patched by seqnum and length must be equal
+ * to the header that is built in host byte order and swapped at once, @see make_cmd_submit_template.
+ */
+TEST(codec, patched_template_equals_swapped_header)
+{
+        auto tmpl = make_cmd_submit(0, USBIP_DIR_IN, 0, number_of_packets_non_isoch);
+        tmpl.u.cmd_submit.transfer_flags = 0;
+        byteswap_header(tmpl, swap_dir::host2net);
+
+        for (seqnum_t num = 1; num < 100; ++num) {
+                auto seqnum = make_seqnum(num, true);
+                INT32 len = num*512;
+
+                auto expected = make_cmd_submit(seqnum, USBIP_DIR_IN, len, number_of_packets_non_isoch);
+                byteswap_header(expected, swap_dir::host2net);
+
+                auto hdr = tmpl;
+                hdr.base.seqnum = bswap(seqnum);
+                hdr.u.cmd_submit.transfer_flags = bswap(UINT32(URB_SHORT_NOT_OK));
+                hdr.u.cmd_submit.transfer_buffer_length = INT32(bswap(UINT32(len)));
+
+                ASSERT_TRUE(bytes_equal(hdr, expected)) << num;
+        }
+}
+
+TEST(codec, total_size)
+{
+        auto out = make_cmd_submit(make_seqnum(1, false), USBIP_DIR_OUT, 100, number_of_packets_non_isoch);
+        EXPECT_EQ(get_total_size(out), sizeof(usbip_header) + 100);
+
+        auto in = make_cmd_submit(make_seqnum(1, true), USBIP_DIR_IN, 100, number_of_packets_non_isoch);
+        EXPECT_EQ(get_payload_size(in), 0U);
+
+        auto isoch_in = make_cmd_submit(make_seqnum(1, true), USBIP_DIR_IN, 100, 3);
+        EXPECT_EQ(get_payload_size(isoch_in), 3*sizeof(usbip_iso_packet_descriptor));
+
+        usbip_header ret{};
+        ret.base.command = USBIP_RET_SUBMIT;
+        ret.base.direction = USBIP_DIR_IN;
+        ret.u.ret_submit.actual_length = 64;
+        ret.u.ret_submit.number_of_packets = 2;
+        EXPECT_EQ(get_payload_size(ret), 64 + 2*sizeof(usbip_iso_packet_descriptor));
+
+        ret.base.direction = USBIP_DIR_OUT;
+        EXPECT_EQ(get_payload_size(ret), 2*sizeof(usbip_iso_packet_descriptor));
+}
+
+TEST(codec, seqnum)
+{
+        for (seqnum_t num: {1U, 2U, 0x7FFFFFFFU}) {
+                for (auto dir_in: {false, true}) {
+                        auto seqnum = make_seqnum(num, dir_in);
+                        EXPECT_EQ(extract_num(seqnum), num);
+                        EXPECT_EQ(extract_dir(seqnum), dir_in ? USBIP_DIR_IN : USBIP_DIR_OUT);
+                        EXPECT_TRUE(is_valid_seqnum(seqnum));
+                }
+        }
+
+        EXPECT_FALSE(is_valid_seqnum(make_seqnum(0, true)));
+}
+
+TEST(codec, validate_ret_header)
+{
+        usbip_header hdr{};
+        hdr.base.command = USBIP_RET_SUBMIT;
+        hdr.base.seqnum = make_seqnum(5, true);
+        hdr.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+
+        EXPECT_EQ(validate_ret_header(hdr), header_error::none);
+        EXPECT_EQ(hdr.u.ret_submit.number_of_packets, 0);
+        EXPECT_EQ(hdr.base.direction, UINT32(USBIP_DIR_IN));
+
+        hdr.u.ret_submit.number_of_packets = USBIP_MAX_ISO_PACKETS + 1;
+        EXPECT_EQ(validate_ret_header(hdr), header_error::number_of_packets);
+
+        hdr.u.ret_submit.number_of_packets = USBIP_MAX_ISO_PACKETS;
+        hdr.base.seqnum = make_seqnum(0, true);
+        EXPECT_EQ(validate_ret_header(hdr), header_error::seqnum);
+
+        hdr.base.command = USBIP_CMD_SUBMIT;
+        EXPECT_EQ(validate_ret_header(hdr), header_error::command);
+
+        hdr.base.command = USBIP_RET_UNLINK;
+        hdr.base.seqnum = make_seqnum(6, false);
+        EXPECT_EQ(validate_ret_header(hdr), header_error::none);
+        EXPECT_EQ(hdr.base.direction, UINT32(USBIP_DIR_OUT));
+}
+
+TEST(codec, isoc_descriptors_follow_the_payload)
+{
+        struct {
+                usbip_header hdr;
+                char data[16];
+                usbip_iso_packet_descriptor d[2];
+        } pdu{};
+
+        pdu.hdr = make_cmd_submit(make_seqnum(1, false), USBIP_DIR_OUT, sizeof(pdu.data), 2);
+
+        usbip_iso_packet_descriptor *isoc{};
+        ASSERT_EQ(get_isoc_descr(isoc, pdu.hdr), 2U);
+        EXPECT_EQ(static_cast<void*>(isoc), static_cast<void*>(pdu.d));
+
+        pdu.d[1].actual_length = 0x01000000;
+        byteswap_payload(pdu.hdr);
+        EXPECT_EQ(pdu.d[1].actual_length, 1U);
+}
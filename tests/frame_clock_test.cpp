@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/frame_clock.h>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr INT64 FREQ = 10'000'000; // 100 ns, as QueryPerformanceFrequency usually reports
+constexpr INT64 MSEC = FREQ/1000;
+
+} // namespace
+
+
+TEST(frame_clock, isoch_frames)
+{
+        EXPECT_EQ(get_isoch_frames(8, 1, false), 8U);
+        EXPECT_EQ(get_isoch_frames(8, 1, true), 1U); // microframes
+        EXPECT_EQ(get_isoch_frames(9, 1, true), 2U);
+        EXPECT_EQ(get_isoch_frames(8, 4, true), 8U); // every 8th microframe
+        EXPECT_EQ(get_isoch_frames(8, 0, false), 8U); // invalid bInterval
+}
+
+TEST(frame_clock, not_synced)
+{
+        frame_clock c;
+        c.init(FREQ);
+
+        UINT32 frame{};
+        EXPECT_FALSE(c.synced());
+        EXPECT_FALSE(c.get_start_frame(frame, 100, 0));
+        EXPECT_EQ(c.frame(5*MSEC), 5U);
+}
+
+TEST(frame_clock, first_sync)
+{
+        frame_clock c;
+        c.init(FREQ);
+
+        c.sync(1000, 8, 0, 2*MSEC); // completed at frame 1008
+        EXPECT_TRUE(c.synced());
+        EXPECT_EQ(c.resyncs(), 1U);
+        EXPECT_EQ(c.frame(2*MSEC), 1008U);
+        EXPECT_EQ(c.frame(12*MSEC), 1018U);
+}
+
+/*
+ * The server's clock is ahead by 5000 frames, RET_SUBMIT-s arrive with up to 2 ms of jitter.
+ */
+TEST(frame_clock, tracks_server_with_jitter)
+{
+        frame_clock c;
+        c.init(FREQ);
+
+        const UINT32 offset = 5000;
+        const INT64 delays[] { 1, 3, 2, 1, 2, 3, 1, 1, 2, 3 }; // ms
+
+        for (int i = 0; i < 1000; ++i) {
+                INT64 done = 10 + i*8; // ms, the transfer is complete on the server
+                auto received = (done + delays[i % 10])*MSEC;
+                c.sync(UINT32(done - 8) + offset, 8, received - 10*MSEC, received);
+        }
+
+        EXPECT_EQ(c.resyncs(), 1U);
+
+        auto now = INT64(8100)*MSEC;
+        auto err = INT32(c.frame(now) - UINT32(8100 + offset));
+        EXPECT_LE(err, 1);
+        EXPECT_GE(err, -4); // lags by the network delay
+        EXPECT_LT(c.jitter_us(), 2000U);
+}
+
+TEST(frame_clock, resync_on_big_error)
+{
+        frame_clock c;
+        c.init(FREQ);
+
+        c.sync(1000, 1, 0, 10*MSEC);
+        c.sync(1000 + 10 + frame_clock::MAX_STEP*2, 1, 0, 20*MSEC); // the server was restarted
+
+        EXPECT_EQ(c.resyncs(), 2U);
+        EXPECT_EQ(c.frame(20*MSEC), 1001U + 10 + frame_clock::MAX_STEP*2);
+}
+
+TEST(frame_clock, start_frame)
+{
+        frame_clock c;
+        c.init(FREQ);
+
+        // RTT is 10 ms, the transfer takes 2 frames
+        c.sync(100, 2, 10*MSEC, 20*MSEC);
+        EXPECT_EQ(c.lead(), frame_clock::MIN_LEAD + 8);
+
+        auto now = 20*MSEC;
+        auto cur = c.frame(now);
+
+        UINT32 frame{};
+        ASSERT_TRUE(c.get_start_frame(frame, cur + 5, now));
+        EXPECT_EQ(frame, cur + 5 + c.lead());
+
+        EXPECT_FALSE(c.get_start_frame(frame, cur - 1, now)); // in the past
+        EXPECT_FALSE(c.get_start_frame(frame, cur + frame_clock::MAX_AHEAD + 1, now));
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/histogram.h>
+
+#include <gtest/gtest.h>
+
+using namespace usbip;
+using h = latency_histogram;
+
+TEST(histogram, buckets_are_contiguous)
+{
+        for (UINT32 b = 1; b < h::BUCKETS; ++b) {
+                ASSERT_EQ(get_bucket_lower(b), get_bucket_upper(b - 1) + 1) << b;
+        }
+}
+
+TEST(histogram, value_is_within_its_bucket)
+{
+        for (UINT64 v = 0; v < 100000; v = v < 64 ? v + 1 : v*9/8) {
+                auto b = get_bucket(v);
+                ASSERT_LT(b, h::BUCKETS);
+                ASSERT_LE(get_bucket_lower(b), v) << v;
+                ASSERT_GE(get_bucket_upper(b), v) << v;
+        }
+
+        EXPECT_EQ(get_bucket(h::MAX_VALUE), h::BUCKETS - 1);
+        EXPECT_EQ(get_bucket(h::MAX_VALUE + 1000), h::BUCKETS - 1);
+}
+
+TEST(histogram, relative_error)
+{
+        for (UINT64 v = h::SUB_BUCKETS; v < h::MAX_VALUE; v = v*3/2 + 1) {
+                auto b = get_bucket(v);
+                auto width = get_bucket_upper(b) - get_bucket_lower(b) + 1;
+                ASSERT_LE(width*h::SUB_BUCKETS, get_bucket_lower(b)) << v;
+        }
+}
+
+TEST(histogram, percentiles)
+{
+        h hist{};
+        EXPECT_EQ(get_percentile(hist, 50), 0U);
+
+        for (UINT64 v = 1; v <= 1000; ++v) {
+                record(hist, v);
+        }
+
+        EXPECT_EQ(get_count(hist), 1000U);
+        EXPECT_EQ(hist.sum, 500500U);
+
+        auto p50 = get_percentile(hist, 50);
+        auto p99 = get_percentile(hist, 99);
+
+        EXPECT_GE(p50, 500U);
+        EXPECT_LE(p50, 500U + 500/h::SUB_BUCKETS);
+        EXPECT_GE(p99, 990U);
+        EXPECT_LE(p99, 990U + 990/h::SUB_BUCKETS);
+        EXPECT_EQ(get_percentile(hist, 0), 1U);
+        EXPECT_GE(get_percentile(hist, 100), 1000U);
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <mock/client.h>
+#include <mock/server.h>
+
+#include <usbip/isoc.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+/*
+ * An isoch URB that has more than USBIP_MAX_ISO_PACKETS is split into parts that are submitted at once
+ * to mock::server and RET_SUBMIT-s of the parts are merged, as the driver does.
+ */
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::mock;
+
+enum : UINT32 {
+        EP = 3, // isoch, high speed, bInterval 1
+        PACKET_SIZE = 16,
+        NOT_ACCESSED = 0xC0020000, // USBD_STATUS_ISO_NOT_ACCESSED_BY_HW
+};
+
+constexpr auto HIGH_SPEED = true;
+constexpr auto INTERVAL = 1;
+
+struct packet // USBD_ISO_PACKET_DESCRIPTOR
+{
+        UINT32 Offset;
+        UINT32 Length;
+        UINT32 Status;
+};
+
+/*
+ * Isoch IN URB.
+ */
+struct urb
+{
+        explicit urb(UINT32 cnt) : packets(cnt)
+        {
+                for (UINT32 i = 0; i < cnt; ++i) {
+                        packets[i].Offset = i*PACKET_SIZE;
+                }
+
+                isoc::reset_packets(packets.data(), cnt, NOT_ACCESSED);
+                state = isoc::make_merge_state(cnt);
+        }
+
+        auto buf_len() const { return UINT32(packets.size()*PACKET_SIZE); }
+
+        std::vector<packet> packets;
+        isoc::part parts[isoc::MAX_PARTS]{};
+        UINT32 part_cnt{};
+        isoc::merge_state state{};
+};
+
+class loopback
+{
+public:
+        explicit loopback(options opts = {}) : m_srv((opts.port = 0, opts))
+        {
+                EXPECT_EQ(m_srv.listen(), "");
+                m_thread = std::thread(&server::run, &m_srv);
+
+                EXPECT_EQ(m_client.connect("127.0.0.1", m_srv.port()), "");
+                EXPECT_EQ(m_client.import("1-1"), "");
+        }
+
+        ~loopback()
+        {
+                m_client.close();
+                m_srv.stop();
+                m_thread.join();
+        }
+
+        auto& srv() { return m_srv; }
+        auto& client() { return m_client; }
+
+private:
+        server m_srv;
+        std::thread m_thread;
+        mock::client m_client;
+};
+
+auto make_cmd_submit(seqnum_t num, const isoc::part &p, UINT32 start_frame)
+{
+        usbip_header hdr{};
+
+        hdr.base.seqnum = make_seqnum(num, true);
+        hdr.base.direction = USBIP_DIR_IN;
+        hdr.base.ep = EP;
+
+        auto &cmd = hdr.u.cmd_submit;
+        cmd.transfer_buffer_length = p.length;
+        cmd.start_frame = start_frame;
+        cmd.number_of_packets = p.cnt;
+
+        return hdr;
+}
+
+/*
+ * @return the frame of the server that is not scheduled yet
+ */
+auto get_current_frame(mock::client &c)
+{
+        auto hdr = make_cmd_submit(0xFFFF, isoc::part{ .first = 0, .cnt = 1, .offset = 0, .length = PACKET_SIZE }, 0);
+        hdr.u.cmd_submit.transfer_flags = URB_ISO_ASAP;
+
+        usbip_iso_packet_descriptor d{};
+        d.length = PACKET_SIZE;
+
+        EXPECT_EQ(c.submit(hdr, nullptr, {d}), "");
+
+        std::string data;
+        std::vector<usbip_iso_packet_descriptor> isoc;
+        EXPECT_EQ(c.receive(hdr, data, isoc), "");
+
+        return UINT32(hdr.u.ret_submit.start_frame) + 1;
+}
+
+/*
+ * Submits all parts at once, seqnum of a part is its index + 1.
+ * @param start_frame of the first part, the parts are consecutive
+ */
+void submit(mock::client &c, urb &u, UINT32 start_frame, UINT32 cnt)
+{
+        for (UINT32 i = 0; i < cnt; ++i) {
+                auto &p = u.parts[i];
+
+                std::vector<usbip_iso_packet_descriptor> d(p.cnt);
+                ASSERT_EQ(isoc::pack(d.data(), u.packets.data() + p.first, p.cnt, p.offset + p.length, p.offset), p.cnt);
+
+                for (auto &e: d) {
+                        e = isoc::to_host(e);
+                }
+
+                ASSERT_EQ(c.submit(make_cmd_submit(i + 1, p, start_frame), nullptr, d), "");
+                start_frame = isoc::get_next_start_frame(start_frame, p, INTERVAL, HIGH_SPEED);
+        }
+}
+
+/*
+ * Receives RET_SUBMIT of a part and merges it.
+ * @return index of the part
+ */
+auto receive(mock::client &c, urb &u)
+{
+        usbip_header hdr{};
+        std::string data;
+        std::vector<usbip_iso_packet_descriptor> isoc;
+
+        EXPECT_EQ(c.receive(hdr, data, isoc), "");
+        EXPECT_EQ(hdr.base.command, USBIP_RET_SUBMIT);
+
+        auto idx = extract_num(hdr.base.seqnum) - 1;
+        EXPECT_LT(idx, u.part_cnt);
+
+        auto &p = u.parts[idx];
+        EXPECT_EQ(isoc.size(), p.cnt);
+
+        for (UINT32 i = 0; i < p.cnt && i < isoc.size(); ++i) {
+                auto &d = isoc[i];
+                auto &r = u.packets[p.first + i];
+
+                EXPECT_EQ(d.offset, r.Offset - p.offset);
+                r.Length = d.actual_length;
+                r.Status = d.status ? UINT32(NOT_ACCESSED) : 0;
+        }
+
+        isoc::merge(u.state, idx, p, hdr.u.ret_submit);
+        return idx;
+}
+
+TEST(isoc_loopback, split_merge)
+{
+        options opts;
+        opts.jitter = std::chrono::microseconds(5000); // RET_SUBMIT-s of the parts are reordered
+        opts.seed = 3;
+
+        loopback lo(opts);
+        auto &c = lo.client();
+
+        urb u(3*USBIP_MAX_ISO_PACKETS + 452);
+        u.part_cnt = isoc::split(u.parts, u.packets.data(), UINT32(u.packets.size()), u.buf_len());
+        ASSERT_EQ(u.part_cnt, 4U);
+
+        auto start_frame = get_current_frame(c) + 100;
+        submit(c, u, start_frame, u.part_cnt);
+
+        for (UINT32 i = 0; i < u.part_cnt; ++i) {
+                EXPECT_NE(u.state.error_count, 0U);
+                receive(c, u);
+        }
+
+        EXPECT_EQ(u.state.status, 0);
+        EXPECT_EQ(u.state.error_count, 0U);
+        EXPECT_EQ(u.state.start_frame, INT32(start_frame));
+
+        for (auto &p: u.packets) {
+                EXPECT_EQ(p.Status, 0U);
+                EXPECT_EQ(p.Length, PACKET_SIZE);
+        }
+
+        EXPECT_EQ(lo.srv().get_stats().urbs, 1U + u.part_cnt);
+}
+
+TEST(isoc_loopback, part_in_past)
+{
+        loopback lo;
+        auto &c = lo.client();
+
+        urb u(3*USBIP_MAX_ISO_PACKETS);
+        u.part_cnt = isoc::split(u.parts, u.packets.data(), UINT32(u.packets.size()), u.buf_len());
+        ASSERT_EQ(u.part_cnt, 3U);
+
+        auto frame = get_current_frame(c);
+
+        submit(c, u, 1, 1); // @see FRAME_BASE
+        EXPECT_EQ(receive(c, u), 0U);
+
+        EXPECT_EQ(u.state.status, -EXDEV_LNX);
+        EXPECT_EQ(u.state.error_count, u.packets.size());
+
+        u.state = isoc::make_merge_state(UINT32(u.packets.size())); // resubmit all parts
+        submit(c, u, frame + 100, u.part_cnt);
+
+        for (UINT32 i = 0; i < u.part_cnt; ++i) {
+                receive(c, u);
+        }
+
+        EXPECT_EQ(u.state.status, 0);
+        EXPECT_EQ(u.state.error_count, 0U);
+}
+
+TEST(isoc_loopback, unsent_part)
+{
+        loopback lo;
+        auto &c = lo.client();
+
+        urb u(2*USBIP_MAX_ISO_PACKETS + 10);
+        u.part_cnt = isoc::split(u.parts, u.packets.data(), UINT32(u.packets.size()), u.buf_len());
+        ASSERT_EQ(u.part_cnt, 3U);
+
+        submit(c, u, get_current_frame(c) + 100, 2); // the last part was not sent
+        receive(c, u);
+        receive(c, u);
+
+        EXPECT_EQ(u.state.status, 0);
+        EXPECT_EQ(u.state.error_count, u.parts[2].cnt);
+
+        for (UINT32 i = 0; i < u.packets.size(); ++i) {
+                auto &p = u.packets[i];
+                auto sent = i < u.parts[2].first;
+                EXPECT_EQ(p.Status, sent ? 0U : NOT_ACCESSED);
+                EXPECT_EQ(p.Length, sent ? PACKET_SIZE : 0U);
+        }
+}
+
+TEST(isoc_loopback, error_injection)
+{
+        options opts;
+        opts.error_rate = 1;
+
+        loopback lo(opts);
+        auto &c = lo.client();
+
+        urb u(USBIP_MAX_ISO_PACKETS + 1);
+        u.part_cnt = isoc::split(u.parts, u.packets.data(), UINT32(u.packets.size()), u.buf_len());
+        ASSERT_EQ(u.part_cnt, 2U);
+
+        submit(c, u, get_current_frame(c) + 100, u.part_cnt);
+        receive(c, u);
+        receive(c, u);
+
+        EXPECT_EQ(u.state.status, 0); // errors are in the packets
+        EXPECT_EQ(u.state.error_count, u.packets.size());
+
+        for (auto &p: u.packets) {
+                EXPECT_EQ(p.Status, NOT_ACCESSED);
+                EXPECT_EQ(p.Length, 0U);
+        }
+}
+
+TEST(isoc_loopback, unlink_each_part)
+{
+        options opts;
+        opts.latency = std::chrono::seconds(10);
+
+        loopback lo(opts);
+        auto &c = lo.client();
+
+        urb u(4*USBIP_MAX_ISO_PACKETS);
+        u.part_cnt = isoc::split(u.parts, u.packets.data(), UINT32(u.packets.size()), u.buf_len());
+        ASSERT_EQ(u.part_cnt, 4U);
+
+        submit(c, u, 0x10000, u.part_cnt); // far ahead, RET_SUBMIT-s are delayed anyway
+
+        for (UINT32 i = 0; i < u.part_cnt; ++i) {
+                ASSERT_EQ(c.unlink(make_seqnum(100 + i, true), make_seqnum(i + 1, true)), "");
+        }
+
+        for (UINT32 i = 0; i < u.part_cnt; ++i) {
+                usbip_header hdr{};
+                std::string data;
+                std::vector<usbip_iso_packet_descriptor> isoc;
+
+                ASSERT_EQ(c.receive(hdr, data, isoc), "");
+                EXPECT_EQ(hdr.base.command, USBIP_RET_UNLINK);
+                EXPECT_EQ(hdr.base.seqnum, make_seqnum(100 + i, true));
+                EXPECT_EQ(hdr.u.ret_unlink.status, -ECONNRESET_LNX);
+        }
+
+        EXPECT_EQ(lo.srv().get_stats().unlinks, u.part_cnt);
+}
+
+} // namespace
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/isoc.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct packet // USBD_ISO_PACKET_DESCRIPTOR
+{
+        UINT32 Offset;
+        UINT32 Length;
+        UINT32 Status;
+};
+
+auto make_packets(UINT32 cnt, UINT32 size)
+{
+        std::vector<packet> v(cnt);
+        for (UINT32 i = 0; i < cnt; ++i) {
+                v[i].Offset = i*size;
+        }
+        return v;
+}
+
+/*
+ * The compacted data received from a server and its descriptors in host byte order.
+ */
+struct ret_submit
+{
+        std::vector<usbip_iso_packet_descriptor> d;
+        std::string buf; // the transfer buffer, the compacted data is at the beginning
+        UINT32 actual_length{};
+};
+
+auto make_ret_submit(std::mt19937 &gen, UINT32 cnt, UINT32 size, int short_percent)
+{
+        ret_submit r;
+        r.buf.assign(cnt*size, '\0');
+
+        for (UINT32 i = 0; i < cnt; ++i) {
+                auto len = UINT32(gen() % 100) < UINT32(short_percent) ? UINT32(gen() % size) : size;
+                r.d.push_back({ .offset = i*size, .length = size, .actual_length = len, .status = 0 });
+
+                for (UINT32 j = 0; j < len; ++j) {
+                        r.buf[r.actual_length++] = char('a' + (i + j) % 26);
+                }
+        }
+
+        return r;
+}
+
+/*
+ * The algorithm of fill_isoc_data before isoc::expander, one memmove per packet.
+ */
+void expand_per_packet(ret_submit &r)
+{
+        auto length = r.actual_length;
+
+        for (auto i = r.d.size(); i--; ) {
+                auto &d = r.d[i];
+                length -= d.actual_length;
+                memmove(r.buf.data() + d.offset, r.buf.data() + length, d.actual_length);
+        }
+}
+
+/*
+ * @return false if get_unpack_error failed
+ */
+bool expand(ret_submit &r)
+{
+        isoc::expander exp(r.buf.data());
+        auto length = r.actual_length;
+        auto buf_len = UINT32(r.buf.size());
+
+        for (auto i = r.d.size(); i--; ) {
+                auto &d = r.d[i];
+                if (!d.actual_length) {
+                        continue;
+                }
+                if (isoc::get_unpack_error(d, d.offset, length, buf_len) != isoc::unpack_error::none) {
+                        return false;
+                }
+                exp.add(length, d.offset, d.actual_length);
+        }
+
+        exp.flush();
+        return !length;
+}
+
+/*
+ * Only the bytes of the packets are meaningful, the gaps between them are not.
+ */
+auto packets_equal(const ret_submit &a, const ret_submit &b)
+{
+        for (auto &d: a.d) {
+                if (a.buf.compare(d.offset, d.actual_length, b.buf, d.offset, d.actual_length)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+} // namespace
+
+
+TEST(isoc, pack)
+{
+        auto src = make_packets(4, 100);
+        usbip_iso_packet_descriptor d[4];
+
+        ASSERT_EQ(isoc::pack(d, src.data(), 4, 350), 4U);
+
+        auto h = isoc::to_host(d[1]);
+        EXPECT_EQ(h.offset, 100U);
+        EXPECT_EQ(h.length, 100U);
+        EXPECT_EQ(h.actual_length, 0U);
+
+        h = isoc::to_host(d[3]);
+        EXPECT_EQ(h.offset, 300U);
+        EXPECT_EQ(h.length, 50U); // to the end of the buffer
+}
+
+TEST(isoc, pack_invalid_offset)
+{
+        auto src = make_packets(4, 100);
+        src[2].Offset = 50; // less than the previous one
+        usbip_iso_packet_descriptor d[4];
+
+        EXPECT_EQ(isoc::pack(d, src.data(), 4, 400), 1U);
+        EXPECT_EQ(isoc::pack(d, make_packets(4, 100).data(), 4, 250), 2U); // beyond the buffer
+}
+
+TEST(isoc, pack_relative_to_part)
+{
+        auto src = make_packets(8, 10);
+        usbip_iso_packet_descriptor d[4];
+
+        ASSERT_EQ(isoc::pack(d, src.data() + 4, 4, 80, 40), 4U);
+        EXPECT_EQ(isoc::to_host(d[0]).offset, 0U);
+        EXPECT_EQ(isoc::to_host(d[3]).offset, 30U);
+}
+
+TEST(isoc, parts_of_large_urb)
+{
+        const UINT32 total = 2*USBIP_MAX_ISO_PACKETS + 10;
+        const UINT32 size = 8;
+        const UINT32 buf_len = total*size;
+
+        auto src = make_packets(total, size);
+        isoc::part p{};
+
+        UINT32 first = 0;
+        UINT32 length = 0;
+        UINT32 parts = 0;
+
+        while (first < total) {
+                ASSERT_TRUE(isoc::get_part(p, src.data(), total, first, buf_len));
+                EXPECT_EQ(p.offset, first*size);
+                EXPECT_EQ(p.length, p.cnt*size);
+
+                first += p.cnt;
+                length += p.length;
+                ++parts;
+        }
+
+        EXPECT_EQ(parts, 3U);
+        EXPECT_EQ(p.cnt, 10U);
+        EXPECT_EQ(length, buf_len);
+        EXPECT_EQ(isoc::get_part_size(total, total), 0U);
+
+        src[USBIP_MAX_ISO_PACKETS].Offset = buf_len + 1;
+        EXPECT_FALSE(isoc::get_part(p, src.data(), total, 0, buf_len));
+}
+
+TEST(isoc, split)
+{
+        const UINT32 total = 3*USBIP_MAX_ISO_PACKETS + 5;
+        const UINT32 size = 4;
+
+        auto src = make_packets(total, size);
+        isoc::part parts[isoc::MAX_PARTS];
+
+        ASSERT_EQ(isoc::split(parts, src.data(), total, total*size), 4U);
+
+        for (UINT32 i = 0; i < 4; ++i) {
+                auto &p = parts[i];
+                EXPECT_EQ(p.first, isoc::get_part_first(i));
+                EXPECT_EQ(p.cnt, i < 3 ? UINT32(USBIP_MAX_ISO_PACKETS) : 5U);
+                EXPECT_EQ(p.offset, p.first*size);
+                EXPECT_EQ(p.length, p.cnt*size);
+        }
+
+        ASSERT_EQ(isoc::split(parts, src.data(), 0, 0), 1U); // without packets
+        EXPECT_EQ(parts[0].cnt, 0U);
+        EXPECT_EQ(parts[0].length, 0U);
+
+        const UINT32 too_many = UINT32(isoc::MAX_PARTS)*USBIP_MAX_ISO_PACKETS + 1;
+        auto v = make_packets(too_many, 1);
+        EXPECT_EQ(isoc::split(parts, v.data(), too_many, too_many), 0U);
+        EXPECT_EQ(isoc::split(parts, v.data(), too_many - 1, too_many - 1), UINT32(isoc::MAX_PARTS));
+
+        src[2*USBIP_MAX_ISO_PACKETS].Offset = 0; // invalid offsets in the third part
+        EXPECT_EQ(isoc::split(parts, src.data(), total, total*size), 0U);
+}
+
+TEST(isoc, consecutive_start_frames)
+{
+        isoc::part p{ .first = 0, .cnt = USBIP_MAX_ISO_PACKETS, .offset = 0, .length = 0 };
+
+        EXPECT_EQ(isoc::get_next_start_frame(100, p, 1, false), 100U + USBIP_MAX_ISO_PACKETS);
+        EXPECT_EQ(isoc::get_next_start_frame(100, p, 1, true), 100U + USBIP_MAX_ISO_PACKETS/8); // microframes
+        EXPECT_EQ(isoc::get_next_start_frame(100, p, 4, true), 100U + USBIP_MAX_ISO_PACKETS);
+
+        EXPECT_EQ(isoc::get_next_start_frame(~0U, p, 1, false), USBIP_MAX_ISO_PACKETS - 1U); // wraparound
+}
+
+TEST(isoc, merge_out_of_order)
+{
+        const UINT32 total = 2*USBIP_MAX_ISO_PACKETS + 100;
+
+        auto src = make_packets(total, 8);
+        isoc::part parts[isoc::MAX_PARTS];
+        ASSERT_EQ(isoc::split(parts, src.data(), total, total*8), 3U);
+
+        auto m = isoc::make_merge_state(total);
+        EXPECT_EQ(m.error_count, total); // nothing is transferred yet
+
+        auto make_ret = [] (INT32 status, INT32 start_frame, INT32 error_count)
+        {
+                usbip_header_ret_submit r{};
+                r.status = status;
+                r.start_frame = start_frame;
+                r.error_count = error_count;
+                return r;
+        };
+
+        auto ret = make_ret(-EXDEV_LNX, 3000, 100);
+        isoc::merge(m, 2, parts[2], ret);
+        EXPECT_EQ(m.error_count, 2U*USBIP_MAX_ISO_PACKETS + 100);
+        EXPECT_EQ(m.status, -EXDEV_LNX);
+
+        ret = make_ret(-EPIPE_LNX, 2000, 3);
+        isoc::merge(m, 1, parts[1], ret);
+        EXPECT_EQ(m.status, -EPIPE_LNX); // the earlier part wins
+        EXPECT_EQ(m.status_part, 1U);
+
+        EXPECT_EQ(m.error_count, USBIP_MAX_ISO_PACKETS + 103U); // the first part is not received yet
+
+        ret = make_ret(0, 1000, 0);
+        isoc::merge(m, 0, parts[0], ret);
+
+        EXPECT_EQ(m.error_count, 103U);
+        EXPECT_EQ(m.start_frame, 1000);
+        EXPECT_EQ(m.status, -EPIPE_LNX);
+}
+
+TEST(isoc, merge_clamps_error_count)
+{
+        isoc::part p{ .first = 0, .cnt = 10, .offset = 0, .length = 0 };
+        auto m = isoc::make_merge_state(10);
+
+        usbip_header_ret_submit ret{};
+        ret.error_count = 1000; // invalid
+        isoc::merge(m, 0, p, ret);
+        EXPECT_EQ(m.error_count, 10U);
+
+        m = isoc::make_merge_state(10);
+        ret.error_count = -1;
+        isoc::merge(m, 0, p, ret);
+        EXPECT_EQ(m.error_count, 0U);
+}
+
+TEST(isoc, reset_packets)
+{
+        auto src = make_packets(4, 10);
+        for (auto &p: src) {
+                p.Length = 10;
+        }
+
+        isoc::reset_packets(src.data() + 1, 2, 0xC0000000U);
+
+        EXPECT_EQ(src[0].Status, 0U);
+        EXPECT_EQ(src[1].Status, 0xC0000000U);
+        EXPECT_EQ(src[2].Length, 0U);
+        EXPECT_EQ(src[3].Length, 10U);
+        EXPECT_EQ(src[2].Offset, 20U);
+}
+
+TEST(isoc, unpack_errors)
+{
+        UINT32 length = 100;
+        usbip_iso_packet_descriptor d{ .offset = 200, .length = 50, .actual_length = 60, .status = 0 };
+
+        EXPECT_EQ(isoc::get_unpack_error(d, 200U, length, 300U), isoc::unpack_error::actual_length);
+
+        d.actual_length = 40;
+        EXPECT_EQ(isoc::get_unpack_error(d, 100U, length, 300U), isoc::unpack_error::offset);
+
+        length = 10;
+        EXPECT_EQ(isoc::get_unpack_error(d, 200U, length, 300U), isoc::unpack_error::length);
+
+        length = 100;
+        EXPECT_EQ(isoc::get_unpack_error(d, 200U, length, 220U), isoc::unpack_error::buffer_length);
+
+        d.offset = 10;
+        length = 100;
+        EXPECT_EQ(isoc::get_unpack_error(d, 10U, length, 300U), isoc::unpack_error::gap);
+
+        d.offset = 200;
+        length = 100;
+        EXPECT_EQ(isoc::get_unpack_error(d, 200U, length, 300U), isoc::unpack_error::none);
+        EXPECT_EQ(length, 60U);
+}
+
+/*
+ * isoc::expander must give the same result as a memmove per packet.
+ */
+TEST(isoc, expander_differential)
+{
+        std::mt19937 gen(2023);
+
+        for (auto short_percent: {0, 1, 10, 50, 100}) {
+                for (UINT32 cnt: {1U, 2U, 7U, 64U, 1024U}) {
+                        auto a = make_ret_submit(gen, cnt, 192, short_percent);
+                        auto b = a;
+
+                        expand_per_packet(a);
+                        ASSERT_TRUE(expand(b));
+                        ASSERT_TRUE(packets_equal(a, b)) << short_percent << "% short, " << cnt << " packets";
+                }
+        }
+}
+
+TEST(isoc, expander_does_not_move_full_packets)
+{
+        std::mt19937 gen(1);
+        auto r = make_ret_submit(gen, 16, 64, 0);
+        auto orig = r.buf;
+
+        ASSERT_TRUE(expand(r));
+        EXPECT_EQ(r.buf, orig);
+}
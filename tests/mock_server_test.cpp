@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <mock/client.h>
+#include <mock/server.h>
+
+#include <usbip/codec.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::mock;
+
+class loopback
+{
+public:
+        explicit loopback(options opts = {}) : m_srv((opts.port = 0, opts))
+        {
+                EXPECT_EQ(m_srv.listen(), "");
+                m_thread = std::thread(&server::run, &m_srv);
+
+                EXPECT_EQ(m_client.connect("127.0.0.1", m_srv.port()), "");
+                EXPECT_EQ(m_client.import("1-1"), "");
+        }
+
+        ~loopback()
+        {
+                m_client.close();
+                m_srv.stop();
+                m_thread.join();
+        }
+
+        auto& srv() { return m_srv; }
+        auto& client() { return m_client; }
+
+private:
+        server m_srv;
+        std::thread m_thread;
+        mock::client m_client;
+};
+
+auto cmd_submit(seqnum_t num, bool dir_in, UINT32 ep, INT32 length)
+{
+        usbip_header hdr{};
+
+        hdr.base.seqnum = make_seqnum(num, dir_in);
+        hdr.base.direction = dir_in ? USBIP_DIR_IN : USBIP_DIR_OUT;
+        hdr.base.ep = ep;
+
+        auto &cmd = hdr.u.cmd_submit;
+        cmd.transfer_buffer_length = length;
+        cmd.number_of_packets = number_of_packets_non_isoch;
+
+        return hdr;
+}
+
+auto isoch_packets(int cnt, UINT32 length)
+{
+        std::vector<usbip_iso_packet_descriptor> v(cnt);
+        for (int i = 0; i < cnt; ++i) {
+                v[i].offset = i*length;
+                v[i].length = length;
+        }
+        return v;
+}
+
+struct reply
+{
+        usbip_header hdr;
+        std::string data;
+        std::vector<usbip_iso_packet_descriptor> isoc;
+};
+
+auto receive(mock::client &c)
+{
+        reply r;
+        EXPECT_EQ(c.receive(r.hdr, r.data, r.isoc), "");
+        return r;
+}
+
+TEST(mock_server, out_of_order_completion)
+{
+        options opts;
+        opts.jitter = std::chrono::microseconds(2000);
+        opts.seed = 1;
+
+        loopback lo(opts);
+
+        bench_options bo;
+        bo.depth = 16;
+        bo.warmup = 0;
+        bo.count = 500;
+
+        bench_result r;
+        ASSERT_EQ(run_bench(r, lo.client(), bo), "");
+
+        EXPECT_EQ(r.urbs, 500U);
+        EXPECT_EQ(get_count(r.latency), 500U);
+        EXPECT_EQ(r.errors, 0U);
+        EXPECT_GT(r.reordered, 0U);
+        EXPECT_EQ(r.bytes, 500U*bo.size);
+}
+
+TEST(mock_server, in_order_without_jitter)
+{
+        loopback lo;
+
+        bench_options bo;
+        bo.depth = 8;
+        bo.warmup = 0;
+        bo.count = 200;
+
+        bench_result r;
+        ASSERT_EQ(run_bench(r, lo.client(), bo), "");
+
+        EXPECT_EQ(r.urbs, 200U);
+        EXPECT_EQ(r.reordered, 0U);
+}
+
+TEST(mock_server, error_injection)
+{
+        options opts;
+        opts.error_rate = 0.2;
+        opts.seed = 7;
+
+        loopback lo(opts);
+
+        bench_options bo;
+        bo.dir_in = false;
+        bo.depth = 4;
+        bo.warmup = 0;
+        bo.count = 1000;
+
+        bench_result r;
+        ASSERT_EQ(run_bench(r, lo.client(), bo), "");
+
+        EXPECT_EQ(r.urbs, 1000U);
+        EXPECT_GT(r.errors, 0U);
+        EXPECT_LT(r.errors, r.urbs);
+        EXPECT_EQ(r.errors, lo.srv().get_stats().errors);
+}
+
+TEST(mock_server, unlink)
+{
+        options opts;
+        opts.latency = std::chrono::seconds(10);
+
+        loopback lo(opts);
+        auto &c = lo.client();
+
+        ASSERT_EQ(c.submit(cmd_submit(1, true, 1, 64)), "");
+        ASSERT_EQ(c.unlink(make_seqnum(2, true), make_seqnum(1, true)), "");
+
+        auto r = receive(c);
+        EXPECT_EQ(r.hdr.base.command, USBIP_RET_UNLINK);
+        EXPECT_EQ(r.hdr.base.seqnum, make_seqnum(2, true));
+        EXPECT_EQ(r.hdr.u.ret_unlink.status, -ECONNRESET_LNX);
+
+        ASSERT_EQ(c.unlink(make_seqnum(3, true), make_seqnum(1, true)), ""); // already unlinked
+
+        r = receive(c);
+        EXPECT_EQ(r.hdr.base.command, USBIP_RET_UNLINK);
+        EXPECT_EQ(r.hdr.u.ret_unlink.status, 0);
+
+        EXPECT_EQ(lo.srv().get_stats().unlinks, 1U);
+}
+
+TEST(mock_server, get_device_descriptor)
+{
+        loopback lo;
+        auto &c = lo.client();
+
+        auto hdr = cmd_submit(1, true, 0, 64);
+        UINT8 setup[] { 0x80, 6, 0, 1, 0, 0, 64, 0 };
+        memcpy(hdr.u.cmd_submit.setup, setup, sizeof(setup));
+
+        ASSERT_EQ(c.submit(hdr), "");
+
+        auto r = receive(c);
+        EXPECT_EQ(r.hdr.u.ret_submit.status, 0);
+        ASSERT_EQ(r.hdr.u.ret_submit.actual_length, 18);
+        ASSERT_EQ(r.data.size(), 18U);
+        EXPECT_EQ(r.data[1], 1); // USB_DEVICE_DESCRIPTOR_TYPE
+}
+
+TEST(mock_server, isoch_asap_back_to_back)
+{
+        loopback lo;
+        auto &c = lo.client();
+
+        auto packets = isoch_packets(256, 64);
+
+        auto hdr = cmd_submit(1, true, 3, 256*64);
+        hdr.u.cmd_submit.transfer_flags = URB_ISO_ASAP;
+        hdr.u.cmd_submit.number_of_packets = 256;
+
+        ASSERT_EQ(c.submit(hdr, nullptr, packets), "");
+
+        hdr.base.seqnum = make_seqnum(2, true);
+        ASSERT_EQ(c.submit(hdr, nullptr, packets), "");
+
+        auto r1 = receive(c);
+        auto r2 = receive(c);
+
+        EXPECT_EQ(r1.hdr.u.ret_submit.status, 0);
+        EXPECT_EQ(r1.hdr.u.ret_submit.actual_length, 256*64);
+        EXPECT_EQ(r1.data.size(), 256U*64);
+        ASSERT_EQ(r1.isoc.size(), 256U);
+        EXPECT_EQ(r1.isoc[255].actual_length, 64U);
+
+        EXPECT_EQ(r2.hdr.u.ret_submit.start_frame, r1.hdr.u.ret_submit.start_frame + 32); // 256 microframes
+}
+
+TEST(mock_server, isoch_start_frame_in_past)
+{
+        loopback lo;
+        auto &c = lo.client();
+
+        auto hdr = cmd_submit(1, false, 3, 4*512);
+        hdr.u.cmd_submit.start_frame = 1; // @see FRAME_BASE
+        hdr.u.cmd_submit.number_of_packets = 4;
+
+        std::string data(4*512, '\0');
+        ASSERT_EQ(c.submit(hdr, data.data(), isoch_packets(4, 512)), "");
+
+        auto r = receive(c);
+        EXPECT_EQ(r.hdr.u.ret_submit.status, -EXDEV_LNX);
+        EXPECT_EQ(r.hdr.u.ret_submit.error_count, 4);
+        ASSERT_EQ(r.isoc.size(), 4U);
+        EXPECT_EQ(r.isoc[0].status, UINT32(-EXDEV_LNX));
+}
+
+} // namespace
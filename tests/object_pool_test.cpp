@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/object_pool.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct pool;
+
+struct alignas(64) object // SYSTEM_CACHE_ALIGNMENT_SIZE
+{
+        object *next; // pool::free
+        pool *owner;
+        char data[32];
+};
+
+struct pool
+{
+        std::mutex mtx; // for free
+        object *free{};
+        std::atomic<long> refs{1};
+        std::atomic<long> fallbacks{};
+        pool_slab<object> *slabs{};
+        UINT32 capacity{};
+        int freed{}; // free_pool calls
+};
+
+struct traits
+{
+        using pool_type = pool;
+        using object_type = object;
+
+        static object* pop_free(pool &p)
+        {
+                std::lock_guard lck(p.mtx);
+                auto obj = p.free;
+                if (obj) {
+                        p.free = obj->next;
+                }
+                return obj;
+        }
+
+        static void push_free(pool &p, object &obj)
+        {
+                std::lock_guard lck(p.mtx);
+                obj.next = p.free;
+                p.free = &obj;
+        }
+
+        static void add_ref(pool &p) { ++p.refs; }
+        static bool release_ref(pool &p) { return !--p.refs; }
+        static void add_fallback(pool &p) { ++p.fallbacks; }
+        static auto get_pool(const object &obj) { return obj.owner; }
+        static void free_pool(pool &p) { ++p.freed; }
+};
+
+enum : UINT32 { MAX_CAPACITY = 16 };
+using object_pool_t = object_pool<traits, MAX_CAPACITY>;
+using slab = object_pool_t::slab_type;
+
+class object_pool_test : public testing::Test
+{
+protected:
+        ~object_pool_test()
+        {
+                for (auto s = m_pool.slabs; s; ) {
+                        auto next = s->next;
+                        operator delete(s, std::align_val_t(alignof(slab)));
+                        s = next;
+                }
+        }
+
+        /*
+         * As add_wsk_contexts does.
+         */
+        auto add(UINT32 cnt)
+        {
+                cnt = object_pool_t::get_slab_count(m_pool.capacity, cnt);
+                if (!cnt) {
+                        return cnt;
+                }
+
+                auto size = slab::get_size(cnt);
+                auto s = static_cast<slab*>(operator new(size, std::align_val_t(alignof(slab))));
+                memset(static_cast<void*>(s), 0, size);
+
+                object_pool_t::add_slab(m_pool, *s, cnt);
+
+                for (UINT32 i = 0; i < cnt; ++i) {
+                        auto &obj = s->objects()[i];
+                        obj.owner = &m_pool;
+                        object_pool_t::push_new(m_pool, obj);
+                }
+
+                return cnt;
+        }
+
+        pool m_pool;
+};
+
+} // namespace
+
+
+TEST(object_pool, get_slab_count)
+{
+        EXPECT_EQ(object_pool_t::get_slab_count(0, 4), 4U);
+        EXPECT_EQ(object_pool_t::get_slab_count(0, MAX_CAPACITY + 1), UINT32(MAX_CAPACITY));
+        EXPECT_EQ(object_pool_t::get_slab_count(MAX_CAPACITY - 3, 8), 3U);
+        EXPECT_EQ(object_pool_t::get_slab_count(MAX_CAPACITY, 1), 0U);
+        EXPECT_EQ(object_pool_t::get_slab_count(MAX_CAPACITY + 1, 1), 0U);
+        EXPECT_EQ(object_pool_t::get_slab_count(0, 0), 0U);
+}
+
+TEST(object_pool, slab_layout)
+{
+        static_assert(!(sizeof(slab) % alignof(object)));
+        static_assert(slab::get_size(3) == sizeof(slab) + 3*sizeof(object));
+
+        alignas(slab) char buf[slab::get_size(2)]{};
+        auto s = reinterpret_cast<slab*>(buf);
+
+        auto obj = s->objects();
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(obj) % alignof(object), 0U);
+        EXPECT_EQ(reinterpret_cast<char*>(obj + 2), buf + sizeof(buf));
+}
+
+TEST_F(object_pool_test, grow_up_to_max_capacity)
+{
+        EXPECT_EQ(add(10), 10U);
+        EXPECT_EQ(add(10), 6U);
+        EXPECT_EQ(add(1), 0U);
+
+        EXPECT_EQ(m_pool.capacity, UINT32(MAX_CAPACITY));
+        ASSERT_TRUE(m_pool.slabs);
+        EXPECT_EQ(m_pool.slabs->cnt, 6U);
+        ASSERT_TRUE(m_pool.slabs->next);
+        EXPECT_EQ(m_pool.slabs->next->cnt, 10U);
+        EXPECT_FALSE(m_pool.slabs->next->next);
+}
+
+TEST_F(object_pool_test, pop_push_refs)
+{
+        add(2);
+
+        auto a = object_pool_t::pop(m_pool);
+        auto b = object_pool_t::pop(m_pool);
+        ASSERT_TRUE(a);
+        ASSERT_TRUE(b);
+        EXPECT_NE(a, b);
+        EXPECT_EQ(m_pool.refs, 3);
+        EXPECT_EQ(m_pool.fallbacks, 0);
+
+        EXPECT_FALSE(object_pool_t::pop(m_pool)); // empty
+        EXPECT_EQ(m_pool.fallbacks, 1);
+        EXPECT_EQ(m_pool.refs, 3);
+
+        EXPECT_TRUE(object_pool_t::push(*b));
+        EXPECT_EQ(m_pool.refs, 2);
+        EXPECT_EQ(object_pool_t::pop(m_pool), b);
+
+        EXPECT_TRUE(object_pool_t::push(*a));
+        EXPECT_TRUE(object_pool_t::push(*b));
+        EXPECT_EQ(m_pool.refs, 1);
+        EXPECT_EQ(m_pool.freed, 0);
+}
+
+TEST_F(object_pool_test, foreign_object)
+{
+        object obj{};
+        EXPECT_FALSE(object_pool_t::push(obj)); // a fallback, the caller frees it
+        EXPECT_EQ(m_pool.refs, 1);
+}
+
+TEST_F(object_pool_test, last_release_frees)
+{
+        add(4);
+
+        auto obj = object_pool_t::pop(m_pool);
+        ASSERT_TRUE(obj);
+
+        object_pool_t::release(m_pool); // the owner closes the pool
+        EXPECT_EQ(m_pool.freed, 0);
+
+        object_pool_t::push(*obj);
+        EXPECT_EQ(m_pool.freed, 1);
+        EXPECT_EQ(m_pool.refs, 0);
+}
+
+TEST_F(object_pool_test, concurrent)
+{
+        add(MAX_CAPACITY);
+
+        std::vector<std::thread> v;
+        std::atomic<long> taken{};
+
+        for (int t = 0; t < 4; ++t) {
+                v.emplace_back([this, &taken]
+                {
+                        for (int i = 0; i < 10'000; ++i) {
+                                auto obj = object_pool_t::pop(m_pool);
+                                if (obj) {
+                                        auto n = ++taken;
+                                        EXPECT_LE(n, long(MAX_CAPACITY));
+                                        --taken;
+                                        object_pool_t::push(*obj);
+                                }
+                        }
+                });
+        }
+
+        for (auto &t: v) {
+                t.join();
+        }
+
+        EXPECT_EQ(m_pool.refs, 1);
+        EXPECT_EQ(m_pool.freed, 0);
+
+        UINT32 cnt = 0;
+        for (auto obj = m_pool.free; obj; obj = obj->next) {
+                ++cnt;
+        }
+        EXPECT_EQ(cnt, UINT32(MAX_CAPACITY));
+}
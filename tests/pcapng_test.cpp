@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/pcapng.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+auto get_u32(const std::string &s, size_t off)
+{
+        uint32_t v;
+        memcpy(&v, s.data() + off, sizeof(v));
+        return v;
+}
+
+auto get_u16_be(const std::string &s, size_t off)
+{
+        return uint16_t(uint8_t(s[off]) << 8 | uint8_t(s[off + 1]));
+}
+
+auto get_u32_be(const std::string &s, size_t off)
+{
+        return uint32_t(get_u16_be(s, off)) << 16 | get_u16_be(s, off + 2);
+}
+
+/*
+ * @return offsets of the blocks, the lengths at the beginning and at the end must be the same
+ */
+auto get_blocks(const std::string &s)
+{
+        std::vector<size_t> v;
+
+        for (size_t off = 0; off < s.size(); ) {
+                auto len = get_u32(s, off + 4);
+                EXPECT_EQ(len % 4, 0U) << off;
+                EXPECT_LE(off + len, s.size());
+                EXPECT_EQ(get_u32(s, off + len - 4), len) << off;
+
+                v.push_back(off);
+                off += len;
+        }
+
+        return v;
+}
+
+} // namespace
+
+
+TEST(pcapng, headers)
+{
+        std::string s;
+        pcapng_writer w(s);
+
+        auto v = get_blocks(s);
+        ASSERT_EQ(v.size(), 2U);
+
+        EXPECT_EQ(get_u32(s, 0), 0x0A0D0D0AU);
+        EXPECT_EQ(get_u32(s, 8), 0x1A2B3C4DU);
+        EXPECT_EQ(get_u32(s, v[1]), 1U); // IDB
+        EXPECT_EQ(get_u32(s, v[1] + 8) & 0xFFFF, 228U); // LINKTYPE_IPV4
+}
+
+TEST(pcapng, packets)
+{
+        std::string s;
+        pcapng_writer w(s);
+
+        w.write(0x1'0000'0002, true, 48, std::string(48, 'a'));
+        w.write(3, false, 1000, std::string(49, 'b')); // truncated, not aligned
+
+        auto v = get_blocks(s);
+        ASSERT_EQ(v.size(), 4U);
+
+        auto epb = v[2];
+        EXPECT_EQ(get_u32(s, epb), 6U);
+        EXPECT_EQ(get_u32(s, epb + 12), 1U); // timestamp, high
+        EXPECT_EQ(get_u32(s, epb + 16), 2U);
+        EXPECT_EQ(get_u32(s, epb + 20), 40U + 48); // captured
+        EXPECT_EQ(get_u32(s, epb + 24), 40U + 48); // original
+
+        auto ip = epb + 28;
+        EXPECT_EQ(uint8_t(s[ip]), 0x45);
+        EXPECT_EQ(get_u16_be(s, ip + 2), 40U + 48);
+        EXPECT_EQ(get_u16_be(s, ip + 22), 3240U); // destination port
+
+        epb = v[3];
+        EXPECT_EQ(get_u32(s, epb + 20), 40U + 49);
+        EXPECT_EQ(get_u32(s, epb + 24), 40U + 1000);
+
+        ip = epb + 28;
+        EXPECT_EQ(get_u16_be(s, ip + 20), 3240U); // source port
+        EXPECT_EQ(get_u32_be(s, ip + 28), 48U); // acknowledges the client's data
+}
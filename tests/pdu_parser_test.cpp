@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/pdu_parser.h>
+#include <usbip/codec.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct pdu
+{
+        seqnum_t seqnum;
+        std::string payload;
+};
+
+/*
+ * RET_SUBMIT-s of IN transfers in network byte order, as a server sends them.
+ */
+auto make_stream(const std::vector<pdu> &v)
+{
+        std::string s;
+
+        for (auto &p: v) {
+                usbip_header hdr{};
+                hdr.base.command = USBIP_RET_SUBMIT;
+                hdr.base.seqnum = p.seqnum;
+                hdr.u.ret_submit.actual_length = INT32(p.payload.size());
+                hdr.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+
+                byteswap_header(hdr, swap_dir::host2net);
+                s.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+                s += p.payload;
+        }
+
+        return s;
+}
+
+struct handler
+{
+        std::vector<pdu> pdus;
+        std::vector<seqnum_t> drained;
+        seqnum_t drain_seqnum{}; // payload of this PDU is skipped
+        size_t stop_after = SIZE_MAX; // on_pdu returns false
+
+        bool on_header(usbip_header &hdr, size_t &payload_size, bool &drain)
+        {
+                byteswap_header(hdr, swap_dir::net2host);
+                if (validate_ret_header(hdr) != header_error::none) {
+                        return false;
+                }
+
+                payload_size = get_payload_size(hdr);
+                drain = hdr.base.seqnum == drain_seqnum;
+
+                if (drain) {
+                        drained.push_back(hdr.base.seqnum);
+                } else {
+                        pdus.push_back({hdr.base.seqnum, {}});
+                }
+
+                return true;
+        }
+
+        bool on_payload(size_t offset, const void *data, size_t len)
+        {
+                auto &s = pdus.back().payload;
+                EXPECT_EQ(offset, s.size());
+                s.append(static_cast<const char*>(data), len);
+                return true;
+        }
+
+        bool on_pdu() { return pdus.size() < stop_after; }
+};
+
+auto sample()
+{
+        return std::vector<pdu> {
+                {make_seqnum(1, true), "abc"},
+                {make_seqnum(2, true), ""},
+                {make_seqnum(3, true), std::string(1000, 'x')},
+                {make_seqnum(4, true), "0123456789"},
+                {make_seqnum(5, true), ""},
+        };
+}
+
+void expect_equal(const std::vector<pdu> &a, const std::vector<pdu> &b)
+{
+        ASSERT_EQ(a.size(), b.size());
+
+        for (size_t i = 0; i < a.size(); ++i) {
+                EXPECT_EQ(a[i].seqnum, b[i].seqnum) << i;
+                EXPECT_EQ(a[i].payload, b[i].payload) << i;
+        }
+}
+
+} // namespace
+
+
+TEST(pdu_parser, any_chunk_size)
+{
+        auto v = sample();
+        auto stream = make_stream(v);
+
+        for (size_t chunk = 1; chunk <= stream.size(); chunk += chunk < 64 ? 1 : 97) {
+                pdu_parser p{};
+                handler h;
+
+                for (size_t i = 0; i < stream.size(); i += chunk) {
+                        auto len = std::min(chunk, stream.size() - i);
+                        ASSERT_TRUE(p.parse(stream.data() + i, len, h)) << chunk;
+                }
+
+                EXPECT_EQ(p.state(), pdu_parser::HEADER);
+                expect_equal(h.pdus, v);
+        }
+}
+
+TEST(pdu_parser, drain)
+{
+        auto v = sample();
+        auto stream = make_stream(v);
+
+        pdu_parser p{};
+        handler h;
+        h.drain_seqnum = v[2].seqnum;
+
+        ASSERT_TRUE(p.parse(stream.data(), stream.size(), h));
+        ASSERT_EQ(h.drained.size(), 1U);
+        EXPECT_EQ(h.drained[0], v[2].seqnum);
+
+        v.erase(v.begin() + 2);
+        expect_equal(h.pdus, v);
+}
+
+TEST(pdu_parser, handler_stops_parsing)
+{
+        auto stream = make_stream(sample());
+
+        pdu_parser p{};
+        handler h;
+        h.stop_after = 2;
+
+        EXPECT_FALSE(p.parse(stream.data(), stream.size(), h));
+        EXPECT_EQ(h.pdus.size(), 2U);
+}
+
+/*
+ * A large payload is received directly into the destination, the parser is told how much was skipped.
+ */
+TEST(pdu_parser, skip_payload)
+{
+        std::vector<pdu> v{ {make_seqnum(1, true), std::string(100, 'y')}, {make_seqnum(2, true), "z"} };
+        auto stream = make_stream(v);
+
+        pdu_parser p{};
+        handler h;
+
+        ASSERT_TRUE(p.parse(stream.data(), sizeof(usbip_header) + 10, h));
+        EXPECT_EQ(p.state(), pdu_parser::PAYLOAD);
+        EXPECT_EQ(p.remaining(), 90U);
+
+        EXPECT_FALSE(p.skip(91, h));
+        ASSERT_TRUE(p.skip(90, h));
+        EXPECT_EQ(p.state(), pdu_parser::HEADER);
+
+        auto rest = sizeof(usbip_header) + 100;
+        ASSERT_TRUE(p.parse(stream.data() + rest, stream.size() - rest, h));
+
+        ASSERT_EQ(h.pdus.size(), 2U);
+        EXPECT_EQ(h.pdus[0].payload, std::string(10, 'y'));
+        EXPECT_EQ(h.pdus[1].payload, "z");
+}
+
+TEST(pdu_parser, invalid_header)
+{
+        usbip_header hdr{};
+        hdr.base.command = USBIP_CMD_SUBMIT; // a server must not send it
+
+        pdu_parser p{};
+        handler h;
+
+        EXPECT_FALSE(p.parse(&hdr, sizeof(hdr), h));
+}
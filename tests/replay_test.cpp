@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/session.h>
+#include <usbip/pcapng.h>
+
+#include <usbip/codec.h>
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr uint16_t USBIP_PORT = 3240; // @see pcapng_writer
+
+auto as_string(const usbip_header &hdr)
+{
+        return std::string(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+}
+
+auto cmd_submit(seqnum_t seqnum, usbip_dir dir, INT32 length)
+{
+        usbip_header hdr{};
+
+        auto &b = hdr.base;
+        b.command = USBIP_CMD_SUBMIT;
+        b.seqnum = seqnum;
+        b.devid = 0x10002;
+        b.direction = dir;
+        b.ep = 1;
+
+        hdr.u.cmd_submit.transfer_buffer_length = length;
+        hdr.u.cmd_submit.number_of_packets = number_of_packets_non_isoch;
+
+        byteswap_header(hdr, swap_dir::host2net);
+        return as_string(hdr);
+}
+
+auto ret_submit(seqnum_t seqnum, INT32 actual_length)
+{
+        usbip_header hdr{};
+        hdr.base.command = USBIP_RET_SUBMIT;
+        hdr.base.seqnum = seqnum;
+        hdr.u.ret_submit.actual_length = actual_length;
+        hdr.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+
+        byteswap_header(hdr, swap_dir::host2net);
+        return as_string(hdr);
+}
+
+void write(pcapng_writer &w, uint64_t time, bool out, const std::string &pdu)
+{
+        w.write(time, out, uint32_t(pdu.size()), pdu);
+}
+
+/*
+ * pcapng_writer -> file -> read_pcap_file, a capture of "usbip capture" is read by "usbip replay".
+ */
+auto write_read(const std::string &capture)
+{
+        auto path = std::filesystem::temp_directory_path() / "usbip_replay_test.pcapng";
+        std::ofstream(path, std::ios::binary).write(capture.data(), std::streamsize(capture.size()));
+
+        std::vector<packet> packets;
+        auto err = read_pcap_file(path.string(), packets);
+        std::filesystem::remove(path);
+
+        EXPECT_EQ(err, "");
+        return packets;
+}
+
+} // namespace
+
+
+TEST(replay, pcapng_round_trip)
+{
+        std::string capture;
+        pcapng_writer w(capture);
+
+        auto in = make_seqnum(1, true);
+        auto out = make_seqnum(2, false);
+
+        write(w, 1'000, true, cmd_submit(in, USBIP_DIR_IN, 512));
+        write(w, 1'100, true, cmd_submit(out, USBIP_DIR_OUT, 100) + std::string(100, 'o'));
+        write(w, 1'500, false, ret_submit(in, 512) + std::string(512, 'i'));
+        write(w, 1'700, false, ret_submit(out, 100));
+
+        auto packets = write_read(capture);
+        ASSERT_EQ(packets.size(), 4U);
+        EXPECT_EQ(packets[0].time, 1'000U);
+        EXPECT_EQ(packets[2].length, 40U + 48 + 512); // IPv4 and TCP headers
+
+        auto r = replay::analyze(packets, USBIP_PORT);
+        EXPECT_EQ(r.packets, 4U);
+        EXPECT_EQ(r.flows, 1U);
+        EXPECT_EQ(r.cmd_submit, 2U);
+        EXPECT_EQ(r.ret_submit, 2U);
+        EXPECT_EQ(r.errors(), 0U);
+        EXPECT_EQ(r.gaps, 0U);
+        EXPECT_EQ(r.unanswered, 0U);
+
+        ASSERT_EQ(r.endpoints.size(), 2U);
+        for (auto &e: r.endpoints) {
+                EXPECT_EQ(e.urbs, 1U);
+                EXPECT_EQ(e.bytes, e.dir_in ? 512U : 100U);
+                EXPECT_EQ(get_count(e.rtt), 1U);
+        }
+}
+
+TEST(replay, unanswered_and_unmatched)
+{
+        std::string capture;
+        pcapng_writer w(capture);
+
+        write(w, 1, true, cmd_submit(make_seqnum(1, true), USBIP_DIR_IN, 8));
+        write(w, 2, false, ret_submit(make_seqnum(5, true), 0));
+
+        auto r = replay::analyze(write_read(capture), USBIP_PORT);
+        EXPECT_EQ(r.unmatched, 1U);
+        EXPECT_EQ(r.unanswered, 1U);
+}
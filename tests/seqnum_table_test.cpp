@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/seqnum_table.h>
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct request
+{
+        seqnum_t seqnum;
+};
+
+enum : UINT32 { SIZE = 64 };
+using table = seqnum_table<request, SIZE>;
+
+struct seqnum_table_test : testing::Test
+{
+        request *t[SIZE]{};
+
+        auto find(seqnum_t seqnum) const
+        {
+                auto i = table::find(t, seqnum);
+                return i == table::NPOS ? nullptr : t[i];
+        }
+
+        auto erase(seqnum_t seqnum)
+        {
+                auto i = table::find(t, seqnum);
+                if (i != table::NPOS) {
+                        table::erase(t, i);
+                }
+                return i != table::NPOS;
+        }
+
+        auto count() const
+        {
+                UINT32 n = 0;
+                for (auto p: t) {
+                        n += bool(p);
+                }
+                return n;
+        }
+};
+
+} // namespace
+
+
+TEST_F(seqnum_table_test, insert_find_erase)
+{
+        std::vector<request> v;
+        for (seqnum_t i = 1; i <= 10; ++i) {
+                v.push_back({make_seqnum(i, i % 2)});
+        }
+
+        for (auto &r: v) {
+                ASSERT_TRUE(table::insert(t, &r));
+        }
+
+        for (auto &r: v) {
+                EXPECT_EQ(find(r.seqnum), &r);
+        }
+
+        EXPECT_EQ(find(make_seqnum(11, false)), nullptr);
+
+        ASSERT_TRUE(erase(v[3].seqnum));
+        EXPECT_EQ(find(v[3].seqnum), nullptr);
+        EXPECT_FALSE(erase(v[3].seqnum));
+        EXPECT_EQ(count(), v.size() - 1);
+}
+
+/*
+ * seqnum-s that have the same home slot, the chain wraps around the end of the array.
+ */
+TEST_F(seqnum_table_test, collisions_and_wraparound)
+{
+        std::vector<request> v;
+        for (seqnum_t i = 0; i < 5; ++i) {
+                v.push_back({make_seqnum(SIZE - 2 + i*SIZE, true)});
+        }
+        v.push_back({make_seqnum(SIZE - 1, false)}); // its home slot is taken
+
+        for (auto &r: v) {
+                ASSERT_TRUE(table::insert(t, &r));
+        }
+
+        ASSERT_TRUE(erase(v[0].seqnum)); // the rest must be shifted back
+        ASSERT_TRUE(erase(v[2].seqnum));
+
+        for (auto i: {1, 3, 4, 5}) {
+                EXPECT_EQ(find(v[i].seqnum), &v[i]) << i;
+        }
+}
+
+TEST_F(seqnum_table_test, full)
+{
+        std::vector<request> v(SIZE + 1);
+        for (seqnum_t i = 0; i < v.size(); ++i) {
+                v[i].seqnum = make_seqnum(i + 1, false);
+        }
+
+        for (UINT32 i = 0; i < SIZE; ++i) {
+                ASSERT_TRUE(table::insert(t, &v[i]));
+        }
+
+        EXPECT_FALSE(table::insert(t, &v[SIZE]));
+        EXPECT_EQ(find(make_seqnum(SIZE + 5, false)), nullptr); // the whole array is probed
+}
+
+/*
+ * Requests complete out of order, compared with std::map.
+ */
+TEST_F(seqnum_table_test, random_against_map)
+{
+        std::mt19937 gen(12345);
+        std::map<seqnum_t, std::unique_ptr<request>> expected;
+        seqnum_t next = 1;
+
+        for (int step = 0; step < 100000; ++step) {
+                if (expected.size() < SIZE*3/4 && (expected.empty() || gen() % 2)) {
+                        auto seqnum = make_seqnum(next++, gen() % 2);
+                        auto &r = expected[seqnum] = std::make_unique<request>(request{seqnum});
+                        ASSERT_TRUE(table::insert(t, r.get()));
+                } else {
+                        auto it = expected.begin();
+                        std::advance(it, gen() % expected.size());
+                        ASSERT_TRUE(erase(it->first));
+                        expected.erase(it);
+                }
+
+                if (step % 97 == 0) {
+                        ASSERT_EQ(count(), expected.size());
+                        for (auto &[seqnum, r]: expected) {
+                                ASSERT_EQ(find(seqnum), r.get());
+                        }
+                }
+        }
+}
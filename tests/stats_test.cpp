@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <usbip/stats.h>
+
+#include <gtest/gtest.h>
+
+using namespace usbip;
+
+/*
+ * The driver sums per-CPU counters this way, @see GET_DEVICE_STATS.
+ */
+TEST(stats, sum_of_cpus)
+{
+        stats_counters cpu[4]{};
+
+        for (UINT64 i = 0; i < 4; ++i) {
+                auto &c = cpu[i];
+                c.submitted = 10*(i + 1);
+                c.completed = 9*(i + 1);
+                c.cancelled = 1;
+                c.bytes_in = 1000;
+                c.send_failures = i;
+        }
+
+        stats_counters total{};
+        for (auto &c: cpu) {
+                total += c;
+        }
+
+        EXPECT_EQ(total.submitted, 100U);
+        EXPECT_EQ(total.completed, 90U);
+        EXPECT_EQ(total.cancelled, 4U);
+        EXPECT_EQ(total.bytes_in, 4000U);
+        EXPECT_EQ(total.bytes_out, 0U);
+        EXPECT_EQ(total.send_failures, 6U);
+        EXPECT_EQ(get_in_flight(total), 6U);
+}
+
+TEST(stats, in_flight_of_inconsistent_snapshot)
+{
+        stats_counters c{};
+        c.submitted = 5;
+        c.completed = 6; // another CPU was read later
+
+        EXPECT_EQ(get_in_flight(c), 0U);
+}
+
+TEST(stats, rate)
+{
+        EXPECT_DOUBLE_EQ(get_rate(100, 300, 2), 100);
+        EXPECT_DOUBLE_EQ(get_rate(300, 100, 2), 0); // a device was reattached
+        EXPECT_DOUBLE_EQ(get_rate(100, 300, 0), 0);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <libusbip/src/usb_ids.h>
+#include <libusbip/src/usb_ids_table.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * UsbIds keeps views of the content, it must outlive the object.
+ */
+const std::string& get_text()
+{
+        static auto s = []
+        {
+                std::ifstream f(USBIP_USB_IDS, std::ios::binary);
+                std::ostringstream os;
+                os << f.rdbuf();
+                return std::move(os).str();
+        }();
+
+        return s;
+}
+
+thread_local size_t g_allocs; // by operator new
+
+/*
+ * The table is copied to aligned memory to be modified.
+ */
+auto copy_table()
+{
+        auto t = usb_ids::get_table();
+
+        std::vector<usb_ids::record> v(t.size()/sizeof(usb_ids::record) + 1);
+        memcpy(v.data(), t.data(), t.size());
+
+        return v;
+}
+
+inline auto as_view(const std::vector<usb_ids::record> &v, size_t size)
+{
+        return std::string_view(reinterpret_cast<const char*>(v.data()), size);
+}
+
+/*
+ * @param GetParam() true for the binary table, false for the text of usb.ids
+ */
+struct usb_ids_test : testing::TestWithParam<bool>
+{
+        UsbIds ids{ GetParam() ? usb_ids::get_table() : get_text() };
+};
+
+} // namespace
+
+void* operator new(size_t size)
+{
+        ++g_allocs;
+
+        if (auto p = malloc(size ? size : 1)) {
+                return p;
+        }
+
+        throw std::bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic push
+  #pragma GCC diagnostic ignored "-Wmismatched-new-delete" // false positive for replaced operator new
+#endif
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+  #pragma GCC diagnostic pop
+#endif
+
+INSTANTIATE_TEST_SUITE_P(content, usb_ids_test, testing::Bool(), 
+                         [] (auto &info) { return info.param ? "table" : "text"; });
+
+TEST_P(usb_ids_test, loaded)
+{
+        ASSERT_FALSE(get_text().empty()) << USBIP_USB_IDS;
+        EXPECT_TRUE(ids);
+}
+
+TEST_P(usb_ids_test, find_product)
+{
+        auto [vendor, product] = ids.find_product(0x1d6b, 0x0002);
+        EXPECT_EQ(vendor, "Linux Foundation");
+        EXPECT_EQ(product, "2.0 root hub");
+
+        std::tie(vendor, product) = ids.find_product(0x1d6b, 0xfffe);
+        EXPECT_EQ(vendor, "Linux Foundation");
+        EXPECT_TRUE(product.empty());
+}
+
+TEST_P(usb_ids_test, find_class_subclass_proto)
+{
+        auto [cls, subcls, proto] = ids.find_class_subclass_proto(3, 0, 2);
+        EXPECT_EQ(cls, "Human Interface Device");
+        EXPECT_TRUE(subcls.empty()); // zero id has no name, but has children
+        EXPECT_EQ(proto, "Mouse");
+
+        std::tie(cls, subcls, proto) = ids.find_class_subclass_proto(9, 0, 1);
+        EXPECT_EQ(cls, "Hub");
+        EXPECT_EQ(proto, "Single TT");
+}
+
+TEST_P(usb_ids_test, find_by_name)
+{
+        auto v = ids.find_by_name("LINUX FOUNDATION");
+        ASSERT_FALSE(v.empty());
+        EXPECT_TRUE(std::is_sorted(v.begin(), v.end()));
+        EXPECT_NE(std::find(v.begin(), v.end(), std::make_pair(uint16_t(0x1d6b), uint16_t(0))), v.end());
+
+        v = ids.find_by_name("2.0 root hub");
+        EXPECT_NE(std::find(v.begin(), v.end(), std::make_pair(uint16_t(0x1d6b), uint16_t(0x0002))), v.end());
+
+        EXPECT_TRUE(ids.find_by_name("no such device, really").empty());
+}
+
+TEST(usb_ids, empty)
+{
+        UsbIds ids("");
+        EXPECT_TRUE(ids.find_product(0x1d6b, 0x0002).first.empty());
+}
+
+TEST(usb_ids, table_is_generated)
+{
+        EXPECT_EQ(usb_ids::make_table(get_text()), usb_ids::get_table());
+        EXPECT_TRUE(usb_ids::make_table("").empty());
+}
+
+/*
+ * The names of all vendors and products found by name are the same.
+ */
+TEST(usb_ids, table_matches_text)
+{
+        UsbIds text(get_text());
+        UsbIds table(usb_ids::get_table());
+
+        auto v = text.find_by_name("a"); // most of the names
+        ASSERT_GT(v.size(), 10'000U);
+        EXPECT_EQ(table.find_by_name("a"), v);
+
+        for (auto [vid, pid]: v) {
+                EXPECT_EQ(text.find_product(vid, pid), table.find_product(vid, pid));
+        }
+
+        for (int cls = 0; cls < 0x100; ++cls) {
+                for (int sub = 0; sub < 0x100; ++sub) {
+                        EXPECT_EQ(text.find_class_subclass_proto(uint8_t(cls), uint8_t(sub), 1), 
+                                  table.find_class_subclass_proto(uint8_t(cls), uint8_t(sub), 1));
+                }
+        }
+}
+
+/*
+ * The only allocation is UsbIds::Impl.
+ */
+TEST(usb_ids, table_load_does_not_allocate)
+{
+        auto t = usb_ids::get_table();
+
+        g_allocs = 0;
+        UsbIds ids(t);
+        auto cnt = g_allocs;
+
+        EXPECT_TRUE(ids);
+        EXPECT_EQ(cnt, 1U);
+}
+
+TEST(usb_ids, corrupted_table)
+{
+        auto size = usb_ids::table_size;
+        auto v = copy_table();
+        EXPECT_TRUE(UsbIds(as_view(v, size)));
+
+        EXPECT_FALSE(UsbIds(as_view(v, size - 1)));
+        EXPECT_FALSE(UsbIds(as_view(v, sizeof(usb_ids::header) - 1)));
+
+        auto misaligned = copy_table();
+        auto p = reinterpret_cast<char*>(misaligned.data());
+        memmove(p + 1, p, size);
+        EXPECT_FALSE(UsbIds(std::string_view(p + 1, size)));
+
+        auto &hdr = *reinterpret_cast<usb_ids::header*>(v.data());
+        auto rec = reinterpret_cast<usb_ids::record*>(&hdr + 1);
+
+        ++hdr.version;
+        EXPECT_FALSE(UsbIds(as_view(v, size)));
+        --hdr.version;
+
+        auto &vendor = rec[0];
+        auto last = vendor.last;
+
+        vendor.last = hdr.count[usb_ids::PRODUCT] + 1; // range of products
+        EXPECT_FALSE(UsbIds(as_view(v, size)));
+        vendor.last = last;
+
+        vendor.name = hdr.blob_size; // out of the blob
+        EXPECT_FALSE(UsbIds(as_view(v, size)));
+}
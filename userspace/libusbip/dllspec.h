@@ -6,6 +6,8 @@
 
 #ifdef USBIP_EXPORTS
   #define USBIP_API __declspec(dllexport)
-#else
+#elif defined(_WIN32)
   #define USBIP_API __declspec(dllimport)
+#else
+  #define USBIP_API // portable sources are linked statically, see CMakeLists.txt
 #endif
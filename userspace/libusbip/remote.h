@@ -9,6 +9,7 @@
 
 #include <usbspec.h>
 #include <string>
+#include <vector>
 
 namespace usbip
 {
@@ -88,4 +89,38 @@ USBIP_API bool enum_exportable_devices(
         _In_ const usb_interface_f &on_intf,
         _In_opt_ const usb_device_cnt_f &on_dev_cnt = nullptr);
 
+struct host_address
+{
+        std::string hostname;
+        std::string service; // TCP/IP port number or symbolic name
+};
+
+struct exportable_device
+{
+        usb_device dev;
+        std::vector<usb_interface> interfaces;
+};
+
+/**
+ * @param idx zero-based index of the host in the list
+ * @param host address of the host
+ * @param error zero on success, otherwise Win32/WinSock/usbip error code for the host
+ * @param devices exportable devices of the host, empty if error is not zero
+ */
+using host_devices_f = std::function<void(
+        _In_ int idx, _In_ const host_address &host, _In_ unsigned long error,
+        _In_ const std::vector<exportable_device> &devices)>;
+
+/**
+ * Enumerates exportable devices of many hosts concurrently, in the calling thread.
+ * @param hosts to enumerate
+ * @param on_host will be called for every host as soon as it is done, in the order of completion
+ * @param timeout for each host to connect and reply, milliseconds
+ * @return call GetLastError() if false is returned, errors of particular hosts are passed to on_host
+ */
+USBIP_API bool enum_exportable_devices(
+        _In_ const std::vector<host_address> &hosts,
+        _In_ const host_devices_f &on_host,
+        _In_ unsigned int timeout);
+
 } // namespace usbip
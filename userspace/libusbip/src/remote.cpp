@@ -15,6 +15,9 @@
 #include <ws2tcpip.h>
 #include <mstcpip.h>
 
+#include <string_view>
+#include <vector>
+
 namespace
 {
 
@@ -72,31 +75,78 @@ auto set_keepalive(_In_ SOCKET s, _In_ ULONG timeout, _In_ ULONG interval)
 	return !err;
 }
 
-auto recv(_In_ SOCKET s, _In_ void *buf, _In_ size_t len, _Out_opt_ bool *eof = nullptr)
+/*
+ * Reads a reply by big chunks instead of a recv() call for each record.
+ * Records are parsed in place, a pointer returned by next() is valid until the next call.
+ * It can read ahead of the reply, that is why it must be the last one on the connection.
+ */
+class stream_reader
 {
-	assert(s != INVALID_SOCKET);
+public:
+	enum { CHUNK_SIZE = 64*1024 };
+
+	explicit stream_reader(_In_ SOCKET s) : m_sock(s) { assert(s != INVALID_SOCKET); }
+
+	template<typename T>
+	auto next() { return static_cast<T*>(next(sizeof(T))); }
+
+	void* next(_In_ size_t len);
 
-	if (eof) {
-		*eof = false;
+private:
+	SOCKET m_sock;
+
+	std::vector<char> m_buf;
+	size_t m_begin{}; // of unread data
+	size_t m_end{};
+
+	bool fill(_In_ size_t len);
+};
+
+void* stream_reader::next(_In_ size_t len)
+{
+	if (m_end - m_begin < len && !fill(len)) {
+		return nullptr;
 	}
 
-	switch (auto ret = ::recv(s, static_cast<char*>(buf), static_cast<int>(len), MSG_WAITALL)) {
-	case SOCKET_ERROR:
-		if (wsa_set_last_error wsa; wsa) {
-			libusbip::output("recv error {:#x}", wsa.error);
-		}
-		return false;
-	case 0: // connection has been gracefully closed
-		if (len) {
-			libusbip::output("recv EOF");
-			if (eof) {
-				*eof = true;
+	auto ptr = m_buf.data() + m_begin;
+	m_begin += len;
+	return ptr;
+}
+
+/*
+ * Receives until at least len bytes are available.
+ */
+bool stream_reader::fill(_In_ size_t len)
+{
+	if (m_begin) { // move the rest to the beginning
+		m_end -= m_begin;
+		memmove(m_buf.data(), m_buf.data() + m_begin, m_end);
+		m_begin = 0;
+	}
+
+	if (m_buf.size() < len) {
+		m_buf.resize(len > CHUNK_SIZE ? len : CHUNK_SIZE);
+	}
+
+	while (m_end < len) {
+		auto avail = static_cast<int>(m_buf.size() - m_end);
+
+		switch (auto ret = ::recv(m_sock, m_buf.data() + m_end, avail, 0)) {
+		case SOCKET_ERROR:
+			if (wsa_set_last_error wsa; wsa) {
+				libusbip::output("recv error {:#x}", wsa.error);
 			}
+			return false;
+		case 0: // connection has been gracefully closed
+			libusbip::output("recv EOF");
+			SetLastError(ERROR_HANDLE_EOF);
+			return false;
+		default:
+			m_end += ret;
 		}
-		[[fallthrough]];
-	default:
-		return ret == len;
 	}
+
+	return true;
 }
 
 auto send(_In_ SOCKET s, _In_ const void *buf, _In_ size_t len)
@@ -134,17 +184,11 @@ auto send_op_common(_In_ SOCKET s, _In_ uint16_t code)
 	return send(s, &r, sizeof(r));
 }
 
-auto recv_op_common(_In_ SOCKET s, _In_ uint16_t expected_code)
+/*
+ * @param r host byte order
+ */
+auto check_op_common(_In_ const op_common &r, _In_ uint16_t expected_code)
 {
-	assert(s != INVALID_SOCKET);
-
-	op_common r{};
-	if (recv(s, &r, sizeof(r))) {
-		PACK_OP_COMMON(false, &r);
-	} else {
-		return GetLastError();
-	}
-
 	if (r.version != USBIP_VERSION) {
 		return USBIP_ERROR_VERSION;
 	}
@@ -156,29 +200,297 @@ auto recv_op_common(_In_ SOCKET s, _In_ uint16_t expected_code)
 	return op_status_error(static_cast<op_status_t>(r.status));
 }
 
-auto as_usb_device(_In_ const usbip_usb_device &d)
+auto recv_op_common(_Inout_ stream_reader &rd, _In_ uint16_t expected_code)
+{
+	auto r = rd.next<op_common>();
+	if (r) {
+		PACK_OP_COMMON(false, r);
+	} else {
+		return static_cast<DWORD>(GetLastError());
+	}
+
+	return static_cast<DWORD>(check_op_common(*r, expected_code));
+}
+
+/*
+ * The fields are not NUL-terminated if they have the maximum length.
+ */
+template<size_t N>
+inline auto as_string_view(_In_ const char (&s)[N])
 {
-	return usb_device {
-		.path = d.path,
-		.busid = d.busid,
+	return std::string_view(s, strnlen(s, N));
+}
 
-		.busnum = d.busnum,
-		.devnum = d.devnum,
-		.speed = win_speed(static_cast<usb_device_speed>(d.speed)),
+/*
+ * Assigns to the existing object to reuse memory of its strings.
+ */
+void assign(_Inout_ usb_device &dst, _In_ const usbip_usb_device &d)
+{
+	dst.path = as_string_view(d.path);
+	dst.busid = as_string_view(d.busid);
 
-		.idVendor = d.idVendor,
-		.idProduct = d.idProduct,
-		.bcdDevice = d.bcdDevice,
+	dst.busnum = d.busnum;
+	dst.devnum = d.devnum;
+	dst.speed = win_speed(static_cast<usb_device_speed>(d.speed));
 
-		.bDeviceClass = d.bDeviceClass,
-		.bDeviceSubClass = d.bDeviceSubClass,
-		.bDeviceProtocol = d.bDeviceProtocol,
+	dst.idVendor = d.idVendor;
+	dst.idProduct = d.idProduct;
+	dst.bcdDevice = d.bcdDevice;
 
-		.bConfigurationValue = d.bConfigurationValue,
+	dst.bDeviceClass = d.bDeviceClass;
+	dst.bDeviceSubClass = d.bDeviceSubClass;
+	dst.bDeviceProtocol = d.bDeviceProtocol;
 
-		.bNumConfigurations = d.bNumConfigurations,
-		.bNumInterfaces = d.bNumInterfaces,
-	};
+	dst.bConfigurationValue = d.bConfigurationValue;
+
+	dst.bNumConfigurations = d.bNumConfigurations;
+	dst.bNumInterfaces = d.bNumInterfaces;
+}
+
+/*
+ * State of a host for the event loop of enum_exportable_devices(hosts).
+ */
+struct host_ctx
+{
+	enum state_t { CONNECT, SEND, RECV, DONE };
+
+	int idx; // in hosts
+	const host_address *host;
+	state_t state = CONNECT;
+
+	std::unique_ptr<addrinfo, decltype(freeaddrinfo)&> info{nullptr, freeaddrinfo};
+	const addrinfo *next_addr{}; // to connect to if the current one fails
+	Socket sock;
+
+	ULONGLONG deadline; // GetTickCount64
+	DWORD error{};
+
+	op_common req{};
+	size_t sent{}; // bytes of req
+
+	std::vector<char> buf; // received bytes of OP_REP_DEVLIST
+	size_t pos{}; // parsed bytes
+	UINT32 ndev{};
+
+	std::vector<exportable_device> devices;
+};
+
+enum class parse_result { more, done, error };
+
+/*
+ * Parses the records that were received completely, can be called many times.
+ */
+auto parse_devlist(_Inout_ host_ctx &h)
+{
+	auto &b = h.buf;
+
+	if (!h.pos) {
+		auto len = sizeof(op_common) + sizeof(op_devlist_reply);
+		if (b.size() < len) {
+			return parse_result::more;
+		}
+
+		auto r = reinterpret_cast<op_common*>(b.data());
+		PACK_OP_COMMON(false, r);
+
+		if (auto err = check_op_common(*r, OP_REP_DEVLIST)) {
+			h.error = err;
+			return parse_result::error;
+		}
+
+		auto reply = reinterpret_cast<op_devlist_reply*>(r + 1);
+		PACK_OP_DEVLIST_REPLY(false, reply);
+
+		h.ndev = reply->ndev;
+		h.pos = len;
+	}
+
+	while (h.devices.size() < h.ndev) {
+
+		auto avail = b.size() - h.pos;
+		if (avail < sizeof(usbip_usb_device)) {
+			return parse_result::more;
+		}
+
+		auto dev = reinterpret_cast<usbip_usb_device*>(b.data() + h.pos);
+		auto intf = reinterpret_cast<usbip_usb_interface*>(dev + 1);
+
+		auto len = sizeof(*dev) + dev->bNumInterfaces*sizeof(*intf); // UINT8 does not need byteswap
+		if (avail < len) {
+			return parse_result::more;
+		}
+
+		usbip_net_pack_usb_device(false, dev);
+
+		auto &d = h.devices.emplace_back();
+		assign(d.dev, *dev);
+
+		for (int i = 0; i < dev->bNumInterfaces; ++i, ++intf) {
+			usbip_net_pack_usb_interface(false, intf);
+			static_assert(sizeof(*intf) == sizeof(usb_interface));
+			d.interfaces.push_back(reinterpret_cast<usb_interface&>(*intf));
+		}
+
+		h.pos += len;
+	}
+
+	return parse_result::done;
+}
+
+/*
+ * Starts non-blocking connect to the next address of the host.
+ */
+void start_connect(_Inout_ host_ctx &h)
+{
+	for (auto &r = h.next_addr; r; ) {
+		auto ai = r;
+		r = r->ai_next;
+
+		h.sock.reset(socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+		if (!h.sock) {
+			h.error = WSAGetLastError();
+			continue;
+		}
+
+		auto s = h.sock.get();
+
+		if (u_long nonblocking = true; ioctlsocket(s, FIONBIO, &nonblocking) || !set_nodelay(s)) {
+			h.error = WSAGetLastError();
+			h.sock.close();
+			continue;
+		}
+
+		if (!::connect(s, ai->ai_addr, int(ai->ai_addrlen))) {
+			h.state = host_ctx::SEND;
+			return;
+		} else if (auto err = WSAGetLastError(); err == WSAEWOULDBLOCK) {
+			h.state = host_ctx::CONNECT;
+			return;
+		} else {
+			h.error = err;
+			h.sock.close();
+		}
+	}
+
+	h.state = host_ctx::DONE; // h.error is set
+}
+
+/*
+ * getaddrinfo can block for a long time, so the deadline of the host is counted from its completion,
+ * the time spent on previous hosts is not taken from this one.
+ */
+void start(_Inout_ host_ctx &h, _In_ unsigned int timeout)
+{
+	auto &host = *h.host;
+
+	h.req = { .version = USBIP_VERSION, .code = OP_REQ_DEVLIST, .status = ST_OK };
+	PACK_OP_COMMON(true, &h.req);
+
+	addrinfo hints{ .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+
+	if (addrinfo *result; getaddrinfo(host.hostname.c_str(), host.service.c_str(), &hints, &result)) {
+		h.error = WSAGetLastError();
+		libusbip::output("getaddrinfo {}:{} error {:#x}", host.hostname, host.service, h.error);
+		h.state = host_ctx::DONE;
+	} else {
+		h.info.reset(result);
+		h.next_addr = result;
+		start_connect(h);
+	}
+
+	h.deadline = GetTickCount64() + timeout;
+}
+
+/*
+ * @return error of non-blocking connect, zero if it is in progress or succeeded
+ */
+auto get_connect_error(_In_ SOCKET s)
+{
+	int err = 0;
+	int len = sizeof(err);
+
+	if (getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &len)) {
+		err = WSAGetLastError();
+	}
+
+	return err;
+}
+
+void connect_failed(_Inout_ host_ctx &h, _In_ int err)
+{
+	h.error = err ? err : WSAECONNREFUSED;
+	h.sock.close();
+
+	start_connect(h); // try the next address
+}
+
+void on_connect(_Inout_ host_ctx &h, _In_ short revents)
+{
+	if (revents & (POLLERR | POLLHUP)) {
+		connect_failed(h, get_connect_error(h.sock.get()));
+	} else {
+		h.state = host_ctx::SEND;
+	}
+}
+
+/*
+ * WSAPoll does not report failed connect on old Windows 10 builds, POLLWRNORM never comes.
+ * The socket is checked when the poll times out, so the host fails with the actual error
+ * and its next address is tried instead of waiting for the deadline.
+ */
+void on_connect_timeout(_Inout_ host_ctx &h)
+{
+	if (auto err = get_connect_error(h.sock.get())) {
+		connect_failed(h, err);
+	}
+}
+
+void on_send(_Inout_ host_ctx &h)
+{
+	auto data = reinterpret_cast<const char*>(&h.req) + h.sent;
+
+	if (auto ret = ::send(h.sock.get(), data, int(sizeof(h.req) - h.sent), 0); ret != SOCKET_ERROR) {
+		if ((h.sent += ret) == sizeof(h.req)) {
+			h.state = host_ctx::RECV;
+		}
+	} else if (auto err = WSAGetLastError(); err != WSAEWOULDBLOCK) {
+		h.error = err;
+		h.state = host_ctx::DONE;
+	}
+}
+
+void on_recv(_Inout_ host_ctx &h)
+{
+	enum { CHUNK_SIZE = 64*1024 };
+
+	auto &b = h.buf;
+	auto size = b.size();
+	b.resize(size + CHUNK_SIZE);
+
+	auto ret = ::recv(h.sock.get(), b.data() + size, CHUNK_SIZE, 0);
+	b.resize(ret == SOCKET_ERROR ? size : size + ret);
+
+	if (ret == SOCKET_ERROR) {
+		if (auto err = WSAGetLastError(); err != WSAEWOULDBLOCK) {
+			h.error = err;
+			h.state = host_ctx::DONE;
+		}
+		return;
+	}
+
+	switch (parse_devlist(h)) {
+	case parse_result::more:
+		if (!ret) { // EOF
+			h.error = ERROR_HANDLE_EOF;
+			h.state = host_ctx::DONE;
+		}
+		break;
+	case parse_result::done:
+		h.error = ERROR_SUCCESS;
+		[[fallthrough]];
+	case parse_result::error:
+		h.state = host_ctx::DONE;
+	}
 }
 
 } // namespace
@@ -249,51 +561,161 @@ bool usbip::enum_exportable_devices(
 		return false;
 	}
 
-	if (auto err = recv_op_common(s, OP_REP_DEVLIST)) {
+	stream_reader rd(s);
+
+	if (auto err = recv_op_common(rd, OP_REP_DEVLIST)) {
 		SetLastError(err);
 		return false;
 	}
 
-	op_devlist_reply reply{};
+	auto reply = rd.next<op_devlist_reply>();
 	
-	if (recv(s, &reply, sizeof(reply))) {
-		PACK_OP_DEVLIST_REPLY(false, &reply);
+	if (reply) {
+		PACK_OP_DEVLIST_REPLY(false, reply);
 	} else {
 		return false;
 	}
 
-	libusbip::output("{} exportable device(s)", reply.ndev);
-	assert(reply.ndev <= INT_MAX);
+	auto ndev = reply->ndev;
+
+	libusbip::output("{} exportable device(s)", ndev);
+	assert(ndev <= INT_MAX);
 
 	if (on_dev_cnt) {
-		on_dev_cnt(reply.ndev);
+		on_dev_cnt(ndev);
 	}
 
 	usb_device lib_dev;
 
-	for (UINT32 i = 0; i < reply.ndev; ++i) {
-
-		usbip_usb_device dev{};
+	for (UINT32 i = 0; i < ndev; ++i) {
 
-		if (recv(s, &dev, sizeof(dev))) {
-			usbip_net_pack_usb_device(false, &dev);
-			lib_dev = as_usb_device(dev);
-			on_dev(i, lib_dev);
-		} else {
+		auto dev = rd.next<usbip_usb_device>();
+		if (!dev) {
 			return false;
 		}
 
-		for (int j = 0; j < dev.bNumInterfaces; ++j) {
+		usbip_net_pack_usb_device(false, dev);
+		assign(lib_dev, *dev);
+		on_dev(i, lib_dev);
 
-			usbip_usb_interface intf{};
+		for (int j = 0; j < lib_dev.bNumInterfaces; ++j) {
 
-			if (recv(s, &intf, sizeof(intf))) {
-				usbip_net_pack_usb_interface(false, &intf);
-				static_assert(sizeof(intf) == sizeof(usb_interface));
-				on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(intf));
-			} else {
+			auto intf = rd.next<usbip_usb_interface>();
+			if (!intf) {
 				return false;
 			}
+
+			usbip_net_pack_usb_interface(false, intf);
+			static_assert(sizeof(*intf) == sizeof(usb_interface));
+			on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(*intf));
+		}
+	}
+
+	return true;
+}
+
+/*
+ * WSAPoll is used instead of a thread per host.
+ */
+bool usbip::enum_exportable_devices(
+	_In_ const std::vector<host_address> &hosts, 
+	_In_ const host_devices_f &on_host,
+	_In_ unsigned int timeout)
+{
+	enum { CONNECT_CHECK_PERIOD = 500 }; // msec, @see on_connect_timeout
+
+	std::vector<host_ctx> ctx(hosts.size());
+
+	for (int i = 0; auto &h: ctx) {
+		h.idx = i;
+		h.host = &hosts[i++];
+		start(h, timeout);
+	}
+
+	auto now = GetTickCount64();
+
+	auto complete = [&on_host] (auto &h)
+	{
+		h.state = host_ctx::DONE;
+		h.sock.close();
+
+		if (h.error) {
+			h.devices.clear();
+		}
+
+		on_host(h.idx, *h.host, h.error, h.devices);
+
+		h.buf = std::vector<char>();
+		h.devices = std::vector<exportable_device>();
+	};
+
+	std::vector<WSAPOLLFD> fds;
+	std::vector<host_ctx*> polled; // polled[i] is for fds[i]
+
+	while (true) {
+		fds.clear();
+		polled.clear();
+
+		auto wait = ULONGLONG(INFINITE);
+
+		for (auto &h: ctx) {
+			if (h.state == host_ctx::DONE) {
+				if (h.host) {
+					complete(h);
+					h.host = nullptr; // reported
+				}
+				continue;
+			}
+
+			auto events = h.state == host_ctx::RECV ? POLLRDNORM : POLLWRNORM;
+			fds.push_back({ .fd = h.sock.get(), .events = short(events) });
+			polled.push_back(&h);
+
+			if (auto left = h.deadline > now ? h.deadline - now : 0; left < wait) {
+				wait = left;
+			}
+
+			if (h.state == host_ctx::CONNECT && wait > CONNECT_CHECK_PERIOD) {
+				wait = CONNECT_CHECK_PERIOD;
+			}
+		}
+
+		if (fds.empty()) {
+			break;
+		}
+
+		if (WSAPoll(fds.data(), ULONG(fds.size()), int(wait)) == SOCKET_ERROR) {
+			wsa_set_last_error wsa;
+			libusbip::output("WSAPoll error {:#x}", wsa.error);
+			return false;
+		}
+
+		now = GetTickCount64();
+
+		for (size_t i = 0; i < fds.size(); ++i) {
+			auto &h = *polled[i];
+
+			if (auto revents = fds[i].revents) {
+				switch (h.state) {
+				case host_ctx::CONNECT:
+					on_connect(h, revents);
+					break;
+				case host_ctx::SEND:
+					on_send(h);
+					break;
+				case host_ctx::RECV:
+					on_recv(h);
+					break;
+				}
+			} else if (h.state == host_ctx::CONNECT) {
+				on_connect_timeout(h);
+			}
+
+			if (h.state != host_ctx::DONE && now >= h.deadline) {
+				libusbip::output("{}:{} timed out", h.host->hostname, h.host->service);
+				h.error = WSAETIMEDOUT;
+				h.state = host_ctx::DONE;
+			}
 		}
 	}
 
@@ -3,13 +3,20 @@
  */
 
 #include "usb_ids.h"
+#include "usb_ids_table.h"
 
 #include <cassert>
 #include <functional>
+#include <algorithm>
+#include <span>
+#include <vector>
+#include <mutex>
 
 namespace
 {
 
+using namespace usbip::usb_ids;
+
 uint16_t remove_prefix_hex(std::string_view &s)
 {
         char *end{};
@@ -51,126 +58,305 @@ void for_each_line(std::string_view text, const line_f &f)
         }
 }
 
+constexpr auto to_lower(char c) noexcept
+{
+        return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+auto to_lower(std::string_view s)
+{
+        std::string r(s);
+        for (auto &c: r) {
+                c = to_lower(c);
+        }
+        return r;
+}
+
+/*
+ * @param s must be lowercase
+ */
+auto contains_nocase(std::string_view name, std::string_view s) noexcept
+{
+        auto eq = [] (char a, char b) { return to_lower(a) == b; };
+        return std::search(name.begin(), name.end(), s.begin(), s.end(), eq) != name.end();
+}
+
+/*
+ * @return hash of three lowercase chars
+ */
+constexpr uint16_t get_bucket(const char *s) noexcept
+{
+        auto trigram = uint32_t(uint8_t(to_lower(s[0]))) << 16 | 
+                       uint32_t(uint8_t(to_lower(s[1]))) << 8 | 
+                       uint8_t(to_lower(s[2]));
+
+        return (trigram*2654435761U) >> 16; // Fibonacci hashing
+}
+
+constexpr auto make_key(uint16_t vid, uint16_t pid) noexcept { return uint32_t(vid) << 16 | pid; }
+
 } // namespace
 
 
-class win::Resource::Impl
+/*
+ * Flat sorted arrays instead of nested hash maps: a record refers to its children by a range of indices,
+ * lookup is a binary search. The arrays are parsed from the text of usb.ids or the binary table
+ * generated at build time is used in place, @see usb_ids_table.h. Names are views of the content.
+ */
+class usbip::UsbIds::Impl
 {
 public:
-        Impl(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) { load(hModule, name, type); }
+        Impl(std::string_view content) { load(content); }
 
-        explicit operator bool() const noexcept { return hResInfo && hResData; }
-        auto operator!() const noexcept { return !bool(*this); } 
+        auto operator!() const noexcept { return m_rec[VENDOR].empty() || m_rec[CLASS].empty(); } 
+        explicit operator bool() const noexcept { return !!*this; }
 
-        DWORD load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
+        void load(std::string_view content);
+        std::string make_table() const;
 
-        auto data() const noexcept { return LockResource(hResData); }
-        auto size(HMODULE hModule) const noexcept { return SizeofResource(hModule, hResInfo); }
+        std::pair<std::string_view, std::string_view> find_product(uint16_t vid, uint16_t pid) const noexcept;
 
-        auto str() const noexcept { return m_str; }
+        std::tuple<std::string_view, std::string_view, std::string_view> 
+                find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) const noexcept;
+
+        std::vector<std::pair<uint16_t, uint16_t>> find_by_name(std::string_view text) const;
 
 private:
-        HRSRC hResInfo{};
-        HGLOBAL hResData{};
-        std::string_view m_str;
+        std::string_view m_names; // the content of usb.ids or the blob of the table
+        std::span<const record> m_rec[RECORD_ARRAYS];
+        std::vector<record> m_parsed[RECORD_ARRAYS]; // from the text, m_rec refers to them
+
+        /*
+         * Trigrams of the names are hashed into buckets, keys of a bucket are m_keys[m_bucket[i], m_bucket[i + 1]).
+         * The index is built by the first search only.
+         */
+        static constexpr uint32_t index_buckets = 1U << 16;
+        mutable std::mutex m_index_mtx;
+        mutable std::vector<uint32_t> m_bucket;
+        mutable std::vector<uint32_t> m_keys; // make_key(vid, pid), pid is zero for a vendor
+
+        void build_index() const;
+
+        auto get_name(const record &r) const noexcept { return m_names.substr(r.name, r.name_len); }
+        std::string_view get_name(uint32_t key) const noexcept;
+
+        bool load_table(std::string_view table) noexcept;
+        void parse(std::string_view content);
+
+        bool parse_vid_pid(std::string_view &line, std::string_view &tail);
+        bool parse_class_sub_proto(std::string_view &line, std::string_view &tail);
+
+        record make_record(uint16_t id, std::string_view name, uint32_t first = 0) const noexcept;
+        record* add_child(int what, uint16_t id, std::string_view name);
+
+        static const record* find(std::span<const record> v, uint32_t first, uint32_t last, uint16_t id) noexcept;
+        static void sort(std::vector<record> &parents, std::vector<record> &children);
 };
 
+auto usbip::UsbIds::Impl::find(std::span<const record> v, uint32_t first, uint32_t last, uint16_t id) noexcept
+        -> const record*
+{
+        auto end = v.data() + last;
+        auto r = std::lower_bound(v.data() + first, end, id, [] (auto &rec, auto val) { return rec.id < val; });
+
+        return r != end && r->id == id ? r : nullptr;
+}
 
-DWORD win::Resource::Impl::load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type)
+/*
+ * @param name view of m_names or empty
+ */
+auto usbip::UsbIds::Impl::make_record(uint16_t id, std::string_view name, uint32_t first) const noexcept -> record
 {
-        hResInfo = FindResource(hModule, name, type);
-        if (!hResInfo) {
-                return GetLastError();
-        }
+        auto off = name.empty() ? 0 : name.data() - m_names.data();
+        return { static_cast<uint32_t>(off), static_cast<uint16_t>(name.size()), id, first, first };
+}
+
+/*
+ * Appends a child to the last parent.
+ * @param what array of the child
+ */
+auto usbip::UsbIds::Impl::add_child(int what, uint16_t id, std::string_view name) -> record*
+{
+        auto &parents = m_parsed[what - 1];
+        auto &children = m_parsed[what];
 
-        hResData = LoadResource(hModule, hResInfo);
-        if (!hResData) {
-                return GetLastError();
+        if (parents.empty()) {
+                assert(!"child without parent");
+                return nullptr;
         }
 
-        m_str = std::string_view(reinterpret_cast<const char*>(data()), size(hModule));
-        return ERROR_SUCCESS;
+        auto &parent = parents.back();
+        assert(parent.last == children.size());
+
+        auto &child = children.emplace_back(make_record(id, name));
+        parent.last = static_cast<uint32_t>(children.size());
+
+        return &child;
 }
 
-win::Resource::Resource(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) 
-        : m_impl(new Impl(hModule, name, type)) {}
+/*
+ * usb.ids is sorted, this is a safety net for local modifications.
+ * Sorts children within the range of each parent, children of children are moved along with their ranges.
+ */
+void usbip::UsbIds::Impl::sort(std::vector<record> &parents, std::vector<record> &children)
+{
+        auto less = [] (auto &a, auto &b) { return a.id < b.id; };
+
+        for (auto &p: parents) {
+                auto first = children.begin() + p.first;
+                auto last = children.begin() + p.last;
 
-win::Resource::~Resource() { delete m_impl; }
+                if (!std::is_sorted(first, last, less)) {
+                        std::sort(first, last, less);
+                }
+        }
+}
 
-auto win::Resource::operator =(Resource&& obj) noexcept -> Resource&
+void usbip::UsbIds::Impl::load(std::string_view content)
 {
-        if (&obj != this) {
-                delete m_impl;
-                m_impl = obj.release();
+        m_bucket.clear();
+        m_keys.clear();
+
+        m_names = {};
+
+        for (auto &r: m_rec) {
+                r = {};
         }
 
-        return *this;
-}
+        for (auto &v: m_parsed) {
+                v.clear();
+        }
 
-win::Resource::operator bool() const noexcept { return static_cast<bool>(*m_impl); }
+        if (content.starts_with(std::string_view(magic, sizeof(magic)))) {
+                load_table(content);
+        } else {
+                parse(content);
+        }
+}
 
-DWORD win::Resource::load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) 
+/*
+ * The table is used in place, nothing is allocated.
+ * It is rejected if it is misaligned or a range or a name is out of bounds, the ids are not checked.
+ */
+bool usbip::UsbIds::Impl::load_table(std::string_view table) noexcept
 {
-        return m_impl->load(hModule, name, type); 
-}
+        if (table.size() < sizeof(header) || reinterpret_cast<uintptr_t>(table.data()) % alignof(record)) {
+                return false;
+        }
 
-void* win::Resource::data() const noexcept { return m_impl->data(); }
-DWORD win::Resource::size(HMODULE hModule) const noexcept{ return m_impl->size(hModule); }
-std::string_view win::Resource::str() const noexcept { return m_impl->str(); }
+        auto &hdr = *reinterpret_cast<const header*>(table.data());
+        if (hdr.version != version) {
+                return false;
+        }
 
+        auto avail = table.size() - sizeof(hdr);
+        auto rec = reinterpret_cast<const record*>(&hdr + 1);
 
-class usbip::UsbIds::Impl
-{
-public:
-        Impl(std::string_view content) { load(content); }
+        std::span<const record> v[RECORD_ARRAYS];
 
-        auto operator!() const noexcept { return m_vendor.empty() || m_class.empty(); } 
-        explicit operator bool() const noexcept { return !!*this; }
+        for (int i = 0; i < RECORD_ARRAYS; ++i) {
+                auto cnt = hdr.count[i];
+                if (cnt > avail/sizeof(*rec)) {
+                        return false;
+                }
 
-        void load(std::string_view content);
+                v[i] = { rec, cnt };
+                rec += cnt;
+                avail -= cnt*sizeof(*rec);
+        }
 
-        std::pair<std::string_view, std::string_view> find_product(uint16_t vid, uint16_t pid) const noexcept;
+        if (hdr.blob_size != avail) {
+                return false;
+        }
 
-        std::tuple<std::string_view, std::string_view, std::string_view> 
-                find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) const noexcept;
+        auto names = table.substr(table.size() - avail);
 
-private:
-        using products_t = std::unordered_map<uint16_t, std::string_view>;
-        using vendors_t = std::unordered_map<uint16_t, std::pair<std::string_view, products_t>>;
-        vendors_t m_vendor;
+        for (int i = 0; i < RECORD_ARRAYS; ++i) {
+                auto children = i == PRODUCT || i == PROTOCOL ? 0 : v[i + 1].size();
 
-        using proto_t = std::unordered_map<uint8_t, std::string_view>;
-        using subclass_t = std::unordered_map<uint8_t, std::pair<std::string_view, proto_t>>;
-        using class_t = std::unordered_map<uint8_t, std::pair<std::string_view, subclass_t>>;
-        class_t m_class;
+                for (auto &r: v[i]) {
+                        if (r.first > r.last || r.last > children || 
+                            r.name > names.size() || r.name_len > names.size() - r.name) {
+                                return false;
+                        }
+                }
+        }
 
-        bool parse_vid_pid(uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail);
-        bool parse_class_sub_proto(uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view &tail);
-};
+        m_names = names;
+        std::copy(std::begin(v), std::end(v), m_rec);
 
-void usbip::UsbIds::Impl::load(std::string_view content)
+        return true;
+}
+
+void usbip::UsbIds::Impl::parse(std::string_view content)
 {
-        uint16_t vid{};
-        uint16_t pid{};
-        
-        auto f = [this, &vid, &pid] (auto&&... args) 
-        { 
-                return parse_vid_pid(vid, pid, std::forward<decltype(args)>(args)...); 
-        };
-        
+        m_names = content;
+
+        auto &[vendor, product, cls, subclass, proto] = m_parsed;
+
+        auto lines = std::count(content.begin(), content.end(), '\n');
+        product.reserve(lines); // most of the lines are products
+
+        auto f = [this] (auto&&... args) { return parse_vid_pid(std::forward<decltype(args)>(args)...); };
         for_each_line(content, std::move(f));
+
+        sort(vendor, product);
+        sort(subclass, proto);
+        sort(cls, subclass);
+
+        auto less = [] (auto &a, auto &b) { return a.id < b.id; };
+        std::sort(vendor.begin(), vendor.end(), less); // no-op for sorted input
+        std::sort(cls.begin(), cls.end(), less);
+
+        product.shrink_to_fit();
+
+        for (int i = 0; i < RECORD_ARRAYS; ++i) {
+                m_rec[i] = m_parsed[i];
+        }
 }
 
-bool usbip::UsbIds::Impl::parse_vid_pid(
-        uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail)
+/*
+ * Names are copied to the blob in the order of the records, the ranges of children are kept as is.
+ */
+std::string usbip::UsbIds::Impl::make_table() const
+{
+        std::string table;
+        if (!*this) {
+                return table;
+        }
+
+        header hdr{};
+        std::copy(std::begin(magic), std::end(magic), hdr.magic);
+        hdr.version = version;
+
+        std::string records;
+        std::string blob;
+
+        for (int i = 0; i < RECORD_ARRAYS; ++i) {
+                hdr.count[i] = static_cast<uint32_t>(m_rec[i].size());
+
+                for (auto r: m_rec[i]) {
+                        auto name = get_name(r);
+                        r.name = static_cast<uint32_t>(blob.size());
+                        blob += name;
+                        records.append(reinterpret_cast<const char*>(&r), sizeof(r));
+                }
+        }
+
+        hdr.blob_size = static_cast<uint32_t>(blob.size());
+
+        table.reserve(sizeof(hdr) + records.size() + blob.size());
+        table.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        table += records;
+        table += blob;
+
+        return table;
+}
+
+bool usbip::UsbIds::Impl::parse_vid_pid(std::string_view &line, std::string_view &tail)
 {
         if (line.starts_with("# List of known device classes, subclasses and protocols")) {
-                uint8_t cls{};
-                uint8_t subcls{};
-                auto f = [this, &cls, &subcls] (auto&&... args) 
-                { 
-                        return parse_class_sub_proto(cls, subcls, std::forward<decltype(args)>(args)...); 
-                };
+                auto f = [this] (auto&&... args) { return parse_class_sub_proto(std::forward<decltype(args)>(args)...); };
                 for_each_line(tail, std::move(f));
                 return true;
         } else if (line.starts_with('#')) {
@@ -179,23 +365,21 @@ bool usbip::UsbIds::Impl::parse_vid_pid(
                 assert(!"\\t\\t detected");
         } else if (line.starts_with('\t')) {
                 line.remove_prefix(1);
-                if (bool(pid = remove_prefix_hex(line))) {
+                if (auto pid = remove_prefix_hex(line)) {
                         line.remove_prefix(2); // device_name
-                        auto &prod = m_vendor[vid].second;
-                        auto [it, inserted] = prod.emplace(pid, line);
-                        assert(inserted);
+                        add_child(PRODUCT, pid, line);
                 }
-        } else if (bool(vid = remove_prefix_hex(line))) {
-                line.remove_prefix(2); // vendor_name
-                auto [it, inserted] = m_vendor.emplace(vid, std::make_pair(line, products_t()));
-                assert(inserted);
+        } else {
+                auto vid = remove_prefix_hex(line);
+                auto name = vid ? line.substr(2) : std::string_view(); // vendor_name
+                auto &v = m_parsed[VENDOR];
+                v.push_back(make_record(vid, name, static_cast<uint32_t>(m_parsed[PRODUCT].size()))); // zero id has no name, but can have children
         }
 
         return false;
 }
 
-bool usbip::UsbIds::Impl::parse_class_sub_proto(
-        uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view&)
+bool usbip::UsbIds::Impl::parse_class_sub_proto(std::string_view &line, std::string_view&)
 {
         if (line.starts_with("# List of Audio Class Terminal Types")) {
                 return true;
@@ -205,26 +389,21 @@ bool usbip::UsbIds::Impl::parse_class_sub_proto(
                 line.remove_prefix(2);
                 if (auto prot = (uint8_t)remove_prefix_hex(line)) {
                         line.remove_prefix(2);
-                        auto &sub = m_class[cls].second;
-                        auto &proto = sub[subcls].second;
-                        auto [it, inserted] = proto.emplace(prot, line);
-                        assert(inserted);
+                        add_child(PROTOCOL, prot, line);
                 }
         } else if (line.starts_with('\t')) {
                 line.remove_prefix(1);
-                if (bool(subcls = (uint8_t)remove_prefix_hex(line))) {
-                        line.remove_prefix(2);
-                        auto &sub = m_class[cls].second;
-                        auto [it, inserted] = sub.emplace(subcls, std::make_pair(line, proto_t()));
-                        assert(inserted);
+                auto subcls = (uint8_t)remove_prefix_hex(line);
+                auto name = subcls ? line.substr(2) : std::string_view(); // zero id has no name, but can have children
+
+                if (auto sub = add_child(SUBCLASS, subcls, name)) {
+                        sub->first = sub->last = static_cast<uint32_t>(m_parsed[PROTOCOL].size());
                 }
         } else if (line.starts_with("C ")) {
                 line.remove_prefix(2);
-                if (bool(cls = (uint8_t)remove_prefix_hex(line))) {
-                        line.remove_prefix(2);
-                        auto [it, inserted] = m_class.emplace(cls, std::make_pair(line, subclass_t()));
-                        assert(inserted);
-                }
+                auto cls = (uint8_t)remove_prefix_hex(line);
+                auto name = cls ? line.substr(2) : std::string_view();
+                m_parsed[CLASS].push_back(make_record(cls, name, static_cast<uint32_t>(m_parsed[SUBCLASS].size())));
         }
 
         return false;
@@ -235,17 +414,17 @@ usbip::UsbIds::Impl::find_product(uint16_t vid, uint16_t pid) const noexcept
 {
         std::pair<std::string_view, std::string_view> res;
 
-        auto v = m_vendor.find(vid);
-        if (v == m_vendor.end()) {
+        auto &vendors = m_rec[VENDOR];
+
+        auto v = find(vendors, 0, static_cast<uint32_t>(vendors.size()), vid);
+        if (!v) {
                 return res;
         }
 
-        res.first = v->second.first;
-        auto &prod = v->second.second;
+        res.first = get_name(*v);
 
-        auto p = prod.find(pid);
-        if (p != prod.end()) {
-                res.second = p->second;
+        if (auto p = find(m_rec[PRODUCT], v->first, v->last, pid)) {
+                res.second = get_name(*p);
         }
 
         return res;
@@ -257,30 +436,143 @@ usbip::UsbIds::Impl::find_class_subclass_proto(
 {
         std::tuple<std::string_view, std::string_view, std::string_view>  res;
 
-        auto c = m_class.find(class_id);
-        if (c == m_class.end()) {
+        auto &classes = m_rec[CLASS];
+
+        auto c = find(classes, 0, static_cast<uint32_t>(classes.size()), class_id);
+        if (!c) {
+                return res;
+        }
+
+        std::get<0>(res) = get_name(*c);
+
+        auto s = find(m_rec[SUBCLASS], c->first, c->last, subclass_id);
+        if (!s) {
                 return res;
         }
 
-        std::get<0>(res) = c->second.first;
-        auto &subcls = c->second.second;
+        std::get<1>(res) = get_name(*s);
+
+        if (auto p = find(m_rec[PROTOCOL], s->first, s->last, prot_id)) {
+                std::get<2>(res) = get_name(*p);
+        }
+
+        return res;
+}
+
+/*
+ * Counting sort by bucket keeps the order of keys, they are sorted because vendors and products are.
+ */
+void usbip::UsbIds::Impl::build_index() const
+{
+        std::vector<std::pair<uint16_t, uint32_t>> postings; // {bucket, key}
+        postings.reserve(m_rec[PRODUCT].size()*24); // the average length of a name is about 25 chars
+
+        std::vector<uint16_t> buckets;
+
+        auto add = [&postings, &buckets] (auto name, auto key)
+        {
+                buckets.clear();
+                for (size_t i = 0; i + 3 <= name.size(); ++i) {
+                        buckets.push_back(get_bucket(name.data() + i));
+                }
+
+                std::sort(buckets.begin(), buckets.end());
+                auto end = std::unique(buckets.begin(), buckets.end());
+
+                for (auto i = buckets.begin(); i != end; ++i) {
+                        postings.emplace_back(*i, key);
+                }
+        };
+
+        for (auto &v: m_rec[VENDOR]) {
+                add(get_name(v), make_key(v.id, 0));
+
+                for (auto i = v.first; i < v.last; ++i) {
+                        auto &p = m_rec[PRODUCT][i];
+                        add(get_name(p), make_key(v.id, p.id));
+                }
+        }
+
+        m_bucket.assign(index_buckets + 1, 0);
+        for (auto &p: postings) {
+                ++m_bucket[p.first + 1];
+        }
+
+        for (uint32_t i = 0; i < index_buckets; ++i) {
+                m_bucket[i + 1] += m_bucket[i];
+        }
+
+        m_keys.resize(postings.size());
+        auto pos = m_bucket;
 
-        auto s = subcls.find(subclass_id);
-        if (s == subcls.end()) {
+        for (auto &[b, key]: postings) {
+                m_keys[pos[b]++] = key;
+        }
+}
+
+std::string_view usbip::UsbIds::Impl::get_name(uint32_t key) const noexcept
+{
+        uint16_t vid = key >> 16;
+        uint16_t pid = key & 0xFFFF;
+
+        auto [vendor, product] = find_product(vid, pid);
+        return pid ? product : vendor;
+}
+
+/*
+ * A text shorter than three chars has no trigrams, it is checked against all names.
+ * Otherwise, candidates are taken from the smallest bucket of the text's trigrams and checked one by one.
+ */
+std::vector<std::pair<uint16_t, uint16_t>> usbip::UsbIds::Impl::find_by_name(std::string_view text) const
+{
+        std::vector<std::pair<uint16_t, uint16_t>> res;
+        if (text.empty()) {
                 return res;
         }
 
-        std::get<1>(res) = s->second.first;
-        auto &prot = s->second.second;
+        auto s = to_lower(text);
+        auto add = [&res] (uint32_t key) { res.emplace_back(uint16_t(key >> 16), uint16_t(key & 0xFFFF)); };
+
+        if (s.size() < 3) {
+                for (auto &v: m_rec[VENDOR]) {
+                        if (contains_nocase(get_name(v), s)) {
+                                add(make_key(v.id, 0));
+                        }
+                        for (auto i = v.first; i < v.last; ++i) {
+                                if (auto &p = m_rec[PRODUCT][i]; contains_nocase(get_name(p), s)) {
+                                        add(make_key(v.id, p.id));
+                                }
+                        }
+                }
+        } else {
+                std::lock_guard lock(m_index_mtx);
+                if (m_bucket.empty()) {
+                        build_index();
+                }
+
+                auto best = get_bucket(s.data());
+                for (size_t i = 1; i + 3 <= s.size(); ++i) {
+                        auto b = get_bucket(s.data() + i);
+                        if (m_bucket[b + 1] - m_bucket[b] < m_bucket[best + 1] - m_bucket[best]) {
+                                best = b;
+                        }
+                }
 
-        auto p = prot.find(prot_id);
-        if (p != prot.end()) {
-                std::get<2>(res) = p->second;
+                for (auto i = m_bucket[best]; i < m_bucket[best + 1]; ++i) {
+                        if (auto key = m_keys[i]; contains_nocase(get_name(key), s)) {
+                                add(key);
+                        }
+                }
         }
 
         return res;
 }
 
+std::string usbip::usb_ids::make_table(std::string_view content)
+{
+        return UsbIds::Impl(content).make_table();
+}
+
 
 usbip::UsbIds::UsbIds(std::string_view content) : m_impl(new Impl(content)) {}
 usbip::UsbIds::~UsbIds() { delete m_impl; }
@@ -311,3 +603,8 @@ usbip::UsbIds::find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id,
 {
         return m_impl->find_class_subclass_proto(class_id, subclass_id, prot_id);
 }
+
+std::vector<std::pair<uint16_t, uint16_t>> usbip::UsbIds::find_by_name(std::string_view text) const
+{
+        return m_impl->find_by_name(text);
+}
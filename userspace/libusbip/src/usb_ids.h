@@ -4,54 +4,21 @@
 
 #pragma once
 
-#include "..\dllspec.h"
+#include "../dllspec.h"
 
 #include <cstdint>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
-#include <windows.h>
-
-namespace win
-{
-
-class USBIP_API Resource
+namespace usbip
 {
-public:
-	Resource(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
-	~Resource();
-
-	Resource(const Resource&) = delete;
-	Resource& operator =(const Resource&) = delete;
-
-	Resource(Resource&& obj) noexcept : m_impl(obj.release()) {}
-	Resource& operator =(Resource&& obj) noexcept;
-
-	explicit operator bool() const noexcept;
-	auto operator!() const noexcept { return !bool(*this); } 
-
-	DWORD load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
-
-	void* data() const noexcept;
-	DWORD size(HMODULE hModule) const noexcept;
-
-	std::string_view str() const noexcept;
-
-private:
-	class Impl;
-	Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
-
-	Impl *release() {
-		auto p = m_impl;
-		m_impl = nullptr;
-		return p;
-	}
-};
-
-} // namespace win
-
 
-namespace usbip
+namespace usb_ids
 {
+	std::string make_table(std::string_view content);
+}
 
 class USBIP_API UsbIds
 {
@@ -68,13 +35,26 @@ public:
 	explicit operator bool() const noexcept;
 	bool operator !() const noexcept;
 
+	/*
+	 * The content must outlive the object, names are its views.
+	 * @param content text of usb.ids or the binary table, @see usb_ids_table.h
+	 */
 	void load(std::string_view content);
 
 	std::pair<std::string_view, std::string_view> find_product(uint16_t vid, uint16_t pid) const noexcept;
 
 	std::tuple<std::string_view, std::string_view, std::string_view> 
 		find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) const noexcept;
+
+	/*
+	 * Case-insensitive substring search in the names of vendors and products.
+	 * The search index is built by the first call.
+	 * @return sorted {vid, pid}, pid is zero if the vendor's name matches
+	 */
+	std::vector<std::pair<uint16_t, uint16_t>> find_by_name(std::string_view text) const;
 private:
+	friend std::string usb_ids::make_table(std::string_view content);
+
 	class Impl;
 	Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
 
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * Flat binary table of usb.ids that is generated at build time by usb_ids_gen, UsbIds uses it in place.
+ * Layout: header, records of vendors, products, classes, subclasses, protocols, the blob of names.
+ * The children of a record are [first, last) in the next array, they are sorted by id.
+ * Integers have the byte order of the host, the table is not portable between little and big endian.
+ */
+namespace usbip::usb_ids
+{
+
+constexpr char magic[8] = "usb.ids"; // text usb.ids starts with '#'
+enum : uint32_t { version = 1 };
+
+enum { VENDOR, PRODUCT, CLASS, SUBCLASS, PROTOCOL, RECORD_ARRAYS };
+
+struct record
+{
+        uint32_t name; // offset in the blob
+        uint16_t name_len;
+        uint16_t id;
+        uint32_t first; // children
+        uint32_t last;
+};
+static_assert(sizeof(record) == 16);
+
+struct header
+{
+        char magic[sizeof(usb_ids::magic)];
+        uint32_t version;
+        uint32_t count[RECORD_ARRAYS];
+        uint32_t blob_size;
+};
+static_assert(!(sizeof(header) % alignof(record)));
+
+/*
+ * @param content text of usb.ids
+ * @return the binary table, it is empty if the content can't be parsed
+ */
+std::string make_table(std::string_view content);
+
+/*
+ * Generated by usb_ids_gen, it is aligned for record.
+ */
+extern const unsigned char table[];
+extern const size_t table_size;
+
+inline auto get_table() noexcept { return std::string_view(reinterpret_cast<const char*>(table), table_size); }
+
+} // namespace usbip::usb_ids
@@ -13,6 +13,8 @@
 #include <initguid.h>
 #include <usbip\vhci.h>
 
+#include <memory>
+
 namespace
 {
 
@@ -75,6 +77,67 @@ void assign(_Out_ std::vector<imported_device> &dst, _In_ const vhci::imported_d
         }
 }
 
+void assign(_Out_ transfer_stats &dst, _In_ const stats_counters &src)
+{
+        static_assert(sizeof(dst) == sizeof(src));
+
+        dst = transfer_stats {
+                .submitted = src.submitted,
+                .completed = src.completed,
+                .cancelled = src.cancelled,
+                .bytes_in = src.bytes_in,
+                .bytes_out = src.bytes_out,
+                .unlinks = src.unlinks,
+                .drained = src.drained,
+                .send_failures = src.send_failures,
+        };
+}
+
+/*
+ * @param freq ticks per second of histogram values
+ */
+void assign(_Out_ latency_stats &dst, _In_ const latency_histogram &src, _In_ UINT64 freq)
+{
+        auto us = [freq] (auto ticks) { return freq ? ticks*1'000'000.0/freq : 0.0; };
+        auto cnt = get_count(src);
+
+        dst = latency_stats {
+                .count = cnt,
+                .mean = cnt ? us(src.sum)/cnt : 0.0,
+                .p50 = us(get_percentile(src, 50)),
+                .p90 = us(get_percentile(src, 90)),
+                .p99 = us(get_percentile(src, 99)),
+                .max = us(get_percentile(src, 100)),
+        };
+}
+
+/*
+ * @param r must be validated
+ */
+void assign(_Out_ std::vector<captured_pdu> &dst, _In_ const vhci::ioctl::get_capture &r)
+{
+        assert(dst.empty());
+        dst.resize(r.count);
+
+        constexpr auto unix_epoch = 116'444'736'000'000'000LL; // 1970-01-01 in 100-nanosecond intervals since 1601
+        auto base = (LONGLONG(r.system_time) - unix_epoch)/10; // microseconds
+
+        for (UINT32 i = 0; i < r.count; ++i) {
+                auto &src = r.records[i];
+                auto &pdu = dst[i];
+
+                auto ticks = LONGLONG(src.timestamp) - LONGLONG(r.timestamp); // records are older, ticks < 0
+                pdu.time = base + (r.frequency ? LONGLONG(ticks*1'000'000.0/r.frequency) : 0);
+
+                pdu.out = src.dir == CAPTURE_OUT;
+                pdu.length = src.length;
+
+                pdu.data.reserve(sizeof(src.hdr) + src.captured);
+                pdu.data.assign(reinterpret_cast<const char*>(&src.hdr), sizeof(src.hdr));
+                pdu.data.append(reinterpret_cast<const char*>(src.payload), src.captured);
+        }
+}
+
 auto get_path()
 {
         auto guid = const_cast<GUID*>(&vhci::GUID_DEVINTERFACE_USB_HOST_CONTROLLER);
@@ -213,3 +276,108 @@ bool usbip::vhci::detach(_In_ HANDLE dev, _In_ int port)
         DWORD BytesReturned; // must be set if the last arg is NULL
         return DeviceIoControl(dev, ioctl::PLUGOUT_HARDWARE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
 }
+
+bool usbip::vhci::get_device_stats(_In_ HANDLE dev, _In_ int port, _Out_ device_stats &stats)
+{
+        stats = device_stats{};
+
+        auto r = std::make_unique<ioctl::get_device_stats>();
+        r->size = sizeof(*r);
+        r->version = r->VERSION;
+        r->port = port;
+
+        if (DWORD BytesReturned; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::GET_DEVICE_STATS, r.get(), sizeof(*r), r.get(), sizeof(*r), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned != sizeof(*r) || r->endpoint_cnt > ARRAYSIZE(r->endpoints)) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        assign(stats.counters, r->device);
+
+        stats.sent_batches = r->sent_batches;
+        stats.sent_pdus = r->sent_pdus;
+
+        stats.descriptor_hits = r->descriptor_hits;
+        stats.descriptor_misses = r->descriptor_misses;
+
+        stats.endpoints.resize(r->endpoint_cnt);
+
+        for (UINT32 i = 0; i < r->endpoint_cnt; ++i) {
+                auto &src = r->endpoints[i];
+                auto &dst = stats.endpoints[i];
+
+                dst.address = src.bEndpointAddress;
+                dst.attributes = src.bmAttributes;
+                assign(dst.counters, src.counters);
+        }
+
+        return true;
+}
+
+bool usbip::vhci::get_endpoint_latency(
+        _In_ HANDLE dev, _In_ int port, _In_ UINT8 address, _Out_ endpoint_latency &latency)
+{
+        static_assert(ARRAYSIZE(latency.stages) == vhci::LATENCY_STAGES);
+        latency = endpoint_latency{};
+
+        auto r = std::make_unique<ioctl::get_endpoint_latency>();
+        r->size = sizeof(*r);
+        r->version = r->VERSION;
+        r->port = port;
+        r->bEndpointAddress = address;
+
+        if (DWORD BytesReturned; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::GET_ENDPOINT_LATENCY, r.get(), sizeof(*r), r.get(), sizeof(*r), &BytesReturned, nullptr)) {
+                return false;
+        } else if (BytesReturned != sizeof(*r)) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        assign(latency.send, r->send, r->frequency);
+
+        for (int i = 0; i < vhci::LATENCY_STAGES; ++i) {
+                assign(latency.stages[i], r->stages[i], r->frequency);
+        }
+
+        return true;
+}
+
+bool usbip::vhci::set_capture(_In_ HANDLE dev, _In_ int port, _In_ bool enable)
+{
+        ioctl::set_capture r { .version = ioctl::set_capture::VERSION, .port = port, .enable = enable };
+        r.size = sizeof(r);
+
+        DWORD BytesReturned; // must be set if the last arg is NULL
+        return DeviceIoControl(dev, ioctl::SET_CAPTURE, &r, sizeof(r), nullptr, 0, &BytesReturned, nullptr);
+}
+
+bool usbip::vhci::read_capture(
+        _In_ HANDLE dev, _In_ int port, _Out_ std::vector<captured_pdu> &pdus, _Out_ UINT64 &lost)
+{
+        pdus.clear();
+        lost = 0;
+
+        constexpr ULONG max_cnt = 1024;
+        std::vector<char> buf(ioctl::get_capture_size(max_cnt));
+
+        auto r = reinterpret_cast<ioctl::get_capture*>(buf.data());
+        r->size = sizeof(*r);
+        r->version = r->VERSION;
+        r->port = port;
+
+        if (DWORD BytesReturned; // must be set if the last arg is NULL
+            !DeviceIoControl(dev, ioctl::GET_CAPTURE, r, sizeof(*r), buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+                return false;
+        } else if (r->count > max_cnt || BytesReturned != ioctl::get_capture_size(r->count)) [[unlikely]] {
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return false;
+        }
+
+        lost = r->lost;
+        assign(pdus, *r);
+
+        return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 - 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "win_resource.h"
+
+class win::Resource::Impl
+{
+public:
+        Impl(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) { load(hModule, name, type); }
+
+        explicit operator bool() const noexcept { return hResInfo && hResData; }
+        auto operator!() const noexcept { return !bool(*this); } 
+
+        DWORD load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
+
+        auto data() const noexcept { return LockResource(hResData); }
+        auto size(HMODULE hModule) const noexcept { return SizeofResource(hModule, hResInfo); }
+
+        auto str() const noexcept { return m_str; }
+
+private:
+        HRSRC hResInfo{};
+        HGLOBAL hResData{};
+        std::string_view m_str;
+};
+
+
+DWORD win::Resource::Impl::load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type)
+{
+        hResInfo = FindResource(hModule, name, type);
+        if (!hResInfo) {
+                return GetLastError();
+        }
+
+        hResData = LoadResource(hModule, hResInfo);
+        if (!hResData) {
+                return GetLastError();
+        }
+
+        m_str = std::string_view(reinterpret_cast<const char*>(data()), size(hModule));
+        return ERROR_SUCCESS;
+}
+
+win::Resource::Resource(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) 
+        : m_impl(new Impl(hModule, name, type)) {}
+
+win::Resource::~Resource() { delete m_impl; }
+
+auto win::Resource::operator =(Resource&& obj) noexcept -> Resource&
+{
+        if (&obj != this) {
+                delete m_impl;
+                m_impl = obj.release();
+        }
+
+        return *this;
+}
+
+win::Resource::operator bool() const noexcept { return static_cast<bool>(*m_impl); }
+
+DWORD win::Resource::load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type) 
+{
+        return m_impl->load(hModule, name, type); 
+}
+
+void* win::Resource::data() const noexcept { return m_impl->data(); }
+DWORD win::Resource::size(HMODULE hModule) const noexcept{ return m_impl->size(hModule); }
+std::string_view win::Resource::str() const noexcept { return m_impl->str(); }
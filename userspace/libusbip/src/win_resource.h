@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2022 - 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "..\dllspec.h"
+
+#include <string_view>
+#include <windows.h>
+
+namespace win
+{
+
+class USBIP_API Resource
+{
+public:
+	Resource(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
+	~Resource();
+
+	Resource(const Resource&) = delete;
+	Resource& operator =(const Resource&) = delete;
+
+	Resource(Resource&& obj) noexcept : m_impl(obj.release()) {}
+	Resource& operator =(Resource&& obj) noexcept;
+
+	explicit operator bool() const noexcept;
+	auto operator!() const noexcept { return !bool(*this); } 
+
+	DWORD load(_In_opt_ HMODULE hModule, _In_ LPCTSTR name, _In_ LPCTSTR type);
+
+	void* data() const noexcept;
+	DWORD size(HMODULE hModule) const noexcept;
+
+	std::string_view str() const noexcept;
+
+private:
+	class Impl;
+	Impl *m_impl{}; // std::unique_ptr is not compatible with __declspec(dllexport) for the class
+
+	Impl *release() {
+		auto p = m_impl;
+		m_impl = nullptr;
+		return p;
+	}
+};
+
+} // namespace win
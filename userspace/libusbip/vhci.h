@@ -37,6 +37,91 @@ struct imported_device
         UINT16 product;
 };
 
+/*
+ * Counters only grow, rates are calculated from the difference of two samples.
+ */
+struct transfer_stats
+{
+        UINT64 submitted; // URBs sent to a server
+        UINT64 completed; // URBs completed with any status except cancelled
+        UINT64 cancelled;
+        UINT64 bytes_in;  // transfer buffer data received from a server
+        UINT64 bytes_out; // transfer buffer data sent to a server
+        UINT64 unlinks;   // CMD_UNLINK sent
+        UINT64 drained;   // payloads of PDUs without a request that were skipped
+        UINT64 send_failures; // PDUs that were not sent because of a network error
+
+        auto in_flight() const noexcept
+        {
+                auto done = completed + cancelled;
+                return submitted > done ? submitted - done : 0;
+        }
+};
+
+struct endpoint_stats
+{
+        UINT8 address; // bEndpointAddress
+        UINT8 attributes; // bmAttributes, transfer type
+        transfer_stats counters;
+};
+
+struct device_stats
+{
+        transfer_stats counters; // includes counters of removed endpoints
+
+        UINT64 sent_batches; // PDUs are sent in batches, batching factor is sent_pdus/sent_batches
+        UINT64 sent_pdus;
+
+        UINT64 descriptor_hits; // GET_DESCRIPTOR was served from the cache
+        UINT64 descriptor_misses;
+
+        std::vector<endpoint_stats> endpoints; // active ones
+};
+
+/*
+ * Summary of a latency histogram, times are in microseconds.
+ * Percentiles and max are upper bounds of histogram buckets, they exceed exact values by 12.5% at most.
+ */
+struct latency_stats
+{
+        UINT64 count;
+        double mean;
+        double p50;
+        double p90;
+        double p99;
+        double max;
+};
+
+/*
+ * Stages of URB lifecycle, indices of endpoint_latency::stages.
+ */
+enum latency_stage
+{
+        LAT_QUEUE,      // from submission of URB to its sending, time in send queue
+        LAT_NETWORK,    // from sending to RET_SUBMIT header, network and server
+        LAT_PAYLOAD,    // from RET_SUBMIT header to the end of its payload
+        LAT_COMPLETION, // from the end of the payload to completion of URB
+        LAT_TOTAL,      // from submission to completion of URB
+        LATENCY_STAGES
+};
+
+/*
+ * Cancelled URBs and URBs that did not receive a response are not taken into account.
+ */
+struct endpoint_latency
+{
+        latency_stats send; // sending of PDU batches, for all endpoints of the device
+        latency_stats stages[LATENCY_STAGES];
+};
+
+struct captured_pdu
+{
+        UINT64 time; // microseconds since 1970-01-01 00:00:00 UTC
+        bool out; // to a server
+        UINT32 length; // of PDU, header and payload
+        std::string data; // header and the beginning of the payload in network byte order, can be truncated
+};
+
 } // namespace usbip
 
 
@@ -70,4 +155,40 @@ USBIP_API int attach(_In_ HANDLE dev, _In_ const device_location &location);
  */
 USBIP_API bool detach(_In_ HANDLE dev, _In_ int port);
 
+/**
+ * @param dev handle of the driver device
+ * @param port hub port number of the imported device
+ * @param stats counters since the device was plugged in
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool get_device_stats(_In_ HANDLE dev, _In_ int port, _Out_ device_stats &stats);
+
+/**
+ * @param dev handle of the driver device
+ * @param port hub port number of the imported device
+ * @param address bEndpointAddress, zero for the default control pipe
+ * @param latency since the endpoint was created
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool get_endpoint_latency(_In_ HANDLE dev, _In_ int port, _In_ UINT8 address, _Out_ endpoint_latency &latency);
+
+/**
+ * Capture of PDUs of the device, it is disabled by default.
+ * @param dev handle of the driver device
+ * @param port hub port number of the imported device
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool set_capture(_In_ HANDLE dev, _In_ int port, _In_ bool enable);
+
+/**
+ * Reads PDUs captured since the previous call, a call returns a limited number of them.
+ * @param dev handle of the driver device
+ * @param port hub port number of the imported device
+ * @param pdus in the order they were sent or received
+ * @param lost PDUs that were overwritten before they were read, since capture was enabled first time
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool read_capture(
+        _In_ HANDLE dev, _In_ int port, _Out_ std::vector<captured_pdu> &pdus, _Out_ UINT64 &lost);
+
 } // namespace usbip::vhci
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "client.h"
+#include "server.h"
+
+#include <CLI11/CLI11.hpp>
+
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::mock;
+
+struct args
+{
+        std::string remote = "127.0.0.1";
+        uint16_t port = 3240;
+
+        bool loopback{};
+        unsigned int latency{}; // microseconds, of loopback server
+        unsigned int jitter{};
+        double error_rate{};
+        unsigned int seed{};
+};
+
+void add_options(CLI::App &app, args &r, bench_options &opts)
+{
+        app.add_option("-r,--remote", r.remote, "USB/IP server address")->capture_default_str();
+        app.add_option("-p,--port", r.port, "TCP port")->capture_default_str();
+        app.add_option("-b,--bus-id", opts.busid, "Bus-id of USB device")->capture_default_str();
+
+        app.add_option("-e,--endpoint", opts.ep, "Number of bulk, interrupt or isoch endpoint")
+                ->check(CLI::Range(1, 15))
+                ->capture_default_str();
+
+        app.add_option("-d,--dir", [&opts] (auto &v) { opts.dir_in = v[0] == "in"; return true; }, "Direction of the transfers")
+                ->check(CLI::IsMember({"in", "out"}))
+                ->default_str("in");
+
+        app.add_option("-s,--size", opts.size, "Transfer buffer length")->capture_default_str();
+
+        app.add_option("--packets", opts.packets, "Number of packets of isoch transfer, ASAP")
+                ->check(CLI::Range(1, int(USBIP_MAX_ISO_PACKETS)));
+
+        app.add_option("-i,--interval", opts.interval, "Interval of interrupt or isoch endpoint");
+        app.add_option("-q,--depth", opts.depth, "URBs in flight")->check(CLI::Range(1, 1024))->capture_default_str();
+        app.add_option("-w,--warmup", opts.warmup, "URBs that are not measured")->capture_default_str();
+        app.add_option("count", opts.count, "Number of measured URBs")->capture_default_str();
+
+        auto lo = app.add_option_group("loopback", "In-process mock server, --remote and --port are ignored");
+        lo->add_flag("--loopback", r.loopback, "Start mock server on any free port of 127.0.0.1");
+        lo->add_option("--latency", r.latency, "Delay of every reply, microseconds");
+        lo->add_option("--jitter", r.jitter, "Random extra delay of a reply, microseconds");
+        lo->add_option("--error-rate", r.error_rate, "Probability of -EPIPE")->check(CLI::Range(0.0, 1.0));
+        lo->add_option("--seed", r.seed, "Seed of random delays and errors, zero means random");
+}
+
+void report(const bench_result &r)
+{
+        auto secs = r.seconds > 0 ? r.seconds : 1;
+
+        printf("%llu URB(s), %llu error(s), %llu reordered, %.0f URB/s, %.2f MB/s\n",
+                (unsigned long long)r.urbs, (unsigned long long)r.errors, (unsigned long long)r.reordered,
+                double(r.urbs)/secs, double(r.bytes)/(1024*1024)/secs);
+
+        if (!r.urbs) {
+                return;
+        }
+
+        printf("latency, us: mean %.0f", double(r.latency.sum)/r.urbs);
+
+        for (auto p: {50.0, 90.0, 99.0, 99.9}) {
+                printf(", p%g %llu", p, (unsigned long long)get_percentile(r.latency, p));
+        }
+
+        printf("\n");
+}
+
+} // namespace
+
+
+/*
+ * Latency benchmark, keeps a number of URBs in flight on an imported device.
+ * The latency of each one is measured from CMD_SUBMIT to RET_SUBMIT.
+ */
+int main(int argc, char *argv[])
+{
+        CLI::App app("USB/IP latency benchmark, sends URBs to an imported device");
+
+        args r;
+        bench_options opts;
+        add_options(app, r, opts);
+
+        CLI11_PARSE(app, argc, argv);
+
+        std::unique_ptr<server> srv;
+        std::thread thread;
+
+        if (r.loopback) {
+                options o;
+                o.port = 0;
+                o.latency = std::chrono::microseconds(r.latency);
+                o.jitter = std::chrono::microseconds(r.jitter);
+                o.error_rate = r.error_rate;
+                o.seed = r.seed;
+
+                srv = std::make_unique<server>(o);
+
+                if (auto err = srv->listen(); !err.empty()) {
+                        std::cerr << err << std::endl;
+                        return EXIT_FAILURE;
+                }
+
+                r.remote = o.address;
+                r.port = srv->port();
+                thread = std::thread(&server::run, srv.get());
+        }
+
+        bench_result result;
+        std::string err;
+        {
+                client c;
+
+                if (err = c.connect(r.remote, r.port); err.empty() && (err = c.import(opts.busid)).empty()) {
+                        err = run_bench(result, c, opts);
+                }
+        }
+
+        if (srv) {
+                srv->stop();
+                thread.join();
+        }
+
+        if (!err.empty()) {
+                std::cerr << err << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        report(result);
+        return EXIT_SUCCESS;
+}
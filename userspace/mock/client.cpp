@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "client.h"
+#include "net.h"
+
+#include <usbip/codec.h>
+#include <usbip/proto_op.h>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <semaphore>
+#include <thread>
+
+usbip::mock::client::~client()
+{
+        if (m_sock >= 0) {
+                ::close(m_sock);
+        }
+}
+
+std::string usbip::mock::client::connect(const std::string &address, uint16_t port)
+{
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo *res{};
+        if (auto err = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &res)) {
+                return address + ": " + gai_strerror(err);
+        }
+
+        std::string err;
+
+        for (auto ai = res; ai; ai = ai->ai_next) {
+                auto sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (sock < 0) {
+                        err = std::string("socket: ") + strerror(errno);
+                } else if (::connect(sock, ai->ai_addr, ai->ai_addrlen)) {
+                        err = std::string("connect: ") + strerror(errno);
+                        ::close(sock);
+                } else {
+                        int on = 1;
+                        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                        m_sock = sock;
+                        err.clear();
+                        break;
+                }
+        }
+
+        freeaddrinfo(res);
+        return err;
+}
+
+std::string usbip::mock::client::import(const std::string &busid)
+{
+        struct {
+                op_common hdr;
+                op_import_request body;
+        } req{};
+        static_assert(sizeof(req) == sizeof(req.hdr) + sizeof(req.body));
+
+        req.hdr.version = htons(USBIP_VERSION);
+        req.hdr.code = htons(OP_REQ_IMPORT);
+        strncpy(req.body.busid, busid.c_str(), sizeof(req.body.busid) - 1);
+
+        if (!send_all(m_sock, &req, sizeof(req))) {
+                return "send OP_REQ_IMPORT failed";
+        }
+
+        op_common rep{};
+        if (!recv_all(m_sock, &rep, sizeof(rep))) {
+                return "recv OP_REP_IMPORT failed";
+        }
+
+        if (ntohs(rep.code) != OP_REP_IMPORT) {
+                return "unexpected reply code " + std::to_string(ntohs(rep.code));
+        }
+
+        if (auto st = ntohl(rep.status)) {
+                return busid + ": import error, status " + std::to_string(st);
+        }
+
+        usbip_usb_device dev{};
+        if (!recv_all(m_sock, &dev, sizeof(dev))) {
+                return "recv usbip_usb_device failed";
+        }
+
+        m_devid = ntohl(dev.busnum) << 16 | ntohl(dev.devnum);
+        return {};
+}
+
+std::string usbip::mock::client::send(const std::string &pdu)
+{
+        std::lock_guard lck(m_send_mtx);
+        return send_all(m_sock, pdu.data(), pdu.size()) ? std::string() : std::string("send: ") + strerror(errno);
+}
+
+std::string usbip::mock::client::submit(
+        usbip_header hdr, const void *data, const std::vector<usbip_iso_packet_descriptor> &isoc)
+{
+        hdr.base.command = USBIP_CMD_SUBMIT;
+        hdr.base.devid = m_devid;
+
+        auto len = hdr.base.direction == USBIP_DIR_OUT ? size_t(hdr.u.cmd_submit.transfer_buffer_length) : 0;
+        byteswap_header(hdr, swap_dir::host2net);
+
+        std::string s(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        if (len) {
+                s.append(static_cast<const char*>(data), len);
+        }
+
+        auto off = s.size();
+        s.append(reinterpret_cast<const char*>(isoc.data()), isoc.size()*sizeof(isoc[0]));
+        byteswap(reinterpret_cast<usbip_iso_packet_descriptor*>(s.data() + off), isoc.size());
+
+        return send(s);
+}
+
+std::string usbip::mock::client::unlink(seqnum_t seqnum, seqnum_t victim)
+{
+        usbip_header hdr{};
+
+        hdr.base.command = USBIP_CMD_UNLINK;
+        hdr.base.seqnum = seqnum;
+        hdr.base.devid = m_devid;
+        hdr.base.direction = extract_dir(seqnum);
+        hdr.u.cmd_unlink.seqnum = victim;
+
+        byteswap_header(hdr, swap_dir::host2net);
+        return send(std::string(reinterpret_cast<const char*>(&hdr), sizeof(hdr)));
+}
+
+std::string usbip::mock::client::receive(
+        usbip_header &hdr, std::string &data, std::vector<usbip_iso_packet_descriptor> &isoc)
+{
+        if (!recv_all(m_sock, &hdr, sizeof(hdr))) {
+                return "connection closed";
+        }
+
+        byteswap_header(hdr, swap_dir::net2host);
+
+        if (auto err = validate_ret_header(hdr); err != header_error::none) {
+                return "invalid header, error " + std::to_string(int(err));
+        }
+
+        usbip_iso_packet_descriptor *d{};
+        auto cnt = get_isoc_descr(d, hdr);
+
+        auto size = get_payload_size(hdr) - cnt*sizeof(*d);
+        data.resize(size);
+        isoc.resize(cnt);
+
+        if (!(recv_all(m_sock, data.data(), size) && recv_all(m_sock, isoc.data(), cnt*sizeof(*d)))) {
+                return "connection closed";
+        }
+
+        byteswap(isoc.data(), cnt);
+        return {};
+}
+
+void usbip::mock::client::close()
+{
+        if (m_sock >= 0) {
+                shutdown(m_sock, SHUT_RDWR); // receive() fails
+        }
+}
+
+std::string usbip::mock::run_bench(bench_result &result, client &c, const bench_options &opts)
+{
+        using clock_type = std::chrono::steady_clock;
+
+        auto total = opts.warmup + opts.count;
+
+        std::counting_semaphore<> slots(opts.depth); // URBs that can be submitted
+
+        std::mutex mtx; // for the variables below
+        std::map<seqnum_t, clock_type::time_point> sent; // ordered by seqnum, thus by submission
+        std::string error;
+        clock_type::time_point start, end;
+
+        auto receiver = [&]
+        {
+                usbip_header hdr;
+                std::string data;
+                std::vector<usbip_iso_packet_descriptor> isoc;
+
+                for (int i = 0; i < total; ++i) {
+                        auto err = c.receive(hdr, data, isoc);
+                        auto now = clock_type::now();
+
+                        std::lock_guard lck(mtx);
+                        auto it = sent.end();
+
+                        if (!err.empty()) {
+                                // already failed
+                        } else if (hdr.base.command != USBIP_RET_SUBMIT) {
+                                err = "unexpected command " + std::to_string(hdr.base.command);
+                        } else if (it = sent.find(hdr.base.seqnum); it == sent.end()) {
+                                err = "unexpected seqnum " + std::to_string(hdr.base.seqnum);
+                        }
+
+                        if (!err.empty()) {
+                                error = std::move(err);
+                                slots.release();
+                                return;
+                        }
+
+                        if (extract_num(hdr.base.seqnum) > seqnum_t(opts.warmup)) {
+                                auto &r = hdr.u.ret_submit;
+                                auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - it->second);
+
+                                record(result.latency, UINT64(us.count()));
+                                ++result.urbs;
+                                result.errors += r.status || r.error_count;
+                                result.reordered += it != sent.begin();
+                                result.bytes += UINT32(r.actual_length);
+                        }
+
+                        sent.erase(it);
+                        end = now;
+                        slots.release();
+                }
+        };
+
+        std::thread thread(receiver);
+
+        usbip_header hdr{};
+        hdr.base.direction = opts.dir_in ? USBIP_DIR_IN : USBIP_DIR_OUT;
+        hdr.base.ep = opts.ep;
+
+        auto &cmd = hdr.u.cmd_submit;
+        cmd.transfer_buffer_length = INT32(opts.size);
+        cmd.interval = opts.interval;
+        cmd.number_of_packets = number_of_packets_non_isoch;
+
+        std::vector<usbip_iso_packet_descriptor> isoc(opts.packets);
+        if (opts.packets) {
+                cmd.transfer_flags = URB_ISO_ASAP;
+                cmd.number_of_packets = opts.packets;
+
+                auto len = opts.size/opts.packets;
+                for (int i = 0; i < opts.packets; ++i) {
+                        auto &d = isoc[i];
+                        d.offset = i*len;
+                        d.length = len;
+                }
+        }
+
+        std::string data(opts.dir_in ? 0 : opts.size, '\0');
+
+        for (int i = 1; i <= total; ++i) {
+                hdr.base.seqnum = make_seqnum(seqnum_t(i), opts.dir_in);
+                slots.acquire();
+                {
+                        std::lock_guard lck(mtx);
+
+                        if (!error.empty()) {
+                                break;
+                        }
+
+                        auto now = clock_type::now();
+                        if (i == opts.warmup + 1) {
+                                start = now;
+                        }
+                        sent.emplace(hdr.base.seqnum, now);
+                }
+
+                if (auto err = c.submit(hdr, data.data(), isoc); !err.empty()) {
+                        std::lock_guard lck(mtx);
+                        error = std::move(err);
+                        break;
+                }
+        }
+
+        if (!error.empty()) {
+                c.close();
+        }
+
+        thread.join();
+
+        result.seconds = std::chrono::duration<double>(end - start).count();
+        return error;
+}
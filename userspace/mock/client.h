@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <usbip/histogram.h>
+#include <usbip/proto.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usbip::mock
+{
+
+/*
+ * Imported device of a USB/IP server, works with mock::server and with a real server.
+ * Functions return empty string on success, otherwise the reason of the failure.
+ * submit() and unlink() can be called concurrently with receive().
+ */
+class client
+{
+public:
+        client() = default;
+        ~client();
+
+        client(const client&) = delete;
+        client& operator =(const client&) = delete;
+
+        std::string connect(const std::string &address, uint16_t port);
+        std::string import(const std::string &busid);
+
+        auto devid() const { return m_devid; } // valid after import()
+
+        /*
+         * @param hdr CMD_SUBMIT in host byte order, base.command and base.devid are set by this function
+         * @param data of OUT transfer, its size must be equal to transfer_buffer_length
+         * @param isoc packet descriptors, their count must be equal to number_of_packets
+         */
+        std::string submit(usbip_header hdr, const void *data = nullptr,
+                           const std::vector<usbip_iso_packet_descriptor> &isoc = {});
+
+        std::string unlink(seqnum_t seqnum, seqnum_t victim);
+
+        /*
+         * Receives RET_SUBMIT or RET_UNLINK, the header is validated by validate_ret_header.
+         * @param hdr in host byte order
+         * @param data of IN transfer
+         * @param isoc packet descriptors in host byte order
+         */
+        std::string receive(usbip_header &hdr, std::string &data, std::vector<usbip_iso_packet_descriptor> &isoc);
+
+        void close();
+
+private:
+        int m_sock = -1;
+        uint32_t m_devid{};
+        std::mutex m_send_mtx;
+
+        std::string send(const std::string &pdu);
+};
+
+struct bench_options
+{
+        std::string busid = "1-1";
+        uint32_t ep = 1; // bulk or interrupt, isoch if packets are set
+        bool dir_in = true;
+        uint32_t size = 512; // transfer buffer length
+        int packets{}; // of isoch transfer
+        int interval{};
+
+        int depth = 1; // URBs in flight
+        int warmup = 100; // URBs that are not measured
+        int count = 10'000; // measured URBs
+};
+
+struct bench_result
+{
+        latency_histogram latency{}; // microseconds, from CMD_SUBMIT to RET_SUBMIT
+        uint64_t urbs{};
+        uint64_t errors{}; // non-zero status or error_count
+        uint64_t reordered{}; // RET_SUBMIT that was received before RET_SUBMIT of an earlier CMD_SUBMIT
+        uint64_t bytes{}; // actual_length
+        double seconds{};
+};
+
+/*
+ * Keeps opts.depth URBs in flight on the imported device.
+ * @return empty string on success, otherwise the reason of the failure
+ */
+std::string run_bench(bench_result &result, client &c, const bench_options &opts);
+
+} // namespace usbip::mock
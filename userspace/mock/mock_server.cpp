@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "server.h"
+
+#include <CLI11/CLI11.hpp>
+
+#include <csignal>
+#include <iostream>
+
+namespace
+{
+
+using namespace usbip::mock;
+
+struct delays
+{
+        unsigned int latency{}; // microseconds
+        unsigned int jitter{};
+};
+
+void add_options(CLI::App &app, options &opts, delays &d)
+{
+        app.add_option("-a,--address", opts.address, "IPv4 address to listen on")->capture_default_str();
+        app.add_option("-p,--port", opts.port, "TCP port, zero means any free one")->capture_default_str();
+
+        app.add_option("-n,--devices", opts.devices, "Number of exported devices, bus-id is 1-1, 1-2, ...")
+                ->check(CLI::Range(1, 127))
+                ->capture_default_str();
+
+        app.add_option("-l,--latency", d.latency, "Delay of every reply, microseconds");
+        app.add_option("-j,--jitter", d.jitter, "Random extra delay of a reply, microseconds, replies can be completed out of order");
+
+        app.add_option("-s,--in-size", opts.in_size, "Max actual_length of IN transfers and isoch packets, zero means as requested");
+
+        app.add_option("-e,--error-rate", opts.error_rate, "Probability of -EPIPE for non-control transfers")
+                ->check(CLI::Range(0.0, 1.0));
+
+        app.add_option("--seed", opts.seed, "Seed of random delays and errors, zero means random");
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        CLI::App app("Mock USB/IP server, it exports synthetic devices for loopback tests and benchmarks");
+
+        options opts;
+        delays d;
+        add_options(app, opts, d);
+
+        CLI11_PARSE(app, argc, argv);
+
+        opts.latency = std::chrono::microseconds(d.latency);
+        opts.jitter = std::chrono::microseconds(d.jitter);
+
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &set, nullptr); // inherited by the threads of the server
+
+        server srv(opts);
+
+        if (auto err = srv.listen(); !err.empty()) {
+                std::cerr << err << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        std::cout << "listening on " << opts.address << ':' << srv.port() << std::endl;
+
+        std::thread thread(&server::run, &srv);
+
+        int sig;
+        sigwait(&set, &sig);
+
+        srv.stop();
+        thread.join();
+
+        auto &st = srv.get_stats();
+        std::cout << st.connections << " connection(s), " << st.urbs << " URB(s), "
+                  << st.unlinks << " unlinked, " << st.errors << " error(s) injected, "
+                  << st.bytes_in << " byte(s) in, " << st.bytes_out << " byte(s) out" << std::endl;
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstddef>
+
+namespace usbip::mock
+{
+
+/*
+ * Blocking I/O of the whole buffer, POSIX sockets.
+ * @return false if the connection was closed or an error occurred
+ */
+inline bool recv_all(int sock, void *buf, size_t len)
+{
+        for (auto p = static_cast<char*>(buf); len; ) {
+                auto n = recv(sock, p, len, 0);
+                if (n > 0) {
+                        p += n;
+                        len -= size_t(n);
+                } else if (!(n < 0 && errno == EINTR)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+inline bool send_all(int sock, const void *buf, size_t len)
+{
+        for (auto p = static_cast<const char*>(buf); len; ) {
+                auto n = send(sock, p, len, MSG_NOSIGNAL);
+                if (n > 0) {
+                        p += n;
+                        len -= size_t(n);
+                } else if (!(n < 0 && errno == EINTR)) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+} // namespace usbip::mock
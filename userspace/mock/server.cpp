@@ -0,0 +1,677 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "server.h"
+#include "net.h"
+
+#include <usbip/codec.h>
+#include <usbip/frame_clock.h>
+#include <usbip/pdu_parser.h>
+#include <usbip/proto_op.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::mock;
+
+using clock_type = std::chrono::steady_clock;
+
+enum : uint32_t { USB_SPEED_HIGH = 3 }; // enum usb_device_speed
+enum : uint32_t { MAX_TRANSFER_SIZE = 16*1024*1024 };
+enum : uint32_t { FRAME_BASE = 1000 }; // frame number when a connection is established
+
+const uint8_t device_descriptor[] { 18, 1, 0x00, 0x02, 0xFF, 0, 0, 64, 0x34, 0x12, 0x78, 0x56, 0x00, 0x01, 1, 2, 3, 1 };
+
+/*
+ * Interface 0: bulk IN 0x81, bulk OUT 0x01, interrupt IN 0x82.
+ * Interface 1: alternate setting 1 has isoch IN 0x83 and OUT 0x03.
+ */
+const uint8_t config_descriptor[] {
+        9, 2, 71, 0, 2, 1, 0, 0x80, 50,
+        9, 4, 0, 0, 3, 0xFF, 0, 0, 0,
+        7, 5, 0x81, 2, 0x00, 0x02, 0,
+        7, 5, 0x01, 2, 0x00, 0x02, 0,
+        7, 5, 0x82, 3, 0x40, 0x00, 4,
+        9, 4, 1, 0, 0, 0xFF, 0, 0, 0,
+        9, 4, 1, 1, 2, 0xFF, 0, 0, 0,
+        7, 5, 0x83, 1, 0x00, 0x04, 1,
+        7, 5, 0x03, 1, 0x00, 0x04, 1,
+};
+static_assert(sizeof(config_descriptor) == 71);
+
+constexpr UINT8 ISOCH_INTERVAL = 1; // bInterval of isoch endpoints
+
+const char* const strings[] { nullptr, "usbip-win2", "Mock USB/IP device", "0001" };
+
+enum class endpoint_type { control, bulk, interrupt, isoch };
+
+auto get_endpoint_type(uint32_t ep)
+{
+        switch (ep) {
+        case 0:
+                return endpoint_type::control;
+        case 2:
+                return endpoint_type::interrupt;
+        case 3:
+                return endpoint_type::isoch;
+        default:
+                return endpoint_type::bulk;
+        }
+}
+
+/*
+ * @return descriptor or empty string if it does not exist
+ */
+std::string get_string_descriptor(unsigned int index)
+{
+        if (!index) {
+                return { 4, 3, 0x09, 0x04 }; // English (United States)
+        }
+
+        if (index >= std::size(strings)) {
+                return {};
+        }
+
+        std::string s(2, '\0');
+        for (auto p = strings[index]; *p; ++p) { // ASCII to UTF-16LE
+                s += *p;
+                s += '\0';
+        }
+
+        s[0] = char(s.size());
+        s[1] = 3; // USB_STRING_DESCRIPTOR_TYPE
+        return s;
+}
+
+/*
+ * @return data stage of control IN transfer, false if the request is not supported (stall)
+ */
+bool control_in(std::string &data, const UINT8 (&setup)[8], uint32_t length)
+{
+        auto wValue = uint16_t(setup[2] | setup[3] << 8);
+        auto wLength = uint16_t(setup[6] | setup[7] << 8);
+        auto len = std::min(length, uint32_t(wLength));
+
+        if (setup[1] != 6) { // GET_DESCRIPTOR
+                data.assign(len, '\0');
+                return true;
+        }
+
+        switch (wValue >> 8) {
+        case 1:
+                data.assign(reinterpret_cast<const char*>(device_descriptor), sizeof(device_descriptor));
+                break;
+        case 2:
+                data.assign(reinterpret_cast<const char*>(config_descriptor), sizeof(config_descriptor));
+                break;
+        case 3:
+                data = get_string_descriptor(wValue & 0xFF);
+                break;
+        default:
+                data.clear();
+        }
+
+        if (data.empty()) {
+                return false;
+        }
+
+        if (data.size() > len) {
+                data.resize(len);
+        }
+
+        return true;
+}
+
+auto make_device(const std::string &busid, uint32_t devnum)
+{
+        usbip_usb_device d{};
+
+        auto path = "/sys/devices/mock/usb1/" + busid;
+        strncpy(d.path, path.c_str(), sizeof(d.path) - 1);
+        strncpy(d.busid, busid.c_str(), sizeof(d.busid) - 1);
+
+        d.busnum = htonl(1);
+        d.devnum = htonl(devnum);
+        d.speed = htonl(USB_SPEED_HIGH);
+
+        d.idVendor = htons(0x1234);
+        d.idProduct = htons(0x5678);
+        d.bcdDevice = htons(0x0100);
+
+        d.bDeviceClass = 0xFF;
+        d.bConfigurationValue = 1;
+        d.bNumConfigurations = 1;
+        d.bNumInterfaces = 2;
+
+        return d;
+}
+
+/*
+ * Serves a connection after OP_REQ_IMPORT, it is a handler of pdu_parser.
+ */
+class connection
+{
+public:
+        connection(int sock, const options &opts, stats &st, unsigned int seed) :
+                m_sock(sock), m_opts(opts), m_stats(st), m_gen(seed) {}
+
+        void run();
+
+        bool on_header(usbip_header &hdr, size_t &payload_size, bool &drain);
+        bool on_payload(size_t offset, const void *data, size_t len);
+        bool on_pdu();
+
+private:
+        int m_sock;
+        const options &m_opts;
+        stats &m_stats;
+
+        std::mt19937 m_gen; // used by the thread of on_pdu only
+        usbip_header m_hdr{}; // host byte order
+        std::string m_payload;
+
+        clock_type::time_point m_start = clock_type::now();
+        uint32_t m_next_frame[2]{}; // of isoch OUT and IN endpoints, ASAP transfers are scheduled from it
+
+        std::mutex m_send_mtx;
+
+        using due_t = std::pair<clock_type::time_point, seqnum_t>;
+
+        std::mutex m_mtx; // for the fields below
+        std::condition_variable m_cv;
+        std::priority_queue<due_t, std::vector<due_t>, std::greater<due_t>> m_due;
+        std::map<seqnum_t, std::string> m_replies; // RET_SUBMIT that are not sent yet
+        bool m_closed{};
+
+        auto current_frame() const
+        {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - m_start);
+                return FRAME_BASE + uint32_t(ms.count());
+        }
+
+        void send(const std::string &pdu)
+        {
+                std::lock_guard lck(m_send_mtx);
+                send_all(m_sock, pdu.data(), pdu.size());
+        }
+
+        std::chrono::microseconds delay();
+        bool inject_error();
+
+        void schedule(seqnum_t seqnum, std::string reply);
+        void sender();
+
+        std::string submit();
+        std::string isoch(const usbip_iso_packet_descriptor *d, INT32 cnt);
+        void unlink();
+};
+
+std::chrono::microseconds connection::delay()
+{
+        auto d = m_opts.latency;
+
+        if (auto jitter = m_opts.jitter.count()) {
+                d += std::chrono::microseconds(std::uniform_int_distribution<long long>(0, jitter)(m_gen));
+        }
+
+        return d;
+}
+
+bool connection::inject_error()
+{
+        auto err = m_opts.error_rate > 0 && std::uniform_real_distribution<double>()(m_gen) < m_opts.error_rate;
+        if (err) {
+                ++m_stats.errors;
+        }
+        return err;
+}
+
+void connection::schedule(seqnum_t seqnum, std::string reply)
+{
+        auto d = delay();
+        if (!d.count()) {
+                send(reply);
+                return;
+        }
+
+        std::lock_guard lck(m_mtx);
+
+        m_replies.emplace(seqnum, std::move(reply));
+        m_due.emplace(clock_type::now() + d, seqnum);
+        m_cv.notify_one();
+}
+
+void connection::sender()
+{
+        std::unique_lock lck(m_mtx);
+
+        while (true) {
+                if (m_closed) {
+                        return;
+                }
+
+                if (auto due = m_due.empty() ? clock_type::time_point::max() : m_due.top().first;
+                    clock_type::now() < due) {
+                        m_cv.wait_until(lck, due);
+                        continue;
+                }
+
+                auto seqnum = m_due.top().second;
+                m_due.pop();
+
+                auto i = m_replies.find(seqnum);
+                if (i == m_replies.end()) { // unlinked
+                        continue;
+                }
+
+                auto reply = std::move(i->second);
+                m_replies.erase(i);
+
+                lck.unlock();
+                send(reply);
+                lck.lock();
+        }
+}
+
+/*
+ * @param d isoch packet descriptors of RET_SUBMIT in host byte order, they follow the data
+ */
+std::string make_ret_submit(
+        seqnum_t seqnum, INT32 status, INT32 actual_length, INT32 start_frame,
+        const std::string &data = {}, std::vector<usbip_iso_packet_descriptor> d = {}, bool isoch = false)
+{
+        usbip_header hdr{};
+
+        hdr.base.command = USBIP_RET_SUBMIT;
+        hdr.base.seqnum = seqnum;
+
+        auto &r = hdr.u.ret_submit;
+        r.status = status;
+        r.actual_length = actual_length;
+        r.start_frame = start_frame;
+        r.number_of_packets = isoch ? INT32(d.size()) : number_of_packets_non_isoch;
+
+        for (auto &i: d) {
+                r.error_count += i.status != 0;
+        }
+
+        byteswap_header(hdr, swap_dir::host2net);
+        byteswap(d.data(), d.size());
+
+        std::string s(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        s += data;
+        s.append(reinterpret_cast<const char*>(d.data()), d.size()*sizeof(d[0]));
+
+        return s;
+}
+
+/*
+ * Packets of IN transfer are compacted, @see isoc::get_unpack_error.
+ * @param d in host byte order
+ */
+std::string connection::isoch(const usbip_iso_packet_descriptor *d, INT32 cnt)
+{
+        auto &cmd = m_hdr.u.cmd_submit;
+        auto dir_in = m_hdr.base.direction == USBIP_DIR_IN;
+
+        auto frame = current_frame();
+        auto &next = m_next_frame[dir_in];
+
+        UINT32 start_frame = cmd.start_frame;
+        auto status = 0;
+
+        if (cmd.transfer_flags & URB_ISO_ASAP) {
+                start_frame = INT32(next - frame) > 0 ? next : frame + 1;
+        } else if (INT32(start_frame - frame) < 0) {
+                status = -EXDEV_LNX;
+        }
+
+        auto error = !status && inject_error();
+
+        std::vector<usbip_iso_packet_descriptor> out(cnt);
+        std::string data;
+        INT32 actual_length = 0;
+
+        for (INT32 i = 0; i < cnt; ++i) {
+                auto &o = out[i];
+                o = d[i];
+
+                if (status || error) {
+                        o.actual_length = 0;
+                        o.status = status ? status : -EPIPE_LNX;
+                        continue;
+                }
+
+                o.actual_length = dir_in && m_opts.in_size ? std::min(o.length, m_opts.in_size) : o.length;
+                o.status = 0;
+
+                if (dir_in) {
+                        data.append(o.actual_length, char(i));
+                }
+                actual_length += o.actual_length;
+        }
+
+        if (!status) {
+                next = start_frame + get_isoch_frames(cnt, ISOCH_INTERVAL, true);
+        }
+
+        m_stats.bytes_in += data.size();
+        return make_ret_submit(m_hdr.base.seqnum, status, actual_length, start_frame, data, std::move(out), true);
+}
+
+std::string connection::submit()
+{
+        auto &cmd = m_hdr.u.cmd_submit;
+        auto seqnum = m_hdr.base.seqnum;
+        auto dir_in = m_hdr.base.direction == USBIP_DIR_IN;
+
+        ++m_stats.urbs;
+
+        if (!dir_in) {
+                m_stats.bytes_out += cmd.transfer_buffer_length;
+        }
+
+        auto type = get_endpoint_type(m_hdr.base.ep);
+
+        if (auto cnt = cmd.number_of_packets; type == endpoint_type::isoch && cnt != number_of_packets_non_isoch) {
+                // the descriptors follow OUT data, m_payload is not contiguous with m_hdr
+                auto d = reinterpret_cast<usbip_iso_packet_descriptor*>(m_payload.data() + m_payload.size()) - cnt;
+                byteswap(d, cnt);
+
+                return isoch(d, cnt);
+        }
+
+        if (type != endpoint_type::control && inject_error()) {
+                return make_ret_submit(seqnum, -EPIPE_LNX, 0, 0);
+        }
+
+        if (!dir_in) { // the data is not sent back
+                return make_ret_submit(seqnum, 0, cmd.transfer_buffer_length, 0);
+        }
+
+        std::string data;
+
+        if (type == endpoint_type::control) {
+                if (!control_in(data, cmd.setup, cmd.transfer_buffer_length)) {
+                        return make_ret_submit(seqnum, -EPIPE_LNX, 0, 0);
+                }
+        } else {
+                auto len = uint32_t(cmd.transfer_buffer_length);
+                data.assign(m_opts.in_size ? std::min(len, m_opts.in_size) : len, '\0');
+        }
+
+        m_stats.bytes_in += data.size();
+        return make_ret_submit(seqnum, 0, INT32(data.size()), 0, data);
+}
+
+/*
+ * RET_SUBMIT is not sent for the unlinked URB, as Linux stub driver does.
+ */
+void connection::unlink()
+{
+        bool unlinked;
+        {
+                std::lock_guard lck(m_mtx);
+                unlinked = m_replies.erase(m_hdr.u.cmd_unlink.seqnum);
+        }
+
+        if (unlinked) {
+                ++m_stats.unlinks;
+        }
+
+        usbip_header hdr{};
+        hdr.base.command = USBIP_RET_UNLINK;
+        hdr.base.seqnum = m_hdr.base.seqnum;
+        hdr.u.ret_unlink.status = unlinked ? -ECONNRESET_LNX : 0;
+
+        byteswap_header(hdr, swap_dir::host2net);
+        send(std::string(reinterpret_cast<const char*>(&hdr), sizeof(hdr)));
+}
+
+bool connection::on_header(usbip_header &hdr, size_t &payload_size, bool &drain)
+{
+        m_hdr = hdr;
+        byteswap_header(m_hdr, swap_dir::net2host);
+
+        switch (m_hdr.base.command) {
+        case USBIP_CMD_SUBMIT:
+                if (auto &cmd = m_hdr.u.cmd_submit;
+                    !(uint32_t(cmd.transfer_buffer_length) <= MAX_TRANSFER_SIZE &&
+                      (cmd.number_of_packets == number_of_packets_non_isoch ||
+                       is_valid_number_of_packets(cmd.number_of_packets)))) {
+                        return false;
+                }
+                break;
+        case USBIP_CMD_UNLINK:
+                break;
+        default:
+                return false;
+        }
+
+        payload_size = get_payload_size(m_hdr);
+        drain = false;
+
+        m_payload.clear();
+        m_payload.reserve(payload_size);
+        return true;
+}
+
+bool connection::on_payload(size_t, const void *data, size_t len)
+{
+        m_payload.append(static_cast<const char*>(data), len);
+        return true;
+}
+
+bool connection::on_pdu()
+{
+        if (m_hdr.base.command == USBIP_CMD_UNLINK) {
+                unlink();
+        } else {
+                schedule(m_hdr.base.seqnum, submit());
+        }
+
+        return true;
+}
+
+void connection::run()
+{
+        std::thread thread(&connection::sender, this);
+
+        pdu_parser parser{};
+        std::vector<char> buf(64*1024);
+
+        while (true) {
+                auto n = recv(m_sock, buf.data(), buf.size(), 0);
+                if (n <= 0 || !parser.parse(buf.data(), size_t(n), *this)) {
+                        break;
+                }
+        }
+
+        {
+                std::lock_guard lck(m_mtx);
+                m_closed = true;
+                m_cv.notify_one();
+        }
+
+        thread.join();
+}
+
+auto send_op_common(int sock, uint16_t code, uint32_t status)
+{
+        op_common r{ .version = htons(USBIP_VERSION), .code = htons(code), .status = htonl(status) };
+        return send_all(sock, &r, sizeof(r));
+}
+
+auto make_busid(int i)
+{
+        return "1-" + std::to_string(i + 1);
+}
+
+} // namespace
+
+
+std::string usbip::mock::server::listen()
+{
+        m_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (m_sock < 0) {
+                return std::string("socket: ") + strerror(errno);
+        }
+
+        int on = 1;
+        setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(m_opts.port);
+
+        if (inet_pton(AF_INET, m_opts.address.c_str(), &addr.sin_addr) != 1) {
+                return "invalid IPv4 address " + m_opts.address;
+        }
+
+        if (bind(m_sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+                return std::string("bind: ") + strerror(errno);
+        }
+
+        if (::listen(m_sock, SOMAXCONN)) {
+                return std::string("listen: ") + strerror(errno);
+        }
+
+        socklen_t len = sizeof(addr);
+        if (getsockname(m_sock, reinterpret_cast<sockaddr*>(&addr), &len)) {
+                return std::string("getsockname: ") + strerror(errno);
+        }
+
+        m_port = ntohs(addr.sin_port);
+        return {};
+}
+
+void usbip::mock::server::run()
+{
+        while (!m_stopped) {
+                auto sock = accept(m_sock, nullptr, nullptr);
+                if (sock < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        break;
+                }
+
+                std::lock_guard lck(m_mtx);
+
+                if (m_stopped) {
+                        close(sock);
+                        break;
+                }
+
+                m_conns.push_back(sock);
+                m_threads.emplace_back(&server::serve, this, sock);
+        }
+
+        for (auto &t: m_threads) {
+                t.join();
+        }
+        m_threads.clear();
+}
+
+void usbip::mock::server::stop()
+{
+        std::lock_guard lck(m_mtx);
+
+        if (m_stopped.exchange(true)) {
+                return;
+        }
+
+        if (m_sock >= 0) {
+                shutdown(m_sock, SHUT_RDWR); // accept() fails
+        }
+
+        for (auto sock: m_conns) {
+                shutdown(sock, SHUT_RDWR);
+        }
+}
+
+usbip::mock::server::~server()
+{
+        stop();
+
+        for (auto &t: m_threads) { // run() was not called or has not returned yet
+                t.join();
+        }
+
+        if (m_sock >= 0) {
+                close(m_sock);
+        }
+}
+
+void usbip::mock::server::serve(int sock)
+{
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        auto idx = int(m_stats.connections++);
+        auto seed = m_opts.seed ? m_opts.seed + idx : std::random_device()();
+
+        op_common req{};
+
+        if (recv_all(sock, &req, sizeof(req))) {
+                switch (ntohs(req.code)) {
+                case OP_REQ_DEVLIST:
+                        if (op_devlist_request r{}; recv_all(sock, &r, sizeof(r)) && send_op_common(sock, OP_REP_DEVLIST, ST_OK)) {
+
+                                op_devlist_reply rep{ .ndev = htonl(uint32_t(m_opts.devices)) };
+                                std::string s(reinterpret_cast<const char*>(&rep), sizeof(rep));
+
+                                for (int i = 0; i < m_opts.devices; ++i) {
+                                        auto d = make_device(make_busid(i), uint32_t(i + 2));
+                                        s.append(reinterpret_cast<const char*>(&d), sizeof(d));
+
+                                        usbip_usb_interface intf{};
+                                        intf.bInterfaceClass = 0xFF;
+
+                                        for (int j = 0; j < d.bNumInterfaces; ++j) {
+                                                s.append(reinterpret_cast<const char*>(&intf), sizeof(intf));
+                                        }
+                                }
+
+                                send_all(sock, s.data(), s.size());
+                        }
+                        break;
+                case OP_REQ_IMPORT:
+                        if (op_import_request r{}; recv_all(sock, &r, sizeof(r))) {
+                                std::string busid(r.busid, strnlen(r.busid, sizeof(r.busid)));
+
+                                int i = 0;
+                                for ( ; i < m_opts.devices && make_busid(i) != busid; ++i);
+
+                                if (i == m_opts.devices) {
+                                        send_op_common(sock, OP_REP_IMPORT, ST_NODEV);
+                                } else if (send_op_common(sock, OP_REP_IMPORT, ST_OK)) {
+                                        auto d = make_device(busid, uint32_t(i + 2));
+                                        if (send_all(sock, &d, sizeof(d))) {
+                                                connection(sock, m_opts, m_stats, seed).run();
+                                        }
+                                }
+                        }
+                        break;
+                }
+        }
+
+        std::lock_guard lck(m_mtx);
+        m_conns.remove(sock);
+        close(sock);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace usbip::mock
+{
+
+struct options
+{
+        std::string address = "127.0.0.1";
+        uint16_t port = 3240; // zero means any free port, @see server::port
+
+        int devices = 1; // bus-id is 1-1, 1-2, ...
+
+        std::chrono::microseconds latency{}; // delay of every reply
+        std::chrono::microseconds jitter{}; // random extra delay, replies can be completed out of order
+
+        uint32_t in_size{}; // max actual_length of IN transfers and isoch packets, zero means as requested
+        double error_rate{}; // probability of -EPIPE for non-control transfers
+        unsigned int seed{}; // of the random delays and errors, zero means random
+};
+
+struct stats
+{
+        std::atomic<uint64_t> urbs;
+        std::atomic<uint64_t> unlinks; // CMD_UNLINK that canceled RET_SUBMIT
+        std::atomic<uint64_t> errors; // injected
+        std::atomic<uint64_t> bytes_in; // to a client
+        std::atomic<uint64_t> bytes_out; // from a client
+        std::atomic<uint64_t> connections;
+};
+
+/*
+ * USB/IP server with synthetic devices for loopback tests and benchmarks, it does not need hardware.
+ * It implements OP_REQ_DEVLIST and OP_REQ_IMPORT and answers CMD_SUBMIT and CMD_UNLINK.
+ * Endpoints: control 0, bulk 0x81/0x01, interrupt 0x82, isoch 0x83/0x03 (bInterval 1, high speed).
+ * PDUs are split by pdu_parser and decoded by codec.h, as the drivers do.
+ * Replies are sent by a separate thread of a connection when their delay expires, so they are
+ * completed out of order if the delays differ. Explicit start_frame of isoch CMD_SUBMIT must not
+ * be in the past, otherwise RET_SUBMIT has -EXDEV. ASAP transfers of an endpoint are scheduled back to back.
+ */
+class server
+{
+public:
+        explicit server(const options &opts) : m_opts(opts) {}
+        ~server();
+
+        server(const server&) = delete;
+        server& operator =(const server&) = delete;
+
+        /*
+         * @return empty string on success, otherwise the reason of the failure
+         */
+        std::string listen();
+
+        auto port() const { return m_port; } // valid after listen()
+        auto& get_stats() const { return m_stats; }
+
+        /*
+         * Accepts connections until stop() is called, each one is served by its own thread.
+         */
+        void run();
+
+        /*
+         * Can be called from any thread, closes the listening socket and all connections.
+         */
+        void stop();
+
+private:
+        options m_opts;
+        stats m_stats{};
+
+        int m_sock = -1;
+        uint16_t m_port{};
+        std::atomic<bool> m_stopped{};
+
+        std::mutex m_mtx; // for m_conns
+        std::list<int> m_conns; // sockets
+        std::list<std::thread> m_threads;
+
+        void serve(int sock);
+};
+
+} // namespace usbip::mock
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include <libusbip/src/usb_ids_table.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+/*
+ * Generates C++ source with the binary table of usb.ids at build time, @see libusbip/src/usb_ids_table.h.
+ * usb_ids_gen <usb.ids> <output.cpp>
+ */
+namespace
+{
+
+auto read(const char *path, std::string &content)
+{
+        std::ifstream f(path, std::ios::binary);
+        if (!f) {
+                return false;
+        }
+
+        std::ostringstream os;
+        os << f.rdbuf();
+        content = std::move(os).str();
+
+        return true;
+}
+
+auto write(const char *path, std::string_view table)
+{
+        auto f = fopen(path, "w");
+        if (!f) {
+                return false;
+        }
+
+        fprintf(f, "// generated by usb_ids_gen, do not edit\n\n"
+                   "#include <libusbip/src/usb_ids_table.h>\n\n"
+                   "alignas(usbip::usb_ids::record) const unsigned char usbip::usb_ids::table[] =\n{");
+
+        for (size_t i = 0; i < table.size(); ++i) {
+                fprintf(f, i % 32 ? "%u," : "\n%u,", static_cast<unsigned char>(table[i]));
+        }
+
+        fprintf(f, "\n};\n\nconst size_t usbip::usb_ids::table_size = sizeof(table);\n");
+
+        auto ok = !ferror(f);
+        return fclose(f) == 0 && ok;
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+        if (argc != 3) {
+                std::cerr << "Usage: " << argv[0] << " <usb.ids> <output.cpp>\n";
+                return EXIT_FAILURE;
+        }
+
+        std::string content;
+        if (!read(argv[1], content)) {
+                std::cerr << "Can't read " << argv[1] << '\n';
+                return EXIT_FAILURE;
+        }
+
+        auto table = usbip::usb_ids::make_table(content);
+        if (table.empty()) {
+                std::cerr << "Can't parse " << argv[1] << '\n';
+                return EXIT_FAILURE;
+        }
+
+        if (!write(argv[2], table)) {
+                std::cerr << "Can't write " << argv[2] << '\n';
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
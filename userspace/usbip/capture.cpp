@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+#include "pcapng.h"
+
+#include <libusbip\vhci.h>
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <spdlog\spdlog.h>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Reads all captured PDUs.
+ * @param w can be nullptr to discard PDUs
+ */
+auto drain(_In_ HANDLE dev, _In_ int port, _Inout_opt_ pcapng_writer *w, _Inout_ UINT64 &cnt, _Out_ UINT64 &lost)
+{
+        for (std::vector<captured_pdu> pdus; true; ) {
+                if (!vhci::read_capture(dev, port, pdus, lost)) {
+                        spdlog::error("port {}: {}", port, GetLastErrorMsg());
+                        return false;
+                } else if (pdus.empty()) {
+                        return true;
+                }
+
+                if (w) {
+                        for (auto &pdu: pdus) {
+                                w->write(pdu.time, pdu.out, pdu.length, pdu.data);
+                        }
+                        cnt += pdus.size();
+                }
+        }
+}
+
+} // namespace
+
+
+bool usbip::cmd_capture(void *p)
+{
+        auto &args = *reinterpret_cast<capture_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        std::ofstream f(args.file, std::ios::binary | std::ios::trunc);
+        if (!f) {
+                spdlog::error("can't create '{}'", args.file);
+                return false;
+        }
+
+        UINT64 cnt = 0;
+        UINT64 lost_before;
+
+        if (!drain(dev.get(), args.port, nullptr, cnt, lost_before)) { // records of a previous capture
+                return false;
+        }
+
+        if (!vhci::set_capture(dev.get(), args.port, true)) {
+                spdlog::error("port {}: {}", args.port, GetLastErrorMsg());
+                return false;
+        }
+
+        std::string buf;
+        pcapng_writer w(buf);
+
+        UINT64 lost = lost_before;
+        auto ok = true;
+
+        auto stop = std::chrono::steady_clock::now() + std::chrono::seconds(args.duration);
+
+        for (auto last = false; ok && !last; ) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+                last = std::chrono::steady_clock::now() >= stop;
+                if (last) {
+                        vhci::set_capture(dev.get(), args.port, false);
+                }
+
+                ok = drain(dev.get(), args.port, &w, cnt, lost);
+
+                f.write(buf.data(), buf.size());
+                buf.clear();
+
+                if (!f) {
+                        spdlog::error("can't write '{}'", args.file);
+                        ok = false;
+                }
+        }
+
+        if (!ok) {
+                vhci::set_capture(dev.get(), args.port, false); // the device can be detached
+        }
+
+        printf("%llu PDU(s) captured, %llu lost\n", cnt, lost > lost_before ? lost - lost_before : 0);
+        return ok;
+}
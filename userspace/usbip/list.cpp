@@ -7,14 +7,60 @@
 
 #include <libusbip\vhci.h>
 #include <libusbip\persistent.h>
+#include <libusbip\src\usb_ids.h>
 
 #include <spdlog\spdlog.h>
 
+#include <fstream>
+#include <string_view>
+#include <algorithm>
+
 namespace
 {
 
 using namespace usbip;
 
+/*
+ * usbip list --match TEXT
+ */
+struct
+{
+	std::string text; // lowercase
+	std::vector<std::pair<uint16_t, uint16_t>> ids; // see UsbIds::find_by_name
+	bool skip; // interfaces of the last device
+} filter;
+
+void set_filter(_In_ std::string_view text)
+{
+	filter.text = text;
+	for (auto &c: filter.text) {
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+
+	filter.ids = get_ids().find_by_name(text);
+}
+
+auto is_matched(_In_ const usb_device &d)
+{
+	auto &f = filter;
+	if (f.text.empty()) {
+		return true;
+	}
+
+	for (auto pid: {uint16_t(0), d.idProduct}) { // vendor's name or product's name
+		if (std::binary_search(f.ids.begin(), f.ids.end(), std::make_pair(d.idVendor, pid))) {
+			return true;
+		}
+	}
+
+	auto s = std::format("{:04x}:{:04x} {}", d.idVendor, d.idProduct, d.busid);
+	for (auto &c: s) {
+		c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+
+	return s.find(f.text) != s.npos;
+}
+
 void on_device_count(int count)
 {
 	if (count) {
@@ -25,6 +71,10 @@ void on_device_count(int count)
 
 void on_device(int, const usb_device &d)
 {
+	if (filter.skip = !is_matched(d); filter.skip) {
+		return;
+	}
+
 	auto &ids = get_ids();
 	auto prod = get_product(ids, d.idVendor, d.idProduct);
 	auto csp = get_class(ids, d.bDeviceClass, d.bDeviceSubClass, d.bDeviceProtocol);
@@ -46,6 +96,10 @@ void on_device(int, const usb_device &d)
 
 void on_interface(int, const usb_device &d, int idx, const usb_interface &r)
 {
+	if (filter.skip) {
+		return;
+	}
+
 	auto &ids = get_ids();
 	auto csp = get_class(ids, r.bInterfaceClass, r.bInterfaceSubClass, r.bInterfaceProtocol);
 
@@ -72,6 +126,106 @@ auto list_stashed_devices()
 	return success;
 }
 
+/*
+ * HOST, HOST:PORT, [IPv6]:PORT. IPv6 address without brackets is taken as is.
+ */
+auto make_host_address(_In_ std::string_view s)
+{
+	host_address r{ .service = global_args.tcp_port };
+
+	if (s.starts_with('[')) {
+		if (auto pos = s.find(']'); pos != s.npos) {
+			r.hostname = s.substr(1, pos - 1);
+			if (s.size() > pos + 1 && s[pos + 1] == ':') {
+				r.service = s.substr(pos + 2);
+			}
+			return r;
+		}
+	}
+
+	if (auto pos = s.find(':'); pos != s.npos && pos == s.rfind(':')) {
+		r.hostname = s.substr(0, pos);
+		r.service = s.substr(pos + 1);
+	} else {
+		r.hostname = s;
+	}
+
+	return r;
+}
+
+auto read_host_file(_Inout_ std::vector<host_address> &hosts, _In_ const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in) {
+		spdlog::error("can't open '{}'", path);
+		return false;
+	}
+
+	for (std::string line; std::getline(in, line); ) {
+		std::string_view s(line);
+
+		if (auto pos = s.find('#'); pos != s.npos) {
+			s = s.substr(0, pos);
+		}
+
+		auto first = s.find_first_not_of(" \t\r");
+		if (first == s.npos) {
+			continue;
+		}
+
+		s = s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+		hosts.push_back(make_host_address(s));
+	}
+
+	return true;
+}
+
+auto get_hosts(_Out_ std::vector<host_address> &hosts, _In_ const list_args &args)
+{
+	hosts.clear();
+
+	for (auto &s: args.remotes) {
+		hosts.push_back(make_host_address(s));
+	}
+
+	return args.host_file.empty() || read_host_file(hosts, args.host_file);
+}
+
+void on_host(int, const host_address &host, unsigned long error, const std::vector<exportable_device> &devices)
+{
+	if (error) {
+		spdlog::error("{}:{} {}", host.hostname, host.service, GetLastErrorMsg(error));
+		return;
+	}
+
+	auto title = std::format("{}:{}", host.hostname, host.service);
+	printf("%s\n%s\n", title.c_str(), std::string(title.size(), '=').c_str());
+
+	if (devices.empty()) {
+		printf("\n");
+	}
+
+	for (int i = 0; auto &d: devices) {
+		on_device(i, d.dev);
+
+		for (int j = 0; auto &intf: d.interfaces) {
+			on_interface(i, d.dev, j++, intf);
+		}
+
+		++i;
+	}
+}
+
+auto list_many(_In_ const std::vector<host_address> &hosts, _In_ unsigned int timeout)
+{
+	if (!enum_exportable_devices(hosts, on_host, timeout)) {
+		spdlog::error(GetLastErrorMsg());
+		return false;
+	}
+
+	return true;
+}
+
 } // namespace
 
 
@@ -82,13 +236,31 @@ bool usbip::cmd_list(void *p)
 		return list_stashed_devices();
 	}
 
-	auto sock = connect(args.remote.c_str(), global_args.tcp_port.c_str());
+	std::vector<host_address> hosts;
+	if (!get_hosts(hosts, args)) {
+		return false;
+	}
+
+	if (!args.match.empty()) {
+		set_filter(args.match);
+	}
+
+	if (hosts.empty()) {
+		spdlog::error("no remote is specified");
+		return false;
+	} else if (hosts.size() > 1) {
+		return list_many(hosts, args.timeout);
+	}
+
+	auto &[hostname, service] = hosts.front();
+
+	auto sock = connect(hostname.c_str(), service.c_str());
 	if (!sock) {
 		spdlog::error(GetLastErrorMsg());
 		return false;
 	}
 
-	spdlog::debug("connected to {}:{}", args.remote, global_args.tcp_port);
+	spdlog::debug("connected to {}:{}", hostname, service);
 
 	if (!enum_exportable_devices(sock.get(), on_device, on_interface, on_device_count)) {
 		spdlog::error(GetLastErrorMsg());
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "pcap_file.h"
+
+#include <fstream>
+#include <iterator>
+
+namespace
+{
+
+using namespace usbip;
+
+enum : uint32_t {
+        PCAP_MAGIC_US = 0xA1B2C3D4,
+        PCAP_MAGIC_NS = 0xA1B23C4D,
+        PCAPNG_SHB = 0x0A0D0D0A, // Section Header Block
+        PCAPNG_IDB = 1, // Interface Description Block
+        PCAPNG_SPB = 3, // Simple Packet Block
+        PCAPNG_EPB = 6, // Enhanced Packet Block
+        PCAPNG_BYTE_ORDER_MAGIC = 0x1A2B3C4D,
+};
+
+/*
+ * Reads integers of a file whose byte order can differ from the host's one.
+ */
+class reader
+{
+public:
+        reader(const std::string &buf) : m_buf(buf) {}
+
+        auto pos() const { return m_pos; }
+        auto remaining() const { return m_buf.size() - m_pos; }
+
+        void swap(bool v) { m_swap = v; }
+        void seek(size_t pos) { m_pos = pos; }
+
+        template<typename T>
+        bool get(T &val)
+        {
+                if (remaining() < sizeof(val)) {
+                        return false;
+                }
+
+                val = 0;
+                for (size_t i = 0; i < sizeof(val); ++i) {
+                        auto b = static_cast<T>(static_cast<uint8_t>(m_buf[m_pos + i]));
+                        val |= b << 8*(m_swap ? sizeof(val) - 1 - i : i); // file is little-endian if not swapped
+                }
+
+                m_pos += sizeof(val);
+                return true;
+        }
+
+        bool get(std::string &s, size_t len)
+        {
+                if (remaining() < len) {
+                        return false;
+                }
+
+                s.assign(m_buf, m_pos, len);
+                m_pos += len;
+                return true;
+        }
+
+private:
+        const std::string &m_buf;
+        size_t m_pos{};
+        bool m_swap{};
+};
+
+/*
+ * @param magic_le magic number read as little-endian
+ * @return true if the file is big-endian
+ */
+bool is_swapped(uint32_t magic_le, uint32_t expected)
+{
+        auto swapped = (magic_le >> 24) | (magic_le >> 8 & 0xFF00) | (magic_le << 8 & 0xFF0000) | (magic_le << 24);
+        return magic_le != expected && swapped == expected;
+}
+
+std::string read_pcap(reader &r, std::vector<packet> &packets)
+{
+        uint32_t magic{};
+        r.get(magic);
+
+        auto nano = magic == PCAP_MAGIC_NS || is_swapped(magic, PCAP_MAGIC_NS);
+        r.swap(is_swapped(magic, PCAP_MAGIC_US) || is_swapped(magic, PCAP_MAGIC_NS));
+
+        uint16_t major, minor;
+        uint32_t thiszone, sigfigs, snaplen, network;
+
+        if (!(r.get(major) && r.get(minor) && r.get(thiszone) && r.get(sigfigs) && r.get(snaplen) && r.get(network))) {
+                return "truncated pcap header";
+        }
+
+        while (r.remaining()) {
+                uint32_t sec, frac, caplen, len;
+                packet p{ .linktype = static_cast<uint16_t>(network) };
+
+                if (!(r.get(sec) && r.get(frac) && r.get(caplen) && r.get(len) && r.get(p.data, caplen))) {
+                        return "truncated pcap record";
+                }
+
+                p.time = sec*1'000'000ULL + (nano ? frac/1000 : frac);
+                p.length = len;
+
+                packets.push_back(std::move(p));
+        }
+
+        return {};
+}
+
+struct interface
+{
+        uint16_t linktype;
+        uint64_t units; // per second
+};
+
+/*
+ * if_tsresol: if the most significant bit is zero, the resolution is 10^-value, otherwise 2^-value.
+ */
+auto get_units(uint8_t tsresol)
+{
+        uint64_t units = 1;
+
+        if (tsresol & 0x80) {
+                units <<= tsresol & 0x7F;
+        } else for (int i = 0; i < tsresol; ++i) {
+                units *= 10;
+        }
+
+        return units;
+}
+
+bool read_idb(reader &r, size_t end, interface &iface)
+{
+        uint16_t reserved;
+        uint32_t snaplen;
+
+        if (!(r.get(iface.linktype) && r.get(reserved) && r.get(snaplen))) {
+                return false;
+        }
+
+        iface.units = 1'000'000;
+
+        while (r.pos() + 4 <= end) { // options
+                uint16_t code, len;
+                if (!(r.get(code) && r.get(len)) || !code) { // truncated or opt_endofopt
+                        break;
+                }
+
+                auto next = r.pos() + (len + 3)/4*4;
+
+                if (uint8_t tsresol; code == 9 && len == 1 && r.get(tsresol)) { // if_tsresol
+                        iface.units = get_units(tsresol);
+                }
+
+                r.seek(next);
+        }
+
+        return true;
+}
+
+auto to_microseconds(uint64_t ts, uint64_t units)
+{
+        return units == 1'000'000 ? ts : units > 1'000'000 ? ts/(units/1'000'000) : ts*(1'000'000/units);
+}
+
+std::string read_pcapng(reader &r, std::vector<packet> &packets)
+{
+        std::vector<interface> ifaces;
+
+        while (r.remaining()) {
+                auto start = r.pos();
+
+                uint32_t type, len;
+                if (!r.get(type)) {
+                        return "truncated pcapng block";
+                }
+
+                if (type == PCAPNG_SHB) {
+                        r.seek(start + 8);
+                        uint32_t magic;
+                        if (!r.get(magic)) {
+                                return "truncated section header";
+                        }
+
+                        r.swap(is_swapped(magic, PCAPNG_BYTE_ORDER_MAGIC));
+                        r.seek(start + 4);
+                        ifaces.clear(); // interfaces are numbered in a section
+                }
+
+                if (!(r.get(len) && len >= 12 && len % 4 == 0 && len <= r.remaining() + 8)) {
+                        return "invalid pcapng block length";
+                }
+
+                auto end = start + len - 4; // trailing block total length
+
+                switch (type) {
+                case PCAPNG_IDB:
+                        if (interface iface; read_idb(r, end, iface)) {
+                                ifaces.push_back(iface);
+                        } else {
+                                return "invalid interface description block";
+                        }
+                        break;
+                case PCAPNG_EPB:
+                        if (uint32_t id, hi, lo, caplen, orig; 
+                            r.get(id) && r.get(hi) && r.get(lo) && r.get(caplen) && r.get(orig) && id < ifaces.size()) {
+
+                                auto &iface = ifaces[id];
+                                packet p { 
+                                        .time = to_microseconds(uint64_t(hi) << 32 | lo, iface.units), 
+                                        .length = orig, 
+                                        .linktype = iface.linktype 
+                                };
+
+                                if (r.pos() + caplen > end || !r.get(p.data, caplen)) {
+                                        return "invalid enhanced packet block";
+                                }
+
+                                packets.push_back(std::move(p));
+                        } else {
+                                return "invalid enhanced packet block";
+                        }
+                        break;
+                case PCAPNG_SPB:
+                        if (uint32_t orig; r.get(orig) && !ifaces.empty()) {
+                                packet p{ .length = orig, .linktype = ifaces.front().linktype };
+                                
+                                auto caplen = end - r.pos();
+                                if (caplen > orig) {
+                                        caplen = orig; // padding
+                                }
+
+                                r.get(p.data, caplen);
+                                packets.push_back(std::move(p));
+                        } else {
+                                return "invalid simple packet block";
+                        }
+                        break;
+                }
+
+                r.seek(start + len);
+        }
+
+        return {};
+}
+
+} // namespace
+
+
+std::string usbip::read_pcap_file(const std::string &path, std::vector<packet> &packets)
+{
+        std::ifstream f(path, std::ios::binary);
+        if (!f) {
+                return "can't open file";
+        }
+
+        std::string buf(std::istreambuf_iterator<char>(f), {});
+        reader r(buf);
+
+        uint32_t magic{};
+        if (!r.get(magic)) {
+                return "file is too short";
+        }
+
+        r.seek(0);
+
+        if (magic == PCAPNG_SHB) {
+                return read_pcapng(r, packets);
+        }
+
+        for (auto m: {PCAP_MAGIC_US, PCAP_MAGIC_NS}) {
+                if (magic == m || is_swapped(magic, m)) {
+                        return read_pcap(r, packets);
+                }
+        }
+
+        return "unknown file format";
+}
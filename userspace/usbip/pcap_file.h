@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace usbip
+{
+
+struct packet
+{
+        uint64_t time{}; // microseconds since 1970-01-01 00:00:00 UTC, zero if unknown
+        uint32_t length{}; // original length, data can be truncated
+        uint16_t linktype{}; // LINKTYPE_*, see https://www.tcpdump.org/linktypes.html
+        std::string data{}; // starts with the link layer header
+};
+
+/*
+ * Reads all packets of pcap or pcapng file, it does not depend on Windows API.
+ * @return empty string on success, otherwise the reason of the failure
+ */
+std::string read_pcap_file(const std::string &path, std::vector<packet> &packets);
+
+} // namespace usbip
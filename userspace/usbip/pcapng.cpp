@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "pcapng.h"
+
+namespace
+{
+
+enum : uint32_t {
+        BT_SHB = 0x0A0D0D0A, // Section Header Block
+        BT_IDB = 1, // Interface Description Block
+        BT_EPB = 6, // Enhanced Packet Block
+        BYTE_ORDER_MAGIC = 0x1A2B3C4D,
+};
+
+enum : uint16_t { 
+        LINKTYPE_IPV4 = 228, // raw IPv4, the packet begins with IPv4 header
+        USBIP_PORT = 3240,
+        CLIENT_PORT = 49152,
+};
+
+enum : uint32_t { // TEST-NET-1, RFC 5737
+        CLIENT_ADDR = 0xC0000201, // 192.0.2.1
+        SERVER_ADDR = 0xC0000202, // 192.0.2.2
+};
+
+constexpr size_t IP_HDR_LEN = 20;
+constexpr size_t TCP_HDR_LEN = 20;
+
+/*
+ * pcapng blocks are in host byte order, it is recorded by the byte-order magic.
+ */
+template<typename T>
+void put(std::string &s, T val)
+{
+        s.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+/*
+ * Network headers are in big-endian byte order.
+ */
+template<typename T>
+void put_be(std::string &s, T val)
+{
+        for (auto i = sizeof(val); i; --i) {
+                s.push_back(static_cast<char>(val >> 8*(i - 1)));
+        }
+}
+
+void pad32(std::string &s)
+{
+        s.append((4 - s.size() % 4) % 4, '\0');
+}
+
+auto checksum(std::string_view data)
+{
+        uint32_t sum = 0;
+
+        for (size_t i = 0; i + 1 < data.size(); i += 2) {
+                sum += uint8_t(data[i]) << 8 | uint8_t(data[i + 1]);
+        }
+
+        while (sum >> 16) {
+                sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+
+        return static_cast<uint16_t>(~sum);
+}
+
+/*
+ * @param length of the payload, it can be greater than the captured data
+ */
+void put_ip_tcp(std::string &s, bool out, uint32_t length, uint32_t seq, uint32_t ack)
+{
+        auto ip = s.size();
+
+        auto total = IP_HDR_LEN + TCP_HDR_LEN + length;
+        if (total > UINT16_MAX) {
+                total = UINT16_MAX;
+        }
+
+        put<uint8_t>(s, 0x45); // version 4, header length 5*4
+        put<uint8_t>(s, 0); // DSCP, ECN
+        put_be<uint16_t>(s, static_cast<uint16_t>(total));
+        put_be<uint16_t>(s, 0); // identification
+        put_be<uint16_t>(s, 0x4000); // don't fragment
+        put<uint8_t>(s, 64); // TTL
+        put<uint8_t>(s, 6); // TCP
+        put_be<uint16_t>(s, 0); // checksum
+        put_be<uint32_t>(s, out ? CLIENT_ADDR : SERVER_ADDR);
+        put_be<uint32_t>(s, out ? SERVER_ADDR : CLIENT_ADDR);
+
+        auto sum = checksum(std::string_view(s).substr(ip, IP_HDR_LEN));
+        s[ip + 10] = static_cast<char>(sum >> 8);
+        s[ip + 11] = static_cast<char>(sum);
+
+        put_be<uint16_t>(s, out ? CLIENT_PORT : USBIP_PORT);
+        put_be<uint16_t>(s, out ? USBIP_PORT : CLIENT_PORT);
+        put_be<uint32_t>(s, seq);
+        put_be<uint32_t>(s, ack);
+        put<uint8_t>(s, TCP_HDR_LEN/4 << 4); // data offset
+        put<uint8_t>(s, 0x18); // PSH, ACK
+        put_be<uint16_t>(s, UINT16_MAX); // window
+        put_be<uint16_t>(s, 0); // checksum is not calculated, Wireshark does not verify it by default
+        put_be<uint16_t>(s, 0); // urgent pointer
+}
+
+} // namespace
+
+
+usbip::pcapng_writer::pcapng_writer(std::string &out) : m_out(out)
+{
+        write_header();
+}
+
+void usbip::pcapng_writer::write_header()
+{
+        auto &s = m_out;
+
+        put<uint32_t>(s, BT_SHB);
+        put<uint32_t>(s, 28); // block total length
+        put<uint32_t>(s, BYTE_ORDER_MAGIC);
+        put<uint16_t>(s, 1); // major version
+        put<uint16_t>(s, 0); // minor version
+        put<int64_t>(s, -1); // section length is not specified
+        put<uint32_t>(s, 28);
+
+        put<uint32_t>(s, BT_IDB);
+        put<uint32_t>(s, 20);
+        put<uint16_t>(s, LINKTYPE_IPV4);
+        put<uint16_t>(s, 0); // reserved
+        put<uint32_t>(s, 0); // snaplen, no limit
+        put<uint32_t>(s, 20); // if_tsresol is absent, timestamps are in microseconds
+}
+
+void usbip::pcapng_writer::write(uint64_t time, bool out, uint32_t length, std::string_view data)
+{
+        auto &s = m_out;
+        auto start = s.size();
+
+        auto &seq = m_seq[out];
+        auto ack = m_seq[!out];
+
+        constexpr auto hdr_len = uint32_t(IP_HDR_LEN + TCP_HDR_LEN);
+        auto captured = hdr_len + static_cast<uint32_t>(data.size());
+
+        put<uint32_t>(s, BT_EPB);
+        put<uint32_t>(s, 0); // block total length, see below
+        put<uint32_t>(s, 0); // interface id
+        put<uint32_t>(s, static_cast<uint32_t>(time >> 32));
+        put<uint32_t>(s, static_cast<uint32_t>(time));
+        put<uint32_t>(s, captured);
+        put<uint32_t>(s, hdr_len + length); // original packet length
+
+        put_ip_tcp(s, out, length, seq, ack);
+        s.append(data);
+        pad32(s);
+
+        auto total = static_cast<uint32_t>(s.size() - start + sizeof(uint32_t));
+        put<uint32_t>(s, total);
+        s.replace(start + sizeof(uint32_t), sizeof(total), reinterpret_cast<const char*>(&total), sizeof(total));
+
+        seq += length;
+}
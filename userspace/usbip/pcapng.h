@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace usbip
+{
+
+/*
+ * Writes captured PDUs in pcapng format, it does not depend on Windows API.
+ * Each PDU is wrapped into synthetic IPv4 and TCP headers with the port of USB/IP server,
+ * this way Wireshark dissects them with its USB/IP dissector.
+ * See: https://www.ietf.org/archive/id/draft-tuexen-opsawg-pcapng-05.html
+ */
+class pcapng_writer
+{
+public:
+        /*
+         * @param out blocks are appended to it, section header is written first
+         */
+        explicit pcapng_writer(std::string &out);
+
+        /*
+         * @param time microseconds since 1970-01-01 00:00:00 UTC
+         * @param out direction, to a server
+         * @param length of PDU, data can be truncated
+         * @param data usbip_header and the beginning of the payload
+         */
+        void write(uint64_t time, bool out, uint32_t length, std::string_view data);
+
+private:
+        std::string &m_out;
+        uint32_t m_seq[2]{}; // TCP sequence numbers of both directions
+
+        void write_header();
+};
+
+} // namespace usbip
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+#include "session.h"
+
+#include <chrono>
+#include <format>
+#include <spdlog\spdlog.h>
+
+namespace
+{
+
+using namespace usbip;
+using steady_clock = std::chrono::steady_clock;
+
+/*
+ * @param repeat the parsing to get stable results for small files
+ * @return seconds spent to parse once
+ */
+auto analyze(_Out_ replay::report &r, _In_ const std::vector<packet> &packets, _In_ uint16_t server_port,
+             _In_ unsigned int repeat)
+{
+        auto start = steady_clock::now();
+
+        for (unsigned int i = 0; i < repeat; ++i) {
+                r = replay::analyze(packets, server_port);
+        }
+
+        std::chrono::duration<double> elapsed = steady_clock::now() - start;
+        return elapsed.count()/repeat;
+}
+
+void print_report(_In_ const std::string &path, _In_ const replay::report &r, _In_ double sec)
+{
+        auto pdus = r.cmd_submit + r.ret_submit + r.cmd_unlink + r.ret_unlink;
+        auto rate = [sec] (auto v) { return sec > 0 ? v/sec : 0.0; };
+
+        constexpr auto &fmt = R"({}: packets {}, connections {}, stream bytes {}
+        CMD_SUBMIT {}, RET_SUBMIT {}, CMD_UNLINK {}, RET_UNLINK {}
+        errors: invalid headers {}, unmatched RET_SUBMIT {}, isoch packets {}
+        capture: gaps {}, truncated isoch PDUs {}, unanswered CMD_SUBMIT {}
+        parsed in {:.3f} ms, {:.1f} MiB/s, {:.0f} PDU/s
+)";
+        auto msg = std::format(fmt, path, r.packets, r.flows, r.stream_bytes,
+                               r.cmd_submit, r.ret_submit, r.cmd_unlink, r.ret_unlink,
+                               r.invalid_headers, r.unmatched, r.isoc_errors,
+                               r.gaps, r.truncated, r.unanswered,
+                               sec*1000, rate(double(r.stream_bytes))/(1024*1024), rate(double(pdus)));
+
+        if (!r.endpoints.empty()) {
+                msg += std::format("        {:>4} {:>8} {:>4} {:>3} {:>10} {:>8} {:>8} {:>12} {:>10} "
+                                   "{:>10} {:>10} {:>10} {:>10} {:>12} {:>7}\n",
+                                   "conn", "devid", "ep", "dir", "URBs", "errors", "unlinks", "bytes", "KiB/s",
+                                   "p50, us", "p90, us", "p99, us", "max, us", "jitter, us", "resyncs");
+        }
+
+        for (auto &e: r.endpoints) {
+                auto usec = e.last > e.first ? e.last - e.first : 0;
+                auto kib = usec ? e.bytes*1'000'000.0/usec/1024 : 0.0;
+
+                auto isoc = e.isoc_urbs > 0; // frame clock of non-isoch endpoints is not used
+                auto jitter = isoc ? std::to_string(e.frames.jitter_us()) : "-";
+                auto resyncs = isoc ? std::to_string(e.frames.resyncs()) : "-";
+
+                msg += std::format("        {:4} {:#08x} {:4} {:>3} {:10} {:8} {:8} {:12} {:10.1f} "
+                                   "{:10} {:10} {:10} {:10} {:>12} {:>7}\n",
+                                   e.flow, e.devid, e.ep, e.dir_in ? "in" : "out", e.urbs, e.errors, e.unlinks,
+                                   e.bytes, kib,
+                                   get_percentile(e.rtt, 50), get_percentile(e.rtt, 90), get_percentile(e.rtt, 99),
+                                   get_percentile(e.rtt, 100), jitter, resyncs);
+        }
+
+        printf("%s", msg.c_str());
+}
+
+} // namespace
+
+
+/*
+ * Protocol errors make the command fail, so a directory of captures can be used as a regression corpus.
+ */
+bool usbip::cmd_replay(void *p)
+{
+        auto &args = *reinterpret_cast<replay_args*>(p);
+
+        auto server_port = static_cast<uint16_t>(std::stoul(global_args.tcp_port));
+        auto success = true;
+
+        for (auto &path: args.files) {
+                std::vector<packet> packets;
+                if (auto err = read_pcap_file(path, packets); !err.empty()) {
+                        spdlog::error("{}: {}", path, err);
+                        success = false;
+                        continue;
+                }
+
+                replay::report r;
+                auto sec = analyze(r, packets, server_port, args.repeat);
+
+                print_report(path, r, sec);
+
+                if (r.errors()) {
+                        success = false;
+                }
+        }
+
+        return success;
+}
@@ -0,0 +1,719 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "session.h"
+
+#include <usbip/isoc.h>
+#include <usbip/pdu_parser.h>
+#include <usbip/proto_op.h>
+
+#include <map>
+#include <memory>
+#include <tuple>
+#include <string_view>
+#include <cstring>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::replay;
+
+enum : uint16_t {
+        LINKTYPE_NULL = 0,
+        LINKTYPE_ETHERNET = 1,
+        LINKTYPE_RAW = 101,
+        LINKTYPE_LINUX_SLL = 113,
+        LINKTYPE_IPV4 = 228,
+        LINKTYPE_IPV6 = 229,
+        LINKTYPE_LINUX_SLL2 = 276,
+};
+
+enum : uint8_t { TCP_FIN = 1, TCP_SYN = 2, TCP_RST = 4 };
+
+auto get_be16(std::string_view s, size_t off)
+{
+        return static_cast<uint16_t>(uint8_t(s[off]) << 8 | uint8_t(s[off + 1]));
+}
+
+auto get_be32(std::string_view s, size_t off)
+{
+        return uint32_t(get_be16(s, off)) << 16 | get_be16(s, off + 2);
+}
+
+struct segment
+{
+        std::string_view src{}; // IP address
+        std::string_view dst{};
+        uint16_t src_port{};
+        uint16_t dst_port{};
+
+        uint32_t seq{};
+        uint8_t flags{};
+
+        std::string_view payload{}; // captured part
+        uint32_t length{}; // of TCP payload, can be greater than payload.size()
+};
+
+/*
+ * @return IP packet or empty view
+ */
+auto get_ip(const packet &p)
+{
+        std::string_view s = p.data;
+        size_t hdr_len = 0;
+
+        switch (p.linktype) {
+        case LINKTYPE_NULL:
+                hdr_len = 4;
+                break;
+        case LINKTYPE_ETHERNET:
+                for (hdr_len = 14; s.size() >= hdr_len; hdr_len += 4) {
+                        if (auto type = get_be16(s, hdr_len - 2); type != 0x8100 && type != 0x88A8) { // VLAN tags
+                                break;
+                        }
+                }
+                break;
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+                break;
+        case LINKTYPE_LINUX_SLL:
+                hdr_len = 16;
+                break;
+        case LINKTYPE_LINUX_SLL2:
+                hdr_len = 20;
+                break;
+        default:
+                return std::string_view();
+        }
+
+        return s.size() > hdr_len ? s.substr(hdr_len) : std::string_view();
+}
+
+bool decode(const packet &p, segment &seg)
+{
+        auto ip = get_ip(p);
+        if (ip.empty()) {
+                return false;
+        }
+
+        std::string_view tcp;
+        size_t ip_payload = 0;
+
+        switch (uint8_t(ip[0]) >> 4) {
+        case 4:
+                if (size_t ihl = (ip[0] & 0xF)*4; ip.size() < 20 || ip.size() < ihl || ip[9] != 6) { // TCP
+                        return false;
+                } else if (get_be16(ip, 6) & 0x3FFF) { // fragment
+                        return false;
+                } else {
+                        seg.src = ip.substr(12, 4);
+                        seg.dst = ip.substr(16, 4);
+                        tcp = ip.substr(ihl);
+
+                        auto total = get_be16(ip, 2); // zero for TCP segmentation offload
+                        ip_payload = total >= ihl ? total - ihl : tcp.size();
+                }
+                break;
+        case 6:
+                if (ip.size() < 40 || ip[6] != 6) { // extension headers are not supported
+                        return false;
+                }
+                seg.src = ip.substr(8, 16);
+                seg.dst = ip.substr(24, 16);
+                tcp = ip.substr(40);
+                ip_payload = get_be16(ip, 4);
+                break;
+        default:
+                return false;
+        }
+
+        size_t doff = tcp.size() >= 20 ? (uint8_t(tcp[12]) >> 4)*4 : 0;
+        if (!doff || tcp.size() < doff || ip_payload < doff) {
+                return false;
+        }
+
+        seg.src_port = get_be16(tcp, 0);
+        seg.dst_port = get_be16(tcp, 2);
+        seg.seq = get_be32(tcp, 4);
+        seg.flags = uint8_t(tcp[13]);
+
+        seg.length = static_cast<uint32_t>(ip_payload - doff);
+        seg.payload = tcp.substr(doff, seg.length); // without Ethernet padding
+
+        return true;
+}
+
+/*
+ * @param payload isoch descriptors are at the end, they can be unaligned
+ * @return host byte order
+ */
+auto read_isoc_descr(std::string_view payload, size_t cnt, size_t i)
+{
+        usbip_iso_packet_descriptor d;
+        memcpy(&d, payload.data() + payload.size() - (cnt - i)*sizeof(d), sizeof(d));
+        return isoc::to_host(d);
+}
+
+struct submit
+{
+        uint64_t time;
+        endpoint_report *endp;
+        usbip_header_cmd_submit cmd;
+        std::vector<uint32_t> offsets; // of isoch packets
+};
+
+using endpoint_key = std::tuple<uint32_t, uint32_t, uint32_t, bool>; // flow, devid, ep, dir_in
+
+struct flow
+{
+        uint32_t index{};
+        std::map<seqnum_t, submit> submits{}; // key is seqnum of CMD_SUBMIT
+        std::map<seqnum_t, seqnum_t> unlinks{}; // seqnum of CMD_UNLINK -> seqnum of unlinked CMD_SUBMIT
+};
+
+class session;
+
+/*
+ * One direction of TCP connection.
+ */
+class stream
+{
+public:
+        stream(session &s, flow &f, bool to_server) : m_session(s), m_flow(f), m_to_server(to_server) {}
+
+        void add(const segment &seg, uint64_t time);
+        void finish();
+
+        bool on_header(const usbip_header &hdr, size_t &payload_size, bool &drain);
+        bool on_payload(size_t offset, const void *data, size_t len);
+        bool on_pdu();
+
+private:
+        struct pending
+        {
+                uint64_t time;
+                uint32_t seq;
+                uint32_t length;
+                std::string payload;
+        };
+
+        enum { MAX_PENDING = 1024 };
+
+        session &m_session;
+        flow &m_flow;
+        bool m_to_server;
+
+        bool m_started{};
+        bool m_broken{};
+        bool m_skip_op{}; // stream starts from SYN, OP_REQ_IMPORT/OP_REP_IMPORT can precede URBs
+        bool m_aligned{}; // the stream starts from SYN or a valid header was found
+        uint32_t m_next{}; // expected sequence number
+        std::vector<pending> m_pending; // out of order
+
+        uint64_t m_time{}; // of the current segment
+        size_t m_op_remaining{}; // bytes of OP_* to skip
+        std::string m_op; // op_common
+
+        pdu_parser m_parser{}; // zeroed memory is its initial state
+        usbip_header m_hdr{}; // host byte order
+        uint64_t m_hdr_time{};
+        std::string m_payload; // of isoch PDU
+
+        void deliver(std::string_view data, uint32_t length, uint64_t time);
+        void feed(std::string_view data);
+        size_t skip_op(std::string_view data);
+        void gap(size_t len);
+
+        void cmd_submit(const usbip_header &hdr, bool complete);
+        void ret_submit(const usbip_header &hdr, bool complete);
+        void ret_unlink(const usbip_header &hdr);
+
+        auto& rep();
+};
+
+class session
+{
+public:
+        session(const std::vector<packet> &packets, uint16_t server_port) :
+                m_packets(packets), m_server_port(server_port) {}
+
+        report run();
+
+        report& rep() { return m_report; }
+        endpoint_report& get_endpoint(const endpoint_key &key);
+
+private:
+        using flow_key = std::tuple<std::string_view, std::string_view, uint16_t>; // client, server, client port
+
+        struct connection
+        {
+                flow f;
+                stream to_server;
+                stream to_client;
+
+                connection(session &s, uint32_t index) :
+                        f{ .index = index }, to_server(s, f, true), to_client(s, f, false) {}
+        };
+
+        const std::vector<packet> &m_packets;
+        uint16_t m_server_port;
+
+        report m_report{};
+        std::map<flow_key, std::unique_ptr<connection>> m_connections;
+        std::map<endpoint_key, endpoint_report> m_endpoints;
+};
+
+inline auto& stream::rep()
+{
+        return m_session.rep();
+}
+
+endpoint_report& session::get_endpoint(const endpoint_key &key)
+{
+        auto [i, inserted] = m_endpoints.try_emplace(key);
+        auto &e = i->second;
+
+        if (inserted) {
+                std::tie(e.flow, e.devid, e.ep, e.dir_in) = key;
+                e.frames.init(1'000'000); // timestamps are in microseconds
+        }
+
+        return e;
+}
+
+report session::run()
+{
+        m_report.packets = m_packets.size();
+
+        for (auto &p: m_packets) {
+                segment seg;
+                if (!decode(p, seg)) {
+                        continue;
+                }
+
+                auto to_server = seg.dst_port == m_server_port;
+                if (!(to_server || seg.src_port == m_server_port)) {
+                        continue;
+                }
+
+                flow_key key = to_server ? flow_key(seg.src, seg.dst, seg.src_port) : flow_key(seg.dst, seg.src, seg.dst_port);
+
+                auto &conn = m_connections[key];
+                if (!conn) {
+                        conn = std::make_unique<connection>(*this, static_cast<uint32_t>(m_connections.size()));
+                }
+
+                (to_server ? conn->to_server : conn->to_client).add(seg, p.time);
+        }
+
+        for (auto &[key, conn]: m_connections) {
+                conn->to_server.finish();
+                conn->to_client.finish();
+                m_report.unanswered += conn->f.submits.size();
+        }
+
+        m_report.flows = m_connections.size();
+
+        m_report.endpoints.reserve(m_endpoints.size());
+        for (auto &[key, e]: m_endpoints) {
+                m_report.endpoints.push_back(e);
+        }
+
+        return m_report;
+}
+
+void stream::add(const segment &seg, uint64_t time)
+{
+        if (seg.flags & TCP_SYN) {
+                m_started = true;
+                m_skip_op = true;
+                m_aligned = true;
+                m_next = seg.seq + 1;
+                return;
+        }
+
+        if (!m_started) { // the capture was started in the middle of the session
+                m_started = true;
+                m_next = seg.seq;
+        }
+
+        if (!seg.length) {
+                return;
+        }
+
+        auto delta = static_cast<int32_t>(seg.seq - m_next);
+
+        if (delta > 0) { // out of order
+                if (m_pending.size() == MAX_PENDING) {
+                        gap(static_cast<uint32_t>(delta)); // lost segment
+                        m_next = seg.seq;
+                } else {
+                        m_pending.push_back({ .time = time, .seq = seg.seq, .length = seg.length,
+                                              .payload = std::string(seg.payload) });
+                        return;
+                }
+        }
+
+        auto data = seg.payload;
+        auto length = seg.length;
+
+        if (delta < 0) { // retransmission
+                auto dup = static_cast<uint32_t>(-delta);
+                if (dup >= length) {
+                        return;
+                }
+
+                data.remove_prefix(dup < data.size() ? dup : data.size());
+                length -= dup;
+        }
+
+        deliver(data, length, time);
+
+        for (auto found = true; found && !m_pending.empty(); ) {
+                found = false;
+
+                for (auto i = m_pending.begin(); i != m_pending.end(); ++i) {
+                        if (static_cast<int32_t>(i->seq - m_next) > 0) {
+                                continue;
+                        }
+
+                        auto p = std::move(*i);
+                        m_pending.erase(i);
+
+                        segment s{ .seq = p.seq, .payload = p.payload, .length = p.length };
+                        add(s, p.time);
+
+                        found = true;
+                        break;
+                }
+        }
+}
+
+void stream::deliver(std::string_view data, uint32_t length, uint64_t time)
+{
+        m_next += length;
+        rep().stream_bytes += length;
+
+        m_time = time;
+        feed(data);
+
+        if (length > data.size()) { // truncated by snaplen
+                gap(length - data.size());
+        }
+}
+
+void stream::finish()
+{
+        if (!m_pending.empty()) {
+                ++rep().gaps;
+                m_pending.clear();
+        }
+}
+
+/*
+ * @return number of consumed bytes
+ */
+size_t stream::skip_op(std::string_view data)
+{
+        size_t cnt = 0;
+
+        if (!m_op_remaining) {
+                cnt = sizeof(op_common) - m_op.size();
+                if (cnt > data.size()) {
+                        cnt = data.size();
+                }
+
+                m_op.append(data.substr(0, cnt));
+                if (m_op.size() < sizeof(op_common)) {
+                        return cnt;
+                }
+
+                m_skip_op = false; // only one OP_* precedes URBs
+
+                if (get_be16(m_op, 0) != USBIP_VERSION) { // URBs without OP_REQ_IMPORT
+                        feed(m_op);
+                        return cnt;
+                }
+
+                switch (get_be16(m_op, 2)) {
+                case OP_REQ_IMPORT:
+                        m_op_remaining = sizeof(op_import_request);
+                        break;
+                case OP_REP_IMPORT:
+                        m_op_remaining = get_be32(m_op, 4) == ST_OK ? sizeof(op_import_reply) : 0;
+                        break;
+                default: // OP_REQ_DEVLIST, OP_REP_DEVLIST, the connection does not transfer URBs
+                        m_broken = true;
+                        return data.size();
+                }
+
+                data.remove_prefix(cnt);
+        }
+
+        auto n = m_op_remaining < data.size() ? m_op_remaining : data.size();
+        m_op_remaining -= n;
+
+        return cnt + n;
+}
+
+void stream::feed(std::string_view data)
+{
+        if (m_broken) {
+                return;
+        }
+
+        if (m_skip_op || m_op_remaining) {
+                auto cnt = skip_op(data);
+                data.remove_prefix(cnt);
+        }
+
+        if (!m_broken && !data.empty() && !m_parser.parse(data.data(), data.size(), *this)) {
+                m_broken = true;
+        }
+}
+
+/*
+ * Missing bytes can be skipped inside of a payload only.
+ */
+void stream::gap(size_t len)
+{
+        if (m_broken) {
+                return;
+        }
+
+        ++rep().gaps;
+
+        if (m_skip_op || m_op_remaining) {
+                m_broken = true;
+                return;
+        }
+
+        while (len) {
+                if (m_parser.state() == pdu_parser::HEADER) {
+                        m_broken = true;
+                        return;
+                }
+
+                auto n = m_parser.remaining() < len ? m_parser.remaining() : len;
+                if (!m_parser.skip(n, *this)) {
+                        m_broken = true;
+                        return;
+                }
+
+                len -= n;
+        }
+}
+
+/*
+ * Non-isoch PDUs are handled here and their payload is drained.
+ */
+bool stream::on_header(const usbip_header &hdr, size_t &payload_size, bool &drain)
+{
+        m_hdr = hdr;
+        m_hdr_time = m_time;
+        m_payload.clear();
+
+        byteswap_header(m_hdr, swap_dir::net2host);
+        auto &base = m_hdr.base;
+
+        auto ok = false;
+
+        if (!m_to_server) {
+                ok = validate_ret_header(m_hdr) == header_error::none;
+        } else switch (base.command) {
+        case USBIP_CMD_SUBMIT:
+                if (auto &cnt = m_hdr.u.cmd_submit.number_of_packets; cnt == number_of_packets_non_isoch) {
+                        cnt = 0;
+                        ok = true;
+                } else {
+                        ok = is_valid_number_of_packets(cnt);
+                }
+                ok = ok && is_valid_seqnum(base.seqnum) && extract_dir(base.seqnum) == base.direction;
+                break;
+        case USBIP_CMD_UNLINK:
+                ok = is_valid_seqnum(base.seqnum);
+                break;
+        }
+
+        if (!ok) {
+                ++(m_aligned ? rep().invalid_headers : rep().gaps); // first segment can start in the middle of PDU
+                return false;
+        }
+
+        m_aligned = true;
+
+        payload_size = get_payload_size(m_hdr);
+
+        usbip_iso_packet_descriptor *isoc{};
+        drain = !get_isoc_descr(isoc, m_hdr);
+
+        if (!drain) {
+                return true;
+        }
+
+        switch (base.command) {
+        case USBIP_CMD_SUBMIT:
+                cmd_submit(m_hdr, true);
+                break;
+        case USBIP_RET_SUBMIT:
+                ret_submit(m_hdr, true);
+                break;
+        case USBIP_CMD_UNLINK:
+                ++rep().cmd_unlink;
+                m_flow.unlinks[base.seqnum] = m_hdr.u.cmd_unlink.seqnum;
+                if (auto i = m_flow.submits.find(m_hdr.u.cmd_unlink.seqnum); i != m_flow.submits.end()) {
+                        ++i->second.endp->unlinks;
+                }
+                break;
+        case USBIP_RET_UNLINK:
+                ret_unlink(m_hdr);
+                break;
+        }
+
+        return true;
+}
+
+bool stream::on_payload(size_t, const void *data, size_t len)
+{
+        m_payload.append(static_cast<const char*>(data), len);
+        return true;
+}
+
+/*
+ * Isoch PDU, its payload can be incomplete if a part of it was not captured.
+ */
+bool stream::on_pdu()
+{
+        auto complete = m_payload.size() == get_payload_size(m_hdr);
+        if (!complete) {
+                ++rep().truncated;
+        }
+
+        if (m_hdr.base.command == USBIP_CMD_SUBMIT) {
+                cmd_submit(m_hdr, complete);
+        } else {
+                ret_submit(m_hdr, complete);
+        }
+
+        return true;
+}
+
+/*
+ * @param complete the payload of isoch PDU is complete
+ */
+void stream::cmd_submit(const usbip_header &hdr, bool complete)
+{
+        ++rep().cmd_submit;
+
+        auto &base = hdr.base;
+        auto dir_in = base.direction == USBIP_DIR_IN;
+
+        auto &s = m_flow.submits[base.seqnum];
+        s.time = m_hdr_time;
+        s.endp = &m_session.get_endpoint({ m_flow.index, base.devid, base.ep, dir_in });
+        s.cmd = hdr.u.cmd_submit;
+        s.offsets.clear();
+
+        if (!s.endp->first) {
+                s.endp->first = m_hdr_time;
+        }
+
+        if (usbip_iso_packet_descriptor *isoc{}; complete && get_isoc_descr(isoc, const_cast<usbip_header&>(hdr))) {
+                auto cnt = static_cast<size_t>(s.cmd.number_of_packets);
+
+                s.offsets.reserve(cnt);
+                for (size_t i = 0; i < cnt; ++i) {
+                        s.offsets.push_back(read_isoc_descr(m_payload, cnt, i).offset);
+                }
+        }
+}
+
+/*
+ * Mirrors fill_isoc_data of the drivers for IN transfers.
+ */
+bool check_isoc(const submit &s, const usbip_header_ret_submit &ret, std::string_view payload)
+{
+        auto cnt = static_cast<UINT32>(ret.number_of_packets);
+        if (cnt != s.offsets.size()) {
+                return false;
+        }
+
+        auto length = static_cast<UINT32>(ret.actual_length);
+        auto buf_len = static_cast<UINT32>(s.cmd.transfer_buffer_length);
+
+        for (auto i = int64_t(cnt) - 1; i >= 0; --i) {
+                auto sd = read_isoc_descr(payload, cnt, i);
+                if (sd.actual_length && isoc::get_unpack_error(sd, s.offsets[i], length, buf_len) != isoc::unpack_error::none) {
+                        return false;
+                }
+        }
+
+        return !length;
+}
+
+void stream::ret_submit(const usbip_header &hdr, bool complete)
+{
+        ++rep().ret_submit;
+
+        auto i = m_flow.submits.find(hdr.base.seqnum);
+        if (i == m_flow.submits.end()) {
+                ++rep().unmatched;
+                return;
+        }
+
+        auto &s = i->second;
+        auto &e = *s.endp;
+        auto &ret = hdr.u.ret_submit;
+
+        ++e.urbs;
+        e.errors += !!ret.status;
+        e.bytes += ret.actual_length > 0 ? ret.actual_length : 0;
+        e.last = m_hdr_time;
+
+        record(e.rtt, m_hdr_time > s.time ? m_hdr_time - s.time : 0);
+
+        if (ret.number_of_packets > 0 && !ret.status) { // bInterval is unknown, the duration is not subtracted
+                e.frames.sync(ret.start_frame, 0, s.time, m_hdr_time);
+                ++e.isoc_urbs;
+        }
+
+        if (usbip_iso_packet_descriptor *isoc{};
+            complete && hdr.base.direction == USBIP_DIR_IN && get_isoc_descr(isoc, const_cast<usbip_header&>(hdr))) {
+                if (!check_isoc(s, ret, m_payload)) {
+                        ++rep().isoc_errors;
+                }
+        }
+
+        m_flow.submits.erase(i);
+}
+
+/*
+ * URB was unlinked by a server if status is -ECONNRESET, RET_SUBMIT will not be sent for it.
+ */
+void stream::ret_unlink(const usbip_header &hdr)
+{
+        ++rep().ret_unlink;
+
+        auto i = m_flow.unlinks.find(hdr.base.seqnum);
+        if (i == m_flow.unlinks.end()) {
+                return;
+        }
+
+        if (hdr.u.ret_unlink.status == -ECONNRESET_LNX) {
+                m_flow.submits.erase(i->second);
+        }
+
+        m_flow.unlinks.erase(i);
+}
+
+} // namespace
+
+
+auto usbip::replay::analyze(const std::vector<packet> &packets, uint16_t server_port) -> report
+{
+        session s(packets, server_port);
+        return s.run();
+}
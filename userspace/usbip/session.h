@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "pcap_file.h"
+#include <usbip/histogram.h>
+#include <usbip/frame_clock.h>
+
+namespace usbip::replay
+{
+
+struct endpoint_report
+{
+        uint32_t flow; // index of TCP connection
+        uint32_t devid;
+        uint32_t ep; // endpoint number
+        bool dir_in;
+
+        uint64_t urbs; // RET_SUBMIT that were matched to CMD_SUBMIT
+        uint64_t errors; // RET_SUBMIT with non-zero status
+        uint64_t unlinks; // CMD_UNLINK of URBs of the endpoint
+        uint64_t bytes; // actual_length
+
+        uint64_t first; // time of the first CMD_SUBMIT, microseconds
+        uint64_t last; // time of the last RET_SUBMIT
+
+        latency_histogram rtt; // from CMD_SUBMIT to RET_SUBMIT, microseconds
+
+        uint64_t isoc_urbs; // that updated the frame clock
+        frame_clock frames; // fed by start_frame of isoch RET_SUBMIT-s, as the drivers do
+};
+
+struct report
+{
+        uint64_t packets; // in the capture
+        uint64_t flows; // TCP connections to USB/IP server
+        uint64_t stream_bytes; // reassembled TCP payload, including missing bytes
+
+        uint64_t cmd_submit;
+        uint64_t ret_submit;
+        uint64_t cmd_unlink;
+        uint64_t ret_unlink;
+
+        // violations of the protocol
+        uint64_t invalid_headers; // a stream is not analyzed after such header
+        uint64_t unmatched; // RET_SUBMIT without CMD_SUBMIT
+        uint64_t isoc_errors; // @see isoc::get_unpack_error
+
+        // defects of the capture, they are not errors
+        uint64_t gaps; // missing parts of TCP streams, a stream is not analyzed after a gap in a header
+        uint64_t truncated; // isoch PDUs whose payload was not captured completely
+        uint64_t unanswered; // CMD_SUBMIT without RET_SUBMIT at the end of the capture
+
+        std::vector<endpoint_report> endpoints;
+
+        auto errors() const { return invalid_headers + unmatched + isoc_errors; }
+};
+
+/*
+ * Reassembles TCP streams of USB/IP sessions and parses them with the code the drivers use:
+ * pdu_parser, validate_ret_header, get_payload_size, isoc::get_unpack_error.
+ * It does not depend on Windows API.
+ *
+ * @param server_port TCP port of USB/IP server
+ */
+report analyze(const std::vector<packet> &packets, uint16_t server_port);
+
+} // namespace usbip::replay
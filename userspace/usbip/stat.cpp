@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2023 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+
+#include <libusbip\vhci.h>
+
+#include <chrono>
+#include <format>
+#include <thread>
+#include <spdlog\spdlog.h>
+
+namespace
+{
+
+using namespace usbip;
+using steady_clock = std::chrono::steady_clock;
+
+struct sample
+{
+        int port;
+        steady_clock::time_point time;
+        device_stats stats;
+};
+
+auto get_type_str(UINT8 bmAttributes) noexcept
+{
+        const char *v[] { "control", "isoch", "bulk", "interrupt" };
+        return v[bmAttributes & 3];
+}
+
+auto get_ports(_In_ HANDLE dev, _In_ const stat_args &args, _Out_ bool &success)
+{
+        std::vector<int> ports(args.ports.begin(), args.ports.end());
+        success = true;
+
+        if (ports.empty()) {
+                for (auto &d: vhci::get_imported_devices(dev, success)) {
+                        ports.push_back(d.port);
+                }
+        }
+
+        return ports;
+}
+
+auto get_sample(_Out_ sample &s, _In_ HANDLE dev, _In_ int port)
+{
+        s.port = port;
+        s.time = steady_clock::now();
+
+        auto ok = vhci::get_device_stats(dev, port, s.stats);
+        if (!ok) {
+                spdlog::error("port {}: {}", port, GetLastErrorMsg());
+        }
+
+        return ok;
+}
+
+void print_totals(_In_ const sample &s)
+{
+        auto &d = s.stats;
+        auto &c = d.counters;
+
+        auto batch = d.sent_batches ? double(d.sent_pdus)/d.sent_batches : 0.0;
+
+        constexpr auto &fmt = R"(Port {:02}: in flight {}, submitted {}, completed {}, cancelled {}, unlinks {}
+         bytes in {}, bytes out {}, drained {}, send failures {}
+         batches {}, {:.1f} PDU(s) per batch, descriptor cache hits {}, misses {}
+)";
+        auto msg = std::format(fmt, s.port, c.in_flight(), c.submitted, c.completed, c.cancelled, c.unlinks,
+                                c.bytes_in, c.bytes_out, c.drained, c.send_failures,
+                                d.sent_batches, batch, d.descriptor_hits, d.descriptor_misses);
+
+        for (auto &e: d.endpoints) {
+                auto &ec = e.counters;
+                msg += std::format("           -> ep {:#04x} {:9}: in flight {}, submitted {}, cancelled {}, "
+                                   "bytes in {}, bytes out {}\n",
+                                   e.address, get_type_str(e.attributes), ec.in_flight(), ec.submitted, ec.cancelled,
+                                   ec.bytes_in, ec.bytes_out);
+        }
+
+        printf("%s", msg.c_str());
+}
+
+void print_latency(_In_ HANDLE dev, _In_ const sample &s)
+{
+        auto line = [] (auto name, auto &l)
+        {
+                return std::format("              {:10} {:10} {:10.1f} {:10.1f} {:10.1f} {:10.1f} {:10.1f}\n",
+                                    name, l.count, l.mean, l.p50, l.p90, l.p99, l.max);
+        };
+
+        const char *stages[] { "queue", "network", "payload", "completion", "total" };
+        static_assert(ARRAYSIZE(stages) == LATENCY_STAGES);
+
+        std::string msg;
+
+        for (auto &e: s.stats.endpoints) {
+                endpoint_latency l;
+                if (!vhci::get_endpoint_latency(dev, s.port, e.address, l)) {
+                        spdlog::error("port {}, ep {:#04x}: {}", s.port, e.address, GetLastErrorMsg());
+                        continue;
+                }
+
+                if (msg.empty()) {
+                        msg = std::format("Port {:02}: {:15} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+                                          s.port, "latency, us", "count", "mean", "p50", "p90", "p99", "max");
+                        msg += line("send", l.send);
+                }
+
+                msg += std::format("           -> ep {:#04x} {}\n", e.address, get_type_str(e.attributes));
+
+                for (int i = 0; i < LATENCY_STAGES; ++i) {
+                        msg += line(stages[i], l.stages[i]);
+                }
+        }
+
+        printf("%s", msg.c_str());
+}
+
+void print_rates(_In_ const sample &prev, _In_ const sample &cur)
+{
+        std::chrono::duration<double> elapsed = cur.time - prev.time;
+        auto sec = elapsed.count();
+
+        auto rate = [sec] (auto a, auto b) { return b > a && sec > 0 ? (b - a)/sec : 0.0; };
+
+        auto &a = prev.stats.counters;
+        auto &b = cur.stats.counters;
+
+        auto msg = std::format("Port {:02}: {:8.0f} URB/s, in {:10.1f} KiB/s, out {:10.1f} KiB/s, "
+                               "in flight {:4}, cancelled {:.0f}/s, unlinks {:.0f}/s, send failures {}\n",
+                               cur.port, rate(a.completed, b.completed),
+                               rate(a.bytes_in, b.bytes_in)/1024, rate(a.bytes_out, b.bytes_out)/1024,
+                               b.in_flight(), rate(a.cancelled, b.cancelled), rate(a.unlinks, b.unlinks),
+                               b.send_failures - a.send_failures);
+
+        printf("%s", msg.c_str());
+}
+
+} // namespace
+
+
+bool usbip::cmd_stat(void *p)
+{
+        auto &args = *reinterpret_cast<stat_args*>(p);
+
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        bool success;
+
+        auto ports = get_ports(dev.get(), args, success);
+        if (!success) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        std::vector<sample> samples;
+        samples.reserve(ports.size());
+
+        for (auto port: ports) {
+                if (sample s; get_sample(s, dev.get(), port)) {
+                        print_totals(s);
+                        if (args.latency) {
+                                print_latency(dev.get(), s);
+                        }
+                        samples.push_back(std::move(s));
+                } else {
+                        success = false;
+                }
+        }
+
+        for (auto interval = std::chrono::seconds(args.interval); args.interval && !samples.empty(); ) {
+
+                std::this_thread::sleep_for(interval);
+                printf("\n");
+
+                for (auto i = samples.begin(); i != samples.end(); ) {
+                        if (sample s; get_sample(s, dev.get(), i->port)) { // the device can be detached
+                                print_rates(*i, s);
+                                *i++ = std::move(s);
+                        } else {
+                                i = samples.erase(i);
+                        }
+                }
+        }
+
+        return success;
+}
@@ -12,6 +12,7 @@
 #include <libusbip\vhci.h>
 
 #include <libusbip\src\usb_ids.h>
+#include <libusbip\src\win_resource.h>
 #include <libusbip\src\strconv.h>
 #include <libusbip\src\file_ver.h>
 
@@ -96,9 +97,19 @@ void add_cmd_list(CLI::App &app)
 		->callback(pack(cmd_list, &r))
 		->require_option(1);
 
-	cmd->add_option_group("remote", "List exportable USB devices")
-		->add_option("-r,--remote", r.remote, "List exportable devices on a remote")
-		->required();
+	auto rem = cmd->add_option_group("remote", "List exportable USB devices");
+
+	rem->add_option("-r,--remote", r.remotes, "List exportable devices on a remote, HOST[:PORT], can be repeated");
+
+	rem->add_option("-f,--host-file", r.host_file, "File with a remote HOST[:PORT] per line, '#' starts a comment")
+		->check(CLI::ExistingFile);
+
+	rem->add_option("--timeout", r.timeout, "Timeout for each remote if there are many, milliseconds")
+		->check(CLI::Range(100U, 600'000U))
+		->capture_default_str();
+
+	rem->add_option("-m,--match", r.match, "Show devices whose vendor/product name, VID:PID or busid contain TEXT, case-insensitive")
+		->option_text("TEXT");
 
 	cmd->add_option_group("stashed", "List stashed USB devices")
 		->add_flag("-s,--stashed", r.stashed, "List devices stashed by 'port --stash'");
@@ -119,6 +130,62 @@ void add_cmd_port(CLI::App &app)
 		->expected(1, MAX_HUB_PORTS);
 }
 
+void add_cmd_stat(CLI::App &app)
+{
+	static stat_args r;
+
+	auto cmd = app.add_subcommand("stat", "Show traffic counters of imported USB devices")
+		->callback(pack(cmd_stat, &r));
+
+	cmd->add_option("-p,--port", r.ports, "Hub port number, all imported devices if omitted")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->expected(1, MAX_HUB_PORTS);
+
+	cmd->add_option("-i,--interval", r.interval, "Print rates every N seconds until interrupted")
+		->check(CLI::Range(1U, 3600U))
+		->option_text("N");
+
+	cmd->add_flag("-l,--latency", r.latency, "Show latency percentiles of URBs for each endpoint");
+}
+
+void add_cmd_capture(CLI::App &app)
+{
+	static capture_args r;
+
+	auto cmd = app.add_subcommand("capture", "Capture USB/IP traffic of an imported USB device into pcapng file")
+		->callback(pack(cmd_capture, &r));
+
+	cmd->add_option("-p,--port", r.port, "Hub port number the device is plugged in")
+		->check(CLI::Range(1, MAX_HUB_PORTS))
+		->required();
+
+	cmd->add_option("-w,--write", r.file, "Path to pcapng file, it can be opened by Wireshark")
+		->option_text("FILE")
+		->required();
+
+	cmd->add_option("-t,--time", r.duration, "Stop capture after N seconds")
+		->check(CLI::Range(1U, 86400U))
+		->option_text("N")
+		->default_val(10);
+}
+
+void add_cmd_replay(CLI::App &app)
+{
+	static replay_args r;
+
+	auto cmd = app.add_subcommand("replay", "Analyze USB/IP sessions captured by 'usbip capture', Wireshark or tcpdump")
+		->callback(pack(cmd_replay, &r));
+
+	cmd->add_option("files", r.files, "pcap or pcapng files, it fails if any of them has protocol errors")
+		->check(CLI::ExistingFile)
+		->required();
+
+	cmd->add_option("-r,--repeat", r.repeat, "Parse each file N times to measure throughput")
+		->check(CLI::Range(1U, 1000U))
+		->option_text("N")
+		->default_val(1);
+}
+
 void init(CLI::App &app, const wchar_t *program)
 {
 	app.set_version_flag("-V,--version", get_version(program));
@@ -195,6 +262,9 @@ int wmain(int argc, wchar_t *argv[])
 	add_cmd_detach(app);
 	add_cmd_list(app);
 	add_cmd_port(app);
+	add_cmd_stat(app);
+	add_cmd_capture(app);
+	add_cmd_replay(app);
 
 	app.require_subcommand(1);
 	CLI11_PARSE(app, argc, argv);
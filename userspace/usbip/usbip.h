@@ -6,6 +6,7 @@
 
 #include <string>
 #include <set>
+#include <vector>
 
 #include <libusbip\remote.h>
 
@@ -45,8 +46,11 @@ command_t cmd_detach;
 
 struct list_args
 {
-        // --remote
-        std::string remote;
+        // --remote, --host-file
+        std::vector<std::string> remotes; // HOST or HOST:PORT
+        std::string host_file;
+        unsigned int timeout = 5000; // milliseconds, for each host if there are many
+        std::string match; // show devices whose vendor/product name, VID:PID or busid contain it
 
         // --stashed
         bool stashed;
@@ -60,4 +64,27 @@ struct port_args
 };
 command_t cmd_port;
 
+struct stat_args
+{
+        std::set<int> ports; // all imported devices if empty
+        unsigned int interval{}; // seconds, print rates every interval if not zero
+        bool latency{}; // print latency percentiles of endpoints
+};
+command_t cmd_stat;
+
+struct capture_args
+{
+        int port;
+        std::string file; // pcapng
+        unsigned int duration; // seconds
+};
+command_t cmd_capture;
+
+struct replay_args
+{
+        std::vector<std::string> files; // pcap or pcapng, server's port is global --tcp-port
+        unsigned int repeat = 1; // parse each file N times to measure throughput
+};
+command_t cmd_replay;
+
 } // namespace usbip